@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Simulated bootloader answering the packet protocol over
+ *                   any serial handle (pty master or in-process loopback).
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __BLDR_SIM_H
+#define __BLDR_SIM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "inc/serial.h"
+/* Exported constants --------------------------------------------------------*/
+/* Exported types ------------------------------------------------------------*/
+typedef struct bldr_sim_cfg_s {
+    /* device address the simulator answers to */
+    uint8_t dev_addr;
+    /* identification strings */
+    const char *part_number;
+    const char *uuid;
+    /* bootloader version and location */
+    uint8_t major_ver;
+    uint8_t minor_ver;
+    uint16_t build_ver;
+    uint32_t bldr_addr;
+    uint32_t bldr_size;
+    /* flash geometry */
+    uint32_t aprom_addr;
+    uint32_t aprom_size;
+    uint32_t eeprom_addr;
+    uint32_t eeprom_size;
+    uint32_t page_size;
+    /* largest window of REG_WDATA frames, 0 = no windowed writes */
+    uint8_t max_window;
+    /* answer TYPE_GET_RANGE requests, 0 = reject them like older bootloaders */
+    uint8_t get_range;
+    /* unpack REG_ZDATA frames, 0 = raw REG_WDATA only */
+    uint8_t zdata;
+    /* answer REG_RDATA reads, 0 = REG_DATA only */
+    uint8_t rdata;
+    /* compute REG_RANGE_CRC checksums, 0 = verify by readback only */
+    uint8_t range_crc;
+    /* largest payload of an extended packet, 0 = basic packets only */
+    uint16_t frame_size;
+    /* emulated line rate in bits/s for 8N1 framing, 0 = no pacing */
+    uint32_t baudrate;
+    /* highest rate REG_BAUDRATE accepts, 0 = fixed rate */
+    uint32_t max_baudrate;
+    /* fastest rate the emulated cable carries cleanly, 0 = any */
+    uint32_t line_limit;
+    /* delay between the end of a request and the start of its reply, us */
+    uint32_t turnaround_us;
+    /* one-way delay of the link, e.g. a USB adapter, us; unlike turnaround_us
+     * it overlaps between requests sent back to back */
+    uint32_t latency_us;
+    /* time to erase one page, us */
+    uint32_t erase_us;
+    /* time to program PKT_PLD_SIZE bytes, us */
+    uint32_t program_us;
+    /* probability of corrupting the CRC of a reply, parts per million */
+    uint32_t fault_ppm;
+} bldr_sim_cfg_t;
+
+typedef struct bldr_sim_s bldr_sim_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  fill a configuration with a small default device.
+  * @param  cfg [O] - configuration to fill
+  * @retval none
+  */
+void bldr_sim_default_cfg(bldr_sim_cfg_t *cfg);
+
+/**
+  * @brief  create a simulator instance with erased flash.
+  * @param  cfg [I] - configuration, copied; strings must outlive the instance
+  * @param  sim [O] - created instance
+  * @retval 0 = success, -1 = failure
+  */
+int32_t bldr_sim_create(const bldr_sim_cfg_t *cfg, bldr_sim_t **sim);
+
+/**
+  * @brief  serve requests on a handle until bldr_sim_stop() is called.
+  * @param  sim [I] - simulator instance
+  * @param  hdl [I] - device side of the link
+  * @retval 0 = stopped, -1 = link failure
+  */
+int32_t bldr_sim_run(bldr_sim_t *sim, com_handle_t hdl);
+
+/**
+  * @brief  run bldr_sim_run() in a background thread.
+  * @param  sim [I] - simulator instance
+  * @param  hdl [I] - device side of the link
+  * @retval 0 = success, -1 = failure
+  */
+int32_t bldr_sim_start(bldr_sim_t *sim, com_handle_t hdl);
+
+/**
+  * @brief  stop serving and join the background thread if any.
+  * @param  sim [I] - simulator instance
+  * @retval 0 = success, -1 = failure
+  */
+int32_t bldr_sim_stop(bldr_sim_t *sim);
+
+/**
+  * @brief  release a simulator instance, stopping it first.
+  * @param  sim [I] - simulator instance
+  * @retval none
+  */
+void bldr_sim_destroy(bldr_sim_t *sim);
+
+/**
+  * @brief  direct access to the simulated flash for checking results.
+  * @param  sim [I] - simulator instance
+  * @param  addr [I] - flash address
+  * @param  size [I] - size of the region
+  * @retval pointer to the region, NULL if it is not entirely in APROM or EEPROM
+  */
+uint8_t *bldr_sim_memory(bldr_sim_t *sim, uint32_t addr, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BLDR_SIM_H */
+
+/******************************** END OF FILE *********************************/
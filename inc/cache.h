@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Local copy of the content last flashed to each device,
+ *                   and the progress of an interrupted load, keyed by the
+ *                   device UUID.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+/* Exported constants --------------------------------------------------------*/
+/* Environment variable overriding the cache directory */
+#define CACHE_DIR_ENV                       "FSISP_CACHE_DIR"
+/* Exported types ------------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  read the content last flashed to an area of a device
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name, e.g. "APROM"
+  * @param  data [O] - content
+  * @param  size [I] - size of the area, a cached copy of another size is ignored
+  * @retval 0 = success, -1 = nothing cached
+  */
+int32_t cache_load(const char *uuid, const char *area, uint8_t *data, uint32_t size);
+
+/**
+  * @brief  remember the content just flashed to an area of a device
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @param  data [I] - content of the whole area
+  * @param  size [I] - size of the area
+  * @retval 0 = success, -1 = failure
+  * @note   The copy is replaced atomically, a crash never leaves half of it.
+  */
+int32_t cache_store(const char *uuid, const char *area, const uint8_t *data, uint32_t size);
+
+/**
+  * @brief  forget an area whose content is no longer known
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @retval none
+  */
+void cache_drop(const char *uuid, const char *area);
+
+/**
+  * @brief  read how far an earlier load of an image into an area got
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @param  hash [I] - hash of the image and of the way it is loaded
+  * @param  done [O] - bytes of the write plan programmed, in plan order
+  * @retval 0 = success, -1 = no journal of this image
+  */
+int32_t cache_journal_load(const char *uuid, const char *area, uint32_t hash, uint32_t *done);
+
+/**
+  * @brief  record the progress of a load
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @param  hash [I] - hash of the image and of the way it is loaded
+  * @param  done [I] - bytes of the write plan programmed, in plan order
+  * @retval 0 = success, -1 = failure
+  * @note   The journal is replaced atomically, as the cached copy is.
+  */
+int32_t cache_journal_store(const char *uuid, const char *area, uint32_t hash, uint32_t done);
+
+/**
+  * @brief  forget the progress of a load, once it completed or the area changed
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @retval none
+  */
+void cache_journal_drop(const char *uuid, const char *area);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CACHE_H */
+
+/******************************** END OF FILE *********************************/
@@ -20,6 +20,10 @@
 #include <stdint.h>
 #include <stddef.h>
 /* Exported constants --------------------------------------------------------*/
+/* CRC engines */
+#define CRC_ENGINE_AUTO                     0
+#define CRC_ENGINE_TABLE                    1
+#define CRC_ENGINE_CLMUL                    2
 /* Exported types ------------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
 /* Exported variables --------------------------------------------------------*/
@@ -42,6 +46,53 @@ uint8_t crc8_maxim_update(uint8_t crc, const uint8_t * pdata, size_t size);
   */
 uint8_t crc8_maxim(const uint8_t * pdata, size_t size);
 
+/**
+  * @brief  CRC16/modbus calculation with initial crc-16 value.
+  * @param  crc [I] - initial crc-16 value
+  * @param  pdata [I] - points to data block
+  * @param  size [I] - size of the data block
+  * @retval updated crc-16
+  */
+uint16_t crc16_modbus_update(uint16_t crc, const uint8_t * pdata, size_t size);
+
+/**
+  * @brief  CRC16/modbus calculation starting from 0xFFFF.
+  * @param  pdata [I] - points to data block
+  * @param  size [I] - size of the data block
+  * @retval calculated crc-16
+  */
+uint16_t crc16_modbus(const uint8_t * pdata, size_t size);
+
+/**
+  * @brief  CRC-32 (IEEE 802.3, as in zlib) continuing a previous result.
+  * @param  crc [I] - result over the preceding data, 0 to start
+  * @param  pdata [I] - points to data block
+  * @param  size [I] - size of the data block
+  * @retval crc-32 over the preceding data and this block
+  */
+uint32_t crc32_ieee_update(uint32_t crc, const uint8_t * pdata, size_t size);
+
+/**
+  * @brief  CRC-32 (IEEE 802.3) of a data block.
+  * @param  pdata [I] - points to data block
+  * @param  size [I] - size of the data block
+  * @retval calculated crc-32
+  */
+uint32_t crc32_ieee(const uint8_t * pdata, size_t size);
+
+/**
+  * @brief  force an engine for all CRCs, mainly for benchmarking.
+  * @param  engine [I] - CRC_ENGINE_*, AUTO picks the fastest one available
+  * @retval 0 = success, -1 = engine not available on this CPU or build
+  */
+int32_t crc_set_engine(uint8_t engine);
+
+/**
+  * @brief  engine used for large blocks.
+  * @retval CRC_ENGINE_TABLE or CRC_ENGINE_CLMUL
+  */
+uint8_t crc_engine(void);
+
 #endif /* __CRC_H */
 
 /******************************** END OF FILE *********************************/
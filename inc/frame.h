@@ -0,0 +1,151 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Incremental parser for packets sent by the device and
+ *                   transmit arena for the packets sent to it.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "inc/packet.h"
+#include "inc/serial.h"
+/* Exported constants --------------------------------------------------------*/
+/* Size of the receive ring, a power of two holding several frames */
+#define FRAME_RING_SIZE                     16384
+
+/* Frames queued for transmission before they must be flushed */
+#define FRAME_TX_FRAMES                     32
+/* Largest payload head copied into the arena, the rest is referenced */
+#define FRAME_TX_HEAD_MAX                   8
+/* Arena slot of a frame: header, payload head and CRC */
+#define FRAME_TX_SLOT                       (PKT_EXT_HDR_SIZE + FRAME_TX_HEAD_MAX + PKT_EXT_CRC_SIZE)
+/* Write segments of a frame: header with head, payload body, CRC */
+#define FRAME_TX_IOVS                       3
+/* Exported types ------------------------------------------------------------*/
+typedef struct frame_rx_s {
+    /* raw bytes from the port */
+    uint8_t ring[FRAME_RING_SIZE];
+    /* free-running indexes: next byte to write, first byte of the
+     * candidate frame, next byte to examine */
+    uint32_t head;
+    uint32_t tail;
+    uint32_t pos;
+    /* parser state: bytes still missing from the current field, extended
+     * frame, raw header and CRC as received */
+    uint8_t state;
+    uint8_t ext;
+    uint16_t need;
+    uint8_t hdr[PKT_EXT_HDR_SIZE];
+    uint8_t crc[PKT_EXT_CRC_SIZE];
+    /* frame being assembled, valid once frame_rx_parse() returns 1 */
+    packet_t pkt;
+    /* number of bytes skipped to find a frame boundary, and of candidate
+     * frames rejected by their header or frame CRC */
+    uint32_t resyncs;
+    uint32_t crc_errors;
+} frame_rx_t;
+
+typedef struct frame_tx_s {
+    /* headers, payload heads and CRCs of the queued frames */
+    uint8_t arena[FRAME_TX_FRAMES][FRAME_TX_SLOT];
+    /* segments to write, payload bodies point at the caller's data */
+    com_iovec_t iov[FRAME_TX_FRAMES * FRAME_TX_IOVS];
+    uint32_t frames;
+    uint32_t iovs;
+} frame_tx_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  reset a parser and drop all buffered bytes
+  * @param  rx [I] - parser
+  * @retval none
+  */
+void frame_rx_init(frame_rx_t *rx);
+
+/**
+  * @brief  contiguous free space of the ring
+  * @param  rx [I] - parser
+  * @param  size [O] - number of bytes that can be written at the pointer
+  * @retval pointer to write received bytes to
+  */
+uint8_t *frame_rx_space(frame_rx_t *rx, size_t *size);
+
+/**
+  * @brief  account bytes written to the space returned by frame_rx_space()
+  * @param  rx [I] - parser
+  * @param  size [I] - number of bytes written
+  * @retval none
+  */
+void frame_rx_commit(frame_rx_t *rx, size_t size);
+
+/**
+  * @brief  smallest number of bytes that could complete the current frame
+  * @param  rx [I] - parser, after frame_rx_parse() returned 0
+  * @retval number of bytes, at least 1
+  * @note   Reading no more than this lets the caller return a frame the
+  *         moment its last byte arrives.
+  */
+size_t frame_rx_needed(const frame_rx_t *rx);
+
+/**
+  * @brief  run the state machine over the buffered bytes
+  * @param  rx [I] - parser
+  * @retval 1 = rx->pkt holds a complete frame, 0 = more bytes are needed
+  * @note   A bad header or crc makes the parser retry from the byte after
+  *         the start of the rejected frame. Extended frames are recognized
+  *         by TYPE_EXT and a bad length is caught by their header CRC.
+  */
+int32_t frame_rx_parse(frame_rx_t *rx);
+
+/**
+  * @brief  drop all queued frames
+  * @param  tx [I] - arena
+  * @retval none
+  */
+void frame_tx_init(frame_tx_t *tx);
+
+/**
+  * @brief  queue a frame, basic or extended as its length requires
+  * @param  tx [I] - arena
+  * @param  dev_addr [I] - device address
+  * @param  type [I] - packet type
+  * @param  reg_addr [I] - register address
+  * @param  length [I] - number of bytes in payload
+  * @param  head [I] - first bytes of the payload, copied, may be NULL
+  * @param  head_size [I] - number of bytes in head, up to FRAME_TX_HEAD_MAX
+  * @param  body [I] - rest of the payload, length - head_size bytes
+  * @retval 0 = success, -1 = the arena is full or the frame is invalid
+  * @note   Only TYPE_SET frames carry their payload, other types just
+  *         announce the length. The body is not copied: it must stay put
+  *         until tx->iov has been written out.
+  */
+int32_t frame_tx_add(frame_tx_t *tx, uint8_t dev_addr, uint8_t type, uint8_t reg_addr, uint16_t length,
+                     const uint8_t *head, uint8_t head_size, const uint8_t *body);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_H */
+
+/******************************** END OF FILE *********************************/
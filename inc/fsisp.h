@@ -1,16 +1,18 @@
 /*******************************************************************************
- * Copyright (c) 2021-2022, OKMCU Development Team 
+ * Copyright (c) 2021-2022, OKMCU Development Team
  *
  * SPDX-License-Identifier: Apache-2.0
  *
  * Website: http://www.okmcu.com
  *
- * File Description: Template description.
+ * File Description: libfsisp, non-blocking sessions for programs that drive
+ *                   many devices from their own event loop.
  *
  * Change Logs:
- * Date         Author       Notes    
+ * Date         Author       Notes
  * 2021-10-29   Wentao SUN   first version
- * 
+ * 2026-10-17   OKMCU Team   asynchronous session API
+ *
  ******************************************************************************/
 
 /* Define to prevent recursive inclusion -------------------------------------*/
@@ -22,19 +24,145 @@
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "inc/isp.h"
 /* Exported constants --------------------------------------------------------*/
+/* Operations of a request */
+#define FSISP_OP_CONNECT                    0
+#define FSISP_OP_ERASE                      1
+#define FSISP_OP_WRITE                      2
+#define FSISP_OP_VERIFY                     3
+#define FSISP_OP_READ                       4
 /* Exported types ------------------------------------------------------------*/
+/* Session, opaque to the caller */
+typedef struct fsisp_session_s fsisp_session_t;
+
+typedef struct fsisp_config_s {
+    /* port name or device server URL, see com_open(); copied */
+    const char *port;
+    /* rate the bootloader answers at, and the fastest one to negotiate
+     * after connecting, 0 = stay at baudrate */
+    uint32_t baudrate;
+    uint32_t max_baudrate;
+    /* largest frame payload, PKT_PLD_SIZE = basic frames only, 0 = any */
+    uint16_t frame_limit;
+    /* device address, 0 = DEVICE_ADDR */
+    uint8_t dev_addr;
+    /* how long FSISP_OP_CONNECT waits for the device, ms, 0 = forever */
+    uint32_t connect_ms;
+    /* counters and timeline of the session, may be NULL */
+    stats_t *stats;
+} fsisp_config_t;
+
+typedef struct fsisp_request_s {
+    /* FSISP_OP_* */
+    uint8_t op;
+    /* ERASE_* for FSISP_OP_ERASE */
+    uint8_t area;
+    /* frames or reads in flight, 0 = the default of the command line tool */
+    uint8_t window;
+    /* FSISP_OP_WRITE erases the pages it touches, otherwise they must
+     * have been erased before */
+    uint8_t erase_ahead;
+    /* flash range */
+    uint32_t addr;
+    uint32_t size;
+    /* content to write or to verify against, FSISP_OP_WRITE and
+     * FSISP_OP_VERIFY; must stay valid until the request completes */
+    const uint8_t *data;
+    /* room for size bytes, FSISP_OP_READ */
+    uint8_t *buf;
+    /* returned untouched in the result */
+    void *user;
+} fsisp_request_t;
+
+typedef struct fsisp_result_s {
+    /* the request as submitted */
+    uint8_t op;
+    void *user;
+    /* 0 = success, -1 = failure; FSISP_OP_VERIFY: 1 = flash differs */
+    int32_t result;
+    /* ISP_ERR_* and TYPE_FAILURE_* behind a failure, see isp_strerror() */
+    uint8_t error;
+    uint8_t nak;
+    /* FSISP_OP_VERIFY: bytes that differ and the first of them */
+    uint32_t mismatches;
+    uint32_t first_bad;
+    /* time the request took, us */
+    uint64_t us;
+} fsisp_result_t;
 /* Exported macro ------------------------------------------------------------*/
 /* Exported variables --------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
 /**
-  * @brief  Template brief.
-  * @param  none
+  * @brief  create a session, the port is opened by FSISP_OP_CONNECT
+  * @param  cfg [I] - settings, copied
+  * @retval session, NULL = out of resources
+  * @note   Every session runs its requests on a thread of its own, the
+  *         protocol engine underneath waits on the port. None of the calls
+  *         below blocks except fsisp_complete() and fsisp_close().
+  */
+fsisp_session_t *fsisp_create(const fsisp_config_t *cfg);
+
+/**
+  * @brief  descriptor that turns readable when a request has completed
+  * @param  s [I] - session
+  * @retval file descriptor, to be watched with poll(), epoll, select()...
+  * @note   It may also wake up when nothing is left to collect;
+  *         fsisp_poll() then returns 0.
+  */
+int fsisp_fd(const fsisp_session_t *s);
+
+/**
+  * @brief  start a request
+  * @param  s [I] - session
+  * @param  req [I] - request, copied
+  * @retval 0 = started, -1 = a request is in progress or not collected yet,
+  *         or the session is not connected
+  * @note   One request at a time, FSISP_OP_CONNECT first.
+  */
+int32_t fsisp_submit(fsisp_session_t *s, const fsisp_request_t *req);
+
+/**
+  * @brief  collect a completed request without waiting
+  * @param  s [I] - session
+  * @param  res [O] - outcome
+  * @retval 1 = collected, 0 = nothing completed
+  */
+int32_t fsisp_poll(fsisp_session_t *s, fsisp_result_t *res);
+
+/**
+  * @brief  wait for the request in progress and collect it
+  * @param  s [I] - session
+  * @param  res [O] - outcome
+  * @param  timeout [I] - ms to wait, 0 = forever
+  * @retval 1 = collected, 0 = timed out or nothing in progress
+  */
+int32_t fsisp_complete(fsisp_session_t *s, fsisp_result_t *res, uint32_t timeout);
+
+/**
+  * @brief  attributes read by the last FSISP_OP_CONNECT
+  * @param  s [I] - session
+  * @param  attr [O] - copy of the attributes
+  * @retval 0 = success, -1 = not connected or a request is in progress
+  */
+int32_t fsisp_device(const fsisp_session_t *s, dev_attr_t *attr);
+
+/**
+  * @brief  line rate in use, after FSISP_OP_CONNECT negotiated it
+  * @param  s [I] - session
+  * @retval baudrate, 0 while a request is in progress
+  */
+uint32_t fsisp_baudrate(const fsisp_session_t *s);
+
+/**
+  * @brief  wait for the request in progress, close the port and free the session
+  * @param  s [I] - session, may be NULL
   * @retval none
-  * @note   Template note.
   */
-void TemplateFunction(void);
+void fsisp_close(fsisp_session_t *s);
 
 #ifdef __cplusplus
 }
@@ -43,4 +171,3 @@ void TemplateFunction(void);
 #endif /* __FSISP_H */
 
 /******************************** END OF FILE *********************************/
-
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Firmware image reader for raw binary, Intel HEX,
+ *                   Motorola S-record and ELF files.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __IMAGE_H
+#define __IMAGE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+/* Exported constants --------------------------------------------------------*/
+/* File formats */
+#define IMAGE_FMT_BIN                       0
+#define IMAGE_FMT_HEX                       1
+#define IMAGE_FMT_SREC                      2
+#define IMAGE_FMT_ELF                       3
+/* Exported types ------------------------------------------------------------*/
+typedef struct image_seg_s {
+    /* flash address, or offset into the area for IMAGE_FMT_BIN */
+    uint32_t addr;
+    uint32_t size;
+    /* points into the mapped file or the decoded bytes, never copied */
+    const uint8_t *data;
+} image_seg_t;
+
+typedef struct image_s {
+    /* IMAGE_FMT_* */
+    uint8_t format;
+    /* read-only mapping of the whole file */
+    void *map;
+    size_t map_size;
+#if defined(_WIN32)
+    void *mapping;
+#endif
+    /* bytes decoded from HEX or S-record text, as many as the file carries */
+    uint8_t *decoded;
+    /* segments sorted by address, not overlapping */
+    image_seg_t *segs;
+    uint32_t count;
+    /* number of data bytes in all segments */
+    uint32_t bytes;
+} image_t;
+
+typedef struct image_plan_s {
+    /* page-aligned chunks in address order */
+    image_seg_t *chunks;
+    uint32_t count;
+    /* number of bytes to program, padding included */
+    uint32_t bytes;
+    /* pages only partly covered by the image, filled up with 0xFF */
+    uint8_t *pad;
+} image_plan_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  map a firmware file and index its segments
+  * @param  img [O] - image
+  * @param  path [I] - file path, the format is told by ELF magic or extension
+  * @retval 0 = success, -1 = failure
+  */
+int32_t image_open(image_t *img, const char *path);
+
+/**
+  * @brief  release an image and everything that points into it
+  * @param  img [I] - image opened by image_open(), may be zeroed
+  * @retval none
+  */
+void image_close(image_t *img);
+
+/**
+  * @brief  turn the segments into page-aligned writes for a flash area
+  * @param  img [I] - image
+  * @param  base [I] - start address of the area, page aligned
+  * @param  limit [I] - size of the area
+  * @param  page_size [I] - flash page size
+  * @param  plan [O] - write plan, to be freed by image_plan_free()
+  * @retval 0 = success, -1 = the image does not fit in the area
+  * @note   Whole pages inside a segment are written straight from the
+  *         image; only pages at segment edges are copied to be padded.
+  */
+int32_t image_plan(const image_t *img, uint32_t base, uint32_t limit, uint32_t page_size, image_plan_t *plan);
+
+/**
+  * @brief  release a write plan
+  * @param  plan [I] - plan made by image_plan(), may be zeroed
+  * @retval none
+  */
+void image_plan_free(image_plan_t *plan);
+
+/**
+  * @brief  lay a write plan out as the content of the whole area
+  * @param  plan [I] - write plan
+  * @param  base [I] - start address of the area
+  * @param  buf [O] - content, erased bytes as 0xFF
+  * @param  size [I] - size of the area
+  * @retval none
+  */
+void image_render(const image_plan_t *plan, uint32_t base, uint8_t *buf, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __IMAGE_H */
+
+/******************************** END OF FILE *********************************/
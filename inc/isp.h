@@ -0,0 +1,454 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Host side of the bootloader packet protocol.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __ISP_H
+#define __ISP_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "inc/serial.h"
+#include "inc/packet.h"
+#include "inc/frame.h"
+#include "inc/stats.h"
+/* Exported constants --------------------------------------------------------*/
+/* Default device address of the bootloader */
+#define DEVICE_ADDR                         0xAA
+
+/* Timeout of an ordinary register access until round trips have been measured, ms */
+#define ISP_TIMEOUT                         100
+/**
+ * Time a device may spend on a request on top of the round trip timeout:
+ * none for ordinary accesses, a mass erase and a page erase, ms
+ */
+#define ISP_BUDGET_NONE                     0
+#define ISP_ERASE_TIMEOUT                   5000
+#define ISP_PAGE_ERASE_TIMEOUT              500
+
+/* Flash areas */
+#define ISP_AREA_APROM                      0
+#define ISP_AREA_EEPROM                     1
+
+/**
+ * Why the last transaction failed, see isp_session_t.error: no valid reply
+ * in time, a TYPE_FAILURE_* reply, the port failed, a reply that does not fit
+ * the request. Only timeouts and malformed replies are worth another try.
+ */
+#define ISP_ERR_NONE                        0
+#define ISP_ERR_TIMEOUT                     1
+#define ISP_ERR_NAK                         2
+#define ISP_ERR_PORT                        3
+#define ISP_ERR_PROTOCOL                    4
+
+/* Time isp_wait_connect() waits for a device by default, ms */
+#define ISP_CONNECT_TIMEOUT                 10000
+/* Exported types ------------------------------------------------------------*/
+typedef struct dev_attr_mcu_s {
+    char part_number[128];
+    char uuid[128];
+} dev_attr_mcu_t;
+
+typedef struct dev_attr_bldr_s {
+    uint8_t major_ver;
+    uint8_t minor_ver;
+    uint16_t build_ver;
+    uint32_t addr;
+    uint32_t size;
+} dev_attr_bldr_t;
+
+typedef struct dev_attr_flash_s {
+    uint32_t aprom_addr;
+    uint32_t aprom_size;
+    uint32_t eeprom_addr;
+    uint32_t eeprom_size;
+    uint32_t page_size;
+} dev_attr_flash_t;
+
+typedef struct dev_attr_s {
+    dev_attr_mcu_t mcu;
+    dev_attr_bldr_t bldr;
+    dev_attr_flash_t flash;
+    /* CAP_* bitmap, 0 for bootloaders without REG_CAPS */
+    uint32_t caps;
+    /* largest number of REG_WDATA frames in flight */
+    uint8_t max_window;
+    /* largest payload of an extended frame, 0 without CAP_EXT_FRAME */
+    uint16_t max_frame;
+} dev_attr_t;
+
+typedef struct isp_diff_s {
+    /* pages in the area */
+    uint32_t pages;
+    /* pages erased and reprogrammed */
+    uint32_t changed;
+    /* the device was asked for page CRCs */
+    uint8_t queried;
+} isp_diff_t;
+
+typedef struct isp_verify_s {
+    /* REG_RANGE_CRC and REG_PAGE_CRC round trips */
+    uint32_t queries;
+    /* bytes read back to find the differences */
+    uint32_t read_back;
+    /* bytes that differ and the address of the first one */
+    uint32_t mismatches;
+    uint32_t first_bad;
+} isp_verify_t;
+
+typedef struct isp_rtt_s {
+    /* smoothed round trip beyond the time on the wire and its mean deviation, us */
+    uint32_t srtt_us;
+    uint32_t rttvar_us;
+    /* at least one round trip has been measured */
+    uint8_t valid;
+    /* timeouts in a row, each one doubles the timeout */
+    uint8_t backoff;
+} isp_rtt_t;
+
+/**
+  * @brief  consumer of isp_read() data, called in address order
+  * @param  ctx [I] - context given to isp_read()
+  * @param  offset [I] - offset of data from the start of the read
+  * @param  data [I] - bytes read
+  * @param  size [I] - number of bytes
+  * @retval 0 = go on, -1 = abort the read
+  */
+typedef int32_t (*isp_sink_t)(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size);
+
+/**
+  * @brief  watcher of isp_write(), called as the device acknowledges data
+  * @param  ctx [I] - sess->progress_ctx
+  * @param  addr [I] - every byte of the block below this address is programmed
+  * @retval none
+  */
+typedef void (*isp_progress_t)(void *ctx, uint32_t addr);
+
+typedef struct isp_session_s {
+    /* serial port the device is attached to */
+    com_handle_t hdl;
+    /* device address */
+    uint8_t dev_addr;
+    /* attributes read by isp_connect(), valid once attr_valid is set */
+    dev_attr_t attr;
+    uint8_t attr_valid;
+    /* the bootloader rejected TYPE_GET_RANGE, do not ask again */
+    uint8_t no_get_range;
+    /* receive engine, keeps bytes of the next reply between calls */
+    frame_rx_t rx;
+    /* transmit arena, frames queued for the next write to the port */
+    frame_tx_t tx;
+    /* largest payload the caller allows in a frame, PKT_PLD_SIZE keeps to
+     * basic frames; and the payload size isp_connect() settled on */
+    uint16_t frame_limit;
+    uint16_t frame_size;
+    /* time of one character at the current line settings, us */
+    uint32_t char_us;
+    /* round trips of register accesses, and from a windowed frame to its
+     * ack, which includes waiting behind the frames ahead of it */
+    isp_rtt_t rtt;
+    isp_rtt_t frame_rtt;
+    /* isp_write() packs data into REG_ZDATA frames if the device has CAP_ZDATA */
+    uint8_t compress;
+    /* isp_write() erases the pages it touches itself, ahead of the data */
+    uint8_t erase_ahead;
+    /* told by isp_write() how far the device has got, NULL = nobody */
+    isp_progress_t progress;
+    void *progress_ctx;
+    /* bytes programmed through REG_ZDATA and the size they were packed to */
+    uint32_t z_raw;
+    uint32_t z_packed;
+    /* counters and timeline of the session, NULL = not kept */
+    stats_t *stats;
+    /* ISP_ERR_* of the last register access, ISP_ERR_NONE once it
+     * succeeded, and the TYPE_FAILURE_* of the last NAK */
+    uint8_t error;
+    uint8_t nak;
+} isp_session_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  send a packet to device side
+  * @param  hdl [I] - serial port handle
+  * @param  dev_addr [I] - device address
+  * @param  type [I] - packet type
+  * @param  reg_addr [I] - register address
+  * @param  length [I] - number of bytes in payload
+  * @param  payload [I] - points to the payload data
+  * @retval 0 = success, -1 = failure
+  * @note   A length beyond PKT_PLD_SIZE goes out as an extended packet,
+  *         only for devices with CAP_EXT_FRAME.
+  */
+int32_t send_packet(com_handle_t hdl, uint8_t dev_addr, uint8_t type, uint8_t reg_addr, uint16_t length, const uint8_t *payload);
+
+/**
+  * @brief  receive the next packet from device side
+  * @param  sess [I] - session
+  * @param  pkt [O] - received packet
+  * @param  timeout [I] - timeout in ms
+  * @retval 0 = success, -1 = failure or timeout
+  * @note   Corrupted bytes are skipped, the call returns as soon as the last
+  *         byte of a valid packet has arrived.
+  */
+int32_t recv_packet(isp_session_t *sess, packet_t *pkt, uint32_t timeout);
+
+/**
+  * @brief  read a register
+  * @param  sess [I] - session
+  * @param  reg_addr [I] - register address
+  * @param  pdata [O] - register value
+  * @param  size [I] - number of bytes to read
+  * @param  length [O] - number of bytes returned, may be NULL
+  * @param  budget [I] - time the device may take on top of the round trip,
+  *                      ISP_BUDGET_NONE for an ordinary access, ms
+  * @retval 0 = success, -1 = failure
+  * @note   The timeout follows the round trips measured on the session and
+  *         the time the packets take on the wire at the current line rate.
+  */
+int32_t read_reg(isp_session_t *sess, uint8_t reg_addr, uint8_t *pdata, uint16_t size, uint16_t *length, uint32_t budget);
+
+/**
+  * @brief  write a register and wait for the device to accept it
+  * @param  sess [I] - session
+  * @param  reg_addr [I] - register address
+  * @param  pdata [I] - register value
+  * @param  size [I] - number of bytes to write
+  * @param  budget [I] - time the device may take on top of the round trip,
+  *                      e.g. ISP_ERASE_TIMEOUT for a mass erase, ms
+  * @retval 0 = success, -1 = failure
+  */
+int32_t write_reg(isp_session_t *sess, uint8_t reg_addr, const uint8_t *pdata, uint16_t size, uint32_t budget);
+
+/**
+  * @brief  read identification, flash geometry and capability registers
+  * @param  sess [I] - session
+  * @param  attr [O] - device attributes
+  * @retval 0 = success, -1 = failure
+  * @note   The registers are fetched with a single TYPE_GET_RANGE request and
+  *         read one by one only where the bootloader does not support it.
+  * @note   Once the device has answered, a register that times out is asked
+  *         for again on its own, a few times with growing pauses.
+  */
+int32_t get_dev_attr(isp_session_t *sess, dev_attr_t *attr);
+
+/**
+  * @brief  prepare a session on an open port
+  * @param  sess [O] - session
+  * @param  hdl [I] - serial port handle
+  * @param  dev_addr [I] - device address
+  * @retval none
+  * @note   frame_limit starts at PKT_EXT_PLD_SIZE, lower it before
+  *         isp_connect() to cap the frame size.
+  */
+void isp_init(isp_session_t *sess, com_handle_t hdl, uint8_t dev_addr);
+
+/**
+  * @brief  tell a session the line settings its timeouts are derived from
+  * @param  sess [I/O] - session, assumes 115200 8N1 until told otherwise
+  * @param  param [I] - line settings of the port
+  * @retval none
+  * @note   isp_upshift() keeps it up to date by itself.
+  */
+void isp_set_line(isp_session_t *sess, const com_param_t *param);
+
+/**
+  * @brief  identify the device and read its flash geometry and capabilities
+  * @param  sess [I] - session prepared by isp_init()
+  * @retval 0 = success, -1 = failure
+  * @note   The attributes are kept in the session, later calls return at once.
+  * @note   sess->frame_size becomes the largest payload both the device
+  *         and sess->frame_limit allow; every transfer is cut to it.
+  */
+int32_t isp_connect(isp_session_t *sess);
+
+/**
+  * @brief  repeat isp_connect() until a device answers
+  * @param  sess [I] - session prepared by isp_init()
+  * @param  wait_ms [I] - how long to wait for the device, 0 = forever
+  * @retval 0 = success, -1 = failure, sess->error tells why
+  * @note   The pause between handshakes doubles up to half a second. A port
+  *         failure or a device refusing the handshake ends it at once.
+  */
+int32_t isp_wait_connect(isp_session_t *sess, uint32_t wait_ms);
+
+/**
+  * @brief  describe the reason the last transaction of a session failed
+  * @param  sess [I] - session
+  * @retval static string
+  */
+const char *isp_strerror(const isp_session_t *sess);
+
+/**
+  * @brief  switch to the fastest line rate both sides and the cable handle
+  * @param  sess [I] - connected session
+  * @param  param [I/O] - host line settings, baudrate is updated to the rate
+  *                       in use on return
+  * @param  max_baudrate [I] - highest rate to try, 0 = no limit
+  * @retval 0 = success, -1 = the device stopped answering
+  * @note   Each rate is checked with a burst of test pattern reads; on any
+  *         error both sides return to the previous rate and the next lower
+  *         one is tried. Devices without CAP_BAUDRATE, and ports whose
+  *         line settings are out of reach (com_fixed_line()), stay where
+  *         they are.
+  */
+int32_t isp_upshift(isp_session_t *sess, com_param_t *param, uint32_t max_baudrate);
+
+/**
+  * @brief  locate a flash area of the connected device
+  * @param  sess [I] - connected session
+  * @param  area [I] - ISP_AREA_*
+  * @param  addr [O] - start address
+  * @param  size [O] - size in bytes
+  * @retval 0 = success, -1 = unknown area
+  */
+int32_t isp_area(const isp_session_t *sess, uint8_t area, uint32_t *addr, uint32_t *size);
+
+/**
+  * @brief  erase an area of the device
+  * @param  sess [I] - connected session
+  * @param  area [I] - ERASE_* area
+  * @retval 0 = success, -1 = failure
+  */
+int32_t isp_erase(isp_session_t *sess, uint8_t area);
+
+/**
+  * @brief  program a block of erased flash
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  data [I] - data to program
+  * @param  size [I] - number of bytes
+  * @param  window [I] - frames kept in flight, 1 = stop-and-wait; bounded by
+  *                      what the device reports and ignored if it has no
+  *                      CAP_WINDOW
+  * @retval 0 = success, -1 = failure
+  * @note   With sess->compress set the data goes out LZ packed where the
+  *         device supports it and packing saves bytes on the line, raw otherwise.
+  * @note   With sess->erase_ahead set every page the block touches is
+  *         erased first, whole. In a windowed stream each page is erased
+  *         while the frames of the one before are still on the line, which
+  *         hides the erase time behind the transfer.
+  * @note   sess->progress, if set, is told how far the device has got each
+  *         time it acknowledges more of the block.
+  */
+int32_t isp_write(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size, uint8_t window);
+
+/**
+  * @brief  bring a whole area to new content, touching only changed pages
+  * @param  sess [I] - connected session
+  * @param  area [I] - ISP_AREA_*
+  * @param  data [I] - new content of the entire area, erased bytes as 0xFF
+  * @param  prev [I] - content flashed last time, NULL if unknown
+  * @param  window [I] - frames kept in flight, see isp_write()
+  * @param  diff [O] - what was done
+  * @retval 0 = success, -1 = failure
+  * @note   Without prev the pages are compared through REG_PAGE_CRC, and
+  *         all of them are rewritten if the device lacks CAP_PAGE_CRC.
+  *         With sess->erase_ahead set changed pages are erased as they are
+  *         programmed rather than all before.
+  */
+int32_t isp_write_diff(isp_session_t *sess, uint8_t area, const uint8_t *data, const uint8_t *prev,
+                       uint8_t window, isp_diff_t *diff);
+
+/**
+  * @brief  erase an area of every device on a multi-drop line at once
+  * @param  sess [I] - connected sessions sharing one port, one per device
+  * @param  count [I] - number of sessions
+  * @param  area [I] - ERASE_*
+  * @retval 0 = every device is done, -1 = one of them did not answer
+  *         afterwards, see its sess->error
+  * @note   One broadcast request, answered by nobody. Each device is then
+  *         asked for its flash pointer and answers once it has erased; as
+  *         they all erase together it takes about as long as one device.
+  */
+int32_t isp_bus_erase(isp_session_t *const *sess, uint32_t count, uint8_t area);
+
+/**
+  * @brief  program the same data into every device on a multi-drop line at once
+  * @param  pacer [I] - connected session of one of the devices
+  * @param  addr [I] - flash address, erased on every device
+  * @param  data [I] - data to program
+  * @param  size [I] - number of bytes
+  * @param  frame [I] - largest payload every device takes
+  * @param  frames [O] - number of frames broadcast
+  * @retval 0 = success, -1 = the pacer stopped answering
+  * @note   Every frame goes out once to DEVICE_ADDR_BROADCAST behind the
+  *         address it belongs at, so a device that misses one is only left
+  *         with a hole; blank frames are skipped. The pacer is asked for its
+  *         flash pointer after each frame, which holds the line until the
+  *         frame is programmed. Nobody acknowledges anything: check each
+  *         device with isp_bus_repair() afterwards.
+  */
+int32_t isp_bus_write(isp_session_t *pacer, uint32_t addr, const uint8_t *data, uint32_t size, uint16_t frame,
+                      uint32_t *frames);
+
+/**
+  * @brief  check one device after isp_bus_write() and rewrite what it missed
+  * @param  sess [I] - connected session of the device
+  * @param  area [I] - ISP_AREA_*
+  * @param  data [I] - content of the entire area, erased bytes as 0xFF
+  * @param  window [I] - frames kept in flight by the repair, see isp_write()
+  * @param  diff [O] - what was done, diff->changed = 0 if the device has it all
+  * @retval 0 = success, -1 = failure
+  * @note   A device with CAP_RANGE_CRC that got every frame costs a single
+  *         checksum, otherwise the pages are compared as isp_write_diff()
+  *         does and only those that differ are erased and programmed.
+  */
+int32_t isp_bus_repair(isp_session_t *sess, uint8_t area, const uint8_t *data, uint8_t window, isp_diff_t *diff);
+
+/**
+  * @brief  read a block of flash
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  size [I] - number of bytes
+  * @param  window [I] - requests kept in flight, 1 = one at a time
+  * @param  sink [I] - consumer of the data, fed in order
+  * @param  ctx [I] - passed to sink
+  * @retval 0 = success, -1 = failure
+  * @note   Devices with CAP_RDATA tag every reply with its address, so
+  *         several REG_RDATA requests can be outstanding at once; others are
+  *         read through REG_DATA one request at a time.
+  */
+int32_t isp_read(isp_session_t *sess, uint32_t addr, uint32_t size, uint8_t window, isp_sink_t sink, void *ctx);
+
+/**
+  * @brief  check that flash holds the given bytes
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  data [I] - expected content
+  * @param  size [I] - number of bytes
+  * @param  window [I] - requests kept in flight by readback, see isp_read()
+  * @param  verify [O] - what was done and found
+  * @retval 0 = flash matches, 1 = it differs, -1 = failure
+  * @note   Devices with CAP_RANGE_CRC checksum the whole range in a couple
+  *         of round trips. Only if that disagrees are the pages narrowed
+  *         down, through REG_PAGE_CRC where possible, and the ones that
+  *         differ read back. Other devices are read back entirely.
+  */
+int32_t isp_verify(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size, uint8_t window,
+                   isp_verify_t *verify);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ISP_H */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: LZ block codec for REG_ZDATA frames.
+ *
+ * A block is a list of sequences. Each one starts with a token byte whose
+ * high nibble is the number of literals and low nibble the match length
+ * minus LZ_MIN_MATCH; a nibble of 15 continues in the bytes that follow,
+ * each added to it until one is below 255. The literals come next, then
+ * the match offset (2, big-endian, 1 = previous byte). The last sequence
+ * may end right after its literals. Matches only reach back into the
+ * output of the same block, so the decoder needs no more memory than one
+ * block unpacks to.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __LZ_H
+#define __LZ_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+/* Exported constants --------------------------------------------------------*/
+/* Shortest match worth a sequence */
+#define LZ_MIN_MATCH                        4
+/* Exported types ------------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  pack as much input as fits in a block of limited size
+  * @param  src [I] - input
+  * @param  size [I] - number of input bytes available, at most 65535
+  * @param  dst [O] - block
+  * @param  dst_max [I] - capacity of dst
+  * @param  consumed [O] - number of input bytes the block unpacks to
+  * @retval size of the block
+  */
+uint32_t lz_pack(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dst_max, uint32_t *consumed);
+
+/**
+  * @brief  unpack a block
+  * @param  src [I] - block
+  * @param  size [I] - size of the block
+  * @param  dst [O] - output
+  * @param  dst_max [I] - capacity of dst
+  * @param  length [O] - number of bytes unpacked
+  * @retval 0 = success, -1 = malformed block or output too large
+  */
+int32_t lz_unpack(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dst_max, uint32_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LZ_H */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,264 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Bootloader packet protocol definitions shared by the
+ *                   host tool and the device simulator.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __PACKET_H
+#define __PACKET_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+/* Exported constants --------------------------------------------------------*/
+/* Broadcast device address, devices never reply to it */
+#define DEVICE_ADDR_BROADCAST               0x00
+
+/* Maximum number of bytes in payload of a packet */
+#define PKT_PLD_SIZE                        128
+/* Maximum number of bytes in payload of an extended packet */
+#define PKT_EXT_PLD_SIZE                    4096
+/* Extended packet header: address, type, register, length (2), header CRC-8 */
+#define PKT_EXT_HDR_SIZE                    6
+/* CRC-32 closing an extended packet */
+#define PKT_EXT_CRC_SIZE                    4
+/* Packet type enum */
+#define TYPE_SET                            0x01
+#define TYPE_GET                            0x02
+/**
+ * Read consecutive registers in one transaction. reg_addr is the first
+ * register and length the number of registers. Answered by a SET packet of
+ * the first register whose payload is a length byte followed by the value
+ * for each register in turn; the list stops early at the first register
+ * that is unknown or does not fit.
+ */
+#define TYPE_GET_RANGE                      0x03
+/**
+ * Flag on the type of an extended packet, for payloads beyond PKT_PLD_SIZE.
+ * Its header carries a 16-bit length and the CRC-8 of the five bytes
+ * before it, so a damaged length is caught before the payload is waited
+ * for; the packet ends with the CRC-32 of header and payload. A device
+ * with CAP_EXT_FRAME answers an extended request with an extended packet.
+ */
+#define TYPE_EXT                            0x40
+#define TYPE_SUCCESS                        0x80
+#define TYPE_FAILURE_UNKNOWN_REG            (0x80|0x00)
+#define TYPE_FAILURE_ERR_LENGTH             (0x80|0x01)
+#define TYPE_FAILURE_NOT_SUPPORT            (0x80|0x02)
+#define TYPE_FAILURE_ERR_PASSWD             (0x80|0x03)
+#define TYPE_FAILURE_ERR_SIGNATURE          (0x80|0x04)
+#define TYPE_FAILURE_ERR_HAL                (0x80|0x05)
+#define TYPE_FAILURE_ERR_PARAM              (0x80|0x06)
+
+/**
+ * Register map. A successful GET is answered by a SET packet of the same
+ * register, a SET by a header-only TYPE_SUCCESS packet. Multi-byte values
+ * are big-endian unless noted otherwise.
+ */
+/* GET: MCU part number string */
+#define REG_PART_NUMBER                     0x00
+/* GET: MCU unique id string */
+#define REG_UUID                            0x01
+/* GET: major, minor, build (16-bit) */
+#define REG_BLDR_VERSION                    0x02
+/* GET: flash address of the bootloader */
+#define REG_BLDR_ADDR                       0x03
+/* GET: size of the bootloader */
+#define REG_BLDR_SIZE                       0x04
+/* GET: aprom addr, aprom size, eeprom addr, eeprom size, page size */
+#define REG_FLASH_GEOMETRY                  0x05
+/* GET: CAP_* bitmap (4 bytes), largest window of REG_WDATA frames (1 byte) */
+#define REG_CAPS                            0x06
+/**
+ * GET: current line rate (4), highest rate the device supports (4).
+ * SET: line rate (4). The device replies at the current rate, then moves to
+ * the new one and goes back unless the host repeats the same SET at the new
+ * rate within BAUDRATE_REVERT_MS. Setting the current rate is a no-op.
+ */
+#define REG_BAUDRATE                        0x07
+/* GET: length bytes of TEST_PATTERN_BYTE(0), TEST_PATTERN_BYTE(1), ... */
+#define REG_TEST_PATTERN                    0x08
+/* GET: largest payload (2) of an extended packet the device takes and sends */
+#define REG_FRAME_SIZE                      0x09
+/* SET/GET: flash address pointer used by REG_ERASE and REG_DATA */
+#define REG_ADDR                            0x10
+/* SET: 1-byte ERASE_* area, or 4-byte address of a single page */
+#define REG_ERASE                           0x11
+/* SET: program payload at the address pointer, GET: read from it; the
+ * pointer advances by the number of bytes transferred */
+#define REG_DATA                            0x12
+/* SET: start a windowed write stream, base address (4), chunk size (2) */
+#define REG_STREAM                          0x13
+/**
+ * SET: sequence number (2) followed by one chunk, programmed at
+ * base + seq * chunk. Answered by a SET packet of REG_WDATA carrying the
+ * cumulative ack (2), i.e. the first sequence number not yet received, and
+ * a selective ack bitmap (2) whose bit n stands for sequence ack + 1 + n.
+ */
+#define REG_WDATA                           0x14
+/**
+ * SET: sequence number (2), offset from the stream base (4) and an LZ block
+ * (see inc/lz.h) unpacking to at most ZDATA_RAW_MAX bytes, programmed at
+ * base + offset. Shares the sequence space and acknowledgement of REG_WDATA.
+ */
+#define REG_ZDATA                           0x15
+/**
+ * GET: address (4) followed by length - 4 bytes read at the address pointer,
+ * which advances. The address lets a host with several requests in flight
+ * place every reply and spot the ones that went missing.
+ */
+#define REG_RDATA                           0x16
+/**
+ * GET: CRC-32 (4) of each of length / 4 flash pages starting at the address
+ * pointer, which must be page aligned and advances past the pages
+ */
+#define REG_PAGE_CRC                        0x20
+/**
+ * SET: address (4) and size (4) of a flash range, answered once the device
+ * has computed its CRC-32; GET: that CRC-32 (4). Lets the host verify a
+ * whole image in a couple of round trips instead of reading it back.
+ */
+#define REG_RANGE_CRC                       0x21
+
+/* REG_ERASE areas */
+#define ERASE_CHIP                          0x00
+#define ERASE_APROM                         0x01
+#define ERASE_EEPROM                        0x02
+
+/* REG_CAPS bits */
+#define CAP_WINDOW                          BIT(0)
+#define CAP_BAUDRATE                        BIT(1)
+#define CAP_PAGE_CRC                        BIT(2)
+#define CAP_ZDATA                           BIT(3)
+#define CAP_RDATA                           BIT(4)
+#define CAP_RANGE_CRC                       BIT(5)
+#define CAP_EXT_FRAME                       BIT(6)
+
+/* Size of the REG_FLASH_GEOMETRY payload */
+#define FLASH_GEOMETRY_SIZE                 20
+/* Size of the REG_CAPS payload */
+#define CAPS_SIZE                           5
+/* Size of the REG_FRAME_SIZE payload */
+#define FRAME_SIZE_SIZE                     2
+/* Size of the REG_BAUDRATE GET payload */
+#define BAUDRATE_SIZE                       8
+/* Time a device waits at a new line rate for the host to confirm it, ms */
+#define BAUDRATE_REVERT_MS                  300
+/* Size of the REG_STREAM payload */
+#define STREAM_SIZE                         6
+/* Sequence number in front of a REG_WDATA chunk */
+#define WDATA_SEQ_SIZE                      2
+/* Size of the REG_WDATA acknowledgement */
+#define WDATA_ACK_SIZE                      4
+/* Sequence number and offset in front of a REG_ZDATA block */
+#define ZDATA_HDR_SIZE                      6
+/* Largest number of bytes a REG_ZDATA block may unpack to */
+#define ZDATA_RAW_MAX                       1024
+/* Address in front of the data of a REG_RDATA reply */
+#define RDATA_ADDR_SIZE                     4
+/* Size of the REG_RANGE_CRC SET payload */
+#define RANGE_CRC_SIZE                      8
+/* Frames the selective ack bitmap can describe beyond the cumulative ack */
+#define WDATA_SACK_BITS                     16
+/* Exported types ------------------------------------------------------------*/
+
+/**
+ * First 4-byte header format of a packet.
+ */
+typedef struct packet_header_s {
+    /* device address, ranging from 0x01 ~ 0xFF, 0x00 is for broadcasting */
+    uint8_t dev_addr;
+    /* packet type */
+    uint8_t type;
+    /* register address */
+    uint8_t reg_addr;
+    /**
+     * number of bytes in payload of a SET type packet, or
+     * number of bytes to read of a GET type packet
+     */
+    uint8_t length;
+} packet_header_t;
+
+/**
+ * Received packet, basic or extended.
+ */
+typedef struct packet_s {
+    /* packet header, type without TYPE_EXT, length 0 if extended */
+    packet_header_t header;
+    /* number of bytes in payload */
+    uint16_t length;
+    /* packet payload */
+    uint8_t payload[PKT_EXT_PLD_SIZE];
+} packet_t;
+/* Exported macro ------------------------------------------------------------*/
+/**
+ * bitmask value of one bit
+ */
+#define BIT(n)      (1UL<<(n))
+
+/**
+ * break a 32-bit value into bytes
+ */
+#define BREAK_UINT32(var, ByteNum) \
+          (uint8_t)((uint32_t)(((var) >>((ByteNum) * 8)) & 0x00FF))
+
+/**
+ * build a 32-bit value from bytes
+ */
+#define BUILD_UINT32(Byte0, Byte1, Byte2, Byte3) \
+          ((uint32_t)((uint32_t)((Byte0) & 0x00FF) \
+          + ((uint32_t)((Byte1) & 0x00FF) << 8) \
+          + ((uint32_t)((Byte2) & 0x00FF) << 16) \
+          + ((uint32_t)((Byte3) & 0x00FF) << 24)))
+
+/**
+ * build a 16-bit value from bytes
+ */
+#define BUILD_UINT16(loByte, hiByte) \
+          ((uint16_t)(((loByte) & 0x00FF) + (((hiByte) & 0x00FF) << 8)))
+
+/**
+ * break a 16-bit value into bytes
+ */
+#define HI_UINT16(a) (((a) >> 8) & 0xFF)
+#define LO_UINT16(a) ((a) & 0xFF)
+
+/**
+ * big-endian helpers for payload fields
+ */
+#define GET_BE32(p) BUILD_UINT32((p)[3], (p)[2], (p)[1], (p)[0])
+#define GET_BE16(p) BUILD_UINT16((p)[1], (p)[0])
+#define PUT_BE16(p, v) do { (p)[0] = HI_UINT16(v); (p)[1] = LO_UINT16(v); } while(0)
+#define PUT_BE32(p, v) do { \
+          (p)[0] = BREAK_UINT32(v, 3); (p)[1] = BREAK_UINT32(v, 2); \
+          (p)[2] = BREAK_UINT32(v, 1); (p)[3] = BREAK_UINT32(v, 0); } while(0)
+
+/**
+ * byte n of the REG_TEST_PATTERN burst
+ */
+#define TEST_PATTERN_BYTE(n) ((uint8_t)((n) * 0x1D + 0x55))
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PACKET_H */
+
+/******************************** END OF FILE *********************************/
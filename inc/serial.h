@@ -48,42 +48,124 @@ typedef struct com_param_s {
 } com_param_t;
 
 typedef void *com_handle_t;
+
+/* one segment of a gathered write */
+typedef struct com_iovec_s {
+    const uint8_t *base;
+    size_t size;
+} com_iovec_t;
 /* Exported macro ------------------------------------------------------------*/
 /* Exported variables --------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
 /**
-  * @brief  Template brief.
-  * @param  none
-  * @retval none
-  * @note   Template note.
+  * @brief  open a serial port and apply the line settings.
+  * @param  port [I] - port name, e.g. "COM1" or "/dev/ttyUSB0"; or a serial
+  *                    device server, "tcp://host:port" for a raw TCP port
+  *                    and "rfc2217://host:port" for Telnet with RFC 2217
+  * @param  param [I] - line settings, any integer baud rate is accepted
+  *                     where the driver supports it
+  * @param  handle [O] - handle of the opened port
+  * @retval 0 = success, -1 = failure
+  * @note   A raw TCP port runs at whatever the server is set up for, see
+  *         com_fixed_line(). RFC 2217 applies the settings remotely.
   */
 int32_t com_open(const char *port, com_param_t *param, com_handle_t *handle);
 
 /**
-  * @brief  Template brief.
-  * @param  none
-  * @retval none
-  * @note   Template note.
+  * @brief  change the line settings of an open port.
+  * @param  handle [I] - port handle
+  * @param  param [I] - new line settings
+  * @retval 0 = success, -1 = failure
+  * @note   Data already written is sent at the old settings first. Links
+  *         that are not terminals, such as loopbacks, accept any setting.
+  */
+int32_t com_set_param(com_handle_t handle, const com_param_t *param);
+
+/**
+  * @brief  write a block of data, blocking until all of it is accepted.
+  * @param  handle [I] - port handle
+  * @param  buf [I] - data to send
+  * @param  size [I] - number of bytes to send
+  * @retval 0 = success, -1 = failure
   */
 int32_t com_send(com_handle_t handle, const uint8_t *buf, size_t size);
 
 /**
-  * @brief  Template brief.
-  * @param  none
-  * @retval none
-  * @note   Template note.
+  * @brief  write several segments as one block, blocking until all of it
+  *         is accepted.
+  * @param  handle [I] - port handle
+  * @param  iov [I] - segments to send, in order
+  * @param  count [I] - number of segments
+  * @retval 0 = success, -1 = failure
+  * @note   Takes one system call for the whole block unless the driver
+  *         buffer fills up, so frames queued together leave back to back.
+  */
+int32_t com_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count);
+
+/**
+  * @brief  read a block of data.
+  * @param  handle [I] - port handle
+  * @param  buf [O] - receive buffer
+  * @param  size [I] - size of the receive buffer
+  * @param  rxcnt [O] - number of bytes received, 0 on timeout
+  * @param  timeout [I] - time to wait for the first byte in ms
+  * @retval 0 = success, -1 = failure
+  * @note   Returns as soon as the buffer is full or the line has been idle
+  *         for a few character times after data arrived.
   */
 int32_t com_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
 
 /**
-  * @brief  Template brief.
-  * @param  none
-  * @retval none
-  * @note   Template note.
+  * @brief  tell whether the line settings are out of reach.
+  * @param  handle [I] - port handle
+  * @retval 1 = com_set_param() only accepts the settings in effect, as on a
+  *         raw TCP port; 0 = they can be changed
+  */
+uint8_t com_fixed_line(com_handle_t handle);
+
+/**
+  * @brief  close a serial port.
+  * @param  handle [I] - port handle
+  * @retval 0 = success, -1 = failure
   */
 int32_t com_close(com_handle_t handle);
 
+/**
+  * @brief  create a pseudo terminal and open its master side.
+  * @param  slave [O] - receives the path of the slave side, which can be
+  *                     passed to com_open() by another process
+  * @param  size [I] - size of the slave buffer
+  * @param  handle [O] - handle of the master side
+  * @retval 0 = success, -1 = failure
+  * @note   POSIX only. The master keeps the slave open so it never hangs up
+  *         while the peer reconnects.
+  */
+int32_t com_open_pty(char *slave, size_t size, com_handle_t *handle);
+
+/**
+  * @brief  listen for a serial device client, the far side of com_open().
+  * @param  port [I] - "tcp://host:port" or "rfc2217://host:port", an empty
+  *                    host listens on every interface
+  * @param  handle [O] - handle of the listening end
+  * @retval 0 = success, -1 = failure
+  * @note   Clients are served one at a time. Until one connects com_recv()
+  *         times out and sent data is dropped; when it hangs up the next
+  *         one is accepted. RFC 2217 settings are confirmed to the client
+  *         and otherwise ignored, this stands in for a device server.
+  */
+int32_t com_listen(const char *port, com_handle_t *handle);
+
+/**
+  * @brief  create an in-process loopback link made of two connected handles.
+  * @param  handle_a [O] - first end
+  * @param  handle_b [O] - second end
+  * @retval 0 = success, -1 = failure
+  * @note   POSIX only. Data sent on one end is received on the other one,
+  *         there is no baud rate pacing.
+  */
+int32_t com_open_loopback(com_handle_t *handle_a, com_handle_t *handle_b);
+
 #ifdef __cplusplus
 }
 #endif
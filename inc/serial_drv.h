@@ -0,0 +1,78 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Transport interface behind the com_* API, implemented by
+ *                   the serial port backends and the network transports.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SERIAL_DRV_H
+#define __SERIAL_DRV_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "inc/serial.h"
+/* Exported constants --------------------------------------------------------*/
+/* Port name prefixes selecting a network transport */
+#define COM_PREFIX_TCP                      "tcp://"
+#define COM_PREFIX_RFC2217                  "rfc2217://"
+/* Exported types ------------------------------------------------------------*/
+typedef struct com_drv_s {
+    /* see com_set_param(), com_sendv(), com_recv() and com_close() */
+    int32_t (*set_param)(com_handle_t handle, const com_param_t *param);
+    int32_t (*sendv)(com_handle_t handle, const com_iovec_t *iov, size_t count);
+    int32_t (*recv)(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
+    int32_t (*close)(com_handle_t handle);
+    /* the line settings belong to the far end, set_param cannot change them */
+    uint8_t fixed_line;
+} com_drv_t;
+
+/* every handle points at an instance that starts with this */
+typedef struct com_port_s {
+    const com_drv_t *drv;
+} com_port_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  open a local serial port, see com_open()
+  */
+int32_t com_tty_open(const char *port, com_param_t *param, com_handle_t *handle);
+
+/**
+  * @brief  connect to a serial device server, see com_open()
+  * @param  host [I] - "host:port", an IPv6 host in brackets
+  * @param  param [I] - line settings, applied remotely with RFC 2217
+  * @param  rfc2217 [I] - 1 = Telnet with RFC 2217 port control, 0 = raw TCP
+  * @param  handle [O] - handle of the connection
+  * @retval 0 = success, -1 = failure
+  */
+int32_t com_net_open(const char *host, const com_param_t *param, uint8_t rfc2217, com_handle_t *handle);
+
+/**
+  * @brief  listen for connections, see com_listen()
+  */
+int32_t com_net_listen(const char *host, uint8_t rfc2217, com_handle_t *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SERIAL_DRV_H */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Counters and timeline of a programming session, written
+ *                   out as a JSON summary and as a Chrome trace.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __STATS_H
+#define __STATS_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+/* Exported constants --------------------------------------------------------*/
+/* Rows of the timeline: steps of a command, register accesses and streams,
+ * writes to and waits on the port */
+#define STATS_LANE_PHASE                    0
+#define STATS_LANE_XFER                     1
+#define STATS_LANE_LINK                     2
+#define STATS_LANES                         3
+
+/* Events kept per session, later ones are only counted */
+#define STATS_EVENTS_MAX                    (1UL << 20)
+/* Exported types ------------------------------------------------------------*/
+typedef struct stats_event_s {
+    uint64_t start_us;
+    /* 0 for an instant, such as a timeout */
+    uint32_t dur_us;
+    /* static string */
+    const char *name;
+    uint32_t bytes;
+    uint8_t lane;
+    uint8_t reg_addr;
+    /* 0 = success, -1 = failure */
+    int8_t result;
+} stats_event_t;
+
+typedef struct stats_s {
+    /* port and outcome, filled in by the caller for the reports */
+    const char *port;
+    int32_t result;
+    const char *stage;
+    /* when counting started and stopped, us; end_us is 0 while running */
+    uint64_t start_us;
+    uint64_t end_us;
+    /* isp_connect() handshakes started */
+    uint32_t connects;
+    /* register accesses, and those answered with TYPE_FAILURE_* */
+    uint32_t transactions;
+    uint32_t naks;
+    /* replies waited for in vain, frames or requests sent again */
+    uint32_t timeouts;
+    uint32_t retries;
+    /* received frames failing their CRC and bytes skipped to resync */
+    uint32_t crc_errors;
+    uint32_t resync_bytes;
+    /* frames and bytes each way */
+    uint32_t frames_tx;
+    uint32_t frames_rx;
+    uint64_t bytes_tx;
+    uint64_t bytes_rx;
+    /* time spent writing to the port and blocked waiting on it, and the
+     * time all the bytes take on the line at the rate in use, us */
+    uint64_t send_us;
+    uint64_t wait_us;
+    uint64_t wire_us;
+    /* round trip estimates at the end, see isp_rtt_t */
+    uint32_t srtt_us;
+    uint32_t rttvar_us;
+    uint32_t frame_srtt_us;
+    /* timeline; phases are always kept, everything else only with trace */
+    uint8_t trace;
+    stats_event_t *events;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t dropped;
+    /* phase in progress */
+    const char *phase;
+    uint64_t phase_us;
+} stats_t;
+/* Exported macro ------------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  monotonic clock shared by every timestamp
+  * @retval microseconds
+  */
+uint64_t stats_now_us(void);
+
+/**
+  * @brief  start counting
+  * @param  st [O] - statistics
+  * @param  trace [I] - keep a timeline of every transaction, not only phases
+  * @retval none
+  */
+void stats_init(stats_t *st, uint8_t trace);
+
+/**
+  * @brief  release the timeline
+  * @param  st [I] - statistics
+  * @retval none
+  */
+void stats_free(stats_t *st);
+
+/**
+  * @brief  add a span or an instant to the timeline
+  * @param  st [I] - statistics
+  * @param  lane [I] - STATS_LANE_*
+  * @param  name [I] - static string
+  * @param  start_us [I] - start, stats_now_us()
+  * @param  end_us [I] - end, start_us for an instant
+  * @param  reg_addr [I] - register involved, 0 if none
+  * @param  bytes [I] - bytes moved
+  * @param  result [I] - 0 = success, -1 = failure
+  * @retval none
+  * @note   Without st->trace only STATS_LANE_PHASE is kept.
+  */
+void stats_event(stats_t *st, uint8_t lane, const char *name, uint64_t start_us, uint64_t end_us,
+                 uint8_t reg_addr, uint32_t bytes, int8_t result);
+
+/**
+  * @brief  end the phase in progress and start another
+  * @param  st [I] - statistics, may be NULL
+  * @param  name [I] - static string, NULL to just end the current one
+  * @retval none
+  */
+void stats_phase(stats_t *st, const char *name);
+
+/**
+  * @brief  end the phase in progress and stop the clock of the session
+  * @param  st [I] - statistics
+  * @retval none
+  */
+void stats_stop(stats_t *st);
+
+/**
+  * @brief  write the counters of one or more sessions as JSON
+  * @param  path [I] - file, "-" for stdout
+  * @param  st [I] - statistics of each session
+  * @param  count [I] - number of sessions
+  * @retval 0 = success, -1 = failure
+  */
+int32_t stats_write_summary(const char *path, stats_t *const *st, uint32_t count);
+
+/**
+  * @brief  write the timelines of one or more sessions in Chrome trace format
+  * @param  path [I] - file, load it in chrome://tracing or Perfetto
+  * @param  st [I] - statistics of each session, one process each
+  * @param  count [I] - number of sessions
+  * @retval 0 = success, -1 = failure
+  */
+int32_t stats_write_trace(const char *path, stats_t *const *st, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STATS_H */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,1008 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Simulated bootloader answering the packet protocol over
+ *                   any serial handle (pty master or in-process loopback).
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "inc/serial.h"
+#include "inc/crc.h"
+#include "inc/lz.h"
+#include "inc/packet.h"
+#include "inc/bldr_sim.h"
+/* Private define ------------------------------------------------------------*/
+/* A partial frame older than this is dropped, like the firmware does, ms */
+#define SIM_FRAME_TIMEOUT_MS        50
+/* Poll period of the serving loop, bounds the latency of bldr_sim_stop() */
+#define SIM_POLL_MS                 20
+/* Bits per character on an 8N1 line */
+#define SIM_BITS_PER_CHAR           10
+/* Largest frame on the wire: extended header, payload and crc */
+#define SIM_FRAME_MAX               (PKT_EXT_HDR_SIZE + PKT_EXT_PLD_SIZE + PKT_EXT_CRC_SIZE)
+/* Bytes buffered between the line thread and the protocol loop */
+#define SIM_LINE_SIZE               16384
+/* Nominal line rate of an unpaced simulator */
+#define SIM_DEFAULT_BAUDRATE        115200
+/* Private typedef -----------------------------------------------------------*/
+struct bldr_sim_s {
+    bldr_sim_cfg_t cfg;
+    /* simulated memories, erased to 0xFF */
+    uint8_t *aprom;
+    uint8_t *eeprom;
+    /* flash address pointer, see REG_ADDR */
+    uint32_t addr;
+    /* windowed stream, see REG_STREAM and REG_WDATA */
+    uint32_t stream_base;
+    uint16_t stream_chunk;
+    uint16_t stream_ack;
+    uint32_t stream_sack;
+    /* CRC-32 of the last range given to REG_RANGE_CRC */
+    uint32_t range_crc;
+    /**
+     * Bytes read by the line thread, each stamped with the time its last bit
+     * would arrive on the emulated line. Reading on a separate thread keeps
+     * the stamps right while the protocol loop sleeps in an operation.
+     */
+    uint8_t line[SIM_LINE_SIZE];
+    uint64_t line_ns[SIM_LINE_SIZE];
+    size_t line_head;
+    size_t line_tail;
+    int line_err;
+    volatile int line_stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* receive assembly buffer of the protocol loop */
+    uint8_t rx[SIM_FRAME_MAX * 2];
+    uint64_t rx_ns[SIM_FRAME_MAX * 2];
+    size_t rxlen;
+    /* line rate, see REG_BAUDRATE: current, confirmed, requested by the last
+     * SET, and when an unconfirmed rate reverts (0 = confirmed) */
+    uint32_t rate;
+    uint32_t rate_prev;
+    uint32_t rate_next;
+    uint64_t rate_revert_ns;
+    /* emulated line: time at which the last received/sent byte is on the wire */
+    uint64_t char_ns;
+    uint64_t rx_done_ns;
+    uint64_t tx_done_ns;
+    /* pseudo random state for fault injection */
+    uint32_t seed;
+    /* serving loop control */
+    volatile int stop;
+    int running;
+    pthread_t thread;
+    com_handle_t hdl;
+};
+/* Private macro -------------------------------------------------------------*/
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+static uint64_t sim_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sim_sleep_until(uint64_t ns)
+{
+    struct timespec ts;
+
+    if(ns <= sim_now_ns())
+        return;
+    ts.tv_sec = (time_t)(ns / 1000000000ULL);
+    ts.tv_nsec = (long)(ns % 1000000000ULL);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+static void sim_delay_us(uint32_t us)
+{
+    if(us)
+        sim_sleep_until(sim_now_ns() + (uint64_t)us * 1000);
+}
+
+static uint32_t sim_rand(bldr_sim_t *sim)
+{
+    /* xorshift32 */
+    sim->seed ^= sim->seed << 13;
+    sim->seed ^= sim->seed >> 17;
+    sim->seed ^= sim->seed << 5;
+    return sim->seed;
+}
+
+static void sim_set_baudrate(bldr_sim_t *sim, uint32_t baudrate)
+{
+    pthread_mutex_lock(&sim->lock);
+    sim->rate = baudrate;
+    /* an unpaced simulator only keeps track of the nominal rate */
+    sim->char_ns = sim->cfg.baudrate ? (SIM_BITS_PER_CHAR * 1000000000ULL + baudrate - 1) / baudrate : 0;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+/**
+  * @brief  tell whether the emulated cable garbles the current rate
+  * @param  sim [I] - simulator instance
+  * @retval 1 = bytes get corrupted, 0 = clean line
+  */
+static int sim_line_noisy(const bldr_sim_t *sim)
+{
+    return sim->cfg.line_limit && sim->rate > sim->cfg.line_limit;
+}
+
+/**
+  * @brief  locate a flash region
+  * @param  sim [I] - simulator instance
+  * @param  addr [I] - start address
+  * @param  size [I] - size of the region
+  * @retval pointer into the simulated memory, NULL if out of range
+  */
+static uint8_t *sim_region(bldr_sim_t *sim, uint32_t addr, uint32_t size)
+{
+    const bldr_sim_cfg_t *cfg = &sim->cfg;
+
+    if(addr >= cfg->aprom_addr && (uint64_t)addr + size <= (uint64_t)cfg->aprom_addr + cfg->aprom_size)
+        return sim->aprom + (addr - cfg->aprom_addr);
+    if(addr >= cfg->eeprom_addr && (uint64_t)addr + size <= (uint64_t)cfg->eeprom_addr + cfg->eeprom_size)
+        return sim->eeprom + (addr - cfg->eeprom_addr);
+
+    return NULL;
+}
+
+/**
+  * @brief  put one frame on the emulated line
+  * @param  sim [I] - simulator instance
+  * @param  type [I] - packet type
+  * @param  reg_addr [I] - register address
+  * @param  payload [I] - payload, NULL if none
+  * @param  length [I] - number of bytes in payload
+  * @param  ext [I] - send an extended frame
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t sim_reply(bldr_sim_t *sim, uint8_t type, uint8_t reg_addr, const uint8_t *payload, uint16_t length,
+                         uint8_t ext)
+{
+    uint8_t frame[SIM_FRAME_MAX];
+    size_t size, hdr;
+    uint32_t crc;
+    uint64_t start;
+
+    frame[0] = sim->cfg.dev_addr;
+    frame[1] = type;
+    frame[2] = reg_addr;
+    if(ext)
+    {
+        frame[1] |= TYPE_EXT;
+        PUT_BE16(&frame[3], length);
+        frame[5] = crc8_maxim(frame, PKT_EXT_HDR_SIZE - 1);
+        hdr = PKT_EXT_HDR_SIZE;
+    }
+    else
+    {
+        frame[3] = (uint8_t)length;
+        hdr = sizeof(packet_header_t);
+    }
+    if(length)
+        memcpy(&frame[hdr], payload, length);
+    size = hdr + length;
+    if(ext)
+    {
+        crc = crc32_ieee(frame, size);
+        PUT_BE32(&frame[size], crc);
+        size += PKT_EXT_CRC_SIZE;
+    }
+    else
+    {
+        frame[size] = crc8_maxim(frame, size);
+        size++;
+    }
+
+    if(sim->cfg.fault_ppm && sim_rand(sim) % 1000000 < sim->cfg.fault_ppm)
+        frame[size - 1] ^= 0x5A;
+    if(sim_line_noisy(sim))
+        frame[sim_rand(sim) % size] ^= 0x10;
+
+    /* the reply becomes visible once its last bit would have been sent */
+    sim_delay_us(sim->cfg.turnaround_us);
+    start = MAX(sim_now_ns(), sim->tx_done_ns);
+    sim->tx_done_ns = start + size * sim->char_ns;
+    sim_sleep_until(sim->tx_done_ns);
+
+    return com_send(sim->hdl, frame, size);
+}
+
+/**
+  * @brief  largest payload the device takes or sends in one frame
+  */
+static uint16_t sim_pld_max(const bldr_sim_t *sim)
+{
+    return sim->cfg.frame_size > PKT_PLD_SIZE ? sim->cfg.frame_size : PKT_PLD_SIZE;
+}
+
+static uint8_t sim_get(bldr_sim_t *sim, uint8_t reg_addr, uint16_t length, uint8_t *payload, uint16_t *outlen)
+{
+    const bldr_sim_cfg_t *cfg = &sim->cfg;
+    const char *str;
+    uint8_t *mem;
+
+    switch(reg_addr)
+    {
+        case REG_PART_NUMBER:
+        case REG_UUID:
+            str = reg_addr == REG_PART_NUMBER ? cfg->part_number : cfg->uuid;
+            *outlen = (uint16_t)MIN(strlen(str), (size_t)length);
+            memcpy(payload, str, *outlen);
+            return TYPE_SET;
+
+        case REG_BLDR_VERSION:
+            if(length < 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            payload[0] = cfg->major_ver;
+            payload[1] = cfg->minor_ver;
+            payload[2] = HI_UINT16(cfg->build_ver);
+            payload[3] = LO_UINT16(cfg->build_ver);
+            *outlen = 4;
+            return TYPE_SET;
+
+        case REG_BLDR_ADDR:
+        case REG_BLDR_SIZE:
+        case REG_ADDR:
+            if(length < 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE32(payload, reg_addr == REG_BLDR_ADDR ? cfg->bldr_addr :
+                              reg_addr == REG_BLDR_SIZE ? cfg->bldr_size : sim->addr);
+            *outlen = 4;
+            return TYPE_SET;
+
+        case REG_FLASH_GEOMETRY:
+            if(length < FLASH_GEOMETRY_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE32(&payload[0], cfg->aprom_addr);
+            PUT_BE32(&payload[4], cfg->aprom_size);
+            PUT_BE32(&payload[8], cfg->eeprom_addr);
+            PUT_BE32(&payload[12], cfg->eeprom_size);
+            PUT_BE32(&payload[16], cfg->page_size);
+            *outlen = FLASH_GEOMETRY_SIZE;
+            return TYPE_SET;
+
+        case REG_CAPS:
+            if(length < CAPS_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE32(payload, (cfg->max_window ? CAP_WINDOW : 0) | (cfg->max_baudrate ? CAP_BAUDRATE : 0) | CAP_PAGE_CRC |
+                             (cfg->max_window && cfg->zdata ? CAP_ZDATA : 0) | (cfg->rdata ? CAP_RDATA : 0) |
+                             (cfg->range_crc ? CAP_RANGE_CRC : 0) | (cfg->frame_size ? CAP_EXT_FRAME : 0));
+            payload[4] = cfg->max_window;
+            *outlen = CAPS_SIZE;
+            return TYPE_SET;
+
+        case REG_BAUDRATE:
+            if(cfg->max_baudrate == 0)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length < BAUDRATE_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE32(&payload[0], sim->rate);
+            PUT_BE32(&payload[4], cfg->max_baudrate);
+            *outlen = BAUDRATE_SIZE;
+            return TYPE_SET;
+
+        case REG_FRAME_SIZE:
+            if(cfg->frame_size == 0)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length < FRAME_SIZE_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE16(payload, cfg->frame_size);
+            *outlen = FRAME_SIZE_SIZE;
+            return TYPE_SET;
+
+        case REG_PAGE_CRC:
+            if(length > sim_pld_max(sim) || length % 4 || cfg->page_size == 0)
+                return TYPE_FAILURE_ERR_LENGTH;
+            mem = sim_region(sim, sim->addr, length / 4 * cfg->page_size);
+            if(mem == NULL || sim->addr % cfg->page_size)
+                return TYPE_FAILURE_ERR_PARAM;
+            for(*outlen = 0; *outlen < length; *outlen += 4, mem += cfg->page_size)
+                PUT_BE32(&payload[*outlen], crc32_ieee(mem, cfg->page_size));
+            sim->addr += length / 4 * cfg->page_size;
+            return TYPE_SET;
+
+        case REG_RANGE_CRC:
+            if(!cfg->range_crc)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length < 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            PUT_BE32(payload, sim->range_crc);
+            *outlen = 4;
+            return TYPE_SET;
+
+        case REG_TEST_PATTERN:
+            if(length > sim_pld_max(sim))
+                return TYPE_FAILURE_ERR_LENGTH;
+            for(*outlen = 0; *outlen < length; (*outlen)++)
+                payload[*outlen] = TEST_PATTERN_BYTE(*outlen);
+            return TYPE_SET;
+
+        case REG_DATA:
+            if(length > sim_pld_max(sim))
+                return TYPE_FAILURE_ERR_LENGTH;
+            mem = sim_region(sim, sim->addr, length);
+            if(mem == NULL)
+                return TYPE_FAILURE_ERR_PARAM;
+            memcpy(payload, mem, length);
+            sim->addr += length;
+            *outlen = length;
+            return TYPE_SET;
+
+        case REG_RDATA:
+            if(!cfg->rdata)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length > sim_pld_max(sim) || length <= RDATA_ADDR_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            mem = sim_region(sim, sim->addr, length - RDATA_ADDR_SIZE);
+            if(mem == NULL)
+                return TYPE_FAILURE_ERR_PARAM;
+            PUT_BE32(payload, sim->addr);
+            memcpy(&payload[RDATA_ADDR_SIZE], mem, length - RDATA_ADDR_SIZE);
+            sim->addr += length - RDATA_ADDR_SIZE;
+            *outlen = length;
+            return TYPE_SET;
+
+        case REG_ERASE:
+        case REG_STREAM:
+        case REG_WDATA:
+        case REG_ZDATA:
+            return TYPE_FAILURE_NOT_SUPPORT;
+
+        default:
+            return TYPE_FAILURE_UNKNOWN_REG;
+    }
+}
+
+static uint8_t sim_erase(bldr_sim_t *sim, uint32_t addr, uint32_t size)
+{
+    uint8_t *mem = sim_region(sim, addr, size);
+    uint32_t pages;
+
+    if(mem == NULL || sim->cfg.page_size == 0)
+        return TYPE_FAILURE_ERR_PARAM;
+
+    pages = (size + sim->cfg.page_size - 1) / sim->cfg.page_size;
+    sim_delay_us(sim->cfg.erase_us * pages);
+    memset(mem, 0xFF, size);
+
+    return TYPE_SUCCESS;
+}
+
+static uint8_t sim_program(bldr_sim_t *sim, uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    uint8_t *mem = sim_region(sim, addr, size);
+    uint32_t i;
+
+    if(mem == NULL)
+        return TYPE_FAILURE_ERR_PARAM;
+
+    sim_delay_us(sim->cfg.program_us * (size > PKT_PLD_SIZE ? (size + PKT_PLD_SIZE - 1) / PKT_PLD_SIZE : 1));
+    /* NOR flash can only clear bits, programming over data fails */
+    for(i = 0; i < size; i++)
+    {
+        mem[i] &= data[i];
+        if(mem[i] != data[i])
+            return TYPE_FAILURE_ERR_HAL;
+    }
+
+    return TYPE_SUCCESS;
+}
+
+/**
+  * @brief  unpack a REG_ZDATA frame and program it
+  * @param  sim [I] - simulator instance
+  * @param  payload [I] - offset and LZ block, after the sequence number
+  * @param  length [I] - number of bytes in payload
+  * @retval reply type
+  */
+static uint8_t sim_zdata(bldr_sim_t *sim, const uint8_t *payload, uint16_t length)
+{
+    const uint8_t hdr = ZDATA_HDR_SIZE - WDATA_SEQ_SIZE;
+    uint8_t raw[ZDATA_RAW_MAX];
+    uint32_t len;
+
+    if(length < hdr)
+        return TYPE_FAILURE_ERR_LENGTH;
+    if(lz_unpack(payload + hdr, length - hdr, raw, sizeof(raw), &len))
+        return TYPE_FAILURE_ERR_PARAM;
+
+    return sim_program(sim, sim->stream_base + GET_BE32(payload), raw, len);
+}
+
+/**
+  * @brief  accept one REG_WDATA or REG_ZDATA frame and build its
+  *         acknowledgement
+  * @param  sim [I] - simulator instance
+  * @param  reg_addr [I] - REG_WDATA or REG_ZDATA
+  * @param  payload [I] - sequence number and chunk or block
+  * @param  length [I] - payload length
+  * @param  ack [O] - acknowledgement payload
+  * @retval reply type
+  */
+static uint8_t sim_wdata(bldr_sim_t *sim, uint8_t reg_addr, const uint8_t *payload, uint16_t length, uint8_t *ack)
+{
+    uint16_t seq, rel;
+    uint8_t ret, done;
+
+    if(sim->stream_chunk == 0 || sim->cfg.max_window == 0 || (reg_addr == REG_ZDATA && !sim->cfg.zdata))
+        return TYPE_FAILURE_NOT_SUPPORT;
+    if(length < WDATA_SEQ_SIZE || (reg_addr == REG_WDATA && length - WDATA_SEQ_SIZE > sim->stream_chunk))
+        return TYPE_FAILURE_ERR_LENGTH;
+
+    seq = GET_BE16(payload);
+    rel = (uint16_t)(seq - sim->stream_ack);
+    if(rel <= 32)
+    {
+        done = rel > 0 && (sim->stream_sack & BIT(rel - 1));
+        if(!done)
+        {
+            if(reg_addr == REG_ZDATA)
+                ret = sim_zdata(sim, payload + WDATA_SEQ_SIZE, length - WDATA_SEQ_SIZE);
+            else
+                ret = sim_program(sim, sim->stream_base + (uint32_t)seq * sim->stream_chunk,
+                                  payload + WDATA_SEQ_SIZE, length - WDATA_SEQ_SIZE);
+            if(ret != TYPE_SUCCESS)
+                return ret;
+        }
+        if(rel > 0)
+        {
+            sim->stream_sack |= BIT(rel - 1);
+        }
+        else
+        {
+            /* slide past every frame that is now contiguous */
+            sim->stream_ack++;
+            while(1)
+            {
+                done = sim->stream_sack & 1;
+                sim->stream_sack >>= 1;
+                if(!done)
+                    break;
+                sim->stream_ack++;
+            }
+        }
+    }
+    else if(rel < 0x8000)
+    {
+        /* too far ahead of the window */
+        return TYPE_FAILURE_ERR_PARAM;
+    }
+    /* else a duplicate of an acknowledged frame, just acknowledge again */
+
+    PUT_BE16(&ack[0], sim->stream_ack);
+    PUT_BE16(&ack[2], (uint16_t)sim->stream_sack);
+
+    return TYPE_SET;
+}
+
+static uint8_t sim_set(bldr_sim_t *sim, uint8_t reg_addr, const uint8_t *payload, uint16_t length)
+{
+    const bldr_sim_cfg_t *cfg = &sim->cfg;
+    const uint8_t *mem;
+    uint32_t addr, size;
+    uint8_t ret;
+
+    switch(reg_addr)
+    {
+        case REG_ADDR:
+            if(length != 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            sim->addr = GET_BE32(payload);
+            return TYPE_SUCCESS;
+
+        case REG_ERASE:
+            if(length == 1)
+            {
+                ret = TYPE_SUCCESS;
+                if(payload[0] == ERASE_CHIP || payload[0] == ERASE_APROM)
+                    ret = sim_erase(sim, cfg->aprom_addr, cfg->aprom_size);
+                if(ret == TYPE_SUCCESS && cfg->eeprom_size && (payload[0] == ERASE_CHIP || payload[0] == ERASE_EEPROM))
+                    ret = sim_erase(sim, cfg->eeprom_addr, cfg->eeprom_size);
+                if(payload[0] > ERASE_EEPROM)
+                    ret = TYPE_FAILURE_ERR_PARAM;
+                return ret;
+            }
+            if(length != 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            addr = GET_BE32(payload);
+            if(cfg->page_size == 0)
+                return TYPE_FAILURE_ERR_PARAM;
+            return sim_erase(sim, addr - addr % cfg->page_size, cfg->page_size);
+
+        case REG_BAUDRATE:
+            if(cfg->max_baudrate == 0)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length != 4)
+                return TYPE_FAILURE_ERR_LENGTH;
+            addr = GET_BE32(payload);
+            if(addr == sim->rate)
+            {
+                /* the host got through at the new rate, keep it */
+                sim->rate_revert_ns = 0;
+                return TYPE_SUCCESS;
+            }
+            if(addr == 0 || addr > cfg->max_baudrate)
+                return TYPE_FAILURE_ERR_PARAM;
+            /* switched once the reply is out, see sim_dispatch() */
+            sim->rate_next = addr;
+            return TYPE_SUCCESS;
+
+        case REG_DATA:
+            ret = sim_program(sim, sim->addr, payload, length);
+            if(ret == TYPE_SUCCESS)
+                sim->addr += length;
+            return ret;
+
+        case REG_STREAM:
+            if(length != STREAM_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            if(cfg->max_window == 0)
+                return TYPE_FAILURE_NOT_SUPPORT;
+            sim->stream_base = GET_BE32(&payload[0]);
+            sim->stream_chunk = GET_BE16(&payload[4]);
+            sim->stream_ack = 0;
+            sim->stream_sack = 0;
+            return sim->stream_chunk ? TYPE_SUCCESS : TYPE_FAILURE_ERR_PARAM;
+
+        case REG_RANGE_CRC:
+            if(!cfg->range_crc)
+                return TYPE_FAILURE_UNKNOWN_REG;
+            if(length != RANGE_CRC_SIZE)
+                return TYPE_FAILURE_ERR_LENGTH;
+            addr = GET_BE32(&payload[0]);
+            size = GET_BE32(&payload[4]);
+            mem = sim_region(sim, addr, size);
+            if(mem == NULL)
+                return TYPE_FAILURE_ERR_PARAM;
+            sim->range_crc = crc32_ieee(mem, size);
+            return TYPE_SUCCESS;
+
+        case REG_PART_NUMBER:
+        case REG_UUID:
+        case REG_BLDR_VERSION:
+        case REG_BLDR_ADDR:
+        case REG_BLDR_SIZE:
+        case REG_FLASH_GEOMETRY:
+        case REG_CAPS:
+            return TYPE_FAILURE_NOT_SUPPORT;
+
+        default:
+            return TYPE_FAILURE_UNKNOWN_REG;
+    }
+}
+
+/**
+  * @brief  answer a TYPE_GET_RANGE request
+  * @param  sim [I] - simulator instance
+  * @param  reg_addr [I] - first register
+  * @param  count [I] - number of registers
+  * @param  payload [O] - length prefixed values
+  * @param  outlen [O] - number of bytes in payload
+  * @retval packet type of the reply
+  */
+static uint8_t sim_get_range(bldr_sim_t *sim, uint8_t reg_addr, uint8_t count, uint8_t *payload, uint16_t *outlen)
+{
+    uint8_t val[PKT_PLD_SIZE];
+    uint16_t len;
+    uint8_t i;
+
+    *outlen = 0;
+    for(i = 0; i < count; i++)
+    {
+        /* registers with side effects are never part of a block */
+        if((uint8_t)(reg_addr + i) == REG_DATA || (uint8_t)(reg_addr + i) == REG_RDATA ||
+           (uint8_t)(reg_addr + i) == REG_PAGE_CRC || (uint8_t)(reg_addr + i) == REG_RANGE_CRC ||
+           sim_get(sim, (uint8_t)(reg_addr + i), sizeof(val), val, &len) != TYPE_SET ||
+           *outlen + 1 + len > PKT_PLD_SIZE)
+            break;
+        payload[*outlen] = (uint8_t)len;
+        memcpy(&payload[*outlen + 1], val, len);
+        *outlen += 1 + len;
+    }
+
+    return i ? TYPE_SET : TYPE_FAILURE_UNKNOWN_REG;
+}
+
+/**
+  * @brief  execute one valid frame and answer it
+  * @param  sim [I] - simulator instance
+  * @param  frame [I] - frame without its crc
+  * @param  ext [I] - frame is an extended one, answered alike
+  * @retval 0 = success, -1 = link failure
+  */
+static int32_t sim_dispatch(bldr_sim_t *sim, const uint8_t *frame, uint8_t ext)
+{
+    uint8_t payload[PKT_EXT_PLD_SIZE];
+    const uint8_t *data = frame + (ext ? PKT_EXT_HDR_SIZE : sizeof(packet_header_t));
+    uint8_t dev_addr = frame[0], reg_addr = frame[2];
+    uint8_t req = frame[1] & ~TYPE_EXT, type;
+    uint16_t length = ext ? GET_BE16(&frame[3]) : frame[3];
+    uint16_t len = 0;
+
+    if(dev_addr != sim->cfg.dev_addr && dev_addr != DEVICE_ADDR_BROADCAST)
+        return 0;
+
+    if(req == TYPE_GET)
+        type = sim_get(sim, reg_addr, length, payload, &len);
+    else if(req == TYPE_GET_RANGE && sim->cfg.get_range && !ext)
+        type = sim_get_range(sim, reg_addr, (uint8_t)length, payload, &len);
+    else if(req == TYPE_SET && (reg_addr == REG_WDATA || reg_addr == REG_ZDATA))
+    {
+        type = sim_wdata(sim, reg_addr, data, length, payload);
+        len = WDATA_ACK_SIZE;
+    }
+    else if(req == TYPE_SET)
+        type = length > sim_pld_max(sim) ? TYPE_FAILURE_ERR_LENGTH : sim_set(sim, reg_addr, data, length);
+    else
+        type = TYPE_FAILURE_NOT_SUPPORT;
+
+    /* broadcast requests are executed silently */
+    if(dev_addr == DEVICE_ADDR_BROADCAST)
+        return 0;
+
+    if(sim_reply(sim, type, reg_addr, type == TYPE_SET ? payload : NULL, type == TYPE_SET ? len : 0, ext))
+        return -1;
+
+    if(sim->rate_next)
+    {
+        /* a rate that was never confirmed is no base to return to */
+        if(sim->rate_revert_ns == 0)
+            sim->rate_prev = sim->rate;
+        sim_set_baudrate(sim, sim->rate_next);
+        sim->rate_next = 0;
+        sim->rate_revert_ns = sim_now_ns() + BAUDRATE_REVERT_MS * 1000000ULL;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  size of the frame at the start of a buffer
+  * @param  sim [I] - simulator instance
+  * @param  buf [I] - received bytes
+  * @param  avail [I] - number of bytes in buf
+  * @param  ext [O] - the frame is an extended one
+  * @retval frame size including its crc, 0 = more bytes needed to tell,
+  *         -1 = not a frame boundary
+  */
+static int32_t sim_frame_size(const bldr_sim_t *sim, const uint8_t *buf, size_t avail, uint8_t *ext)
+{
+    uint32_t length;
+
+    if(avail < sizeof(packet_header_t) + 1)
+        return 0;
+
+    *ext = (buf[1] & TYPE_EXT) != 0;
+    if(!*ext)
+        return (int32_t)(sizeof(packet_header_t) + (buf[1] == TYPE_SET ? buf[3] : 0) + 1);
+
+    /* older bootloaders see noise in an extended frame */
+    if(sim->cfg.frame_size == 0)
+        return -1;
+    if(avail < PKT_EXT_HDR_SIZE)
+        return 0;
+    if(buf[PKT_EXT_HDR_SIZE - 1] != crc8_maxim(buf, PKT_EXT_HDR_SIZE - 1))
+        return -1;
+    length = GET_BE16(&buf[3]);
+    if(length > PKT_EXT_PLD_SIZE)
+        return -1;
+
+    return (int32_t)(PKT_EXT_HDR_SIZE + ((buf[1] & ~TYPE_EXT) == TYPE_SET ? length : 0) + PKT_EXT_CRC_SIZE);
+}
+
+/**
+  * @brief  extract and execute every complete frame in the receive buffer
+  * @param  sim [I] - simulator instance
+  * @retval 0 = success, -1 = link failure
+  */
+static int32_t sim_process(bldr_sim_t *sim)
+{
+    const uint8_t *frame;
+    size_t size, off = 0;
+    int32_t n;
+    uint8_t ext, ok = 0;
+
+    while(off < sim->rxlen)
+    {
+        frame = &sim->rx[off];
+        n = sim_frame_size(sim, frame, sim->rxlen - off, &ext);
+        if(n == 0 || (n > 0 && sim->rxlen - off < (size_t)n))
+            break;
+
+        if(n > 0)
+        {
+            size = (size_t)n - (ext ? PKT_EXT_CRC_SIZE : 1);
+            if(ext)
+                ok = GET_BE32(&frame[size]) == crc32_ieee(frame, size);
+            else
+                ok = frame[size] == crc8_maxim(frame, size);
+        }
+        if(n < 0 || !ok)
+        {
+            /* not a frame boundary, resynchronize on the next byte */
+            off++;
+            continue;
+        }
+
+        /* act only once the request has fully crossed the emulated line */
+        sim_sleep_until(sim->rx_ns[off + n - 1]);
+        if(sim_dispatch(sim, frame, ext))
+            return -1;
+        off += (size_t)n;
+    }
+
+    memmove(sim->rx, &sim->rx[off], sim->rxlen - off);
+    memmove(sim->rx_ns, &sim->rx_ns[off], (sim->rxlen - off) * sizeof(uint64_t));
+    sim->rxlen -= off;
+
+    return 0;
+}
+/**
+  * @brief  read the link and stamp every byte with its emulated arrival time
+  * @param  arg [I] - simulator instance
+  * @retval NULL
+  */
+static void *sim_line_thread(void *arg)
+{
+    bldr_sim_t *sim = (bldr_sim_t *)arg;
+    uint8_t buf[256];
+    size_t rxcnt, i;
+    uint64_t t;
+
+    while(!sim->line_stop)
+    {
+        if(com_recv(sim->hdl, buf, sizeof(buf), &rxcnt, SIM_POLL_MS))
+        {
+            pthread_mutex_lock(&sim->lock);
+            sim->line_err = 1;
+            pthread_cond_broadcast(&sim->cond);
+            pthread_mutex_unlock(&sim->lock);
+            break;
+        }
+        if(rxcnt == 0)
+            continue;
+
+        /* bytes follow each other on the wire, never earlier than now */
+        t = MAX(sim_now_ns(), sim->rx_done_ns);
+        pthread_mutex_lock(&sim->lock);
+        for(i = 0; i < rxcnt && !sim->line_stop; i++)
+        {
+            while(sim->line_head - sim->line_tail == SIM_LINE_SIZE && !sim->line_stop)
+                pthread_cond_wait(&sim->cond, &sim->lock);
+            t += sim->char_ns;
+            if(sim_line_noisy(sim) && (sim->line_head & 0x07) == 0)
+                buf[i] ^= 0x10;
+            sim->line[sim->line_head % SIM_LINE_SIZE] = buf[i];
+            sim->line_ns[sim->line_head % SIM_LINE_SIZE] = t + sim->cfg.latency_us * 1000ULL;
+            sim->line_head++;
+        }
+        sim->rx_done_ns = t;
+        pthread_cond_broadcast(&sim->cond);
+        pthread_mutex_unlock(&sim->lock);
+    }
+
+    return NULL;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+void bldr_sim_default_cfg(bldr_sim_cfg_t *cfg)
+{
+    memset(cfg, 0, sizeof(bldr_sim_cfg_t));
+    cfg->dev_addr = 0xAA;
+    cfg->part_number = "FSISP-SIM";
+    cfg->uuid = "0123456789ABCDEF";
+    cfg->major_ver = 1;
+    cfg->minor_ver = 0;
+    cfg->build_ver = 0;
+    cfg->bldr_addr = 0x00000000;
+    cfg->bldr_size = 0x1000;
+    cfg->aprom_addr = 0x00001000;
+    cfg->aprom_size = 0x0001F000;
+    cfg->eeprom_addr = 0x00020000;
+    cfg->eeprom_size = 0x800;
+    cfg->page_size = 512;
+    cfg->max_window = WDATA_SACK_BITS;
+    cfg->get_range = 1;
+    cfg->zdata = 1;
+    cfg->rdata = 1;
+    cfg->range_crc = 1;
+    cfg->frame_size = PKT_EXT_PLD_SIZE;
+    cfg->max_baudrate = 3000000;
+}
+
+int32_t bldr_sim_create(const bldr_sim_cfg_t *cfg, bldr_sim_t **sim)
+{
+    bldr_sim_t *s;
+    pthread_condattr_t attr;
+
+    if(cfg->frame_size > PKT_EXT_PLD_SIZE)
+        return -1;
+
+    s = (bldr_sim_t *)calloc(1, sizeof(bldr_sim_t));
+    if(s == NULL)
+        return -1;
+
+    s->cfg = *cfg;
+    s->aprom = (uint8_t *)malloc(cfg->aprom_size ? cfg->aprom_size : 1);
+    s->eeprom = (uint8_t *)malloc(cfg->eeprom_size ? cfg->eeprom_size : 1);
+    if(s->aprom == NULL || s->eeprom == NULL)
+    {
+        free(s->aprom);
+        free(s->eeprom);
+        free(s);
+        return -1;
+    }
+    memset(s->aprom, 0xFF, cfg->aprom_size);
+    memset(s->eeprom, 0xFF, cfg->eeprom_size);
+    s->seed = 0x2545F491;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&s->lock, NULL);
+    sim_set_baudrate(s, cfg->baudrate ? cfg->baudrate : SIM_DEFAULT_BAUDRATE);
+
+    *sim = s;
+    return 0;
+}
+
+int32_t bldr_sim_run(bldr_sim_t *sim, com_handle_t hdl)
+{
+    pthread_t line_thread;
+    struct timespec ts;
+    size_t n, i;
+    int32_t ret = 0;
+
+    sim->hdl = hdl;
+    sim->rxlen = 0;
+    sim->line_head = sim->line_tail = 0;
+    sim->line_err = 0;
+    sim->line_stop = 0;
+    if(pthread_create(&line_thread, NULL, sim_line_thread, sim))
+        return -1;
+
+    while(!sim->stop)
+    {
+        pthread_mutex_lock(&sim->lock);
+        if(sim->line_head == sim->line_tail && !sim->line_err)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += SIM_POLL_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&sim->cond, &sim->lock, &ts);
+        }
+        n = MIN(sim->line_head - sim->line_tail, sizeof(sim->rx) - sim->rxlen);
+        for(i = 0; i < n; i++, sim->line_tail++)
+        {
+            sim->rx[sim->rxlen + i] = sim->line[sim->line_tail % SIM_LINE_SIZE];
+            sim->rx_ns[sim->rxlen + i] = sim->line_ns[sim->line_tail % SIM_LINE_SIZE];
+        }
+        pthread_cond_broadcast(&sim->cond);
+        if(sim->line_err)
+            ret = -1;
+        pthread_mutex_unlock(&sim->lock);
+        if(ret)
+            break;
+
+        if(sim->rate_revert_ns && sim_now_ns() >= sim->rate_revert_ns)
+        {
+            /* the host never confirmed the new rate */
+            sim_set_baudrate(sim, sim->rate_prev);
+            sim->rate_revert_ns = 0;
+            sim->rxlen = 0;
+        }
+
+        if(n == 0)
+        {
+            if(sim->rxlen && sim_now_ns() - sim->rx_ns[sim->rxlen - 1] > SIM_FRAME_TIMEOUT_MS * 1000000ULL)
+                sim->rxlen = 0;
+            continue;
+        }
+
+        sim->rxlen += n;
+        if(sim_process(sim))
+        {
+            ret = -1;
+            break;
+        }
+
+        /* a full buffer without any valid frame is garbage */
+        if(sim->rxlen == sizeof(sim->rx))
+            sim->rxlen = 0;
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    sim->line_stop = 1;
+    pthread_cond_broadcast(&sim->cond);
+    pthread_mutex_unlock(&sim->lock);
+    pthread_join(line_thread, NULL);
+
+    return ret;
+}
+
+static void *sim_thread(void *arg)
+{
+    bldr_sim_t *sim = (bldr_sim_t *)arg;
+
+    bldr_sim_run(sim, sim->hdl);
+
+    return NULL;
+}
+
+int32_t bldr_sim_start(bldr_sim_t *sim, com_handle_t hdl)
+{
+    if(sim->running)
+        return -1;
+
+    sim->stop = 0;
+    sim->hdl = hdl;
+    if(pthread_create(&sim->thread, NULL, sim_thread, sim))
+        return -1;
+    sim->running = 1;
+
+    return 0;
+}
+
+int32_t bldr_sim_stop(bldr_sim_t *sim)
+{
+    sim->stop = 1;
+    if(sim->running)
+    {
+        if(pthread_join(sim->thread, NULL))
+            return -1;
+        sim->running = 0;
+    }
+
+    return 0;
+}
+
+void bldr_sim_destroy(bldr_sim_t *sim)
+{
+    if(sim == NULL)
+        return;
+
+    bldr_sim_stop(sim);
+    pthread_cond_destroy(&sim->cond);
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->aprom);
+    free(sim->eeprom);
+    free(sim);
+}
+
+uint8_t *bldr_sim_memory(bldr_sim_t *sim, uint32_t addr, uint32_t size)
+{
+    return sim_region(sim, addr, size);
+}
+
+#endif /* !defined(_WIN32) */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,249 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Local copy of the content last flashed to each device,
+ *                   and the progress of an interrupted load, keyed by the
+ *                   device UUID.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "inc/cache.h"
+/* Private define ------------------------------------------------------------*/
+#define CACHE_PATH_MAX                      512
+/* First word of a journal, followed by the image hash and the bytes done */
+#define CACHE_JOURNAL_MAGIC                 "fsisp-journal-1"
+/* Private typedef -----------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+#if defined(_WIN32)
+#define cache_mkdir(path)   _mkdir(path)
+#define cache_getpid()      _getpid()
+#else
+#define cache_mkdir(path)   mkdir(path, 0755)
+#define cache_getpid()      getpid()
+#endif
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  locate the cache directory, creating it if needed
+  * @param  dir [O] - directory path
+  * @param  size [I] - size of dir
+  * @retval 0 = success, -1 = no usable directory
+  */
+static int32_t cache_dir(char *dir, size_t size)
+{
+    const char *base;
+    char *p;
+    int n;
+
+    if((base = getenv(CACHE_DIR_ENV)) != NULL && *base)
+        n = snprintf(dir, size, "%s", base);
+#if defined(_WIN32)
+    else if((base = getenv("LOCALAPPDATA")) != NULL && *base)
+        n = snprintf(dir, size, "%s\\fsisp", base);
+#else
+    else if((base = getenv("XDG_CACHE_HOME")) != NULL && *base)
+        n = snprintf(dir, size, "%s/fsisp", base);
+    else if((base = getenv("HOME")) != NULL && *base)
+        n = snprintf(dir, size, "%s/.cache/fsisp", base);
+#endif
+    else
+        return -1;
+    if(n < 0 || (size_t)n >= size)
+        return -1;
+
+    /* mkdir -p */
+    for(p = dir + 1; *p; p++)
+    {
+        if(*p != '/' && *p != '\\')
+            continue;
+        *p = '\0';
+        if(cache_mkdir(dir) != 0 && errno != EEXIST)
+            return -1;
+        *p = dir[0] == '/' ? '/' : '\\';
+    }
+    if(cache_mkdir(dir) != 0 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+/**
+  * @brief  build the file name of an entry
+  * @param  uuid [I] - device UUID
+  * @param  area [I] - area name
+  * @param  ext [I] - kind of entry, "bin" or "journal"
+  * @param  path [O] - file path
+  * @param  size [I] - size of path
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t cache_path(const char *uuid, const char *area, const char *ext, char *path, size_t size)
+{
+    char dir[CACHE_PATH_MAX];
+    char key[128];
+    size_t i;
+    int n;
+
+    if(uuid == NULL || *uuid == '\0' || cache_dir(dir, sizeof(dir)))
+        return -1;
+
+    /* the UUID comes from the device, keep only what is safe in a file name */
+    for(i = 0; uuid[i] && i < sizeof(key) - 1; i++)
+    {
+        key[i] = uuid[i];
+        if(!((key[i] >= '0' && key[i] <= '9') || (key[i] >= 'A' && key[i] <= 'Z') ||
+             (key[i] >= 'a' && key[i] <= 'z') || key[i] == '-' || key[i] == '_'))
+            key[i] = '_';
+    }
+    key[i] = '\0';
+
+    n = snprintf(path, size, "%s/%s-%s.%s", dir, key, area, ext);
+
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+/**
+  * @brief  replace a file atomically, a crash never leaves half of it
+  * @param  path [I] - file path
+  * @param  data [I] - new content
+  * @param  size [I] - number of bytes
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t cache_replace(const char *path, const void *data, size_t size)
+{
+    char tmp[CACHE_PATH_MAX + 16];
+    FILE *fp;
+    int ok;
+
+    /* gang workers write different devices, the pid keeps processes apart */
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)cache_getpid());
+    fp = fopen(tmp, "wb");
+    if(fp == NULL)
+        return -1;
+    ok = fwrite(data, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+
+#if defined(_WIN32)
+    /* rename() does not replace an existing file on Windows */
+    remove(path);
+#endif
+    if(!ok || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t cache_load(const char *uuid, const char *area, uint8_t *data, uint32_t size)
+{
+    char path[CACHE_PATH_MAX];
+    FILE *fp;
+    long len;
+    int32_t ret = -1;
+
+    if(cache_path(uuid, area, "bin", path, sizeof(path)))
+        return -1;
+
+    fp = fopen(path, "rb");
+    if(fp == NULL)
+        return -1;
+
+    if(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) == (long)size && fseek(fp, 0, SEEK_SET) == 0 &&
+       fread(data, 1, size, fp) == size)
+        ret = 0;
+    fclose(fp);
+
+    return ret;
+}
+
+int32_t cache_store(const char *uuid, const char *area, const uint8_t *data, uint32_t size)
+{
+    char path[CACHE_PATH_MAX];
+
+    if(cache_path(uuid, area, "bin", path, sizeof(path)))
+        return -1;
+
+    return cache_replace(path, data, size);
+}
+
+void cache_drop(const char *uuid, const char *area)
+{
+    char path[CACHE_PATH_MAX];
+
+    if(cache_path(uuid, area, "bin", path, sizeof(path)) == 0)
+        remove(path);
+}
+
+int32_t cache_journal_load(const char *uuid, const char *area, uint32_t hash, uint32_t *done)
+{
+    char path[CACHE_PATH_MAX], magic[32];
+    unsigned long h, n;
+    FILE *fp;
+    int32_t ret = -1;
+
+    if(cache_path(uuid, area, "journal", path, sizeof(path)))
+        return -1;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+        return -1;
+
+    /* a journal of another image says nothing about this one */
+    if(fscanf(fp, "%31s %lx %lu", magic, &h, &n) == 3 && strcmp(magic, CACHE_JOURNAL_MAGIC) == 0 &&
+       (uint32_t)h == hash)
+    {
+        *done = (uint32_t)n;
+        ret = 0;
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+int32_t cache_journal_store(const char *uuid, const char *area, uint32_t hash, uint32_t done)
+{
+    char path[CACHE_PATH_MAX], line[64];
+    int n;
+
+    if(cache_path(uuid, area, "journal", path, sizeof(path)))
+        return -1;
+
+    n = snprintf(line, sizeof(line), "%s %.8lx %lu\n", CACHE_JOURNAL_MAGIC, (unsigned long)hash, (unsigned long)done);
+
+    return cache_replace(path, line, (size_t)n);
+}
+
+void cache_journal_drop(const char *uuid, const char *area)
+{
+    char path[CACHE_PATH_MAX];
+
+    if(cache_path(uuid, area, "journal", path, sizeof(path)) == 0)
+        remove(path);
+}
+
+/******************************** END OF FILE *********************************/
@@ -1,5 +1,5 @@
 /*******************************************************************************
- * Copyright (c) 2021-2022, OKMCU Development Team 
+ * Copyright (c) 2021-2022, OKMCU Development Team
  *
  * SPDX-License-Identifier: Apache-2.0
  *
@@ -8,95 +8,390 @@
  * File Description: CRC algotrithm library
  *
  * Change Logs:
- * Date         Author       Notes    
+ * Date         Author       Notes
  * 2021-10-24   Wentao SUN   first version
- * 
+ * 2026-10-17   OKMCU Team   slice-by-N tables built by the compiler,
+ *                           CRC-16/MODBUS, CRC-32, carry-less multiply engine
+ *
  ******************************************************************************/
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "inc/crc.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CRC_HAVE_CLMUL 1
+#endif
 /* Private define ------------------------------------------------------------*/
-#define CRC8_MAXIM_ALGO_SEL 1
+/**
+ * Bytes consumed per step of the table engine: 1, 8 or 16. Every slice
+ * costs one 256-entry table per CRC.
+ */
+#ifndef CRC_SLICES
+#define CRC_SLICES 16
+#endif
+
+/* Reflected polynomials, split in 16-bit halves for the enum chains below */
+#define CRC8_MAXIM_POLY                     0x0000008CUL
+#define CRC16_MODBUS_POLY                   0x0000A001UL
+#define CRC32_IEEE_POLY                     0xEDB88320UL
+
+/* Buffers shorter than this are not worth setting up the vector engine */
+#define CRC_CLMUL_MIN                       128
 /* Private typedef -----------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
+/**
+ * The tables are generated by the compiler. A reflected CRC is linear, so
+ * entry i of slice table k is the xor of the basis values B(k, b) for the
+ * bits b set in i, where B(k, b) is the register after clocking byte 1 << b
+ * and k zero bytes through it, i.e. x^(w - 1 + 8k + 8 - b) mod P.
+ *
+ * The basis values are produced by a chain of enum constants, each one a
+ * single register shift of the previous. Keeping every link a named
+ * constant stops the expansion from doubling at each shift, and holding
+ * the register in 16-bit halves keeps every constant within int range.
+ */
+#define CRC_SHIFT_H(h, l, ph)       (((h) >> 1) ^ (((l) & 1) ? (ph) : 0))
+#define CRC_SHIFT_L(h, l, pl)       ((((l) >> 1) | (((h) & 1) << 15)) ^ (((l) & 1) ? (pl) : 0))
+
+#define CRC_LINK(pfx, to, from) \
+    pfx##_H##to = CRC_SHIFT_H(pfx##_H##from, pfx##_L##from, pfx##_PH), \
+    pfx##_L##to = CRC_SHIFT_L(pfx##_H##from, pfx##_L##from, pfx##_PL)
+
+/* eight shifts, from B(k - 1, 0) to B(k, 0) */
+#define CRC_GROUP(pfx, k, pk) \
+    CRC_LINK(pfx, _##k##_7, _##pk##_0), CRC_LINK(pfx, _##k##_6, _##k##_7), \
+    CRC_LINK(pfx, _##k##_5, _##k##_6), CRC_LINK(pfx, _##k##_4, _##k##_5), \
+    CRC_LINK(pfx, _##k##_3, _##k##_4), CRC_LINK(pfx, _##k##_2, _##k##_3), \
+    CRC_LINK(pfx, _##k##_1, _##k##_2), CRC_LINK(pfx, _##k##_0, _##k##_1)
+
+/* basis values far enough for the folding constants of the vector engine */
+#define CRC_CHAIN(pfx) \
+    pfx##_H_s_0 = 0, pfx##_L_s_0 = 1, \
+    CRC_GROUP(pfx,  0,  s), CRC_GROUP(pfx,  1,  0), CRC_GROUP(pfx,  2,  1), \
+    CRC_GROUP(pfx,  3,  2), CRC_GROUP(pfx,  4,  3), CRC_GROUP(pfx,  5,  4), \
+    CRC_GROUP(pfx,  6,  5), CRC_GROUP(pfx,  7,  6), CRC_GROUP(pfx,  8,  7), \
+    CRC_GROUP(pfx,  9,  8), CRC_GROUP(pfx, 10,  9), CRC_GROUP(pfx, 11, 10), \
+    CRC_GROUP(pfx, 12, 11), CRC_GROUP(pfx, 13, 12), CRC_GROUP(pfx, 14, 13), \
+    CRC_GROUP(pfx, 15, 14), CRC_GROUP(pfx, 16, 15), CRC_GROUP(pfx, 17, 16), \
+    CRC_GROUP(pfx, 18, 17), CRC_GROUP(pfx, 19, 18), CRC_GROUP(pfx, 20, 19), \
+    CRC_GROUP(pfx, 21, 20), CRC_GROUP(pfx, 22, 21), CRC_GROUP(pfx, 23, 22), \
+    CRC_GROUP(pfx, 24, 23), CRC_GROUP(pfx, 25, 24), CRC_GROUP(pfx, 26, 25), \
+    CRC_GROUP(pfx, 27, 26), CRC_GROUP(pfx, 28, 27), CRC_GROUP(pfx, 29, 28), \
+    CRC_GROUP(pfx, 30, 29), CRC_GROUP(pfx, 31, 30), CRC_GROUP(pfx, 32, 31), \
+    CRC_GROUP(pfx, 33, 32), CRC_GROUP(pfx, 34, 33), CRC_GROUP(pfx, 35, 34), \
+    CRC_GROUP(pfx, 36, 35), CRC_GROUP(pfx, 37, 36), CRC_GROUP(pfx, 38, 37), \
+    CRC_GROUP(pfx, 39, 38), CRC_GROUP(pfx, 40, 39), CRC_GROUP(pfx, 41, 40), \
+    CRC_GROUP(pfx, 42, 41), CRC_GROUP(pfx, 43, 42), CRC_GROUP(pfx, 44, 43), \
+    CRC_GROUP(pfx, 45, 44), CRC_GROUP(pfx, 46, 45), CRC_GROUP(pfx, 47, 46), \
+    CRC_GROUP(pfx, 48, 47), CRC_GROUP(pfx, 49, 48), CRC_GROUP(pfx, 50, 49), \
+    CRC_GROUP(pfx, 51, 50), CRC_GROUP(pfx, 52, 51), CRC_GROUP(pfx, 53, 52), \
+    CRC_GROUP(pfx, 54, 53), CRC_GROUP(pfx, 55, 54), CRC_GROUP(pfx, 56, 55), \
+    CRC_GROUP(pfx, 57, 56), CRC_GROUP(pfx, 58, 57), CRC_GROUP(pfx, 59, 58), \
+    CRC_GROUP(pfx, 60, 59), CRC_GROUP(pfx, 61, 60), CRC_GROUP(pfx, 62, 61), \
+    CRC_GROUP(pfx, 63, 62), CRC_GROUP(pfx, 64, 63), CRC_GROUP(pfx, 65, 64), \
+    CRC_GROUP(pfx, 66, 65), CRC_GROUP(pfx, 67, 66), CRC_GROUP(pfx, 68, 67), \
+    CRC_GROUP(pfx, 69, 68), CRC_GROUP(pfx, 70, 69)
+
+#define CRC_B(pfx, k, b) \
+    (((uint32_t)pfx##_H_##k##_##b << 16) | (uint32_t)pfx##_L_##k##_##b)
+
+#define CRC_T1(pfx, k, i) ( \
+    (((i) & 0x01) ? CRC_B(pfx, k, 0) : 0) ^ (((i) & 0x02) ? CRC_B(pfx, k, 1) : 0) ^ \
+    (((i) & 0x04) ? CRC_B(pfx, k, 2) : 0) ^ (((i) & 0x08) ? CRC_B(pfx, k, 3) : 0) ^ \
+    (((i) & 0x10) ? CRC_B(pfx, k, 4) : 0) ^ (((i) & 0x20) ? CRC_B(pfx, k, 5) : 0) ^ \
+    (((i) & 0x40) ? CRC_B(pfx, k, 6) : 0) ^ (((i) & 0x80) ? CRC_B(pfx, k, 7) : 0))
+#define CRC_T4(pfx, k, i) \
+    CRC_T1(pfx, k, (i) + 0), CRC_T1(pfx, k, (i) + 1), \
+    CRC_T1(pfx, k, (i) + 2), CRC_T1(pfx, k, (i) + 3)
+#define CRC_T16(pfx, k, i) \
+    CRC_T4(pfx, k, (i) + 0x0), CRC_T4(pfx, k, (i) + 0x4), \
+    CRC_T4(pfx, k, (i) + 0x8), CRC_T4(pfx, k, (i) + 0xC)
+#define CRC_T64(pfx, k, i) \
+    CRC_T16(pfx, k, (i) + 0x00), CRC_T16(pfx, k, (i) + 0x10), \
+    CRC_T16(pfx, k, (i) + 0x20), CRC_T16(pfx, k, (i) + 0x30)
+#define CRC_ROW(pfx, k) { \
+    CRC_T64(pfx, k, 0x00), CRC_T64(pfx, k, 0x40), \
+    CRC_T64(pfx, k, 0x80), CRC_T64(pfx, k, 0xC0) }
+
+#if CRC_SLICES == 1
+#define CRC_TABLE(pfx) { CRC_ROW(pfx, 0) }
+#elif CRC_SLICES == 8
+#define CRC_TABLE(pfx) { \
+    CRC_ROW(pfx, 0), CRC_ROW(pfx, 1), CRC_ROW(pfx, 2), CRC_ROW(pfx, 3), \
+    CRC_ROW(pfx, 4), CRC_ROW(pfx, 5), CRC_ROW(pfx, 6), CRC_ROW(pfx, 7) }
+#elif CRC_SLICES == 16
+#define CRC_TABLE(pfx) { \
+    CRC_ROW(pfx,  0), CRC_ROW(pfx,  1), CRC_ROW(pfx,  2), CRC_ROW(pfx,  3), \
+    CRC_ROW(pfx,  4), CRC_ROW(pfx,  5), CRC_ROW(pfx,  6), CRC_ROW(pfx,  7), \
+    CRC_ROW(pfx,  8), CRC_ROW(pfx,  9), CRC_ROW(pfx, 10), CRC_ROW(pfx, 11), \
+    CRC_ROW(pfx, 12), CRC_ROW(pfx, 13), CRC_ROW(pfx, 14), CRC_ROW(pfx, 15) }
+#else
+#error "CRC_SLICES must be 1, 8 or 16"
+#endif
+
+/**
+ * Table engine for a reflected CRC of width w held in the low bits of crc.
+ * The register is folded into the first w / 8 bytes of each block, then
+ * every byte of the block is looked up in the table of its distance from
+ * the end of the block. Spelled out so the lookups are independent loads.
+ */
+#define CRC_X(tab, w, i) \
+    tab[CRC_SLICES - 1 - (i)][pdata[i] ^ ((i) < (w) / 8 ? (uint8_t)(crc >> (8 * ((i) & 3))) : 0)]
+#define CRC_X8(tab, w, i) \
+    CRC_X(tab, w, (i) + 0) ^ CRC_X(tab, w, (i) + 1) ^ CRC_X(tab, w, (i) + 2) ^ \
+    CRC_X(tab, w, (i) + 3) ^ CRC_X(tab, w, (i) + 4) ^ CRC_X(tab, w, (i) + 5) ^ \
+    CRC_X(tab, w, (i) + 6) ^ CRC_X(tab, w, (i) + 7)
+
+#if CRC_SLICES == 16
+#define CRC_SLICE_STEP(tab, w)      (CRC_X8(tab, w, 0) ^ CRC_X8(tab, w, 8))
+#elif CRC_SLICES == 8
+#define CRC_SLICE_STEP(tab, w)      (CRC_X8(tab, w, 0))
+#endif
+
+#if CRC_SLICES > 1
+#define CRC_SLICE_BLOCKS(tab, w) \
+    while(size >= CRC_SLICES) \
+    { \
+        crc = CRC_SLICE_STEP(tab, w); \
+        pdata += CRC_SLICES; \
+        size -= CRC_SLICES; \
+    }
+#else
+#define CRC_SLICE_BLOCKS(tab, w)
+#endif
+
+#define CRC_DEFINE_SLICE(name, tab, w) \
+static uint32_t name(uint32_t crc, const uint8_t *pdata, size_t size) \
+{ \
+    CRC_SLICE_BLOCKS(tab, w) \
+    while(size--) \
+        crc = (crc >> 8) ^ tab[0][(crc ^ *pdata++) & 0xFF]; \
+    return crc; \
+}
 /* Private variables ---------------------------------------------------------*/
+enum {
+    CRC8_PH = (CRC8_MAXIM_POLY >> 16), CRC8_PL = (CRC8_MAXIM_POLY & 0xFFFF),
+    CRC_CHAIN(CRC8)
+};
+enum {
+    CRC16_PH = (CRC16_MODBUS_POLY >> 16), CRC16_PL = (CRC16_MODBUS_POLY & 0xFFFF),
+    CRC_CHAIN(CRC16)
+};
+enum {
+    CRC32_PH = (CRC32_IEEE_POLY >> 16), CRC32_PL = (CRC32_IEEE_POLY & 0xFFFF),
+    CRC_CHAIN(CRC32)
+};
+
+static const uint8_t crc8_table[CRC_SLICES][256] = CRC_TABLE(CRC8);
+static const uint16_t crc16_table[CRC_SLICES][256] = CRC_TABLE(CRC16);
+static const uint32_t crc32_table[CRC_SLICES][256] = CRC_TABLE(CRC32);
+
+/**
+ * Folding constants of the vector engine, x^e mod P aligned to the top of a
+ * 64-bit lane. x^e mod P is B(k, 0) with k = (e - w + 1) / 8 - 1; the
+ * exponents are one less than the folding distance because a carry-less
+ * product of two reflected operands comes out shifted by one bit.
+ */
+typedef struct crc_fold_s {
+    /* x^(128 + 63) and x^(128 - 1): fold one 16-byte block onto the next */
+    uint64_t k128_hi;
+    uint64_t k128_lo;
+    /* x^(512 + 63) and x^(512 - 1): fold four blocks onto the next four */
+    uint64_t k512_hi;
+    uint64_t k512_lo;
+} crc_fold_t;
+
+static const crc_fold_t crc8_fold = {
+    (uint64_t)CRC_B(CRC8, 22, 0) << 56, (uint64_t)CRC_B(CRC8, 14, 0) << 56,
+    (uint64_t)CRC_B(CRC8, 70, 0) << 56, (uint64_t)CRC_B(CRC8, 62, 0) << 56,
+};
+static const crc_fold_t crc16_fold = {
+    (uint64_t)CRC_B(CRC16, 21, 0) << 48, (uint64_t)CRC_B(CRC16, 13, 0) << 48,
+    (uint64_t)CRC_B(CRC16, 69, 0) << 48, (uint64_t)CRC_B(CRC16, 61, 0) << 48,
+};
+static const crc_fold_t crc32_fold = {
+    (uint64_t)CRC_B(CRC32, 19, 0) << 32, (uint64_t)CRC_B(CRC32, 11, 0) << 32,
+    (uint64_t)CRC_B(CRC32, 67, 0) << 32, (uint64_t)CRC_B(CRC32, 59, 0) << 32,
+};
+
+/* engine in use, CRC_ENGINE_AUTO until the first call resolves it */
+static uint8_t crc_active = CRC_ENGINE_AUTO;
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
-/* Exported variables --------------------------------------------------------*/
-/* Exported functions --------------------------------------------------------*/
-#if defined (CRC8_MAXIM_ALGO_SEL) && (CRC8_MAXIM_ALGO_SEL == 0)
-uint8_t crc8_maxim_update(uint8_t crc, const uint8_t * pdata, size_t size)
+CRC_DEFINE_SLICE(crc8_slice, crc8_table, 8)
+CRC_DEFINE_SLICE(crc16_slice, crc16_table, 16)
+CRC_DEFINE_SLICE(crc32_slice, crc32_table, 32)
+
+#if defined(CRC_HAVE_CLMUL)
+__attribute__((target("pclmul,sse2")))
+static __m128i crc_fold(__m128i acc, __m128i k, __m128i next)
 {
-    return 0x00;
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x00),
+                                       _mm_clmulepi64_si128(acc, k, 0x11)), next);
 }
-#elif defined (CRC8_MAXIM_ALGO_SEL) && (CRC8_MAXIM_ALGO_SEL == 1)
-uint8_t crc8_maxim_update(uint8_t crc, const uint8_t * pdata, size_t size)
+
+/**
+  * @brief  reduce a buffer to one 16-byte block with the same CRC
+  * @param  fold [I] - folding constants of the polynomial
+  * @param  crc [I] - register, folded into the first bytes
+  * @param  pdata [I] - points to data block, at least CRC_CLMUL_MIN bytes
+  * @param  size [I/O] - size of the data block, left with the unfolded tail
+  * @param  block [O] - folded block, to be run through the table engine
+  * @retval none
+  */
+__attribute__((target("pclmul,sse2")))
+static void crc_clmul_fold(const crc_fold_t *fold, uint32_t crc, const uint8_t *pdata,
+                           size_t *size, uint8_t block[16])
 {
-    static const uint8_t crc8_maxim_array[256] =
+    const __m128i k128 = _mm_set_epi64x((long long)fold->k128_lo, (long long)fold->k128_hi);
+    const __m128i k512 = _mm_set_epi64x((long long)fold->k512_lo, (long long)fold->k512_hi);
+    __m128i x0, x1, x2, x3;
+    size_t left = *size;
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pdata), _mm_cvtsi32_si128((int)crc));
+    x1 = _mm_loadu_si128((const __m128i *)(pdata + 16));
+    x2 = _mm_loadu_si128((const __m128i *)(pdata + 32));
+    x3 = _mm_loadu_si128((const __m128i *)(pdata + 48));
+    pdata += 64;
+    left -= 64;
+
+    /* four independent lanes keep the multiplier busy */
+    while(left >= 64)
     {
-        0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83,
-        0xc2, 0x9c, 0x7e, 0x20, 0xa3, 0xfd, 0x1f, 0x41,
-        0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e,
-        0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc,
-        0x23, 0x7d, 0x9f, 0xc1, 0x42, 0x1c, 0xfe, 0xa0,
-        0xe1, 0xbf, 0x5d, 0x03, 0x80, 0xde, 0x3c, 0x62,
-        0xbe, 0xe0, 0x02, 0x5c, 0xdf, 0x81, 0x63, 0x3d,
-        0x7c, 0x22, 0xc0, 0x9e, 0x1d, 0x43, 0xa1, 0xff,
-        0x46, 0x18, 0xfa, 0xa4, 0x27, 0x79, 0x9b, 0xc5,
-        0x84, 0xda, 0x38, 0x66, 0xe5, 0xbb, 0x59, 0x07,
-        0xdb, 0x85, 0x67, 0x39, 0xba, 0xe4, 0x06, 0x58,
-        0x19, 0x47, 0xa5, 0xfb, 0x78, 0x26, 0xc4, 0x9a,
-        0x65, 0x3b, 0xd9, 0x87, 0x04, 0x5a, 0xb8, 0xe6,
-        0xa7, 0xf9, 0x1b, 0x45, 0xc6, 0x98, 0x7a, 0x24,
-        0xf8, 0xa6, 0x44, 0x1a, 0x99, 0xc7, 0x25, 0x7b,
-        0x3a, 0x64, 0x86, 0xd8, 0x5b, 0x05, 0xe7, 0xb9,
-        0x8c, 0xd2, 0x30, 0x6e, 0xed, 0xb3, 0x51, 0x0f,
-        0x4e, 0x10, 0xf2, 0xac, 0x2f, 0x71, 0x93, 0xcd,
-        0x11, 0x4f, 0xad, 0xf3, 0x70, 0x2e, 0xcc, 0x92,
-        0xd3, 0x8d, 0x6f, 0x31, 0xb2, 0xec, 0x0e, 0x50,
-        0xaf, 0xf1, 0x13, 0x4d, 0xce, 0x90, 0x72, 0x2c,
-        0x6d, 0x33, 0xd1, 0x8f, 0x0c, 0x52, 0xb0, 0xee,
-        0x32, 0x6c, 0x8e, 0xd0, 0x53, 0x0d, 0xef, 0xb1,
-        0xf0, 0xae, 0x4c, 0x12, 0x91, 0xcf, 0x2d, 0x73,
-        0xca, 0x94, 0x76, 0x28, 0xab, 0xf5, 0x17, 0x49,
-        0x08, 0x56, 0xb4, 0xea, 0x69, 0x37, 0xd5, 0x8b,
-        0x57, 0x09, 0xeb, 0xb5, 0x36, 0x68, 0x8a, 0xd4,
-        0x95, 0xcb, 0x29, 0x77, 0xf4, 0xaa, 0x48, 0x16,
-        0xe9, 0xb7, 0x55, 0x0b, 0x88, 0xd6, 0x34, 0x6a,
-        0x2b, 0x75, 0x97, 0xc9, 0x4a, 0x14, 0xf6, 0xa8,
-        0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7,
-        0xb6, 0xe8, 0x0a, 0x54, 0xd7, 0x89, 0x6b, 0x35,
-    };
-    size_t i;
-    for (i = 0; i < size; i++)
+        x0 = crc_fold(x0, k512, _mm_loadu_si128((const __m128i *)pdata));
+        x1 = crc_fold(x1, k512, _mm_loadu_si128((const __m128i *)(pdata + 16)));
+        x2 = crc_fold(x2, k512, _mm_loadu_si128((const __m128i *)(pdata + 32)));
+        x3 = crc_fold(x3, k512, _mm_loadu_si128((const __m128i *)(pdata + 48)));
+        pdata += 64;
+        left -= 64;
+    }
+
+    x0 = crc_fold(x0, k128, x1);
+    x0 = crc_fold(x0, k128, x2);
+    x0 = crc_fold(x0, k128, x3);
+    while(left >= 16)
     {
-         crc = crc8_maxim_array[pdata[i] ^ crc];
+        x0 = crc_fold(x0, k128, _mm_loadu_si128((const __m128i *)pdata));
+        pdata += 16;
+        left -= 16;
     }
-    return crc;
+
+    _mm_storeu_si128((__m128i *)block, x0);
+    *size = left;
+}
+
+static uint8_t crc_clmul_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
 }
+#endif
+
+/**
+  * @brief  engine for the next call, resolving CRC_ENGINE_AUTO once
+  * @retval CRC_ENGINE_TABLE or CRC_ENGINE_CLMUL
+  */
+static uint8_t crc_engine_get(void)
+{
+    if(crc_active == CRC_ENGINE_AUTO)
+    {
+#if defined(CRC_HAVE_CLMUL)
+        crc_active = crc_clmul_supported() ? CRC_ENGINE_CLMUL : CRC_ENGINE_TABLE;
 #else
-uint8_t crc8_maxim_update(uint8_t crc, const uint8_t * data, size_t size)
+        crc_active = CRC_ENGINE_TABLE;
+#endif
+    }
+
+    return crc_active;
+}
+
+/**
+  * @brief  run a reflected CRC of any supported width on the active engine
+  * @param  slice [I] - table engine of the polynomial
+  * @param  fold [I] - folding constants of the polynomial
+  * @param  crc [I] - register
+  * @param  pdata [I] - points to data block
+  * @param  size [I] - size of the data block
+  * @retval updated register
+  */
+static uint32_t crc_run(uint32_t (*slice)(uint32_t, const uint8_t *, size_t), const crc_fold_t *fold,
+                        uint32_t crc, const uint8_t *pdata, size_t size)
 {
-    size_t i;
-    uint8_t inbyte, j, mix;
-    for(i = 0; i < size; i++)
+#if defined(CRC_HAVE_CLMUL)
+    uint8_t block[16];
+    size_t tail;
+
+    if(size >= CRC_CLMUL_MIN && crc_engine_get() == CRC_ENGINE_CLMUL)
     {
-        inbyte = data[i];
-        for (j = 0; j < 8; j++)
-        {
-            mix = (crc ^ inbyte) & 0x01;
-            crc >>= 1;
-            if (mix) crc ^= 0x8C;
-            inbyte >>= 1;
-        }
+        tail = size;
+        crc_clmul_fold(fold, crc, pdata, &tail, block);
+        crc = slice(0, block, sizeof(block));
+        return slice(crc, pdata + size - tail, tail);
     }
-    return crc;
+#endif
+
+    return slice(crc, pdata, size);
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+uint8_t crc8_maxim_update(uint8_t crc, const uint8_t * pdata, size_t size)
+{
+    return (uint8_t)crc_run(crc8_slice, &crc8_fold, crc, pdata, size);
 }
-#endif //defined (CRC8_MAXIM_ALGO_SEL)
 
 uint8_t crc8_maxim(const uint8_t * pdata, size_t size)
 {
     return crc8_maxim_update(0x00, pdata, size);
 }
 
+uint16_t crc16_modbus_update(uint16_t crc, const uint8_t * pdata, size_t size)
+{
+    return (uint16_t)crc_run(crc16_slice, &crc16_fold, crc, pdata, size);
+}
+
+uint16_t crc16_modbus(const uint8_t * pdata, size_t size)
+{
+    return crc16_modbus_update(0xFFFF, pdata, size);
+}
+
+uint32_t crc32_ieee_update(uint32_t crc, const uint8_t * pdata, size_t size)
+{
+    return ~crc_run(crc32_slice, &crc32_fold, ~crc, pdata, size);
+}
+
+uint32_t crc32_ieee(const uint8_t * pdata, size_t size)
+{
+    return crc32_ieee_update(0x00000000, pdata, size);
+}
+
+int32_t crc_set_engine(uint8_t engine)
+{
+    switch(engine)
+    {
+        case CRC_ENGINE_AUTO:
+        case CRC_ENGINE_TABLE:
+            crc_active = engine;
+            return 0;
+
+        case CRC_ENGINE_CLMUL:
+#if defined(CRC_HAVE_CLMUL)
+            if(crc_clmul_supported())
+            {
+                crc_active = engine;
+                return 0;
+            }
+#endif
+            return -1;
+
+        default:
+            return -1;
+    }
+}
+
+uint8_t crc_engine(void)
+{
+    return crc_engine_get();
+}
+
 /******************************** END OF FILE *********************************/
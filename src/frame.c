@@ -0,0 +1,318 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Incremental parser for packets sent by the device and
+ *                   transmit arena for the packets sent to it.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "inc/crc.h"
+#include "inc/packet.h"
+#include "inc/frame.h"
+/* Private define ------------------------------------------------------------*/
+#define FRAME_RING_MASK                     (FRAME_RING_SIZE - 1)
+
+/* Parser states */
+#define FRAME_ST_HEADER                     0
+#define FRAME_ST_PAYLOAD                    1
+#define FRAME_ST_CRC                        2
+/* Private typedef -----------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+static void frame_rx_restart(frame_rx_t *rx)
+{
+    rx->pos = rx->tail;
+    rx->state = FRAME_ST_HEADER;
+    rx->ext = 0;
+}
+
+/**
+  * @brief  header size of the candidate frame, basic until TYPE_EXT is seen
+  */
+static uint32_t frame_rx_hdr_size(const frame_rx_t *rx)
+{
+    return rx->ext ? PKT_EXT_HDR_SIZE : sizeof(packet_header_t);
+}
+
+static uint32_t frame_rx_crc_size(const frame_rx_t *rx)
+{
+    return rx->ext ? PKT_EXT_CRC_SIZE : 1;
+}
+
+/**
+  * @brief  take over a complete header
+  * @param  rx [I] - parser
+  * @retval 0 = success, -1 = not a valid header
+  */
+static int32_t frame_rx_header(frame_rx_t *rx)
+{
+    uint16_t length = rx->hdr[3];
+
+    if(rx->ext)
+    {
+        if(crc8_maxim(rx->hdr, PKT_EXT_HDR_SIZE - 1) != rx->hdr[PKT_EXT_HDR_SIZE - 1])
+        {
+            rx->crc_errors++;
+            return -1;
+        }
+        length = GET_BE16(&rx->hdr[3]);
+        if(length > PKT_EXT_PLD_SIZE)
+            return -1;
+    }
+
+    rx->pkt.header.dev_addr = rx->hdr[0];
+    rx->pkt.header.type = rx->hdr[1] & ~TYPE_EXT;
+    rx->pkt.header.reg_addr = rx->hdr[2];
+    rx->pkt.header.length = rx->ext ? 0 : rx->hdr[3];
+    rx->pkt.length = length;
+
+    return 0;
+}
+
+/**
+  * @brief  check the CRC of a complete frame
+  * @param  rx [I] - parser
+  * @retval 0 = frame is intact, -1 = otherwise
+  */
+static int32_t frame_rx_check(const frame_rx_t *rx)
+{
+    uint32_t crc;
+
+    if(rx->ext)
+    {
+        crc = crc32_ieee(rx->hdr, PKT_EXT_HDR_SIZE);
+        crc = crc32_ieee_update(crc, rx->pkt.payload, rx->pkt.length);
+        return crc == GET_BE32(rx->crc) ? 0 : -1;
+    }
+
+    crc = crc8_maxim(rx->hdr, sizeof(packet_header_t));
+    crc = crc8_maxim_update((uint8_t)crc, rx->pkt.payload, rx->pkt.length);
+
+    return crc == rx->crc[0] ? 0 : -1;
+}
+
+/**
+  * @brief  give up the candidate frame and retry one byte further
+  * @param  rx [I] - parser
+  * @retval none
+  */
+static void frame_rx_resync(frame_rx_t *rx)
+{
+    rx->tail++;
+    rx->resyncs++;
+    frame_rx_restart(rx);
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+void frame_rx_init(frame_rx_t *rx)
+{
+    rx->head = 0;
+    rx->tail = 0;
+    rx->resyncs = 0;
+    rx->crc_errors = 0;
+    frame_rx_restart(rx);
+}
+
+uint8_t *frame_rx_space(frame_rx_t *rx, size_t *size)
+{
+    uint32_t used = rx->head - rx->tail;
+    uint32_t off = rx->head & FRAME_RING_MASK;
+    uint32_t room = FRAME_RING_SIZE - used;
+
+    /* the space must not wrap around the end of the ring */
+    *size = room < FRAME_RING_SIZE - off ? room : FRAME_RING_SIZE - off;
+
+    return &rx->ring[off];
+}
+
+void frame_rx_commit(frame_rx_t *rx, size_t size)
+{
+    rx->head += (uint32_t)size;
+}
+
+size_t frame_rx_needed(const frame_rx_t *rx)
+{
+    size_t need;
+
+    switch(rx->state)
+    {
+        case FRAME_ST_HEADER:
+            need = frame_rx_hdr_size(rx) - (rx->pos - rx->tail) + frame_rx_crc_size(rx);
+            break;
+        case FRAME_ST_PAYLOAD:
+            need = (size_t)rx->need + frame_rx_crc_size(rx);
+            break;
+        default:
+            need = rx->need;
+            break;
+    }
+
+    /* bytes not examined yet count towards the frame */
+    if(need > rx->head - rx->pos)
+        return need - (rx->head - rx->pos);
+
+    return 1;
+}
+
+int32_t frame_rx_parse(frame_rx_t *rx)
+{
+    uint32_t off;
+    uint8_t b, type;
+
+    while(rx->pos != rx->head)
+    {
+        b = rx->ring[rx->pos & FRAME_RING_MASK];
+        off = rx->pos - rx->tail;
+        rx->pos++;
+
+        switch(rx->state)
+        {
+            case FRAME_ST_HEADER:
+                /* device replies are SET packets or status codes */
+                type = b & ~TYPE_EXT;
+                if((off == 1 && type != TYPE_SET && (type < TYPE_SUCCESS || type > TYPE_FAILURE_ERR_PARAM)) ||
+                   (off == 3 && !rx->ext && b > PKT_PLD_SIZE))
+                {
+                    frame_rx_resync(rx);
+                    break;
+                }
+                if(off == 1)
+                    rx->ext = (b & TYPE_EXT) != 0;
+                rx->hdr[off] = b;
+                if(off < frame_rx_hdr_size(rx) - 1)
+                    break;
+                if(frame_rx_header(rx))
+                {
+                    frame_rx_resync(rx);
+                    break;
+                }
+                rx->need = rx->pkt.length;
+                rx->state = rx->need ? FRAME_ST_PAYLOAD : FRAME_ST_CRC;
+                if(rx->state == FRAME_ST_CRC)
+                    rx->need = (uint16_t)frame_rx_crc_size(rx);
+                break;
+
+            case FRAME_ST_PAYLOAD:
+                rx->pkt.payload[rx->pkt.length - rx->need] = b;
+                if(--rx->need == 0)
+                {
+                    rx->state = FRAME_ST_CRC;
+                    rx->need = (uint16_t)frame_rx_crc_size(rx);
+                }
+                break;
+
+            default:
+                rx->crc[frame_rx_crc_size(rx) - rx->need] = b;
+                if(--rx->need)
+                    break;
+                if(frame_rx_check(rx))
+                {
+                    rx->crc_errors++;
+                    frame_rx_resync(rx);
+                    break;
+                }
+                /* the frame is consumed, the next one starts right after it */
+                rx->tail = rx->pos;
+                frame_rx_restart(rx);
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+void frame_tx_init(frame_tx_t *tx)
+{
+    tx->frames = 0;
+    tx->iovs = 0;
+}
+
+int32_t frame_tx_add(frame_tx_t *tx, uint8_t dev_addr, uint8_t type, uint8_t reg_addr, uint16_t length,
+                     const uint8_t *head, uint8_t head_size, const uint8_t *body)
+{
+    uint8_t *slot, *crc;
+    uint32_t hdr_size, crc_size, crc32;
+    uint16_t body_size = 0;
+    uint8_t crc8;
+
+    if(tx->frames == FRAME_TX_FRAMES || length > PKT_EXT_PLD_SIZE || head_size > FRAME_TX_HEAD_MAX)
+        return -1;
+
+    slot = tx->arena[tx->frames];
+    slot[0] = dev_addr;
+    slot[1] = type;
+    slot[2] = reg_addr;
+    if(length > PKT_PLD_SIZE)
+    {
+        slot[1] |= TYPE_EXT;
+        PUT_BE16(&slot[3], length);
+        slot[5] = crc8_maxim(slot, PKT_EXT_HDR_SIZE - 1);
+        hdr_size = PKT_EXT_HDR_SIZE;
+        crc_size = PKT_EXT_CRC_SIZE;
+    }
+    else
+    {
+        slot[3] = (uint8_t)length;
+        hdr_size = sizeof(packet_header_t);
+        crc_size = 1;
+    }
+
+    /* the head goes right behind the header, they leave in one segment */
+    if(type != TYPE_SET)
+        head_size = 0;
+    else if(head_size > length)
+        return -1;
+    else
+        body_size = length - head_size;
+    if(head_size)
+        memcpy(&slot[hdr_size], head, head_size);
+    crc = &slot[hdr_size + head_size];
+
+    if(crc_size == 1)
+    {
+        crc8 = crc8_maxim(slot, hdr_size + head_size);
+        crc[0] = crc8_maxim_update(crc8, body, body_size);
+    }
+    else
+    {
+        crc32 = crc32_ieee(slot, hdr_size + head_size);
+        crc32 = crc32_ieee_update(crc32, body, body_size);
+        PUT_BE32(crc, crc32);
+    }
+
+    /* without a body the CRC follows the head in the same segment */
+    if(body_size == 0)
+    {
+        tx->iov[tx->iovs].base = slot;
+        tx->iov[tx->iovs].size = hdr_size + head_size + crc_size;
+        tx->iovs++;
+    }
+    else
+    {
+        tx->iov[tx->iovs].base = slot;
+        tx->iov[tx->iovs].size = hdr_size + head_size;
+        tx->iov[tx->iovs + 1].base = body;
+        tx->iov[tx->iovs + 1].size = body_size;
+        tx->iov[tx->iovs + 2].base = crc;
+        tx->iov[tx->iovs + 2].size = crc_size;
+        tx->iovs += FRAME_TX_IOVS;
+    }
+    tx->frames++;
+
+    return 0;
+}
+
+/******************************** END OF FILE *********************************/
@@ -20,110 +20,180 @@
 #include <stddef.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <time.h>
+#include <glob.h>
+#include <unistd.h>
+#endif
 #include "inc/serial.h"
+#include "inc/packet.h"
+#include "inc/isp.h"
+#include "inc/cache.h"
+#include "inc/image.h"
 #include "inc/crc.h"
+#include "inc/stats.h"
 /* Private define ------------------------------------------------------------*/
-#define DEVICE_ADDR                         0xAA
-
-/* Maximum number of bytes in payload of a packet */
-#define PKT_PLD_SIZE                        128
-/* Packet type enum */
-#define TYPE_SET                            0x01
-#define TYPE_GET                            0x02
-#define TYPE_SUCCESS                        0x80
-#define TYPE_FAILURE_UNKNOWN_REG            (0x80|0x00)
-#define TYPE_FAILURE_ERR_LENGTH             (0x80|0x01)
-#define TYPE_FAILURE_NOT_SUPPORT            (0x80|0x02)
-#define TYPE_FAILURE_ERR_PASSWD             (0x80|0x03)
-#define TYPE_FAILURE_ERR_SIGNATURE          (0x80|0x04)
-#define TYPE_FAILURE_ERR_HAL                (0x80|0x05)
-#define TYPE_FAILURE_ERR_PARAM              (0x80|0x06)
+/* Frames kept in flight by load unless --window says otherwise */
+#define ISP_WINDOW_DEFAULT                  8
+/* Fastest line rate tried after connecting unless --max-baudrate says otherwise */
+#define FSISP_MAX_BAUDRATE                  3000000
+
+/* Commands */
+#define FSISP_CMD_CONNECT                   0
+#define FSISP_CMD_ERASE                     1
+#define FSISP_CMD_LOAD                      2
+#define FSISP_CMD_SAVE                      3
+#define FSISP_CMD_VERIFY                    4
+#define FSISP_CMD_SHELL                     5
+
+/* Longest command line of the shell and of a script, and its words */
+#define FSISP_LINE_MAX                      1024
+#define FSISP_ARGS_MAX                      32
+
+/* Size of each of the two buffers between save and its file writer */
+#define FSISP_SAVE_BLOCK                    16384
+
+/* Threads a gang runs its ports on, further ports wait for one to be free */
+#define FSISP_GANG_WORKERS                  32
+
+/* Bytes load programs between two updates of its journal, at least */
+#define FSISP_JOURNAL_BLOCK                 16384
 /* Private typedef -----------------------------------------------------------*/
 typedef struct fsisp_opt_s {
     int version;
     int help;
     char *port;
     char *baudrate;
+    char *gang;
+    char *max_baudrate;
+    char *script;
+    char *frame_size;
+    char *stats;
+    char *trace;
+    char *connect_timeout;
+    char *bus;
 } fsisp_opt_t;
 
-/**
- * First 4-byte header format of a packet.
- */
-typedef struct packet_header_s {
-    /* device address, ranging from 0x01 ~ 0xFF, 0x00 is for broadcasting */
-    uint8_t dev_addr;
-    /* packet type */
-    uint8_t type;
-    /* register address */
-    uint8_t reg_addr;
-    /** 
-     * number of bytes in payload of a SET type packet, or
-     * number of bytes to read of a GET type packet
-     */
-    uint8_t length;
-} packet_header_t;
-
-/**
- * Full packet format.
- */
-typedef struct packet_s {
-    /* packet header */
-    packet_header_t header;
-    /* packet payload */
-    uint8_t payload[PKT_PLD_SIZE];
-} packet_t;
-
-typedef struct dev_attr_mcu_s {
-    char part_number[128];
-    char uuid[128];
-} dev_attr_mcu_t;
-
-typedef struct dev_attr_bldr_s {
-    uint8_t major_ver;
-    uint8_t minor_ver;
-    uint16_t build_ver;
-    uint32_t addr;
-    uint32_t size;
-} dev_attr_bldr_t;
+typedef struct fsisp_cmd_s {
+    /* FSISP_CMD_* */
+    uint8_t id;
+    /* ERASE_* area for erase, ISP_AREA_* for load */
+    uint8_t area;
+    /* frames in flight for load */
+    uint8_t window;
+    /* load rewrites only changed pages */
+    uint8_t diff;
+    /* diff ignores the local copy of the device and asks it for page CRCs */
+    uint8_t no_cache;
+    /* load sends LZ packed frames where the device can unpack them */
+    uint8_t compress;
+    /* load checks the area afterwards */
+    uint8_t verify;
+    /* load erases the whole area first instead of the pages it programs */
+    uint8_t erase_all;
+    /* load ignores the journal of an interrupted load of the same image */
+    uint8_t no_resume;
+    /* image for load, mapped once and shared by every port */
+    image_t image;
+    /* output file for save */
+    const char *path;
+} fsisp_cmd_t;
 
-typedef struct dev_attr_s {
-    dev_attr_mcu_t mcu;
-    dev_attr_bldr_t bldr;
-} dev_attr_t;
-/* Private macro -------------------------------------------------------------*/
-/**
- * break a 32-bit value into bytes
- */
-#define BREAK_UINT32(var, ByteNum) \
-          (uint8_t)((uint32_t)(((var) >>((ByteNum) * 8)) & 0x00FF))
+typedef struct fsisp_writer_s {
+    FILE *fp;
+    /* one buffer fills while the writer thread drains the other */
+    uint8_t *buf[2];
+    uint8_t cur;
+    uint32_t fill;
+    /* bytes taken by writer_sink() so far, the file is written in order */
+    uint32_t total;
+    /* handed to the writer thread, pending = 0 once written */
+    const uint8_t *wbuf;
+    uint32_t pending;
+    int quit;
+    int err;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} fsisp_writer_t;
 
-/**
- * build a 32-bit value from bytes
- */
-#define BUILD_UINT32(Byte0, Byte1, Byte2, Byte3) \
-          ((uint32_t)((uint32_t)((Byte0) & 0x00FF) \
-          + ((uint32_t)((Byte1) & 0x00FF) << 8) \
-          + ((uint32_t)((Byte2) & 0x00FF) << 16) \
-          + ((uint32_t)((Byte3) & 0x00FF) << 24)))
+typedef struct fsisp_journal_s {
+    /* key of the journal */
+    const char *uuid;
+    const char *area;
+    uint32_t hash;
+    uint32_t page;
+    /* chunk being programmed: its address and offset in the plan */
+    uint32_t addr;
+    uint32_t pos;
+    /* bytes of the plan the journal holds as programmed */
+    uint32_t stored;
+} fsisp_journal_t;
 
-/**
- * build a 16-bit value from bytes
- */
-#define BUILD_UINT16(loByte, hiByte) \
-          ((uint16_t)(((loByte) & 0x00FF) + (((hiByte) & 0x00FF) << 8)))
+typedef struct fsisp_job_s {
+    /* inputs */
+    const char *port;
+    const com_param_t *param;
+    uint32_t max_baudrate;
+    uint16_t frame_limit;
+    /* how long after the job started the device may take to answer, ms */
+    uint32_t connect_ms;
+    const fsisp_cmd_t *cmd;
+    /* keep statistics, with a timeline of every transaction */
+    uint8_t report;
+    uint8_t trace;
+    /* state of the port, started once a worker took it */
+    uint8_t started;
+    isp_session_t sess;
+    stats_t stats;
+    /* outcome: result, step reached, elapsed time, line rate used */
+    int32_t result;
+    const char *stage;
+    uint64_t ms;
+    uint32_t baudrate;
+} fsisp_job_t;
 
-/**
- * break a 16-bit value into bytes
- */
-#define HI_UINT16(a) (((a) >> 8) & 0xFF)
-#define LO_UINT16(a) ((a) & 0xFF)
+typedef struct fsisp_gang_s {
+    /* jobs of every port, the workers take them in turn from next */
+    fsisp_job_t *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} fsisp_gang_t;
 
-/**
- * bitmask value of one bit
- */
-#define BIT(n)      (1<<n)
+typedef struct fsisp_node_s {
+    /* one device on a shared line, named "port@addr" in the reports */
+    uint8_t addr;
+    isp_session_t sess;
+    stats_t stats;
+    char name[128];
+    /* answered the scan and takes part in the broadcast */
+    uint8_t present;
+    /* outcome: result, step reached, pages rewritten to it */
+    int32_t result;
+    const char *stage;
+    isp_diff_t diff;
+} fsisp_node_t;
+/* Private macro -------------------------------------------------------------*/
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 /* Private function prototypes -----------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
+/* Synopsis of every command, each line starts with its name */
+static const char *const fsisp_usage[] = {
+    "connect    handshake again and show the device",
+    "erase      --chip[-c] | --aprom[-a] | --eeprom[-e]",
+    "load       --aprom[-a] <file> | --eeprom[-e] <file> [--window[-w] <n>] [--diff[-d]]\r\n"
+    "           [--no-cache] [--compress[-z]] [--verify[-V]] [--erase-all] [--no-resume]",
+    "verify     --aprom[-a] <file> | --eeprom[-e] <file> [--window[-w] <n>]",
+    "save       --aprom[-a] <file> | --eeprom[-e] <file> [--window[-w] <n>]",
+    "shell      read commands from the terminal, the port stays open",
+    "help       [<command>]",
+    "quit",
+};
 /* Private functions ---------------------------------------------------------*/
 int parse_options(int argc, char **argv, fsisp_opt_t *opt)
 {
@@ -133,6 +203,14 @@ int parse_options(int argc, char **argv, fsisp_opt_t *opt)
         {"help",        no_argument,        NULL,   'h'},
         {"port",        required_argument,  NULL,   'p'},
         {"baudrate",    required_argument,  NULL,   'b'},
+        {"gang",        required_argument,  NULL,   'g'},
+        {"max-baudrate",required_argument,  NULL,   'B'},
+        {"script",      required_argument,  NULL,   's'},
+        {"frame-size",  required_argument,  NULL,   'F'},
+        {"stats",       required_argument,  NULL,   'S'},
+        {"trace",       required_argument,  NULL,   'T'},
+        {"connect-timeout",required_argument,NULL,  'C'},
+        {"bus",         required_argument,  NULL,   'A'},
         {0,             0,                  0,       0 },
     };
 
@@ -141,6 +219,14 @@ int parse_options(int argc, char **argv, fsisp_opt_t *opt)
         NULL,
         &opt->port,
         &opt->baudrate,
+        &opt->gang,
+        &opt->max_baudrate,
+        &opt->script,
+        &opt->frame_size,
+        &opt->stats,
+        &opt->trace,
+        &opt->connect_timeout,
+        &opt->bus,
     };
 #if 0
     for(int i = 0; i < argc; i++)
@@ -155,7 +241,8 @@ int parse_options(int argc, char **argv, fsisp_opt_t *opt)
     while(1)
     {
         prev_optind = optind;
-        c = getopt_long(argc, argv, "vhp:b:", opts, &option_index);
+        /* stop at the first non-option, it starts a command */
+        c = getopt_long(argc, argv, "+vhp:b:g:B:s:F:S:T:C:A:", opts, &option_index);
         if(c == -1) break;
         else if(c == 0)
         {
@@ -180,6 +267,30 @@ int parse_options(int argc, char **argv, fsisp_opt_t *opt)
                 case 'b':
                     opt->baudrate = optarg;
                     break;
+                case 'g':
+                    opt->gang = optarg;
+                    break;
+                case 'B':
+                    opt->max_baudrate = optarg;
+                    break;
+                case 's':
+                    opt->script = optarg;
+                    break;
+                case 'F':
+                    opt->frame_size = optarg;
+                    break;
+                case 'S':
+                    opt->stats = optarg;
+                    break;
+                case 'T':
+                    opt->trace = optarg;
+                    break;
+                case 'C':
+                    opt->connect_timeout = optarg;
+                    break;
+                case 'A':
+                    opt->bus = optarg;
+                    break;
                 case '?':
                     return -1;
                 default:
@@ -192,167 +303,1809 @@ int parse_options(int argc, char **argv, fsisp_opt_t *opt)
 }
 
 /**
-  * @brief  send a packet to host side
-  * @param  hdl [I] - serial port handle
-  * @param  type [I] - packet type
-  * @param  reg_addr [I] - register address
-  * @param  length [I] - number of bytes in payload
-  * @param  payload [I] - points to the payload data
-  * @retval 0 = success, -1 = failure
+  * @brief  monotonic clock
+  * @retval milliseconds
+  */
+static uint64_t fsisp_now_ms(void)
+{
+#if defined(_WIN32)
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+/**
+  * @brief  note the step a port has reached, for the error report and the timeline
+  * @param  st [I] - statistics, NULL if not kept
+  * @param  stage [O] - step reached
+  * @param  name [I] - step name, a static string
+  * @retval none
+  */
+static void enter_stage(stats_t *st, const char **stage, const char *name)
+{
+    *stage = name;
+    stats_phase(st, name);
+}
+
+/**
+  * @brief  close the timeline of a port and keep its outcome for the reports
+  * @param  st [I/O] - statistics
+  * @param  sess [I] - session, NULL if the port never opened
+  * @param  result [I] - outcome
+  * @param  stage [I] - step reached
+  * @retval none
+  */
+static void finish_stats(stats_t *st, const isp_session_t *sess, int32_t result, const char *stage)
+{
+    stats_stop(st);
+    st->result = result;
+    st->stage = stage;
+    if(sess)
+    {
+        st->srtt_us = sess->rtt.srtt_us;
+        st->rttvar_us = sess->rtt.rttvar_us;
+        st->frame_srtt_us = sess->frame_rtt.srtt_us;
+    }
+}
+
+/**
+  * @brief  write the --stats summary and the --trace timeline
+  * @param  opt [I] - options naming the files
+  * @param  st [I] - statistics of each port
+  * @param  count [I] - number of ports
+  * @retval 0 = success, -1 = a report could not be written
   */
-int32_t send_packet(com_handle_t hdl, uint8_t dev_addr, uint8_t type, uint8_t reg_addr, uint8_t length, const uint8_t *payload)
+static int write_reports(const fsisp_opt_t *opt, stats_t *const *st, uint32_t count)
 {
-    uint8_t crc;
-    packet_header_t pkt_header;
-    if(length > PKT_PLD_SIZE) return -1;
+    int err = 0;
+
+    if(opt->stats && stats_write_summary(opt->stats, st, count))
+    {
+        printf("Writing \"%s\"...failed\r\n", opt->stats);
+        err = -1;
+    }
+    if(opt->trace && stats_write_trace(opt->trace, st, count))
+    {
+        printf("Writing \"%s\"...failed\r\n", opt->trace);
+        err = -1;
+    }
 
-    pkt_header.dev_addr = dev_addr;
-    pkt_header.type = type;
-    pkt_header.reg_addr = reg_addr;
-    pkt_header.length = length;
+    return err;
+}
 
-    crc = crc8_maxim((uint8_t *)&pkt_header, sizeof(pkt_header));
-    if(type == TYPE_SET && length > 0)
-        crc = crc8_maxim_update(crc, payload, length);
+/**
+  * @brief  parse erase --chip[-c] | --aprom[-a] | --eeprom[-e]
+  * @param  argc [I] - number of command arguments, including its name
+  * @param  argv [I] - command arguments
+  * @param  cmd [O] - parsed command
+  * @retval 0 = success, -1 = failure
+  */
+static int parse_erase(int argc, char **argv, fsisp_cmd_t *cmd)
+{
+    int c, option_index;
+    int area = -1;
+    static const struct option opts[] = {
+        {"chip",        no_argument,        NULL,   'c'},
+        {"aprom",       no_argument,        NULL,   'a'},
+        {"eeprom",      no_argument,        NULL,   'e'},
+        {0,             0,                  0,       0 },
+    };
 
-    com_send(hdl, (uint8_t *)&pkt_header, sizeof(pkt_header));
-    if(length > 0)
-        com_send(hdl, (uint8_t *)payload, length);
-    com_send(hdl, (uint8_t *)&crc, 1);
+    optind = 1;
+    while((c = getopt_long(argc, argv, "cae", opts, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'c': area = ERASE_CHIP; break;
+            case 'a': area = ERASE_APROM; break;
+            case 'e': area = ERASE_EEPROM; break;
+            default: return -1;
+        }
+    }
+    if(area < 0)
+    {
+        printf("erase: one of --chip, --aprom or --eeprom is required\r\n");
+        return -1;
+    }
+    cmd->area = (uint8_t)area;
 
     return 0;
 }
 
-int32_t read_reg(com_handle_t hdl, uint8_t dev_addr, uint8_t reg_addr, uint8_t *pdata, uint8_t size, uint8_t *length, uint32_t timeout)
+/**
+  * @brief  parse load --aprom[-a] <file> | --eeprom[-e] <file> [--window[-w] <n>]
+  *         [--diff[-d]] [--no-cache] [--compress[-z]] [--verify[-V]]
+  *         [--erase-all] and read the image; verify takes the same options
+  * @param  argc [I] - number of command arguments, including its name
+  * @param  argv [I] - command arguments
+  * @param  cmd [O] - parsed command
+  * @retval 0 = success, -1 = failure
+  */
+static int parse_load(int argc, char **argv, fsisp_cmd_t *cmd)
 {
-    uint8_t rxbuf[256];
-    size_t rxlen;
-    packet_t *pkt = (packet_t *)rxbuf;
+    int c, option_index;
+    int area = -1, window = ISP_WINDOW_DEFAULT;
+    const char *path = NULL;
+    static const struct option opts[] = {
+        {"aprom",       required_argument,  NULL,   'a'},
+        {"eeprom",      required_argument,  NULL,   'e'},
+        {"window",      required_argument,  NULL,   'w'},
+        {"diff",        no_argument,        NULL,   'd'},
+        {"no-cache",    no_argument,        NULL,   'N'},
+        {"compress",    no_argument,        NULL,   'z'},
+        {"verify",      no_argument,        NULL,   'V'},
+        {"erase-all",   no_argument,        NULL,   'E'},
+        {"no-resume",   no_argument,        NULL,   'R'},
+        {0,             0,                  0,       0 },
+    };
 
-    if(send_packet(hdl, dev_addr, TYPE_GET, reg_addr, size, NULL))
+    optind = 1;
+    while((c = getopt_long(argc, argv, "a:e:w:dzV", opts, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'a': area = ISP_AREA_APROM; path = optarg; break;
+            case 'e': area = ISP_AREA_EEPROM; path = optarg; break;
+            case 'w': window = atoi(optarg); break;
+            case 'd': cmd->diff = 1; break;
+            case 'N': cmd->no_cache = 1; break;
+            case 'z': cmd->compress = 1; break;
+            case 'V': cmd->verify = 1; break;
+            case 'E': cmd->erase_all = 1; break;
+            case 'R': cmd->no_resume = 1; break;
+            default: return -1;
+        }
+    }
+    if(area < 0)
+    {
+        printf("%s: --aprom <file> or --eeprom <file> is required\r\n", argv[0]);
         return -1;
-    if(com_recv(hdl, rxbuf, sizeof(rxbuf), &rxlen, timeout))
+    }
+    if(window < 1 || window > 255)
+    {
+        printf("%s: --window must be 1..255\r\n", argv[0]);
         return -1;
+    }
+    cmd->area = (uint8_t)area;
+    cmd->window = (uint8_t)window;
 
-    if(rxlen <= sizeof(packet_header_t) || rxbuf[rxlen-1] != crc8_maxim(rxbuf, rxlen-1))
+    if(image_open(&cmd->image, path))
+    {
+        printf("Reading \"%s\"...failed\r\n", path);
         return -1;
+    }
 
-    if(pkt->header.dev_addr != dev_addr ||
-       pkt->header.type != TYPE_SET     ||
-       pkt->header.reg_addr != reg_addr ||
-       pkt->header.length > size)
-        return -1;
+    return 0;
+}
+
+/**
+  * @brief  parse save --aprom[-a] <file> | --eeprom[-e] <file> [--window[-w] <n>]
+  * @param  argc [I] - number of command arguments, including its name
+  * @param  argv [I] - command arguments
+  * @param  cmd [O] - parsed command
+  * @retval 0 = success, -1 = failure
+  */
+static int parse_save(int argc, char **argv, fsisp_cmd_t *cmd)
+{
+    int c, option_index;
+    int area = -1, window = ISP_WINDOW_DEFAULT;
+    static const struct option opts[] = {
+        {"aprom",       required_argument,  NULL,   'a'},
+        {"eeprom",      required_argument,  NULL,   'e'},
+        {"window",      required_argument,  NULL,   'w'},
+        {0,             0,                  0,       0 },
+    };
 
-    if(length) *length = pkt->header.length;
-    memcpy(pdata, pkt->payload, pkt->header.length);
+    optind = 1;
+    while((c = getopt_long(argc, argv, "a:e:w:", opts, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'a': area = ISP_AREA_APROM; cmd->path = optarg; break;
+            case 'e': area = ISP_AREA_EEPROM; cmd->path = optarg; break;
+            case 'w': window = atoi(optarg); break;
+            default: return -1;
+        }
+    }
+    if(area < 0)
+    {
+        printf("save: --aprom <file> or --eeprom <file> is required\r\n");
+        return -1;
+    }
+    if(window < 1 || window > 255)
+    {
+        printf("save: --window must be 1..255\r\n");
+        return -1;
+    }
+    cmd->area = (uint8_t)area;
+    cmd->window = (uint8_t)window;
 
     return 0;
 }
 
-int32_t get_dev_attr(com_handle_t hdl, dev_attr_t *attr)
+/**
+  * @brief  parse a command once, before any device is touched
+  * @param  argc [I] - number of command arguments, including its name
+  * @param  argv [I] - command arguments
+  * @param  cmd [O] - parsed command
+  * @retval 0 = success, -1 = failure
+  */
+static int parse_command(int argc, char **argv, fsisp_cmd_t *cmd)
 {
-    uint8_t payload[128];
-    uint8_t len;
+    memset(cmd, 0x00, sizeof(fsisp_cmd_t));
 
-    /* MCU part number */
-    if(read_reg(hdl, DEVICE_ADDR, 0x00, attr->mcu.part_number, sizeof(attr->mcu.part_number), &len, 100))
-        return -1;
+    if(argc == 0 || strcmp(argv[0], "connect") == 0)
+    {
+        cmd->id = FSISP_CMD_CONNECT;
+        return 0;
+    }
+    if(strcmp(argv[0], "erase") == 0)
+    {
+        cmd->id = FSISP_CMD_ERASE;
+        return parse_erase(argc, argv, cmd);
+    }
+    if(strcmp(argv[0], "load") == 0)
+    {
+        cmd->id = FSISP_CMD_LOAD;
+        return parse_load(argc, argv, cmd);
+    }
+    if(strcmp(argv[0], "save") == 0)
+    {
+        cmd->id = FSISP_CMD_SAVE;
+        return parse_save(argc, argv, cmd);
+    }
+    if(strcmp(argv[0], "verify") == 0)
+    {
+        cmd->id = FSISP_CMD_VERIFY;
+        return parse_load(argc, argv, cmd);
+    }
+    if(strcmp(argv[0], "shell") == 0)
+    {
+        cmd->id = FSISP_CMD_SHELL;
+        return 0;
+    }
+
+    printf("Unknown command \"%s\"\r\n", argv[0]);
+    return -1;
+}
+
+static void *writer_thread(void *arg)
+{
+    fsisp_writer_t *w = (fsisp_writer_t *)arg;
+    const uint8_t *buf;
+    uint32_t n;
+
+    pthread_mutex_lock(&w->lock);
+    while(1)
+    {
+        while(w->pending == 0 && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(w->pending == 0)
+            break;
+        buf = w->wbuf;
+        n = w->pending;
+        pthread_mutex_unlock(&w->lock);
 
-    /* MCU UUID */
-    if(read_reg(hdl, DEVICE_ADDR, 0x01, attr->mcu.uuid, sizeof(attr->mcu.uuid), &len, 100))
+        n = fwrite(buf, 1, n, w->fp) == n;
+
+        pthread_mutex_lock(&w->lock);
+        if(!n)
+            w->err = -1;
+        w->pending = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/**
+  * @brief  give the filled buffer to the writer thread and switch to the other
+  * @param  w [I] - writer
+  * @retval 0 = success, -1 = an earlier write failed
+  */
+static int32_t writer_flush(fsisp_writer_t *w)
+{
+    int err;
+
+    pthread_mutex_lock(&w->lock);
+    while(w->pending)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if(w->fill)
+    {
+        w->wbuf = w->buf[w->cur];
+        w->pending = w->fill;
+        pthread_cond_broadcast(&w->cond);
+    }
+    err = w->err;
+    pthread_mutex_unlock(&w->lock);
+
+    w->cur ^= 1;
+    w->fill = 0;
+
+    return err;
+}
+
+/**
+  * @brief  isp_sink_t of save, copies into the current buffer
+  */
+static int32_t writer_sink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    fsisp_writer_t *w = (fsisp_writer_t *)ctx;
+    uint32_t len;
+
+    /* isp_read() delivers in address order, anything else would land in the wrong place */
+    if(offset != w->total)
         return -1;
+    w->total += size;
+
+    while(size)
+    {
+        len = MIN(size, FSISP_SAVE_BLOCK - w->fill);
+        memcpy(w->buf[w->cur] + w->fill, data, len);
+        w->fill += len;
+        data += len;
+        size -= len;
+        if(w->fill == FSISP_SAVE_BLOCK && writer_flush(w))
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  create the output file at its final size and start the writer
+  * @param  w [O] - writer
+  * @param  path [I] - file path
+  * @param  size [I] - number of bytes that will be written
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t writer_open(fsisp_writer_t *w, const char *path, uint32_t size)
+{
+    memset(w, 0x00, sizeof(fsisp_writer_t));
 
-    /* Bootloader version */
-    if(read_reg(hdl, DEVICE_ADDR, 0x02, payload, 4, &len, 100))
+    w->fp = fopen(path, "wb");
+    if(w->fp == NULL)
         return -1;
-    attr->bldr.major_ver = payload[0];
-    attr->bldr.minor_ver = payload[1];
-    attr->bldr.build_ver = BUILD_UINT16(payload[3], payload[2]);
+    /* reserve the space up front; pipes and devices stay plain streams */
+#if defined(_WIN32)
+    _chsize_s(_fileno(w->fp), size);
+#else
+    if(ftruncate(fileno(w->fp), (off_t)size) != 0)
+        clearerr(w->fp);
+#endif
 
-    /* Bootloader flash address */
-    if(read_reg(hdl, DEVICE_ADDR, 0x03, payload, 4, &len, 100))
+    w->buf[0] = (uint8_t *)malloc(FSISP_SAVE_BLOCK * 2);
+    if(w->buf[0] == NULL)
+    {
+        fclose(w->fp);
         return -1;
-    attr->bldr.addr = BUILD_UINT32(payload[3], payload[2], payload[1], payload[0]);
+    }
+    w->buf[1] = w->buf[0] + FSISP_SAVE_BLOCK;
 
-    /* Bootloader size */
-    if(read_reg(hdl, DEVICE_ADDR, 0x04, payload, 4, &len, 100))
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if(pthread_create(&w->thread, NULL, writer_thread, w))
+    {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w->buf[0]);
+        fclose(w->fp);
         return -1;
-    attr->bldr.size = BUILD_UINT32(payload[3], payload[2], payload[1], payload[0]);
+    }
 
     return 0;
 }
-/* Exported variables --------------------------------------------------------*/
-/* Exported functions --------------------------------------------------------*/
 
-int main(int argc, char **argv)
+/**
+  * @brief  write what is left, stop the writer and close the file
+  * @param  w [I] - writer
+  * @retval 0 = success, -1 = some write failed
+  */
+static int32_t writer_close(fsisp_writer_t *w)
 {
-    fsisp_opt_t fsisp_opt;
-    int32_t err;
-    int32_t baudrate;
-    /* buffer to receive uart data */
-    com_param_t com_param;
-    com_handle_t com_handle;
-    dev_attr_t dev_attr;
+    int32_t err = writer_flush(w);
 
-    if(err = parse_options(argc, argv, &fsisp_opt))
-        return err;
+    pthread_mutex_lock(&w->lock);
+    w->quit = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
 
-    if(fsisp_opt.version)
-        printf("Free Serial ISP command line tool v1.0.0.\r\n");
-        
-    if(fsisp_opt.help)
-        printf("This is help message.\r\n");
+    err |= w->err;
+    if(fclose(w->fp))
+        err = -1;
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->buf[0]);
 
-    com_param.baudrate = 115200;
-    com_param.bytesize = COM_BYTESZ_8;
-    com_param.parity = COM_PARITY_NONE;
-    com_param.stopbits = COM_STOPBITS_1;
+    return err ? -1 : 0;
+}
 
-    if(fsisp_opt.baudrate)
+/**
+  * @brief  check flash against expected content and report the outcome
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  data [I] - expected content
+  * @param  size [I] - number of bytes
+  * @param  window [I] - reads in flight if the range has to be read back
+  * @param  verbose [I] - print the outcome
+  * @retval 0 = flash matches, -1 = it differs or the check failed
+  */
+static int32_t verify_range(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size,
+                            uint8_t window, int verbose)
+{
+    isp_verify_t verify;
+    int32_t ret;
+
+    if(verbose) printf("Verifying %u bytes at 0x%.8x...", size, addr);
+    ret = isp_verify(sess, addr, data, size, window, &verify);
+    if(verbose)
     {
-        baudrate = atoi(fsisp_opt.baudrate);
-        if(baudrate > 0)
-            com_param.baudrate = (uint32_t)baudrate;
+        if(ret < 0)
+            printf("failed\r\n");
+        else if(ret)
+            printf("%u byte(s) differ, the first at 0x%.8x (read back %u bytes)\r\n",
+                   verify.mismatches, verify.first_bad, verify.read_back);
+        else if(verify.read_back)
+            printf("OK, read back %u bytes\r\n", verify.read_back);
+        else
+            printf("OK, %u device CRC request(s)\r\n", verify.queries);
     }
-    
-    printf("Openning serial port \"%s\", baudrate = %d...", fsisp_opt.port == NULL ? "<invalid>" : fsisp_opt.port, com_param.baudrate);
-    if(com_open(fsisp_opt.port, &com_param, &com_handle))
+
+    return ret ? -1 : 0;
+}
+
+/**
+  * @brief  key of the journal of a load: the content of the area after it,
+  *         the chunks it programs and whether it erases the area first
+  */
+static uint32_t journal_hash(const image_plan_t *plan, const uint8_t *image, uint32_t limit, uint8_t erase_all)
+{
+    uint8_t word[8];
+    uint32_t crc, i;
+
+    crc = crc32_ieee(image, limit);
+    for(i = 0; i < plan->count; i++)
     {
-        printf("failed");
-        return -1;
+        PUT_BE32(&word[0], plan->chunks[i].addr);
+        PUT_BE32(&word[4], plan->chunks[i].size);
+        crc = crc32_ieee_update(crc, word, sizeof(word));
     }
-    else
+
+    return crc32_ieee_update(crc, &erase_all, 1);
+}
+
+/**
+  * @brief  check that the device still holds what an interrupted load programmed
+  * @param  sess [I] - connected session
+  * @param  plan [I] - write plan of the image
+  * @param  done [I] - bytes of the plan the journal has as programmed
+  * @param  window [I] - reads in flight if the range has to be read back
+  * @retval 0 = it does, 1 = it does not, -1 = failure
+  * @note   One device CRC per chunk where the device can compute it.
+  */
+static int32_t check_journal(isp_session_t *sess, const image_plan_t *plan, uint32_t done, uint8_t window)
+{
+    isp_verify_t verify;
+    uint32_t i, len;
+    int32_t ret;
+
+    if(done > plan->bytes)
+        return 1;
+
+    for(i = 0; i < plan->count && done; i++)
     {
-        printf("OK");
+        len = MIN(done, plan->chunks[i].size);
+        ret = isp_verify(sess, plan->chunks[i].addr, plan->chunks[i].data, len, window, &verify);
+        if(ret)
+            return ret;
+        done -= len;
     }
-    printf("\r\n");
 
-    printf("Connecting to device...");
+    return 0;
+}
 
-    memset(&dev_attr, 0x00, sizeof(dev_attr));
-    while(get_dev_attr(com_handle, &dev_attr) != 0);
+/**
+  * @brief  journal a chunk as the device acknowledges it, see isp_progress_t
+  */
+static void journal_progress(void *ctx, uint32_t addr)
+{
+    fsisp_journal_t *jr = (fsisp_journal_t *)ctx;
+    /* only whole pages: a resume erasing ahead rewrites the page it starts on */
+    uint32_t done = jr->pos + (addr - jr->addr) / jr->page * jr->page;
 
-    printf("OK");
-    printf("\r\n");
-    printf("MCU part number: %s\r\n", dev_attr.mcu.part_number);
-    printf("MCU UUID: %s\r\n", dev_attr.mcu.uuid);
-    printf("Bootloader version: v%d.%d.%d\r\n", dev_attr.bldr.major_ver, dev_attr.bldr.minor_ver, dev_attr.bldr.build_ver);
-    printf("Bootloader flash adress: 0x%.8x\r\n", dev_attr.bldr.addr);
-    printf("Bootloader size: %d\r\n", dev_attr.bldr.size);
+    if(done < jr->stored + FSISP_JOURNAL_BLOCK)
+        return;
+    /* a journal that cannot be written costs a resume, not the load */
+    cache_journal_store(jr->uuid, jr->area, jr->hash, done);
+    jr->stored = done;
+}
 
-    printf("Closing to serial port...");
-    if(com_close(com_handle))
+/**
+  * @brief  program a plan chunk by chunk, journaling as it is acknowledged
+  * @param  sess [I] - connected session
+  * @param  plan [I] - write plan of the image
+  * @param  window [I] - frames in flight
+  * @param  uuid [I] - device UUID, key of the journal
+  * @param  area [I] - area name, key of the journal
+  * @param  hash [I] - hash of the image, see journal_hash()
+  * @param  done [I] - bytes of the plan already programmed, skipped
+  * @retval 0 = success, -1 = failure
+  * @note   Each chunk goes out as one stream, the journal is kept from its
+  *         acknowledgements: splitting it into blocks would drain the
+  *         window and stall on a page erase at every block. Chunks and
+  *         journal marks are whole pages, so erasing ahead never touches a
+  *         page programmed before.
+  */
+static int32_t program_plan(isp_session_t *sess, const image_plan_t *plan, uint8_t window,
+                            const char *uuid, const char *area, uint32_t hash, uint32_t done)
+{
+    fsisp_journal_t jr;
+    const image_seg_t *chunk;
+    uint32_t off, i;
+    int32_t ret = 0;
+
+    jr.uuid = uuid;
+    jr.area = area;
+    jr.hash = hash;
+    jr.page = sess->attr.flash.page_size ? sess->attr.flash.page_size : 1;
+    jr.stored = done;
+    jr.pos = 0;
+    sess->progress = journal_progress;
+    sess->progress_ctx = &jr;
+
+    for(i = 0; i < plan->count && ret == 0; i++)
     {
-        printf("failed");
-        return -1;
+        chunk = &plan->chunks[i];
+        jr.addr = chunk->addr;
+        if(jr.pos + chunk->size > done)
+        {
+            off = done > jr.pos ? done - jr.pos : 0;
+            ret = isp_write(sess, chunk->addr + off, chunk->data + off, chunk->size - off, window);
+            if(ret == 0 && jr.stored < jr.pos + chunk->size)
+            {
+                cache_journal_store(uuid, area, hash, jr.pos + chunk->size);
+                jr.stored = jr.pos + chunk->size;
+            }
+        }
+        jr.pos += chunk->size;
     }
-    else
+
+    sess->progress = NULL;
+    sess->progress_ctx = NULL;
+    return ret;
+}
+
+/**
+  * @brief  run a parsed command on a connected device
+  * @param  sess [I] - connected session
+  * @param  cmd [I] - parsed command, shared by all gang jobs
+  * @param  verbose [I] - print every step
+  * @param  stage [O] - step that failed
+  * @retval 0 = success, -1 = failure
+  */
+static int run_command(isp_session_t *sess, const fsisp_cmd_t *cmd, int verbose, const char **stage)
+{
+    static const char *erase_names[] = { "chip", "APROM", "EEPROM" };
+    static const char *area_names[] = { "APROM", "EEPROM" };
+    const char *uuid = sess->attr.mcu.uuid;
+    uint32_t addr, limit;
+    uint8_t *image, *prev = NULL;
+    image_plan_t plan;
+    fsisp_writer_t writer;
+    isp_diff_t diff;
+    uint32_t i, hash, done = 0;
+    int32_t ret;
+    int whole = 1;
+
+    switch(cmd->id)
     {
-        printf("OK");
-    }
-    printf("\r\n");
+        case FSISP_CMD_ERASE:
+            enter_stage(sess->stats, stage, "erase");
+            if(verbose) printf("Erasing %s...", erase_names[cmd->area]);
+            ret = isp_erase(sess, cmd->area);
+            if(verbose) printf(ret ? "failed\r\n" : "OK\r\n");
+            /* even a failed erase may have wiped part of the content */
+            if(cmd->area != ERASE_EEPROM)
+            {
+                cache_drop(uuid, area_names[ISP_AREA_APROM]);
+                cache_journal_drop(uuid, area_names[ISP_AREA_APROM]);
+            }
+            if(cmd->area != ERASE_APROM)
+            {
+                cache_drop(uuid, area_names[ISP_AREA_EEPROM]);
+                cache_journal_drop(uuid, area_names[ISP_AREA_EEPROM]);
+            }
+            return ret;
+
+        case FSISP_CMD_LOAD:
+            enter_stage(sess->stats, stage, "load");
+            if(isp_area(sess, cmd->area, &addr, &limit))
+                return -1;
+            if(image_plan(&cmd->image, addr, limit, sess->attr.flash.page_size, &plan))
+            {
+                if(verbose)
+                    printf("Image does not fit in %s at 0x%.8x of %u bytes\r\n",
+                           area_names[cmd->area], addr, limit);
+                return -1;
+            }
+
+            /* the content of the whole area after loading, as the cache keeps it */
+            image = (uint8_t *)malloc((size_t)limit * (cmd->diff ? 2 : 1));
+            if(image == NULL)
+            {
+                image_plan_free(&plan);
+                return -1;
+            }
+            image_render(&plan, addr, image, limit);
+            sess->compress = cmd->compress;
+            sess->erase_ahead = !cmd->erase_all;
+
+            if(cmd->diff)
+            {
+                if(!cmd->no_cache && cache_load(uuid, area_names[cmd->area], image + limit, limit) == 0)
+                    prev = image + limit;
+
+                enter_stage(sess->stats, stage, "program");
+                if(verbose) printf("Updating %s at 0x%.8x...", area_names[cmd->area], addr);
+                ret = isp_write_diff(sess, cmd->area, image, prev, cmd->window, &diff);
+                if(verbose)
+                {
+                    if(ret)
+                        printf("failed\r\n");
+                    else
+                        printf("OK, %u of %u pages changed (%s)\r\n", diff.changed, diff.pages,
+                               prev ? "local cache" : diff.queried ? "device CRC" : "full rewrite");
+                }
+            }
+            else
+            {
+                /* pick up where a load of the same image to this device stopped */
+                ret = 0;
+                hash = journal_hash(&plan, image, limit, cmd->erase_all);
+                if(!cmd->no_resume && cache_journal_load(uuid, area_names[cmd->area], hash, &done) == 0 && done)
+                {
+                    enter_stage(sess->stats, stage, "resume");
+                    if(verbose) printf("Checking %u bytes programmed by an interrupted load...", done);
+                    ret = check_journal(sess, &plan, done, cmd->window);
+                    if(verbose) printf(ret > 0 ? "changed, starting over\r\n" : ret ? "failed\r\n" : "OK\r\n");
+                    if(ret > 0)
+                    {
+                        done = 0;
+                        ret = 0;
+                    }
+                }
+
+                if(ret == 0 && cmd->erase_all && done == 0)
+                {
+                    enter_stage(sess->stats, stage, "erase");
+                    if(verbose) printf("Erasing %s...", area_names[cmd->area]);
+                    ret = isp_erase(sess, cmd->area == ISP_AREA_APROM ? ERASE_APROM : ERASE_EEPROM);
+                    if(verbose) printf(ret ? "failed\r\n" : "OK\r\n");
+                }
+                else if(cmd->erase_all)
+                {
+                    /* the area was erased by the interrupted load, but the pages it
+                     * was on when it stopped may hold part of their data */
+                    sess->erase_ahead = 1;
+                }
+                else
+                {
+                    /* pages outside the image keep what they had, which is not known here */
+                    whole = 0;
+                }
+
+                if(ret == 0)
+                {
+                    enter_stage(sess->stats, stage, "program");
+                    if(verbose) printf("Programming %u bytes in %u block(s) to %s at 0x%.8x%s...",
+                                       plan.bytes - done, plan.count, area_names[cmd->area], addr,
+                                       sess->erase_ahead ? ", erasing ahead" : "");
+                    ret = program_plan(sess, &plan, cmd->window, uuid, area_names[cmd->area], hash, done);
+                    if(verbose) printf(ret ? "failed\r\n" : "OK\r\n");
+                }
+            }
+
+            if(verbose && ret == 0 && cmd->compress)
+            {
+                if(sess->z_raw)
+                    printf("Compressed %u bytes to %u, ratio %.2f\r\n", sess->z_raw, sess->z_packed,
+                           (double)sess->z_raw / (sess->z_packed ? sess->z_packed : 1));
+                else
+                    printf("Sent uncompressed, %s\r\n", (sess->attr.caps & CAP_ZDATA) ?
+                           "the image does not compress" : "the device cannot unpack");
+            }
+
+            /* with the whole area known one range covers it */
+            if(ret == 0 && cmd->verify)
+            {
+                enter_stage(sess->stats, stage, "verify");
+                if(whole)
+                    ret = verify_range(sess, addr, image, limit, cmd->window, verbose);
+                for(i = 0; !whole && i < plan.count && ret == 0; i++)
+                    ret = verify_range(sess, plan.chunks[i].addr, plan.chunks[i].data, plan.chunks[i].size,
+                                       cmd->window, verbose);
+            }
+
+            if(ret || !whole)
+                cache_drop(uuid, area_names[cmd->area]);
+            else
+                cache_store(uuid, area_names[cmd->area], image, limit);
+            /* a failed load keeps its journal for the next run */
+            if(ret == 0)
+                cache_journal_drop(uuid, area_names[cmd->area]);
+            free(image);
+            image_plan_free(&plan);
+            return ret;
+
+        case FSISP_CMD_SAVE:
+            enter_stage(sess->stats, stage, "save");
+            if(isp_area(sess, cmd->area, &addr, &limit))
+                return -1;
+            if(writer_open(&writer, cmd->path, limit))
+            {
+                if(verbose) printf("Creating \"%s\"...failed\r\n", cmd->path);
+                return -1;
+            }
+            if(verbose) printf("Reading %u bytes of %s at 0x%.8x...", limit, area_names[cmd->area], addr);
+            ret = isp_read(sess, addr, limit, cmd->window, writer_sink, &writer);
+            if(writer_close(&writer))
+                ret = -1;
+            if(verbose) printf(ret ? "failed\r\n" : "OK\r\n");
+            return ret;
+
+        case FSISP_CMD_VERIFY:
+            enter_stage(sess->stats, stage, "verify");
+            if(isp_area(sess, cmd->area, &addr, &limit))
+                return -1;
+            if(image_plan(&cmd->image, addr, limit, sess->attr.flash.page_size, &plan))
+            {
+                if(verbose)
+                    printf("Image does not fit in %s at 0x%.8x of %u bytes\r\n",
+                           area_names[cmd->area], addr, limit);
+                return -1;
+            }
+            /* only what the image covers, the rest of the area is not ours to judge */
+            for(i = 0, ret = 0; i < plan.count && ret == 0; i++)
+                ret = verify_range(sess, plan.chunks[i].addr, plan.chunks[i].data, plan.chunks[i].size,
+                                   cmd->window, verbose);
+            image_plan_free(&plan);
+            return ret;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+  * @brief  append a port name to a growing list
+  * @param  names [I/O] - list
+  * @param  n [I/O] - number of names
+  * @param  cap [I/O] - capacity of the list
+  * @param  name [I] - port name, copied
+  * @retval 0 = success, -1 = out of memory
+  */
+static int add_port(char ***names, int *n, int *cap, const char *name)
+{
+    char **grown;
+
+    if(*n == *cap)
+    {
+        grown = (char **)realloc(*names, (size_t)(*cap ? *cap * 2 : 16) * sizeof(char *));
+        if(grown == NULL)
+            return -1;
+        *names = grown;
+        *cap = *cap ? *cap * 2 : 16;
+    }
+
+    (*names)[*n] = strdup(name);
+    if((*names)[*n] == NULL)
+        return -1;
+    (*n)++;
 
     return 0;
 }
 
+/**
+  * @brief  split a comma separated list of ports, expanding glob patterns
+  * @param  spec [I] - list such as "/dev/ttyUSB*,/dev/ttyACM0,tcp://fixture:4001"
+  * @param  ports [O] - allocated array of allocated names
+  * @param  count [O] - number of ports
+  * @retval 0 = success, -1 = failure or no port
+  */
+static int expand_ports(const char *spec, char ***ports, int *count)
+{
+    char *list, *item, *next;
+    char **names = NULL;
+    int n = 0, cap = 0, err = 0;
+#if !defined(_WIN32)
+    glob_t g;
+    size_t i;
+#endif
+
+    list = strdup(spec);
+    if(list == NULL)
+        return -1;
+
+    for(item = list; item && !err; item = next)
+    {
+        next = strchr(item, ',');
+        if(next)
+            *next++ = '\0';
+        if(*item == '\0')
+            continue;
+#if !defined(_WIN32)
+        /* device server URLs are taken as they are, "[::1]" is no pattern */
+        if(strpbrk(item, "*?[") != NULL && strstr(item, "://") == NULL)
+        {
+            if(glob(item, 0, NULL, &g) != 0)
+            {
+                printf("No port matches \"%s\"\r\n", item);
+                continue;
+            }
+            for(i = 0; i < g.gl_pathc && !err; i++)
+                err = add_port(&names, &n, &cap, g.gl_pathv[i]);
+            globfree(&g);
+            continue;
+        }
+#endif
+        err = add_port(&names, &n, &cap, item);
+    }
+    free(list);
+
+    if(n == 0 || err)
+    {
+        while(n--)
+            free(names[n]);
+        free(names);
+        return -1;
+    }
+
+    *ports = names;
+    *count = n;
+
+    return 0;
+}
+
+/**
+  * @brief  open, connect and run the command on one port of a gang
+  * @param  job [I/O] - job
+  * @param  start [I] - when the job started, ms
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t gang_job(fsisp_job_t *job, uint64_t start)
+{
+    com_param_t param = *job->param;
+    stats_t *st = job->report ? &job->stats : NULL;
+    com_handle_t hdl;
+    uint64_t now;
+    int32_t ret;
+
+    enter_stage(st, &job->stage, "open");
+    if(com_open(job->port, &param, &hdl))
+        return -1;
+
+    /* boards are plugged in one after the other, give each some time */
+    enter_stage(st, &job->stage, "connect");
+    isp_init(&job->sess, hdl, DEVICE_ADDR);
+    isp_set_line(&job->sess, &param);
+    job->sess.frame_limit = job->frame_limit;
+    job->sess.stats = st;
+    now = fsisp_now_ms();
+    if(isp_wait_connect(&job->sess, job->connect_ms == 0 ? 0 :
+                       start + job->connect_ms > now ? (uint32_t)(start + job->connect_ms - now) : 1))
+    {
+        com_close(hdl);
+        return -1;
+    }
+
+    enter_stage(st, &job->stage, "baudrate");
+    if(job->max_baudrate > param.baudrate && isp_upshift(&job->sess, &param, job->max_baudrate))
+    {
+        com_close(hdl);
+        return -1;
+    }
+    job->baudrate = param.baudrate;
+
+    ret = run_command(&job->sess, job->cmd, 0, &job->stage);
+    com_close(hdl);
+
+    return ret;
+}
+
+/**
+  * @brief  worker thread of a gang, runs ports until none is left
+  * @param  arg [I] - gang
+  * @retval NULL
+  * @note   Most of a job is spent blocked on its port, a thread each keeps
+  *         the code plain; the pool only bounds them for very large gangs.
+  */
+static void *gang_worker(void *arg)
+{
+    fsisp_gang_t *gang = (fsisp_gang_t *)arg;
+    fsisp_job_t *job;
+    uint64_t start;
+
+    while(1)
+    {
+        pthread_mutex_lock(&gang->lock);
+        job = gang->next < gang->count ? &gang->jobs[gang->next++] : NULL;
+        pthread_mutex_unlock(&gang->lock);
+        if(job == NULL)
+            break;
+
+        start = fsisp_now_ms();
+        job->started = 1;
+        if(job->report)
+        {
+            stats_init(&job->stats, job->trace);
+            job->stats.port = job->port;
+        }
+        job->result = gang_job(job, start);
+        job->ms = fsisp_now_ms() - start;
+        if(job->report)
+            finish_stats(&job->stats, job->sess.hdl ? &job->sess : NULL, job->result, job->stage);
+    }
+
+    return NULL;
+}
+
+/**
+  * @brief  run one command on every port of a gang at once
+  * @param  opt [I] - options: port list, see expand_ports(), and reports
+  * @param  param [I] - serial parameters, the same for all ports
+  * @param  max_baudrate [I] - fastest line rate to try after connecting
+  * @param  frame_limit [I] - largest frame payload to negotiate
+  * @param  connect_ms [I] - time every device has to answer from the start
+  *                          of its port, 0 = forever
+  * @param  cmd [I] - parsed command
+  * @retval 0 = every port succeeded, -1 = otherwise
+  */
+static int run_gang(const fsisp_opt_t *opt, const com_param_t *param, uint32_t max_baudrate, uint16_t frame_limit,
+                    uint32_t connect_ms, const fsisp_cmd_t *cmd)
+{
+    const char *spec = opt->gang;
+    char **ports;
+    fsisp_job_t *jobs;
+    fsisp_gang_t gang;
+    pthread_t workers[FSISP_GANG_WORKERS];
+    stats_t **stats;
+    int count, started, reported, i, failed = 0;
+    uint64_t start;
+
+    if(expand_ports(spec, &ports, &count))
+    {
+        printf("No port to program\r\n");
+        return -1;
+    }
+
+    jobs = (fsisp_job_t *)calloc((size_t)count, sizeof(fsisp_job_t));
+    if(jobs == NULL)
+        return -1;
+
+    for(i = 0; i < count; i++)
+    {
+        jobs[i].port = ports[i];
+        jobs[i].param = param;
+        jobs[i].max_baudrate = max_baudrate;
+        jobs[i].frame_limit = frame_limit;
+        jobs[i].connect_ms = connect_ms;
+        jobs[i].cmd = cmd;
+        jobs[i].report = opt->stats || opt->trace;
+        jobs[i].trace = opt->trace != NULL;
+    }
+    gang.jobs = jobs;
+    gang.count = count;
+    gang.next = 0;
+    pthread_mutex_init(&gang.lock, NULL);
+
+    printf("Running on %d ports...\r\n", count);
+    start = fsisp_now_ms();
+    for(started = 0; started < count && started < FSISP_GANG_WORKERS; started++)
+    {
+        if(pthread_create(&workers[started], NULL, gang_worker, &gang))
+            break;
+    }
+    for(i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&gang.lock);
+
+    for(i = 0; i < count; i++)
+    {
+        if(!jobs[i].started)
+        {
+            printf("%-24s FAILED (not started)\r\n", ports[i]);
+            failed++;
+        }
+        else if(jobs[i].result)
+        {
+            printf("%-24s FAILED (%s%s%s) %6.2fs\r\n", ports[i], jobs[i].stage,
+                   jobs[i].sess.error ? ", " : "", jobs[i].sess.error ? isp_strerror(&jobs[i].sess) : "",
+                   jobs[i].ms / 1000.0);
+            failed++;
+        }
+        else
+        {
+            printf("%-24s OK %6.2fs %7u %s %s\r\n", ports[i], jobs[i].ms / 1000.0, jobs[i].baudrate,
+                   jobs[i].sess.attr.mcu.part_number, jobs[i].sess.attr.mcu.uuid);
+        }
+    }
+    printf("%d of %d ports OK in %.2fs\r\n", count - failed, count, (fsisp_now_ms() - start) / 1000.0);
+
+    /* ports that never started have nothing to report */
+    if(opt->stats || opt->trace)
+    {
+        stats = (stats_t **)calloc((size_t)count, sizeof(stats_t *));
+        for(i = 0, reported = 0; stats && i < count; i++)
+        {
+            if(jobs[i].started)
+                stats[reported++] = &jobs[i].stats;
+        }
+        if(stats == NULL || write_reports(opt, stats, (uint32_t)reported))
+            failed++;
+        for(i = 0; i < count; i++)
+        {
+            if(jobs[i].started)
+                stats_free(&jobs[i].stats);
+        }
+        free(stats);
+    }
+
+    for(i = 0; i < count; i++)
+        free(ports[i]);
+    free(ports);
+    free(jobs);
+
+    return failed ? -1 : 0;
+}
+
+/**
+  * @brief  parse a list of device addresses such as "1-8,0x20"
+  * @param  spec [I] - comma separated addresses and ranges
+  * @param  addrs [O] - room for 255 addresses, each listed once
+  * @param  count [O] - number of addresses
+  * @retval 0 = success, -1 = malformed, broadcast or empty list
+  */
+static int parse_bus(const char *spec, uint8_t *addrs, uint32_t *count)
+{
+    uint8_t seen[256];
+    unsigned long lo, hi, a;
+    const char *p = spec;
+    char *end;
+
+    memset(seen, 0x00, sizeof(seen));
+    *count = 0;
+    while(*p)
+    {
+        lo = strtoul(p, &end, 0);
+        if(end == p)
+            return -1;
+        hi = lo;
+        if(*end == '-')
+        {
+            p = end + 1;
+            hi = strtoul(p, &end, 0);
+            if(end == p)
+                return -1;
+        }
+        if(lo == DEVICE_ADDR_BROADCAST || hi > 0xFF || lo > hi)
+            return -1;
+        for(a = lo; a <= hi; a++)
+        {
+            if(!seen[a])
+                addrs[(*count)++] = (uint8_t)a;
+            seen[a] = 1;
+        }
+        if(*end == ',')
+            end++;
+        else if(*end)
+            return -1;
+        p = end;
+    }
+
+    return *count ? 0 : -1;
+}
+
+/**
+  * @brief  find the devices answering on a shared line
+  * @param  nodes [I/O] - one per address, sessions set up here
+  * @param  count [I] - number of addresses
+  * @param  hdl [I] - open port
+  * @param  line [I] - line settings
+  * @param  frame_limit [I] - largest frame payload to negotiate
+  * @param  connect_ms [I] - how long to wait for the first device, 0 = forever
+  * @param  report [I] - sessions keep statistics in their nodes
+  * @retval number of devices found, -1 = the port failed
+  * @note   An address is probed with a short read before the handshake,
+  *         so an absent one costs a single timeout, as short as the round
+  *         trip of the first device found allows.
+  */
+static int32_t bus_scan(fsisp_node_t *nodes, uint32_t count, com_handle_t hdl, const com_param_t *line,
+                        uint16_t frame_limit, uint32_t connect_ms, int report)
+{
+    const isp_session_t *first = NULL;
+    uint8_t ver[4];
+    uint64_t deadline = fsisp_now_ms() + connect_ms;
+    int32_t found = 0;
+    uint32_t i;
+
+    do
+    {
+        for(i = 0; i < count; i++)
+        {
+            if(nodes[i].present)
+                continue;
+            isp_init(&nodes[i].sess, hdl, nodes[i].addr);
+            isp_set_line(&nodes[i].sess, line);
+            nodes[i].sess.frame_limit = frame_limit;
+            nodes[i].sess.stats = report ? &nodes[i].stats : NULL;
+            if(first)
+            {
+                nodes[i].sess.rtt = first->rtt;
+                nodes[i].sess.rtt.backoff = 0;
+            }
+            if(read_reg(&nodes[i].sess, REG_BLDR_VERSION, ver, sizeof(ver), NULL, ISP_BUDGET_NONE) == 0 &&
+               isp_connect(&nodes[i].sess) == 0)
+            {
+                nodes[i].present = 1;
+                if(first == NULL)
+                    first = &nodes[i].sess;
+                found++;
+            }
+            else if(nodes[i].sess.error == ISP_ERR_PORT)
+            {
+                return -1;
+            }
+        }
+    } while(found == 0 && (connect_ms == 0 || fsisp_now_ms() < deadline));
+
+    return found;
+}
+
+/**
+  * @brief  erase, broadcast and repair the devices found by bus_scan()
+  * @param  nodes [I/O] - devices, the first one present paces the broadcast
+  * @param  count [I] - number of addresses
+  * @param  cmd [I] - parsed load command
+  * @param  frames [O] - frames broadcast
+  * @retval 0 = done, see each node for its outcome, -1 = nothing was loaded
+  */
+static int32_t bus_load(fsisp_node_t *nodes, uint32_t count, const fsisp_cmd_t *cmd, uint32_t *frames)
+{
+    static const char *area_names[] = { "APROM", "EEPROM" };
+    const char *area = area_names[cmd->area];
+    isp_session_t *pacer = NULL, **bus;
+    image_plan_t plan;
+    uint8_t *image;
+    uint32_t addr = 0, limit = 0, page = 0, a, s, n, found = 0, i;
+    uint16_t frame = 0;
+    int32_t ret = 0;
+
+    *frames = 0;
+    bus = (isp_session_t **)calloc(count, sizeof(isp_session_t *));
+    if(bus == NULL)
+        return -1;
+
+    /* one broadcast fits only devices laid out alike */
+    for(i = 0; i < count; i++)
+    {
+        if(!nodes[i].present)
+            continue;
+        if(pacer == NULL)
+        {
+            pacer = &nodes[i].sess;
+            isp_area(pacer, cmd->area, &addr, &limit);
+            page = pacer->attr.flash.page_size;
+        }
+        if(isp_area(&nodes[i].sess, cmd->area, &a, &s) || a != addr || s != limit ||
+           nodes[i].sess.attr.flash.page_size != page)
+        {
+            printf("0x%.2X  %s  %s, skipped: flash differs from 0x%.2X\r\n", nodes[i].addr,
+                   nodes[i].sess.attr.mcu.part_number, nodes[i].sess.attr.mcu.uuid, pacer->dev_addr);
+            nodes[i].present = 0;
+            nodes[i].stage = "layout";
+            continue;
+        }
+        printf("0x%.2X  %s  %s\r\n", nodes[i].addr, nodes[i].sess.attr.mcu.part_number, nodes[i].sess.attr.mcu.uuid);
+        if(frame == 0 || nodes[i].sess.frame_size < frame)
+            frame = nodes[i].sess.frame_size;
+        bus[found++] = &nodes[i].sess;
+    }
+
+    if(image_plan(&cmd->image, addr, limit, page, &plan))
+    {
+        printf("Image does not fit in %s at 0x%.8x of %u bytes\r\n", area, addr, limit);
+        free(bus);
+        return -1;
+    }
+    image = (uint8_t *)malloc(limit ? limit : 1);
+    if(image == NULL)
+    {
+        image_plan_free(&plan);
+        free(bus);
+        return -1;
+    }
+    image_render(&plan, addr, image, limit);
+
+    for(i = 0; i < count; i++)
+    {
+        if(!nodes[i].present)
+            continue;
+        enter_stage(nodes[i].sess.stats, &nodes[i].stage, "erase");
+        /* even a failed erase may have wiped part of the content */
+        cache_drop(nodes[i].sess.attr.mcu.uuid, area);
+        cache_journal_drop(nodes[i].sess.attr.mcu.uuid, area);
+    }
+    printf("Erasing %s on %u device(s)...", area, found);
+    if(isp_bus_erase(bus, found, cmd->area == ISP_AREA_APROM ? ERASE_APROM : ERASE_EEPROM) == 0)
+    {
+        printf("OK\r\n");
+    }
+    else if(pacer->error != ISP_ERR_PORT)
+    {
+        /* whoever missed it is caught by its check */
+        printf("not confirmed by every device\r\n");
+    }
+    else
+    {
+        printf("failed, %s\r\n", isp_strerror(pacer));
+        ret = -1;
+    }
+
+    if(ret == 0)
+    {
+        for(i = 0; i < count; i++)
+            if(nodes[i].present)
+                enter_stage(nodes[i].sess.stats, &nodes[i].stage, "broadcast");
+        printf("Broadcasting %u bytes to %s at 0x%.8x, paced by 0x%.2X...", plan.bytes, area, addr, pacer->dev_addr);
+        for(i = 0; i < plan.count && ret == 0; i++)
+        {
+            ret = isp_bus_write(pacer, plan.chunks[i].addr, plan.chunks[i].data, plan.chunks[i].size, frame, &n);
+            *frames += n;
+        }
+        /* the others may well have it all, their checks tell */
+        if(ret)
+            printf("failed after %u frame(s), %s\r\n", *frames, isp_strerror(pacer));
+        else
+            printf("OK, %u frame(s) of up to %u bytes\r\n", *frames, frame);
+        ret = pacer->error == ISP_ERR_PORT ? -1 : 0;
+        /* the time each device then waits for its turn is no step of its own */
+        for(i = 0; i < count; i++)
+            stats_phase(nodes[i].sess.stats, NULL);
+    }
+
+    /* a device that got every frame costs a checksum, the others a repair */
+    for(i = 0; i < count && ret == 0; i++)
+    {
+        if(!nodes[i].present)
+            continue;
+        enter_stage(nodes[i].sess.stats, &nodes[i].stage, "repair");
+        nodes[i].sess.erase_ahead = 0;
+        nodes[i].result = isp_bus_repair(&nodes[i].sess, cmd->area, image, cmd->window, &nodes[i].diff);
+        /* the rest of the area was erased with the others, the image is what may be off */
+        for(n = 0; n < plan.count && nodes[i].result == 0 && nodes[i].diff.changed; n++)
+        {
+            enter_stage(nodes[i].sess.stats, &nodes[i].stage, "verify");
+            nodes[i].result = verify_range(&nodes[i].sess, plan.chunks[n].addr, plan.chunks[n].data,
+                                           plan.chunks[n].size, cmd->window, 0);
+        }
+
+        if(nodes[i].result)
+        {
+            printf("0x%.2X  FAILED (%s%s%s)\r\n", nodes[i].addr, nodes[i].stage,
+                   nodes[i].sess.error ? ", " : "", nodes[i].sess.error ? isp_strerror(&nodes[i].sess) : "");
+            cache_drop(nodes[i].sess.attr.mcu.uuid, area);
+        }
+        else
+        {
+            if(nodes[i].diff.changed)
+                printf("0x%.2X  OK, repaired %u of %u pages\r\n", nodes[i].addr, nodes[i].diff.changed,
+                       nodes[i].diff.pages);
+            else
+                printf("0x%.2X  OK\r\n", nodes[i].addr);
+            cache_store(nodes[i].sess.attr.mcu.uuid, area, image, limit);
+        }
+        /* the line goes on to the next device, this one is done */
+        stats_phase(nodes[i].sess.stats, NULL);
+    }
+
+    free(image);
+    image_plan_free(&plan);
+    free(bus);
+
+    return ret;
+}
+
+/**
+  * @brief  load one image into every device on a multi-drop line at once
+  * @param  opt [I] - options: port, address list, see parse_bus(), and reports
+  * @param  param [I] - serial parameters
+  * @param  frame_limit [I] - largest frame payload to negotiate
+  * @param  connect_ms [I] - how long to wait for the first device, 0 = forever
+  * @param  cmd [I] - parsed load command
+  * @retval 0 = every device found holds the image, -1 = otherwise
+  * @note   The area is erased and the image sent once for all devices by
+  *         broadcast; each device is then checked by a device CRC and only
+  *         the pages it missed are rewritten to it alone. The line stays at
+  *         the rate the devices were found at.
+  */
+static int run_bus(const fsisp_opt_t *opt, const com_param_t *param, uint16_t frame_limit, uint32_t connect_ms,
+                   const fsisp_cmd_t *cmd)
+{
+    com_param_t line = *param;
+    com_handle_t hdl;
+    fsisp_node_t *nodes;
+    stats_t **stats;
+    uint8_t addrs[255];
+    uint32_t count, frames = 0, repaired = 0, ok = 0, failed = 0, i;
+    int32_t found, err;
+    uint64_t start;
+    int report = opt->stats || opt->trace;
+
+    if(parse_bus(opt->bus, addrs, &count))
+    {
+        printf("--bus: bad address list \"%s\"\r\n", opt->bus);
+        return -1;
+    }
+    nodes = (fsisp_node_t *)calloc(count, sizeof(fsisp_node_t));
+    if(nodes == NULL)
+        return -1;
+
+    printf("Openning serial port \"%s\", baudrate = %u...", opt->port == NULL ? "<invalid>" : opt->port, line.baudrate);
+    if(com_open(opt->port, &line, &hdl))
+    {
+        printf("failed\r\n");
+        free(nodes);
+        return -1;
+    }
+    printf("OK\r\n");
+
+    start = fsisp_now_ms();
+    for(i = 0; i < count; i++)
+    {
+        nodes[i].addr = addrs[i];
+        nodes[i].result = -1;
+        snprintf(nodes[i].name, sizeof(nodes[i].name), "%s@0x%.2X", opt->port, addrs[i]);
+        if(report)
+        {
+            stats_init(&nodes[i].stats, opt->trace != NULL);
+            nodes[i].stats.port = nodes[i].name;
+        }
+        enter_stage(report ? &nodes[i].stats : NULL, &nodes[i].stage, "connect");
+    }
+
+    printf("Scanning %u address(es)...", count);
+    found = bus_scan(nodes, count, hdl, &line, frame_limit, connect_ms, report);
+    if(found > 0)
+    {
+        printf("%d device(s)\r\n", found);
+        err = bus_load(nodes, count, cmd, &frames);
+    }
+    else
+    {
+        printf("failed, %s\r\n", found ? "port failure" : "no device answers");
+        err = -1;
+    }
+
+    /* addresses nobody answered at are no failure, the list may be a guess */
+    for(i = 0; i < count; i++)
+    {
+        if(!nodes[i].sess.attr_valid)
+            continue;
+        if(nodes[i].present && nodes[i].result == 0)
+            ok++;
+        else
+            failed++;
+        repaired += nodes[i].diff.changed;
+    }
+    if(found > 0)
+        printf("%u of %u device(s) OK in %.2fs, %u frame(s) broadcast, %u page(s) repaired\r\n", ok, ok + failed,
+               (fsisp_now_ms() - start) / 1000.0, frames, repaired);
+
+    if(report)
+    {
+        stats = (stats_t **)malloc(count * sizeof(stats_t *));
+        for(i = 0; i < count; i++)
+        {
+            finish_stats(&nodes[i].stats, &nodes[i].sess, nodes[i].result, nodes[i].stage);
+            if(stats)
+                stats[i] = &nodes[i].stats;
+        }
+        if(stats == NULL || write_reports(opt, stats, count))
+            err = -1;
+        for(i = 0; i < count; i++)
+            stats_free(&nodes[i].stats);
+        free(stats);
+    }
+
+    com_close(hdl);
+    free(nodes);
+
+    return err || failed || ok == 0 ? -1 : 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  print the synopsis of one command or of all
+  * @param  name [I] - command name, NULL for all
+  * @retval none
+  */
+static void print_help(const char *name)
+{
+    size_t i, n = name ? strlen(name) : 0;
+    int found = 0;
+
+    for(i = 0; i < sizeof(fsisp_usage) / sizeof(fsisp_usage[0]); i++)
+    {
+        if(name && (strncmp(fsisp_usage[i], name, n) || (fsisp_usage[i][n] != ' ' && fsisp_usage[i][n] != '\0')))
+            continue;
+        printf("%s\r\n", fsisp_usage[i]);
+        found = 1;
+    }
+    if(!found)
+        printf("Unknown command \"%s\"\r\n", name);
+}
+
+/**
+  * @brief  split a command line into words in place
+  * @param  line [I/O] - command line, words are terminated where they end
+  * @param  argv [O] - words
+  * @param  max [I] - capacity of argv
+  * @retval number of words, -1 = unbalanced quote or too many words
+  * @note   Double quotes keep blanks in a word, a word starting with '#'
+  *         comments out the rest of the line.
+  */
+static int split_line(char *line, char **argv, int max)
+{
+    char *in = line, *out;
+    int argc = 0;
+
+    while(1)
+    {
+        while(*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n')
+            in++;
+        if(*in == '\0' || *in == '#')
+            return argc;
+        if(argc == max)
+            return -1;
+
+        /* quotes are dropped by copying the word over itself */
+        argv[argc++] = out = in;
+        while(*in && *in != ' ' && *in != '\t' && *in != '\r' && *in != '\n')
+        {
+            if(*in != '"')
+            {
+                *out++ = *in++;
+                continue;
+            }
+            for(in++; *in && *in != '"'; )
+                *out++ = *in++;
+            if(*in++ != '"')
+                return -1;
+        }
+        if(*in)
+            in++;
+        *out = '\0';
+    }
+}
+
+/**
+  * @brief  handshake with the device, show it and raise the line rate
+  * @param  sess [I/O] - session on an open port
+  * @param  param [I/O] - line settings, follows the rate negotiated
+  * @param  baudrate [I] - rate the bootloader starts at
+  * @param  max_baudrate [I] - fastest rate to negotiate
+  * @param  connect_ms [I] - how long to wait for the device, 0 = forever
+  * @retval 0 = success, -1 = failure
+  * @note   Called again by the shell, after a reset the device is back at
+  *         the start rate while the port may still be at a faster one.
+  */
+static int connect_device(isp_session_t *sess, com_param_t *param, uint32_t baudrate, uint32_t max_baudrate,
+                          uint32_t connect_ms)
+{
+    dev_attr_t *dev_attr = &sess->attr;
+    uint16_t frame_limit = sess->frame_limit;
+    stats_t *stats = sess->stats;
+
+    stats_phase(stats, "connect");
+    printf("Connecting to device...");
+
+    sess->attr_valid = 0;
+    if(param->baudrate != baudrate && isp_connect(sess) != 0)
+    {
+        param->baudrate = baudrate;
+        if(com_set_param(sess->hdl, param))
+        {
+            printf("failed\r\n");
+            return -1;
+        }
+        isp_init(sess, sess->hdl, sess->dev_addr);
+        isp_set_line(sess, param);
+        sess->frame_limit = frame_limit;
+        sess->stats = stats;
+    }
+    if(isp_wait_connect(sess, connect_ms))
+    {
+        printf("failed, %s\r\n", isp_strerror(sess));
+        return -1;
+    }
+
+    printf("OK");
+    printf("\r\n");
+    printf("MCU part number: %s\r\n", dev_attr->mcu.part_number);
+    printf("MCU UUID: %s\r\n", dev_attr->mcu.uuid);
+    printf("Bootloader version: v%d.%d.%d\r\n", dev_attr->bldr.major_ver, dev_attr->bldr.minor_ver, dev_attr->bldr.build_ver);
+    printf("Bootloader flash adress: 0x%.8x\r\n", dev_attr->bldr.addr);
+    printf("Bootloader size: %d\r\n", dev_attr->bldr.size);
+    if(sess->frame_size > PKT_PLD_SIZE)
+        printf("Frame payload: %u bytes\r\n", sess->frame_size);
+
+    if(max_baudrate > param->baudrate)
+    {
+        stats_phase(stats, "baudrate");
+        printf("Negotiating line rate...");
+        if(isp_upshift(sess, param, max_baudrate))
+        {
+            printf("failed\r\n");
+            return -1;
+        }
+        printf("%u\r\n", param->baudrate);
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  run commands line by line on one connected session
+  * @param  sess [I/O] - connected session
+  * @param  param [I/O] - line settings, see connect_device()
+  * @param  baudrate [I] - rate the bootloader starts at
+  * @param  max_baudrate [I] - fastest rate to negotiate
+  * @param  connect_ms [I] - how long the connect command waits, 0 = forever
+  * @param  fp [I] - command source
+  * @param  name [I] - script path, NULL for the interactive shell
+  * @retval 0 = success, -1 = a script command failed
+  * @note   The port, the line rate and the device attributes stay as they
+  *         are between commands, so a job of many steps pays for opening
+  *         and the handshake once. A script stops at the first failure,
+  *         the shell goes on.
+  */
+static int run_shell(isp_session_t *sess, com_param_t *param, uint32_t baudrate, uint32_t max_baudrate,
+                     uint32_t connect_ms, FILE *fp, const char *name)
+{
+    char line[FSISP_LINE_MAX];
+    char *argv[FSISP_ARGS_MAX];
+    fsisp_cmd_t cmd;
+    const char *stage;
+    int argc, lineno = 0, err;
+
+    while(1)
+    {
+        if(name == NULL)
+        {
+            printf("fsisp> ");
+            fflush(stdout);
+        }
+        if(fgets(line, sizeof(line), fp) == NULL)
+            break;
+        lineno++;
+
+        argc = split_line(line, argv, FSISP_ARGS_MAX);
+        if(argc == 0)
+            continue;
+        if(argc < 0)
+        {
+            printf("Unbalanced quote or too many words\r\n");
+            err = -1;
+        }
+        else if(strcmp(argv[0], "quit") == 0 || strcmp(argv[0], "exit") == 0)
+        {
+            break;
+        }
+        else if(strcmp(argv[0], "help") == 0)
+        {
+            print_help(argc > 1 ? argv[1] : NULL);
+            err = 0;
+        }
+        else if(strcmp(argv[0], "connect") == 0)
+        {
+            err = connect_device(sess, param, baudrate, max_baudrate, connect_ms);
+        }
+        else if(strcmp(argv[0], "shell") == 0)
+        {
+            printf("shell: already running\r\n");
+            err = -1;
+        }
+        else
+        {
+            err = parse_command(argc, argv, &cmd);
+            if(err == 0)
+                err = run_command(sess, &cmd, 1, &stage);
+            image_close(&cmd.image);
+        }
+
+        if(err && name)
+        {
+            printf("%s:%d: %s failed\r\n", name, lineno, argc > 0 ? argv[0] : "line");
+            return -1;
+        }
+    }
+
+    if(name == NULL)
+        printf("\r\n");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    fsisp_opt_t fsisp_opt;
+    int32_t err;
+    int32_t baudrate;
+    uint32_t max_baudrate = FSISP_MAX_BAUDRATE;
+    uint16_t frame_limit = PKT_EXT_PLD_SIZE;
+    uint32_t connect_ms = ISP_CONNECT_TIMEOUT;
+    /* buffer to receive uart data */
+    com_param_t com_param;
+    com_handle_t com_handle;
+    isp_session_t sess;
+    fsisp_cmd_t cmd;
+    const char *stage = "open";
+    stats_t stats, *pstats = &stats;
+    FILE *script = NULL;
+    int cmd_argc;
+    char **cmd_argv;
+
+    if(err = parse_options(argc, argv, &fsisp_opt))
+        return err;
+    cmd_argc = argc - optind;
+    cmd_argv = argv + optind;
+
+    if(fsisp_opt.version)
+        printf("Free Serial ISP command line tool v1.0.0.\r\n");
+        
+    if(fsisp_opt.help)
+        print_help(NULL);
+
+    com_param.baudrate = 115200;
+    com_param.bytesize = COM_BYTESZ_8;
+    com_param.parity = COM_PARITY_NONE;
+    com_param.stopbits = COM_STOPBITS_1;
+
+    if(fsisp_opt.baudrate)
+    {
+        baudrate = atoi(fsisp_opt.baudrate);
+        if(baudrate > 0)
+            com_param.baudrate = (uint32_t)baudrate;
+    }
+    if(fsisp_opt.max_baudrate)
+        max_baudrate = (uint32_t)strtoul(fsisp_opt.max_baudrate, NULL, 0);
+    if(fsisp_opt.frame_size)
+        frame_limit = (uint16_t)MIN(strtoul(fsisp_opt.frame_size, NULL, 0), PKT_EXT_PLD_SIZE);
+    if(fsisp_opt.connect_timeout)
+        connect_ms = (uint32_t)strtoul(fsisp_opt.connect_timeout, NULL, 0);
+
+    /* the image is mapped once and shared by every port */
+    if(fsisp_opt.script)
+    {
+        memset(&cmd, 0x00, sizeof(cmd));
+        cmd.id = FSISP_CMD_SHELL;
+        if(cmd_argc)
+        {
+            printf("--script: no command expected, got \"%s\"\r\n", cmd_argv[0]);
+            return -1;
+        }
+        script = strcmp(fsisp_opt.script, "-") ? fopen(fsisp_opt.script, "r") : stdin;
+        if(script == NULL)
+        {
+            printf("Reading \"%s\"...failed\r\n", fsisp_opt.script);
+            return -1;
+        }
+    }
+    else if(parse_command(cmd_argc, cmd_argv, &cmd))
+    {
+        return -1;
+    }
+
+    if(fsisp_opt.bus)
+    {
+        /* a broadcast only writes, and every device gets the same image */
+        if(cmd.id != FSISP_CMD_LOAD || fsisp_opt.gang)
+        {
+            printf("--bus: only with load on one port\r\n");
+            image_close(&cmd.image);
+            if(script && script != stdin)
+                fclose(script);
+            return -1;
+        }
+        err = run_bus(&fsisp_opt, &com_param, frame_limit, connect_ms, &cmd);
+        image_close(&cmd.image);
+        return err;
+    }
+
+    if(fsisp_opt.gang)
+    {
+        /* every port would write the same file */
+        if(cmd.id == FSISP_CMD_SAVE || cmd.id == FSISP_CMD_SHELL)
+        {
+            printf("%s: not available with --gang\r\n", cmd.id == FSISP_CMD_SAVE ? "save" : "shell");
+            if(script && script != stdin)
+                fclose(script);
+            return -1;
+        }
+        err = run_gang(&fsisp_opt, &com_param, max_baudrate, frame_limit, connect_ms, &cmd);
+        image_close(&cmd.image);
+        return err;
+    }
+    
+    /* counted from here, opening the port is part of the session */
+    stats_init(&stats, fsisp_opt.trace != NULL);
+    stats.port = fsisp_opt.port;
+    stats_phase(&stats, stage);
+
+    printf("Openning serial port \"%s\", baudrate = %d...", fsisp_opt.port == NULL ? "<invalid>" : fsisp_opt.port, com_param.baudrate);
+    if(com_open(fsisp_opt.port, &com_param, &com_handle))
+    {
+        printf("failed");
+        finish_stats(&stats, NULL, -1, stage);
+        write_reports(&fsisp_opt, &pstats, 1);
+        stats_free(&stats);
+        image_close(&cmd.image);
+        if(script && script != stdin)
+            fclose(script);
+        return -1;
+    }
+    else
+    {
+        printf("OK");
+    }
+    printf("\r\n");
+
+    isp_init(&sess, com_handle, DEVICE_ADDR);
+    isp_set_line(&sess, &com_param);
+    sess.frame_limit = frame_limit;
+    if(fsisp_opt.stats || fsisp_opt.trace)
+        sess.stats = &stats;
+    baudrate = (int32_t)com_param.baudrate;
+    stage = "connect";
+    err = connect_device(&sess, &com_param, com_param.baudrate, max_baudrate, connect_ms);
+
+    if(err == 0 && cmd.id == FSISP_CMD_SHELL)
+    {
+        stage = "shell";
+        err = run_shell(&sess, &com_param, (uint32_t)baudrate, max_baudrate, connect_ms,
+                        script ? script : stdin, script ? fsisp_opt.script : NULL);
+    }
+    else if(err == 0)
+    {
+        err = run_command(&sess, &cmd, 1, &stage);
+    }
+    image_close(&cmd.image);
+    finish_stats(&stats, &sess, err, stage);
+    if(write_reports(&fsisp_opt, &pstats, 1))
+        err = -1;
+    stats_free(&stats);
+    if(script && script != stdin)
+        fclose(script);
+
+    printf("Closing to serial port...");
+    if(com_close(com_handle))
+    {
+        printf("failed");
+        return -1;
+    }
+    else
+    {
+        printf("OK");
+    }
+    printf("\r\n");
+
+    return err;
+}
+
 /******************************** END OF FILE *********************************/
@@ -0,0 +1,702 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Firmware image reader for raw binary, Intel HEX,
+ *                   Motorola S-record and ELF files.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "inc/image.h"
+/* Private define ------------------------------------------------------------*/
+/* Longest record of a text format, in bytes after decoding */
+#define IMAGE_REC_MAX                       (255 + 5)
+
+/* ELF identification and program header fields used here */
+#define ELF_CLASS32                         1
+#define ELF_CLASS64                         2
+#define ELF_DATA_LSB                        1
+#define ELF_PT_LOAD                         1
+/* Private typedef -----------------------------------------------------------*/
+/* Decoder state shared by the text formats */
+typedef struct image_text_s {
+    image_t *img;
+    /* NULL while counting, decoded bytes go here on the second pass */
+    uint8_t *out;
+    uint32_t pos;
+    uint32_t cap;
+} image_text_t;
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+static int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static uint32_t rd_le(const uint8_t *p, uint8_t n)
+{
+    uint32_t v = 0;
+
+    while(n--)
+        v = (v << 8) | p[n];
+
+    return v;
+}
+
+/**
+  * @brief  decode the hex digits of one text record
+  * @param  p [I] - first digit
+  * @param  end [I] - end of the line
+  * @param  rec [O] - decoded bytes
+  * @retval number of bytes, -1 = odd length, bad digit or too long
+  */
+static int decode_record(const char *p, const char *end, uint8_t *rec)
+{
+    int n = 0, hi, lo;
+
+    while(end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    if((end - p) & 1 || (end - p) / 2 > IMAGE_REC_MAX)
+        return -1;
+    while(p < end)
+    {
+        hi = hex_digit(*p++);
+        lo = hex_digit(*p++);
+        if(hi < 0 || lo < 0)
+            return -1;
+        rec[n++] = (uint8_t)(hi << 4 | lo);
+    }
+
+    return n;
+}
+
+/**
+  * @brief  add data found at an address, extending the last segment when it
+  *         continues it
+  * @param  t [I] - decoder state
+  * @param  addr [I] - flash address
+  * @param  data [I] - bytes
+  * @param  size [I] - number of bytes
+  * @retval 0 = success, -1 = out of memory
+  */
+static int32_t text_put(image_text_t *t, uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    image_t *img = t->img;
+    image_seg_t *seg, *grown;
+
+    if(t->out == NULL)
+    {
+        t->pos += size;
+        return 0;
+    }
+    if(size == 0)
+        return 0;
+
+    memcpy(t->out + t->pos, data, size);
+    seg = img->count ? &img->segs[img->count - 1] : NULL;
+    if(seg && seg->addr + seg->size == addr && seg->data + seg->size == t->out + t->pos)
+    {
+        seg->size += size;
+    }
+    else
+    {
+        if(img->count == t->cap)
+        {
+            t->cap = t->cap ? t->cap * 2 : 16;
+            grown = (image_seg_t *)realloc(img->segs, t->cap * sizeof(image_seg_t));
+            if(grown == NULL)
+                return -1;
+            img->segs = grown;
+        }
+        seg = &img->segs[img->count++];
+        seg->addr = addr;
+        seg->size = size;
+        seg->data = t->out + t->pos;
+    }
+    t->pos += size;
+
+    return 0;
+}
+
+/**
+  * @brief  walk the records of an Intel HEX file
+  * @param  t [I] - decoder state
+  * @retval 0 = success, -1 = malformed file
+  */
+static int32_t parse_hex(image_text_t *t)
+{
+    const char *p = (const char *)t->img->map, *end = p + t->img->map_size, *eol;
+    uint8_t rec[IMAGE_REC_MAX], sum;
+    uint32_t base = 0;
+    int n, i;
+
+    while(p < end)
+    {
+        eol = memchr(p, '\n', (size_t)(end - p));
+        if(eol == NULL)
+            eol = end;
+        if(*p == '\r' || *p == '\n' || p == eol)
+        {
+            p = eol + 1;
+            continue;
+        }
+        if(*p != ':' || (n = decode_record(p + 1, eol, rec)) < 5 || n != rec[0] + 5)
+            return -1;
+        for(sum = 0, i = 0; i < n; i++)
+            sum += rec[i];
+        if(sum)
+            return -1;
+
+        switch(rec[3])
+        {
+            case 0x00:
+                if(text_put(t, base + ((uint32_t)rec[1] << 8 | rec[2]), rec + 4, rec[0]))
+                    return -1;
+                break;
+            case 0x01:
+                return 0;
+            case 0x02:
+                base = ((uint32_t)rec[4] << 8 | rec[5]) << 4;
+                break;
+            case 0x04:
+                base = ((uint32_t)rec[4] << 8 | rec[5]) << 16;
+                break;
+            case 0x03:
+            case 0x05:
+                break;
+            default:
+                return -1;
+        }
+        p = eol + 1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  walk the records of a Motorola S-record file
+  * @param  t [I] - decoder state
+  * @retval 0 = success, -1 = malformed file
+  */
+static int32_t parse_srec(image_text_t *t)
+{
+    const char *p = (const char *)t->img->map, *end = p + t->img->map_size, *eol;
+    uint8_t rec[IMAGE_REC_MAX], sum;
+    uint8_t alen;
+    uint32_t addr;
+    int n, i;
+
+    while(p < end)
+    {
+        eol = memchr(p, '\n', (size_t)(end - p));
+        if(eol == NULL)
+            eol = end;
+        if(*p == '\r' || *p == '\n' || p == eol)
+        {
+            p = eol + 1;
+            continue;
+        }
+        if(*p != 'S' || eol - p < 2 || (n = decode_record(p + 2, eol, rec)) < 1 || n != rec[0] + 1)
+            return -1;
+        for(sum = 0, i = 0; i < n; i++)
+            sum += rec[i];
+        if(sum != 0xFF)
+            return -1;
+
+        switch(p[1])
+        {
+            case '1': alen = 2; break;
+            case '2': alen = 3; break;
+            case '3': alen = 4; break;
+            case '0':
+            case '5':
+            case '6': alen = 0; break;
+            case '7':
+            case '8':
+            case '9': return 0;
+            default: return -1;
+        }
+        if(alen)
+        {
+            if(n < 2 + alen)
+                return -1;
+            for(addr = 0, i = 0; i < alen; i++)
+                addr = addr << 8 | rec[1 + i];
+            if(text_put(t, addr, rec + 1 + alen, (uint32_t)(n - 2 - alen)))
+                return -1;
+        }
+        p = eol + 1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  decode a text format in two passes, the first one only counts the
+  *         data bytes so that exactly that much is allocated
+  * @param  img [I/O] - image with the file mapped
+  * @param  parse [I] - record walker
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t load_text(image_t *img, int32_t (*parse)(image_text_t *))
+{
+    image_text_t t;
+
+    memset(&t, 0x00, sizeof(t));
+    t.img = img;
+    if(parse(&t))
+        return -1;
+
+    img->decoded = (uint8_t *)malloc(t.pos ? t.pos : 1);
+    if(img->decoded == NULL)
+        return -1;
+    t.out = img->decoded;
+    t.pos = 0;
+
+    return parse(&t);
+}
+
+/**
+  * @brief  index the loadable program headers of a little-endian ELF file
+  * @param  img [I/O] - image with the file mapped
+  * @retval 0 = success, -1 = malformed or unsupported file
+  * @note   Segments are placed at their physical (load) address, which is
+  *         where initialised data lives in flash.
+  */
+static int32_t load_elf(image_t *img)
+{
+    const uint8_t *f = (const uint8_t *)img->map, *ph;
+    size_t size = img->map_size;
+    uint64_t phoff, off, filesz, paddr;
+    uint32_t phentsize, phnum, i;
+    int is64;
+
+    if(size < 52 || f[5] != ELF_DATA_LSB || (f[4] != ELF_CLASS32 && f[4] != ELF_CLASS64))
+        return -1;
+    is64 = f[4] == ELF_CLASS64;
+    if(is64 && size < 64)
+        return -1;
+
+    if(is64)
+    {
+        phoff = rd_le(f + 32, 4) | (uint64_t)rd_le(f + 36, 4) << 32;
+        phentsize = rd_le(f + 54, 2);
+        phnum = rd_le(f + 56, 2);
+    }
+    else
+    {
+        phoff = rd_le(f + 28, 4);
+        phentsize = rd_le(f + 42, 2);
+        phnum = rd_le(f + 44, 2);
+    }
+    if(phentsize < (is64 ? 56U : 32U) || phoff > size || (uint64_t)phentsize * phnum > size - phoff)
+        return -1;
+
+    img->segs = (image_seg_t *)malloc((phnum ? phnum : 1) * sizeof(image_seg_t));
+    if(img->segs == NULL)
+        return -1;
+
+    for(i = 0; i < phnum; i++)
+    {
+        ph = f + phoff + (uint64_t)i * phentsize;
+        if(rd_le(ph, 4) != ELF_PT_LOAD)
+            continue;
+        if(is64)
+        {
+            off = rd_le(ph + 8, 4) | (uint64_t)rd_le(ph + 12, 4) << 32;
+            paddr = rd_le(ph + 24, 4) | (uint64_t)rd_le(ph + 28, 4) << 32;
+            filesz = rd_le(ph + 32, 4) | (uint64_t)rd_le(ph + 36, 4) << 32;
+        }
+        else
+        {
+            off = rd_le(ph + 4, 4);
+            paddr = rd_le(ph + 12, 4);
+            filesz = rd_le(ph + 16, 4);
+        }
+        if(filesz == 0)
+            continue;
+        if(off > size || filesz > size - off || paddr + filesz > 0x100000000ULL)
+            return -1;
+        img->segs[img->count].addr = (uint32_t)paddr;
+        img->segs[img->count].size = (uint32_t)filesz;
+        img->segs[img->count].data = f + off;
+        img->count++;
+    }
+
+    return 0;
+}
+
+static int seg_cmp(const void *a, const void *b)
+{
+    const image_seg_t *x = (const image_seg_t *)a, *y = (const image_seg_t *)b;
+
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/**
+  * @brief  tell the format from the ELF magic or the file extension
+  * @param  img [I] - image with the file mapped
+  * @param  path [I] - file path
+  * @retval IMAGE_FMT_*
+  */
+static uint8_t detect_format(const image_t *img, const char *path)
+{
+    static const struct {
+        const char *ext;
+        uint8_t format;
+    } exts[] = {
+        {".hex",    IMAGE_FMT_HEX},
+        {".ihx",    IMAGE_FMT_HEX},
+        {".ihex",   IMAGE_FMT_HEX},
+        {".srec",   IMAGE_FMT_SREC},
+        {".s19",    IMAGE_FMT_SREC},
+        {".s28",    IMAGE_FMT_SREC},
+        {".s37",    IMAGE_FMT_SREC},
+        {".mot",    IMAGE_FMT_SREC},
+    };
+    const char *dot = strrchr(path, '.');
+    const uint8_t *f = (const uint8_t *)img->map;
+    size_t i, n;
+
+    if(img->map_size >= 4 && f[0] == 0x7F && f[1] == 'E' && f[2] == 'L' && f[3] == 'F')
+        return IMAGE_FMT_ELF;
+    if(dot == NULL || strpbrk(dot, "/\\"))
+        return IMAGE_FMT_BIN;
+
+    for(i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+    {
+        n = strlen(exts[i].ext);
+        if(strlen(dot) != n)
+            continue;
+        while(n-- && (dot[n] | 0x20) == exts[i].ext[n]);
+        if(n == (size_t)-1)
+            return exts[i].format;
+    }
+
+    return IMAGE_FMT_BIN;
+}
+
+/**
+  * @brief  map a whole file read-only
+  * @param  img [O] - receives the mapping
+  * @param  path [I] - file path
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t map_file(image_t *img, const char *path)
+{
+#if defined(_WIN32)
+    HANDLE file, mapping;
+    LARGE_INTEGER len;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return -1;
+    if(!GetFileSizeEx(file, &len) || (uint64_t)len.QuadPart > UINT32_MAX)
+    {
+        CloseHandle(file);
+        return -1;
+    }
+    img->map_size = (size_t)len.QuadPart;
+    if(img->map_size == 0)
+    {
+        /* an empty file cannot be mapped */
+        CloseHandle(file);
+        return 0;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(mapping == NULL)
+        return -1;
+    img->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(img->map == NULL)
+    {
+        CloseHandle(mapping);
+        return -1;
+    }
+    img->mapping = mapping;
+#else
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > UINT32_MAX)
+    {
+        close(fd);
+        return -1;
+    }
+    img->map_size = (size_t)st.st_size;
+    if(img->map_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, img->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    img->map = map;
+#endif
+
+    return 0;
+}
+
+/**
+  * @brief  take the page for data that covers only part of it
+  * @param  plan [I/O] - plan being built, pad is NULL while counting
+  * @param  addr [I] - page address
+  * @param  page_size [I] - flash page size
+  * @param  npad [I/O] - pages taken so far
+  * @param  last [I/O] - address of the last page taken plus one, 0 once a
+  *                      whole-page chunk followed it
+  * @retval the page, NULL while counting
+  * @note   Segments come in address order, so a page shared with the
+  *         previous segment is always the last one taken.
+  */
+static uint8_t *pad_page(image_plan_t *plan, uint32_t addr, uint32_t page_size, uint32_t *npad, uint64_t *last)
+{
+    uint8_t *page;
+
+    if(*last != (uint64_t)addr + 1)
+    {
+        (*npad)++;
+        *last = (uint64_t)addr + 1;
+        if(plan->pad)
+        {
+            page = plan->pad + (size_t)(*npad - 1) * page_size;
+            memset(page, 0xFF, page_size);
+            plan->chunks[plan->count].addr = addr;
+            plan->chunks[plan->count].size = page_size;
+            plan->chunks[plan->count].data = page;
+            plan->count++;
+        }
+    }
+
+    return plan->pad ? plan->pad + (size_t)(*npad - 1) * page_size : NULL;
+}
+
+/**
+  * @brief  emit the chunks of every segment
+  * @param  img [I] - image, segments checked to lie in the area
+  * @param  offset [I] - added to segment addresses
+  * @param  page_size [I] - flash page size
+  * @param  plan [I/O] - plan, only the padded pages are counted while pad
+  *                      is NULL
+  * @retval number of padded pages
+  */
+static uint32_t plan_walk(const image_t *img, uint32_t offset, uint32_t page_size, image_plan_t *plan)
+{
+    const image_seg_t *seg;
+    uint32_t a, e, start, pa, stop, npad = 0, i;
+    uint64_t last = 0;
+    uint8_t *page;
+
+    for(i = 0; i < img->count; i++)
+    {
+        seg = &img->segs[i];
+        start = a = seg->addr + offset;
+        e = a + seg->size;
+
+        /* head page shared with other data or not filled */
+        pa = a & ~(page_size - 1);
+        if(a != pa || e - pa < page_size)
+        {
+            stop = e - pa < page_size ? e : pa + page_size;
+            page = pad_page(plan, pa, page_size, &npad, &last);
+            if(page)
+                memcpy(page + (a - pa), seg->data, stop - a);
+            a = stop;
+        }
+
+        /* whole pages come straight from the image */
+        stop = e & ~(page_size - 1);
+        if(stop > a)
+        {
+            if(plan->pad)
+            {
+                plan->chunks[plan->count].addr = a;
+                plan->chunks[plan->count].size = stop - a;
+                plan->chunks[plan->count].data = seg->data + (a - start);
+                plan->count++;
+            }
+            last = 0;
+            a = stop;
+        }
+
+        /* tail page */
+        if(a < e)
+        {
+            page = pad_page(plan, a, page_size, &npad, &last);
+            if(page)
+                memcpy(page, seg->data + (a - start), e - a);
+        }
+    }
+
+    return npad;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t image_open(image_t *img, const char *path)
+{
+    uint32_t i;
+    int32_t ret = 0;
+
+    memset(img, 0x00, sizeof(image_t));
+    if(map_file(img, path))
+        return -1;
+
+    img->format = detect_format(img, path);
+    switch(img->format)
+    {
+        case IMAGE_FMT_HEX:
+            ret = load_text(img, parse_hex);
+            break;
+        case IMAGE_FMT_SREC:
+            ret = load_text(img, parse_srec);
+            break;
+        case IMAGE_FMT_ELF:
+            ret = load_elf(img);
+            break;
+        default:
+            if(img->map_size)
+            {
+                img->segs = (image_seg_t *)malloc(sizeof(image_seg_t));
+                if(img->segs == NULL)
+                {
+                    ret = -1;
+                    break;
+                }
+                img->segs[0].addr = 0;
+                img->segs[0].size = (uint32_t)img->map_size;
+                img->segs[0].data = (const uint8_t *)img->map;
+                img->count = 1;
+            }
+            break;
+    }
+
+    if(ret == 0 && img->count > 1)
+    {
+        qsort(img->segs, img->count, sizeof(image_seg_t), seg_cmp);
+        for(i = 1; i < img->count && ret == 0; i++)
+            if((uint64_t)img->segs[i - 1].addr + img->segs[i - 1].size > img->segs[i].addr)
+                ret = -1;
+    }
+    for(i = 0; i < img->count; i++)
+        img->bytes += img->segs[i].size;
+
+    if(ret)
+        image_close(img);
+
+    return ret;
+}
+
+void image_close(image_t *img)
+{
+#if defined(_WIN32)
+    if(img->map)
+        UnmapViewOfFile(img->map);
+    if(img->mapping)
+        CloseHandle((HANDLE)img->mapping);
+#else
+    if(img->map)
+        munmap(img->map, img->map_size);
+#endif
+    free(img->decoded);
+    free(img->segs);
+    memset(img, 0x00, sizeof(image_t));
+}
+
+int32_t image_plan(const image_t *img, uint32_t base, uint32_t limit, uint32_t page_size, image_plan_t *plan)
+{
+    /* a raw binary has no addresses of its own, it starts at the area */
+    uint32_t offset = img->format == IMAGE_FMT_BIN ? base : 0;
+    uint32_t npad, i, k;
+    uint64_t a;
+
+    memset(plan, 0x00, sizeof(image_plan_t));
+    if(page_size == 0 || (page_size & (page_size - 1)) || (base & (page_size - 1)))
+        return -1;
+
+    for(i = 0; i < img->count; i++)
+    {
+        a = (uint64_t)img->segs[i].addr + offset;
+        if(a < base || a + img->segs[i].size > (uint64_t)base + limit)
+            return -1;
+    }
+
+    /* count the padded pages first, so the plan costs no more than it needs */
+    npad = plan_walk(img, offset, page_size, plan);
+
+    memset(plan, 0x00, sizeof(image_plan_t));
+    plan->chunks = (image_seg_t *)malloc((size_t)(img->count * 3 + 1) * sizeof(image_seg_t));
+    plan->pad = (uint8_t *)malloc((size_t)npad * page_size + 1);
+    if(plan->chunks == NULL || plan->pad == NULL)
+    {
+        image_plan_free(plan);
+        return -1;
+    }
+    plan_walk(img, offset, page_size, plan);
+
+    /* join chunks that continue each other both in flash and in memory */
+    for(i = 0, k = 0; i < plan->count; i++)
+    {
+        if(k && plan->chunks[k - 1].addr + plan->chunks[k - 1].size == plan->chunks[i].addr &&
+           plan->chunks[k - 1].data + plan->chunks[k - 1].size == plan->chunks[i].data)
+            plan->chunks[k - 1].size += plan->chunks[i].size;
+        else
+            plan->chunks[k++] = plan->chunks[i];
+    }
+    plan->count = k;
+    for(i = 0; i < plan->count; i++)
+        plan->bytes += plan->chunks[i].size;
+
+    return 0;
+}
+
+void image_plan_free(image_plan_t *plan)
+{
+    free(plan->chunks);
+    free(plan->pad);
+    memset(plan, 0x00, sizeof(image_plan_t));
+}
+
+void image_render(const image_plan_t *plan, uint32_t base, uint8_t *buf, uint32_t size)
+{
+    uint32_t i;
+
+    memset(buf, 0xFF, size);
+    for(i = 0; i < plan->count; i++)
+        memcpy(buf + (plan->chunks[i].addr - base), plan->chunks[i].data, plan->chunks[i].size);
+}
+
+/******************************** END OF FILE *********************************/
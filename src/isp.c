@@ -0,0 +1,2167 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Host side of the bootloader packet protocol.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "inc/serial.h"
+#include "inc/crc.h"
+#include "inc/packet.h"
+#include "inc/frame.h"
+#include "inc/lz.h"
+#include "inc/isp.h"
+/* Private define ------------------------------------------------------------*/
+/* Attempts of a stop-and-wait transaction before giving up */
+#define ISP_RETRIES                         3
+/* Transmissions of one REG_WDATA frame before giving up */
+#define ISP_WINDOW_RETRIES                  8
+/* Frames tracked by the window, power of two above WDATA_SACK_BITS + 1 */
+#define ISP_WINDOW_RING                     32
+/* Largest chunk of a windowed stream in frames of a given payload, kept 8-byte aligned */
+#define ISP_WINDOW_CHUNK(pld)               (((pld) - WDATA_SEQ_SIZE) & ~7u)
+/* Largest LZ block of a REG_ZDATA frame, one that does not pack is sent raw */
+#define ISP_ZDATA_BLOCK(pld)                MIN((pld) - ZDATA_HDR_SIZE, ZDATA_RAW_MAX)
+/* Data bytes asked for by one REG_RDATA request */
+#define ISP_RDATA_CHUNK(pld)                ((pld) - RDATA_ADDR_SIZE)
+/* Bounds of a measured round trip timeout before backing off, ms */
+#define ISP_RTO_MIN                         4
+#define ISP_RTO_MAX                         1000
+/* Least margin over the smoothed round trip, covers scheduling and USB adapter latency, us */
+#define ISP_RTO_SLACK_US                    2000
+/* Doublings of the round trip timeout after timeouts in a row */
+#define ISP_RTO_BACKOFF_MAX                 4
+/* Character time assumed until isp_set_line(), 115200 8N1, us */
+#define ISP_CHAR_US_DEFAULT                 87
+/* Bytes of a packet besides its payload: header and CRC, basic and extended */
+#define ISP_PKT_OVERHEAD                    (sizeof(packet_header_t) + 1)
+#define ISP_EXT_OVERHEAD                    (PKT_EXT_HDR_SIZE + PKT_EXT_CRC_SIZE)
+/* Time the device may take to program each PKT_PLD_SIZE bytes of a larger payload, ms */
+#define ISP_PROGRAM_TIMEOUT                 10
+/* Time the device may take to checksum a REG_RANGE_CRC range, ms */
+#define ISP_CRC_TIMEOUT                     1000
+/* Page CRCs fetched per REG_PAGE_CRC request */
+#define ISP_PAGE_CRC_BATCH(pld)             ((pld) / 4)
+/* REG_TEST_PATTERN reads a new line rate has to pass */
+#define ISP_BAUD_BURSTS                     4
+/* Tries of an idempotent transaction that timed out, and the time they may take, ms */
+#define ISP_ARQ_TRIES                       5
+#define ISP_ARQ_BUDGET                      2000
+/* Pause before the third try, doubled for each one after, and its limit, ms */
+#define ISP_ARQ_BACKOFF_MIN                 2
+#define ISP_ARQ_BACKOFF_MAX                 100
+/* Pause between handshakes of isp_wait_connect(), doubled each time, ms */
+#define ISP_CONNECT_BACKOFF_MIN             10
+#define ISP_CONNECT_BACKOFF_MAX             500
+/* Registers making up dev_attr_t */
+#define ISP_ATTR_FIRST                      REG_PART_NUMBER
+#define ISP_ATTR_LAST                       REG_CAPS
+/* Private typedef -----------------------------------------------------------*/
+typedef struct isp_frame_s {
+    /* transmission order and time of the last copy sent */
+    uint32_t stamp;
+    uint64_t sent_us;
+    /* number of copies sent */
+    uint8_t tries;
+    /* acknowledged by the device */
+    uint8_t acked;
+} isp_frame_t;
+
+typedef struct isp_zframe_s {
+    /* offset of the unpacked bytes from the start of the block and their number */
+    uint32_t offset;
+    uint16_t length;
+    /* LZ block, where it starts in the packed buffer and its size */
+    uint32_t at;
+    uint16_t size;
+} isp_zframe_t;
+
+typedef struct isp_eraser_s {
+    uint32_t page;
+    /* pages below done are erased, the ones up to end are still to be */
+    uint32_t done;
+    uint32_t end;
+    /* an erase of the page at done is in flight, copies sent and since when */
+    uint8_t busy;
+    uint8_t copies;
+    uint64_t deadline;
+    /* a fence read sent behind the copies of the last erase, tries and since when */
+    uint8_t fence;
+    uint64_t fence_deadline;
+    /* when the last erase was answered, frames sent before waited for it */
+    uint64_t idle_us;
+} isp_eraser_t;
+
+typedef struct isp_stream_s {
+    /* REG_WDATA frames: consecutive chunks of data */
+    const uint8_t *data;
+    uint32_t size;
+    uint16_t chunk;
+    /* REG_ZDATA frames instead when not NULL, their blocks packed in zbuf */
+    const isp_zframe_t *zf;
+    const uint8_t *zbuf;
+    /* number of frames */
+    uint32_t count;
+    /* erases pages ahead of the frames, NULL if they are erased already */
+    isp_eraser_t *er;
+} isp_stream_t;
+
+typedef struct isp_compare_s {
+    /* expected content of the bytes read back */
+    const uint8_t *data;
+    uint32_t addr;
+    isp_verify_t *verify;
+} isp_compare_t;
+/* Private macro -------------------------------------------------------------*/
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+/* The last failure will not go away by asking again */
+#define ISP_FINAL(sess)                     ((sess)->error == ISP_ERR_NAK || (sess)->error == ISP_ERR_PORT)
+/* Count an event in the session statistics, if kept */
+#define ISP_COUNT(sess, field)              do { if((sess)->stats) (sess)->stats->field++; } while(0)
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Bytes to ask for when reading each attribute register on its own */
+static const uint8_t isp_attr_size[ISP_ATTR_LAST - ISP_ATTR_FIRST + 1] = {
+    sizeof(((dev_attr_mcu_t *)0)->part_number) - 1,
+    sizeof(((dev_attr_mcu_t *)0)->uuid) - 1,
+    4,
+    4,
+    4,
+    FLASH_GEOMETRY_SIZE,
+    CAPS_SIZE,
+};
+/* Line rates tried by isp_upshift(), fastest first */
+static const uint32_t isp_rates[] = {
+    4000000, 3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400,
+};
+/* Private functions ---------------------------------------------------------*/
+static uint64_t isp_now_ms(void)
+{
+#if defined(_WIN32)
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+static uint64_t isp_now_us(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+/**
+  * @brief  time a number of bytes take on the wire at the current line rate
+  */
+static uint32_t wire_us(const isp_session_t *sess, uint32_t bytes)
+{
+    return bytes * sess->char_us;
+}
+
+/**
+  * @brief  bytes a packet with a payload of a given size takes on the wire
+  */
+static uint32_t pkt_bytes(uint32_t payload)
+{
+    return payload + (payload > PKT_PLD_SIZE ? ISP_EXT_OVERHEAD : ISP_PKT_OVERHEAD);
+}
+
+/**
+  * @brief  add a span, from start_us until now, to the session timeline
+  * @param  sess [I] - session, nothing is done unless it keeps statistics
+  * @param  lane [I] - STATS_LANE_*
+  * @param  name [I] - static string
+  * @param  start_us [I] - isp_now_us() at the start
+  * @param  reg_addr [I] - register involved
+  * @param  bytes [I] - bytes moved
+  * @param  result [I] - 0 = success, otherwise failure
+  * @retval none
+  */
+static void note_span(isp_session_t *sess, uint8_t lane, const char *name, uint64_t start_us,
+                      uint8_t reg_addr, uint32_t bytes, int32_t result)
+{
+    if(sess->stats)
+        stats_event(sess->stats, lane, name, start_us, isp_now_us(), reg_addr, bytes, result ? -1 : 0);
+}
+
+/**
+  * @brief  tell the progress watcher of the session, if any, how far isp_write() has got
+  */
+static void note_progress(isp_session_t *sess, uint32_t addr)
+{
+    if(sess->progress)
+        sess->progress(sess->progress_ctx, addr);
+}
+
+/**
+  * @brief  count a reply waited for in vain and mark it on the timeline
+  */
+static void note_timeout(isp_session_t *sess, uint8_t reg_addr)
+{
+    uint64_t now;
+
+    if(sess->stats == NULL)
+        return;
+    now = isp_now_us();
+    sess->stats->timeouts++;
+    stats_event(sess->stats, STATS_LANE_XFER, "timeout", now, now, reg_addr, 0, -1);
+}
+
+/**
+  * @brief  count a request or frame sent again and mark it on the timeline
+  */
+static void note_retry(isp_session_t *sess, uint8_t reg_addr)
+{
+    uint64_t now;
+
+    if(sess->stats == NULL)
+        return;
+    now = isp_now_us();
+    sess->stats->retries++;
+    stats_event(sess->stats, STATS_LANE_XFER, "retry", now, now, reg_addr, 0, -1);
+}
+
+/**
+  * @brief  count a TYPE_FAILURE_* reply, other unexpected types are not
+  */
+static void note_nak(isp_session_t *sess, uint8_t reg_addr, uint8_t type)
+{
+    uint64_t now;
+
+    if(sess->stats == NULL || !(type & 0x80) || type == TYPE_SUCCESS)
+        return;
+    now = isp_now_us();
+    sess->stats->naks++;
+    stats_event(sess->stats, STATS_LANE_XFER, "nak", now, now, reg_addr, type, -1);
+}
+
+/**
+  * @brief  record why a reply did not carry what was asked for
+  * @param  sess [I] - session
+  * @param  reg_addr [I] - register involved
+  * @param  type [I] - packet type of the reply
+  * @retval none
+  */
+static void reply_error(isp_session_t *sess, uint8_t reg_addr, uint8_t type)
+{
+    if((type & 0x80) && type != TYPE_SUCCESS)
+    {
+        sess->error = ISP_ERR_NAK;
+        sess->nak = type;
+        note_nak(sess, reg_addr, type);
+    }
+    else
+    {
+        sess->error = ISP_ERR_PROTOCOL;
+    }
+}
+
+/**
+  * @brief  write every queued frame to the port at once
+  * @param  sess [I] - session
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t tx_flush(isp_session_t *sess)
+{
+    stats_t *st = sess->stats;
+    uint64_t start = 0;
+    uint32_t bytes = 0, i;
+    int32_t ret = 0;
+
+    if(sess->tx.iovs)
+    {
+        if(st)
+            start = isp_now_us();
+        ret = com_sendv(sess->hdl, sess->tx.iov, sess->tx.iovs);
+        if(ret)
+            sess->error = ISP_ERR_PORT;
+        if(st)
+        {
+            for(i = 0; i < sess->tx.iovs; i++)
+                bytes += (uint32_t)sess->tx.iov[i].size;
+            st->frames_tx += sess->tx.frames;
+            st->bytes_tx += bytes;
+            st->wire_us += wire_us(sess, bytes);
+            st->send_us += isp_now_us() - start;
+            note_span(sess, STATS_LANE_LINK, "send", start, 0, bytes, ret);
+        }
+    }
+    frame_tx_init(&sess->tx);
+
+    return ret;
+}
+
+/**
+  * @brief  queue a frame to the device, flushing the queue first if full
+  * @param  sess [I] - session
+  * @param  type [I] - packet type
+  * @param  reg_addr [I] - register address
+  * @param  length [I] - number of bytes in payload
+  * @param  head [I] - first bytes of the payload, copied, may be NULL
+  * @param  head_size [I] - number of bytes in head
+  * @param  body [I] - rest of the payload, referenced until tx_flush()
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t tx_queue(isp_session_t *sess, uint8_t type, uint8_t reg_addr, uint16_t length,
+                        const uint8_t *head, uint8_t head_size, const uint8_t *body)
+{
+    if(sess->tx.frames == FRAME_TX_FRAMES && tx_flush(sess))
+        return -1;
+
+    if(frame_tx_add(&sess->tx, sess->dev_addr, type, reg_addr, length, head, head_size, body))
+    {
+        sess->error = ISP_ERR_PROTOCOL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  queue a frame and write it out with whatever was queued before
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t tx_send(isp_session_t *sess, uint8_t type, uint8_t reg_addr, uint16_t length, const uint8_t *payload)
+{
+    if(tx_queue(sess, type, reg_addr, length, NULL, 0, payload))
+        return -1;
+
+    return tx_flush(sess);
+}
+
+/**
+  * @brief  queue a SET frame to every device on the line, none of them answers it
+  * @param  sess [I] - session of any device on the line
+  * @param  reg_addr [I] - register address
+  * @param  length [I] - number of bytes in payload
+  * @param  head [I] - first bytes of the payload, copied, may be NULL
+  * @param  head_size [I] - number of bytes in head
+  * @param  body [I] - rest of the payload, referenced until tx_flush()
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t tx_broadcast(isp_session_t *sess, uint8_t reg_addr, uint16_t length,
+                            const uint8_t *head, uint8_t head_size, const uint8_t *body)
+{
+    if(sess->tx.frames == FRAME_TX_FRAMES && tx_flush(sess))
+        return -1;
+
+    if(frame_tx_add(&sess->tx, DEVICE_ADDR_BROADCAST, TYPE_SET, reg_addr, length, head, head_size, body))
+    {
+        sess->error = ISP_ERR_PROTOCOL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  how long to wait for a reply
+  * @param  rtt [I] - round trip estimate
+  * @param  wire [I] - time the request and its reply spend on the wire, us
+  * @retval timeout in ms
+  * @note   Until a round trip has been measured ISP_TIMEOUT is assumed.
+  *         Timeouts in a row double it, up to ISP_RTO_MAX unless the wire
+  *         time alone takes longer.
+  */
+static uint32_t rtt_timeout(const isp_rtt_t *rtt, uint32_t wire)
+{
+    uint32_t ms, cap;
+
+    if(!rtt->valid)
+        return ISP_TIMEOUT + (wire + 999) / 1000;
+
+    ms = (wire + rtt->srtt_us + (rtt->rttvar_us * 4 > ISP_RTO_SLACK_US ? rtt->rttvar_us * 4 : ISP_RTO_SLACK_US) + 999) / 1000;
+    if(ms < ISP_RTO_MIN)
+        ms = ISP_RTO_MIN;
+    cap = ms > ISP_RTO_MAX ? ms : ISP_RTO_MAX;
+    ms <<= rtt->backoff;
+
+    return ms < cap ? ms : cap;
+}
+
+/**
+  * @brief  fold a measured round trip into the estimate, as TCP does
+  * @param  rtt [I/O] - round trip estimate
+  * @param  sample [I] - round trip beyond the time on the wire, us
+  * @retval none
+  */
+static void rtt_update(isp_rtt_t *rtt, int64_t sample)
+{
+    uint32_t s = sample > 0 ? (uint32_t)sample : 0;
+    uint32_t dev;
+
+    if(!rtt->valid)
+    {
+        rtt->srtt_us = s;
+        rtt->rttvar_us = s / 2;
+        rtt->valid = 1;
+    }
+    else
+    {
+        dev = s > rtt->srtt_us ? s - rtt->srtt_us : rtt->srtt_us - s;
+        rtt->rttvar_us = rtt->rttvar_us - rtt->rttvar_us / 4 + dev / 4;
+        rtt->srtt_us = rtt->srtt_us - rtt->srtt_us / 8 + s / 8;
+    }
+    rtt->backoff = 0;
+}
+
+static void rtt_timed_out(isp_rtt_t *rtt)
+{
+    if(rtt->backoff < ISP_RTO_BACKOFF_MAX)
+        rtt->backoff++;
+}
+
+/**
+  * @brief  send a GET style request and wait for the matching SET reply
+  * @param  sess [I] - session
+  * @param  type [I] - TYPE_GET or TYPE_GET_RANGE
+  * @param  reg_addr [I] - (first) register address
+  * @param  count [I] - length field of the request
+  * @param  pdata [O] - reply payload
+  * @param  size [I] - capacity of pdata
+  * @param  length [O] - number of bytes returned, may be NULL
+  * @param  budget [I] - time the device may take on top of the round trip, ms
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t read_xfer(isp_session_t *sess, uint8_t type, uint8_t reg_addr, uint16_t count,
+                         uint8_t *pdata, uint16_t size, uint16_t *length, uint32_t budget)
+{
+    const char *name = type == TYPE_GET ? "GET" : "GET_RANGE";
+    packet_t pkt;
+    uint64_t deadline, now, sent_us;
+    /* only a request answered at the first try tells whose reply came back */
+    uint8_t clean = sess->rtt.backoff == 0;
+
+    sess->error = ISP_ERR_NONE;
+    sent_us = isp_now_us();
+    if(tx_send(sess, type, reg_addr, count, NULL))
+        return -1;
+    ISP_COUNT(sess, transactions);
+
+    deadline = isp_now_ms() + rtt_timeout(&sess->rtt, wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(size))) + budget;
+    while(1)
+    {
+        now = isp_now_ms();
+        if(now >= deadline || recv_packet(sess, &pkt, (uint32_t)(deadline - now)))
+        {
+            if(now >= deadline)
+                sess->error = ISP_ERR_TIMEOUT;
+            /* what is left of a damaged reply could hold up the next ones */
+            frame_rx_init(&sess->rx);
+            if(sess->error == ISP_ERR_TIMEOUT)
+            {
+                rtt_timed_out(&sess->rtt);
+                note_timeout(sess, reg_addr);
+            }
+            note_span(sess, STATS_LANE_XFER, name, sent_us, reg_addr, 0, -1);
+            return -1;
+        }
+
+        /* a late reply to an earlier request, keep waiting for ours */
+        if(pkt.header.dev_addr != sess->dev_addr || pkt.header.reg_addr != reg_addr)
+            continue;
+
+        if(clean && budget == ISP_BUDGET_NONE)
+            rtt_update(&sess->rtt, (int64_t)(isp_now_us() - sent_us) -
+                                   wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(pkt.length)));
+        sess->rtt.backoff = 0;
+
+        if(pkt.header.type != TYPE_SET || pkt.length > size)
+        {
+            reply_error(sess, reg_addr, pkt.header.type);
+            note_span(sess, STATS_LANE_XFER, name, sent_us, reg_addr, 0, -1);
+            return -1;
+        }
+
+        if(length) *length = pkt.length;
+        memcpy(pdata, pkt.payload, pkt.length);
+        note_span(sess, STATS_LANE_XFER, name, sent_us, reg_addr, pkt.length, 0);
+
+        return 0;
+    }
+}
+
+/**
+  * @brief  store the value of one attribute register
+  * @param  attr [O] - device attributes
+  * @param  reg_addr [I] - register address
+  * @param  val [I] - register value
+  * @param  len [I] - number of bytes in the value
+  * @retval 0 = success, -1 = malformed value
+  */
+static int32_t decode_attr(dev_attr_t *attr, uint8_t reg_addr, const uint8_t *val, uint8_t len)
+{
+    char *str;
+
+    switch(reg_addr)
+    {
+        case REG_PART_NUMBER:
+        case REG_UUID:
+            str = reg_addr == REG_PART_NUMBER ? attr->mcu.part_number : attr->mcu.uuid;
+            len = MIN(len, sizeof(attr->mcu.uuid) - 1);
+            memcpy(str, val, len);
+            str[len] = '\0';
+            return 0;
+
+        case REG_BLDR_VERSION:
+            if(len != 4)
+                return -1;
+            attr->bldr.major_ver = val[0];
+            attr->bldr.minor_ver = val[1];
+            attr->bldr.build_ver = GET_BE16(&val[2]);
+            return 0;
+
+        case REG_BLDR_ADDR:
+        case REG_BLDR_SIZE:
+            if(len != 4)
+                return -1;
+            if(reg_addr == REG_BLDR_ADDR)
+                attr->bldr.addr = GET_BE32(val);
+            else
+                attr->bldr.size = GET_BE32(val);
+            return 0;
+
+        case REG_FLASH_GEOMETRY:
+            if(len != FLASH_GEOMETRY_SIZE)
+                return -1;
+            attr->flash.aprom_addr = GET_BE32(&val[0]);
+            attr->flash.aprom_size = GET_BE32(&val[4]);
+            attr->flash.eeprom_addr = GET_BE32(&val[8]);
+            attr->flash.eeprom_size = GET_BE32(&val[12]);
+            attr->flash.page_size = GET_BE32(&val[16]);
+            return 0;
+
+        case REG_CAPS:
+            if(len != CAPS_SIZE)
+                return -1;
+            attr->caps = GET_BE32(&val[0]);
+            attr->max_window = val[4];
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+/**
+  * @brief  drop everything received until a point in time
+  * @param  sess [I] - session
+  * @param  deadline [I] - isp_now_ms() value to wait for
+  * @retval none
+  * @note   A failed port ends it early, sess->error is ISP_ERR_PORT then.
+  */
+static void drain_until(isp_session_t *sess, uint64_t deadline)
+{
+    packet_t pkt;
+    uint64_t now;
+
+    while((now = isp_now_ms()) < deadline)
+    {
+        if(recv_packet(sess, &pkt, (uint32_t)(deadline - now)) && sess->error == ISP_ERR_PORT)
+            break;
+    }
+    frame_rx_init(&sess->rx);
+}
+
+/**
+  * @brief  decide whether a failed idempotent transaction is worth another try
+  * @param  sess [I] - session, sess->error tells why it failed
+  * @param  reg_addr [I] - register involved
+  * @param  tries [I/O] - tries made so far, counted up
+  * @param  limit [I] - tries allowed
+  * @param  deadline [I] - isp_now_ms() value after which it is given up
+  * @retval 1 = send it again, 0 = give up
+  * @note   Only timeouts and malformed replies are retried; a NAK or a
+  *         failed port will not change by asking again. The second try
+  *         goes at once, a single lost frame being the likely cause; later
+  *         ones first let the line settle for a pause doubled each time.
+  */
+static int32_t arq_again(isp_session_t *sess, uint8_t reg_addr, uint32_t *tries, uint32_t limit, uint64_t deadline)
+{
+    uint32_t pause;
+    uint64_t now;
+    uint8_t error = sess->error;
+
+    if(ISP_FINAL(sess))
+        return 0;
+    if(++*tries >= limit || (now = isp_now_ms()) >= deadline)
+        return 0;
+
+    if(*tries > 1)
+    {
+        pause = MIN(ISP_ARQ_BACKOFF_MIN << (*tries - 2), ISP_ARQ_BACKOFF_MAX);
+        drain_until(sess, MIN(now + pause, deadline));
+        if(sess->error == ISP_ERR_PORT)
+            return 0;
+        sess->error = error;
+    }
+    note_retry(sess, reg_addr);
+
+    return 1;
+}
+
+/**
+  * @brief  time a packet with a payload of a given size takes on the line
+  * @retval ms, rounded up
+  * @note   Added to the budget of retried transfers for each try, which
+  *         on a slow line may be longer than the budget itself.
+  */
+static uint32_t arq_wire_ms(const isp_session_t *sess, uint32_t payload)
+{
+    return (wire_us(sess, pkt_bytes(payload)) + 999) / 1000;
+}
+
+/**
+  * @brief  read_xfer() retried on timeouts with bounded backoff
+  * @param  tries [I] - tries allowed, 1 = no retry
+  * @retval 0 = success, -1 = failure, sess->error tells why
+  */
+static int32_t arq_read(isp_session_t *sess, uint8_t type, uint8_t reg_addr, uint16_t count,
+                        uint8_t *pdata, uint16_t size, uint16_t *length, uint32_t tries)
+{
+    uint64_t deadline = isp_now_ms() + ISP_ARQ_BUDGET;
+    uint32_t n = 0;
+
+    do
+    {
+        if(read_xfer(sess, type, reg_addr, count, pdata, size, length, ISP_BUDGET_NONE) == 0)
+            return 0;
+    } while(arq_again(sess, reg_addr, &n, tries, deadline));
+
+    return -1;
+}
+
+/**
+  * @brief  write_reg() retried on timeouts with bounded backoff
+  * @note   Only for registers that may be written twice, e.g. REG_ADDR
+  *         or REG_ERASE.
+  * @retval 0 = success, -1 = failure, sess->error tells why
+  */
+static int32_t arq_write(isp_session_t *sess, uint8_t reg_addr, const uint8_t *pdata, uint16_t size, uint32_t budget)
+{
+    uint64_t deadline = isp_now_ms() + ISP_ARQ_BUDGET + budget;
+    uint32_t n = 0;
+
+    do
+    {
+        if(write_reg(sess, reg_addr, pdata, size, budget) == 0)
+            return 0;
+    } while(arq_again(sess, reg_addr, &n, ISP_ARQ_TRIES, deadline));
+
+    return -1;
+}
+
+/**
+  * @brief  check the link with a few full-size REG_TEST_PATTERN replies
+  * @param  sess [I] - session
+  * @retval 0 = every byte came back right, -1 = otherwise
+  */
+static int32_t test_link(isp_session_t *sess)
+{
+    uint8_t payload[PKT_PLD_SIZE];
+    uint16_t len;
+    uint32_t i, n;
+
+    /* the round trips measured so far were at another rate, and a late
+     * reply says nothing about the line: only damage fails the test */
+    for(i = 0; i < ISP_BAUD_BURSTS; i++)
+    {
+        if(read_reg(sess, REG_TEST_PATTERN, payload, sizeof(payload), &len, ISP_TIMEOUT) ||
+           len != sizeof(payload))
+            return -1;
+        for(n = 0; n < len; n++)
+            if(payload[n] != TEST_PATTERN_BYTE(n))
+                return -1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  move host and device to a new line rate, or back if it fails
+  * @param  sess [I] - connected session
+  * @param  param [I/O] - host line settings, updated on success
+  * @param  baudrate [I] - rate to try
+  * @retval 0 = running at the new rate, -1 = still at the old one
+  */
+static int32_t try_baudrate(isp_session_t *sess, com_param_t *param, uint32_t baudrate)
+{
+    com_param_t next = *param;
+    uint8_t payload[4];
+    uint64_t revert;
+    uint32_t tries;
+
+    PUT_BE32(payload, baudrate);
+    if(write_reg(sess, REG_BAUDRATE, payload, sizeof(payload), ISP_BUDGET_NONE))
+        return -1;
+    revert = isp_now_ms() + BAUDRATE_REVERT_MS;
+
+    next.baudrate = baudrate;
+    if(com_set_param(sess->hdl, &next) == 0)
+    {
+        isp_set_line(sess, &next);
+        frame_rx_init(&sess->rx);
+        if(test_link(sess) == 0)
+        {
+            /* repeating the SET at the new rate makes the device keep it */
+            for(tries = 0; tries < ISP_RETRIES; tries++)
+            {
+                if(write_reg(sess, REG_BAUDRATE, payload, sizeof(payload), ISP_BUDGET_NONE) == 0)
+                {
+                    *param = next;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    /* the device goes back on its own once the confirmation is overdue */
+    com_set_param(sess->hdl, param);
+    isp_set_line(sess, param);
+    drain_until(sess, revert + ISP_TIMEOUT);
+    if(test_link(sess) == 0)
+        return -1;
+
+    /* every confirmation reply was lost but the device did get one */
+    if(com_set_param(sess->hdl, &next) == 0)
+    {
+        isp_set_line(sess, &next);
+        frame_rx_init(&sess->rx);
+        if(test_link(sess) == 0)
+        {
+            *param = next;
+            return 0;
+        }
+    }
+    com_set_param(sess->hdl, param);
+    isp_set_line(sess, param);
+    frame_rx_init(&sess->rx);
+
+    return -1;
+}
+
+/**
+  * @brief  mark the pages whose device CRC differs from the new content
+  * @param  sess [I] - connected session
+  * @param  addr [I] - page aligned start address
+  * @param  data [I] - new content
+  * @param  pages [I] - number of pages
+  * @param  dirty [O] - one flag per page
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t diff_by_crc(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t pages, uint8_t *dirty)
+{
+    uint32_t page = sess->attr.flash.page_size;
+    uint8_t payload[ISP_PAGE_CRC_BATCH(PKT_EXT_PLD_SIZE) * 4];
+    uint16_t len;
+    uint32_t i, n, k;
+
+    PUT_BE32(payload, addr);
+    if(write_reg(sess, REG_ADDR, payload, 4, ISP_BUDGET_NONE))
+        return -1;
+
+    /* the pointer advances with every batch */
+    for(i = 0; i < pages; i += n)
+    {
+        n = MIN(pages - i, ISP_PAGE_CRC_BATCH(sess->frame_size));
+        if(read_reg(sess, REG_PAGE_CRC, payload, (uint16_t)(n * 4), &len, ISP_BUDGET_NONE) || len != n * 4)
+            return -1;
+        for(k = 0; k < n; k++)
+            dirty[i + k] = GET_BE32(&payload[k * 4]) != crc32_ieee(data + (i + k) * page, page);
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  queue one frame of a stream, without waiting for its ack
+  * @param  sess [I] - connected session
+  * @param  st [I] - stream
+  * @param  seq [I] - sequence number in the stream
+  * @retval 0 = success, -1 = failure
+  * @note   The frame refers to the stream data in place, it leaves with
+  *         the next tx_flush().
+  */
+static int32_t send_frame(isp_session_t *sess, const isp_stream_t *st, uint32_t seq)
+{
+    uint8_t head[ZDATA_HDR_SIZE];
+    const isp_zframe_t *zf;
+    uint32_t len;
+
+    PUT_BE16(head, (uint16_t)seq);
+    if(st->zf)
+    {
+        zf = &st->zf[seq];
+        PUT_BE32(&head[WDATA_SEQ_SIZE], zf->offset);
+        return tx_queue(sess, TYPE_SET, REG_ZDATA, (uint16_t)(ZDATA_HDR_SIZE + zf->size),
+                        head, ZDATA_HDR_SIZE, st->zbuf + zf->at);
+    }
+
+    len = MIN(st->chunk, st->size - seq * st->chunk);
+
+    return tx_queue(sess, TYPE_SET, REG_WDATA, (uint16_t)(WDATA_SEQ_SIZE + len),
+                    head, WDATA_SEQ_SIZE, st->data + seq * st->chunk);
+}
+
+/**
+  * @brief  offset from the stream base of the end of what a frame programs
+  */
+static uint32_t frame_end(const isp_stream_t *st, uint32_t seq)
+{
+    if(st->zf)
+        return st->zf[seq].offset + st->zf[seq].length;
+
+    return MIN(st->size, (seq + 1) * st->chunk);
+}
+
+/**
+  * @brief  queue an erase of the next page without waiting for the reply
+  * @param  sess [I] - connected session
+  * @param  er [I/O] - eraser, a copy is sent again if the erase is in flight
+  * @retval 0 = success, -1 = failure
+  * @note   The erase leaves with the next tx_flush(), ahead of any frame
+  *         queued after it.
+  */
+static int32_t erase_ahead(isp_session_t *sess, isp_eraser_t *er)
+{
+    uint8_t payload[4];
+
+    if(er->busy)
+    {
+        if(er->copies >= ISP_RETRIES)
+            return -1;
+        er->copies++;
+        note_retry(sess, REG_ERASE);
+    }
+    else
+    {
+        er->busy = 1;
+        er->copies = 1;
+    }
+    er->deadline = isp_now_ms() + rtt_timeout(&sess->rtt, wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(sizeof(payload)))) +
+                   ISP_PAGE_ERASE_TIMEOUT;
+
+    PUT_BE32(payload, er->done);
+    return tx_queue(sess, TYPE_SET, REG_ERASE, sizeof(payload), payload, sizeof(payload), NULL);
+}
+
+/**
+  * @brief  queue a read whose reply comes after any reply still due to an erase
+  * @param  sess [I] - connected session
+  * @param  er [I/O] - eraser, a copy is sent again if one is in flight
+  * @retval 0 = success, -1 = failure
+  * @note   The version register is read as it is never written while
+  *         programming, its reply cannot be taken for anything else.
+  */
+static int32_t erase_fence(isp_session_t *sess, isp_eraser_t *er)
+{
+    if(er->fence)
+    {
+        if(er->fence >= ISP_RETRIES)
+            return -1;
+        note_retry(sess, REG_BLDR_VERSION);
+    }
+    er->fence++;
+    er->fence_deadline = isp_now_ms() + rtt_timeout(&sess->rtt, wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(4)));
+
+    return tx_queue(sess, TYPE_GET, REG_BLDR_VERSION, 4, NULL, 0, NULL);
+}
+
+/**
+  * @brief  erase pages one acknowledged request at a time
+  * @param  sess [I] - connected session
+  * @param  er [I/O] - eraser, done moves up to end
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t erase_pages(isp_session_t *sess, isp_eraser_t *er)
+{
+    uint8_t payload[4];
+
+    for(; er->done < er->end; er->done += er->page)
+    {
+        PUT_BE32(payload, er->done);
+        if(arq_write(sess, REG_ERASE, payload, sizeof(payload), ISP_PAGE_ERASE_TIMEOUT))
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  program up to 65535 frames as one windowed stream
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address, the stream base
+  * @param  st [I] - frames
+  * @param  window [I] - frames kept in flight
+  * @retval 0 = success, -1 = failure
+  * @note   With st->er the page after the one being sent is erased while
+  *         its frames are on the line; a frame goes out only once every
+  *         page it touches has been reported erased.
+  */
+static int32_t write_stream(isp_session_t *sess, uint32_t addr, const isp_stream_t *st, uint8_t window)
+{
+    isp_frame_t ring[ISP_WINDOW_RING];
+    isp_frame_t *f, *last;
+    isp_eraser_t *er = st->er;
+    packet_t pkt;
+    uint8_t cfg[STREAM_SIZE];
+    uint32_t count, cum, next, ack, seq, stamp, newest, timeout, wire;
+    uint64_t now, left;
+    uint16_t sack;
+    uint8_t timeouts = 0;
+
+    count = st->count;
+
+    PUT_BE32(&cfg[0], addr);
+    PUT_BE16(&cfg[4], st->chunk);
+    if(write_reg(sess, REG_STREAM, cfg, sizeof(cfg), ISP_BUDGET_NONE))
+        return -1;
+
+    memset(ring, 0, sizeof(ring));
+    cum = next = stamp = 0;
+    /* an ack may come once every frame in flight has crossed the line */
+    wire = wire_us(sess, window * pkt_bytes(sess->frame_size) + pkt_bytes(WDATA_ACK_SIZE));
+
+    while(cum < count)
+    {
+        /* the device handles packets in order, an erase sent now lands behind the frames in flight */
+        if(er && !er->busy && !er->fence && er->done < er->end &&
+           er->done < addr + frame_end(st, MIN(next, count - 1)) + er->page && erase_ahead(sess, er))
+            return -1;
+
+        /* fill the window with fresh frames */
+        while(next < count && next < cum + window)
+        {
+            if(er && addr + frame_end(st, next) > er->done)
+                break;
+            f = &ring[next % ISP_WINDOW_RING];
+            f->stamp = ++stamp;
+            f->sent_us = isp_now_us();
+            f->tries = 1;
+            f->acked = 0;
+            if(send_frame(sess, st, next))
+                return -1;
+            next++;
+        }
+
+        /* frames behind an erase wait for it, give them as long as it may take */
+        timeout = rtt_timeout(&sess->frame_rtt, wire);
+        if(er && (er->busy || er->fence))
+        {
+            now = isp_now_ms();
+            left = er->busy ? er->deadline : er->fence_deadline;
+            left = left > now ? left - now : 0;
+            if(cum == next || left > timeout)
+                timeout = (uint32_t)left;
+        }
+
+        /* whatever this pass queued leaves in one write */
+        if(tx_flush(sess))
+            return -1;
+
+        /* damaged acks are dropped by the parser, the next one is cumulative */
+        if(recv_packet(sess, &pkt, timeout))
+        {
+            if(sess->error == ISP_ERR_PORT)
+                return -1;
+            if(er && er->busy && isp_now_ms() >= er->deadline && erase_ahead(sess, er))
+                return -1;
+            if(er && er->fence && isp_now_ms() >= er->fence_deadline && erase_fence(sess, er))
+                return -1;
+            if(cum == next)
+                continue;
+            /* silence: every frame still in flight is presumed lost */
+            rtt_timed_out(&sess->frame_rtt);
+            note_timeout(sess, st->zf ? REG_ZDATA : REG_WDATA);
+            if(++timeouts > ISP_WINDOW_RETRIES)
+                return -1;
+            for(seq = cum; seq < next; seq++)
+            {
+                f = &ring[seq % ISP_WINDOW_RING];
+                if(f->acked)
+                    continue;
+                if(f->tries++ >= ISP_WINDOW_RETRIES)
+                    return -1;
+                note_retry(sess, st->zf ? REG_ZDATA : REG_WDATA);
+                f->stamp = ++stamp;
+                f->sent_us = isp_now_us();
+                if(send_frame(sess, st, seq))
+                    return -1;
+            }
+            continue;
+        }
+
+        /**
+         * Erase replies carry no address. Taking the reply to an extra copy
+         * of the last erase for the answer to the next one would release
+         * frames onto a page that may never have been erased. An erase sent
+         * more than once is followed by a fence read instead, and the next
+         * erase waits for its reply: replies come in order, any still due
+         * to a copy come before it.
+         */
+        if(er && er->fence && pkt.header.dev_addr == sess->dev_addr && pkt.header.reg_addr == REG_BLDR_VERSION)
+        {
+            er->fence = 0;
+            continue;
+        }
+        if(er && pkt.header.dev_addr == sess->dev_addr && pkt.header.reg_addr == REG_ERASE)
+        {
+            if(!er->busy)
+                continue;
+            if(pkt.header.type != TYPE_SUCCESS)
+            {
+                reply_error(sess, REG_ERASE, pkt.header.type);
+                return -1;
+            }
+            if(er->copies > 1 && erase_fence(sess, er))
+                return -1;
+            er->busy = 0;
+            er->done += er->page;
+            er->idle_us = isp_now_us();
+            continue;
+        }
+
+        if(pkt.header.dev_addr != sess->dev_addr || pkt.header.reg_addr != (st->zf ? REG_ZDATA : REG_WDATA))
+            continue;
+        /* the device refused to program, no point retrying */
+        if(pkt.header.type & 0x80)
+        {
+            reply_error(sess, pkt.header.reg_addr, pkt.header.type);
+            return -1;
+        }
+        if(pkt.header.type != TYPE_SET || pkt.length != WDATA_ACK_SIZE)
+            continue;
+        timeouts = 0;
+
+        /* widen the 16-bit cumulative ack, it never lags behind cum */
+        ack = cum + (uint16_t)(GET_BE16(&pkt.payload[0]) - (uint16_t)cum);
+        sack = GET_BE16(&pkt.payload[2]);
+        if(ack > next)
+            continue;
+
+        /* mark everything acknowledged and remember the latest sent of it */
+        newest = 0;
+        last = NULL;
+        for(seq = cum; seq < next; seq++)
+        {
+            f = &ring[seq % ISP_WINDOW_RING];
+            if(f->acked)
+                continue;
+            if(seq < ack || (seq > ack && seq - ack <= WDATA_SACK_BITS && (sack & BIT(seq - ack - 1))))
+            {
+                f->acked = 1;
+                if(f->stamp > newest)
+                {
+                    newest = f->stamp;
+                    last = f;
+                }
+            }
+        }
+        seq = cum;
+        while(cum < next && ring[cum % ISP_WINDOW_RING].acked)
+            cum++;
+        if(cum > seq)
+            note_progress(sess, addr + frame_end(st, cum - 1));
+
+        /* time it unless it was resent or held up by an erase */
+        if(last && last->tries == 1 && (er == NULL || (!er->busy && last->sent_us >= er->idle_us)))
+            rtt_update(&sess->frame_rtt, (int64_t)(isp_now_us() - last->sent_us) -
+                                         wire_us(sess, pkt_bytes(sess->frame_size) + pkt_bytes(WDATA_ACK_SIZE)));
+        sess->frame_rtt.backoff = 0;
+
+        /**
+         * The device handles frames in order, so a frame sent before an
+         * acknowledged one and still unacknowledged has been lost: resend
+         * only those.
+         */
+        for(seq = cum; seq < next; seq++)
+        {
+            f = &ring[seq % ISP_WINDOW_RING];
+            if(f->acked || f->stamp > newest)
+                continue;
+            if(f->tries++ >= ISP_WINDOW_RETRIES)
+                return -1;
+            note_retry(sess, st->zf ? REG_ZDATA : REG_WDATA);
+            f->stamp = ++stamp;
+            f->sent_us = isp_now_us();
+            if(send_frame(sess, st, seq))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  program a block as windowed streams of REG_ZDATA frames
+  * @param  sess [I] - connected session, the device has CAP_ZDATA
+  * @param  addr [I] - flash address
+  * @param  data [I] - data to program
+  * @param  size [I] - number of bytes
+  * @param  window [I] - frames kept in flight
+  * @param  er [I/O] - erases pages ahead of the frames, NULL if none
+  * @retval 0 = success, -1 = failure, 1 = nothing sent, the data would not
+  *         take fewer bytes on the line packed than raw
+  */
+static int32_t write_packed(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size, uint8_t window,
+                            isp_eraser_t *er)
+{
+    isp_zframe_t *zf = NULL, *grown;
+    uint8_t *zbuf = NULL, *more;
+    isp_stream_t st;
+    uint32_t block = ISP_ZDATA_BLOCK(sess->frame_size);
+    uint32_t chunk = ISP_WINDOW_CHUNK(sess->frame_size);
+    uint32_t count = 0, cap = 0, pos = 0, packed = 0, room = 0, wire = 0, used, i;
+    uint64_t start;
+    int32_t ret = 0;
+
+    /* pack everything first, a frame is resent as it is */
+    while(pos < size)
+    {
+        if(count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            grown = (isp_zframe_t *)realloc(zf, cap * sizeof(isp_zframe_t));
+            if(grown == NULL)
+            {
+                free(zf);
+                free(zbuf);
+                return -1;
+            }
+            zf = grown;
+        }
+        if(room - packed < block)
+        {
+            room = room ? room * 2 : 64 * block;
+            more = (uint8_t *)realloc(zbuf, room);
+            if(more == NULL)
+            {
+                free(zf);
+                free(zbuf);
+                return -1;
+            }
+            zbuf = more;
+        }
+        zf[count].offset = pos;
+        zf[count].at = packed;
+        zf[count].size = (uint16_t)lz_pack(data + pos, MIN(size - pos, ZDATA_RAW_MAX),
+                                           zbuf + packed, block, &used);
+        zf[count].length = (uint16_t)used;
+        packed += zf[count].size;
+        wire += pkt_bytes(ZDATA_HDR_SIZE + zf[count].size);
+        pos += used;
+        count++;
+    }
+
+    /* frames differ in size once extended, so weigh the bytes on the line */
+    if(wire >= (size + chunk - 1) / chunk * pkt_bytes(WDATA_SEQ_SIZE + chunk))
+    {
+        free(zf);
+        free(zbuf);
+        return 1;
+    }
+
+    memset(&st, 0x00, sizeof(st));
+    st.er = er;
+    st.chunk = (uint16_t)chunk;
+    st.zbuf = zbuf;
+    for(i = 0; i < count && ret == 0; i += st.count)
+    {
+        /* the base stays put, offsets are from the start of the block */
+        st.zf = zf + i;
+        st.count = MIN(count - i, 0xFFFFu);
+        start = isp_now_us();
+        ret = write_stream(sess, addr, &st, window);
+        note_span(sess, STATS_LANE_XFER, "stream", start, REG_ZDATA,
+                  frame_end(&st, st.count - 1) - zf[i].offset, ret);
+    }
+    /* a failed stream may leave frames queued that point into zbuf */
+    frame_tx_init(&sess->tx);
+    free(zf);
+    free(zbuf);
+
+    if(ret == 0)
+    {
+        sess->z_raw += size;
+        sess->z_packed += packed;
+    }
+
+    return ret;
+}
+
+/**
+  * @brief  point the device at an address, retrying on timeouts
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t set_addr(isp_session_t *sess, uint32_t addr)
+{
+    uint8_t ptr[4];
+
+    PUT_BE32(ptr, addr);
+
+    return arq_write(sess, REG_ADDR, ptr, sizeof(ptr), ISP_BUDGET_NONE);
+}
+
+/**
+  * @brief  program a block with one acknowledged REG_DATA packet at a time
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  data [I] - data to program
+  * @param  size [I] - number of bytes
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t write_stop_and_wait(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    uint32_t len, budget, tries;
+    uint64_t deadline;
+    int sync = 0;
+
+    while(size)
+    {
+        len = MIN(size, sess->frame_size);
+        /* programming a basic payload is part of the round trip, more is not */
+        budget = (len - 1) / PKT_PLD_SIZE * ISP_PROGRAM_TIMEOUT;
+        deadline = isp_now_ms() + ISP_ARQ_BUDGET + ISP_ARQ_TRIES * (budget + arq_wire_ms(sess, len));
+        tries = 0;
+        while(1)
+        {
+            /* the pointer advances by itself, rewrite it only when unknown */
+            if(!sync)
+            {
+                if(set_addr(sess, addr))
+                    return -1;
+                sync = 1;
+            }
+            if(write_reg(sess, REG_DATA, data, (uint16_t)len, budget) == 0)
+                break;
+            /* programmed or not, the same data goes again to a known address */
+            sync = 0;
+            if(!arq_again(sess, REG_DATA, &tries, ISP_ARQ_TRIES, deadline))
+                return -1;
+        }
+
+        addr += len;
+        data += len;
+        size -= len;
+        note_progress(sess, addr);
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  read a block with one REG_DATA request at a time
+  * @param  sess [I] - connected session
+  * @param  addr [I] - flash address
+  * @param  size [I] - number of bytes
+  * @param  sink [I] - consumer of the data
+  * @param  ctx [I] - passed to sink
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t read_stop_and_wait(isp_session_t *sess, uint32_t addr, uint32_t size, isp_sink_t sink, void *ctx)
+{
+    uint8_t data[PKT_EXT_PLD_SIZE];
+    uint32_t done = 0, len, tries;
+    uint64_t deadline;
+    uint16_t got;
+    int sync = 0;
+
+    while(done < size)
+    {
+        len = MIN(size - done, sess->frame_size);
+        deadline = isp_now_ms() + ISP_ARQ_BUDGET + ISP_ARQ_TRIES * arq_wire_ms(sess, len);
+        tries = 0;
+        while(1)
+        {
+            if(!sync)
+            {
+                if(set_addr(sess, addr + done))
+                    return -1;
+                sync = 1;
+            }
+            if(read_reg(sess, REG_DATA, data, (uint16_t)len, &got, ISP_BUDGET_NONE) == 0)
+            {
+                if(got == len)
+                    break;
+                sess->error = ISP_ERR_PROTOCOL;
+            }
+            /**
+             * The pointer may or may not have moved. Forget what is left of
+             * a damaged reply too: its data could pass for the header of a
+             * long frame and swallow the replies that follow.
+             */
+            frame_rx_init(&sess->rx);
+            sync = 0;
+            if(!arq_again(sess, REG_DATA, &tries, ISP_ARQ_TRIES, deadline))
+                return -1;
+        }
+        if(sink(ctx, done, data, len))
+            return -1;
+        done += len;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  read a block with several REG_RDATA requests in flight
+  * @param  sess [I] - connected session, the device has CAP_RDATA
+  * @param  addr [I] - flash address
+  * @param  size [I] - number of bytes
+  * @param  window [I] - requests kept in flight
+  * @param  sink [I] - consumer of the data, fed in order
+  * @param  ctx [I] - passed to sink
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t read_window(isp_session_t *sess, uint32_t addr, uint32_t size, uint8_t window, isp_sink_t sink, void *ctx)
+{
+    packet_t pkt;
+    uint32_t chunk = ISP_RDATA_CHUNK(sess->frame_size);
+    uint32_t done = 0, sent = 0, inflight = 0, at, len, timeout = 0;
+    uint8_t resyncs = 0;
+
+    if(set_addr(sess, addr))
+        return -1;
+
+    while(done < size)
+    {
+        /* keep the pipe full, the device pointer runs ahead of what arrived */
+        while(inflight < window && sent < size)
+        {
+            len = MIN(size - sent, chunk);
+            if(tx_queue(sess, TYPE_GET, REG_RDATA, (uint16_t)(RDATA_ADDR_SIZE + len), NULL, 0, NULL))
+                return -1;
+            sent += len;
+            inflight++;
+        }
+        if(tx_flush(sess))
+            return -1;
+
+        /* the reply asked for last may queue behind all the others */
+        timeout = rtt_timeout(&sess->rtt, wire_us(sess, inflight * (ISP_PKT_OVERHEAD + pkt_bytes(sess->frame_size))));
+        if(recv_packet(sess, &pkt, timeout) == 0)
+        {
+            if(pkt.header.dev_addr != sess->dev_addr || pkt.header.reg_addr != REG_RDATA)
+                continue;
+            if(pkt.header.type != TYPE_SET)
+            {
+                reply_error(sess, REG_RDATA, pkt.header.type);
+                return -1;
+            }
+            if(inflight)
+                inflight--;
+            if(pkt.length <= RDATA_ADDR_SIZE)
+                continue;
+
+            at = GET_BE32(pkt.payload) - addr;
+            len = pkt.length - RDATA_ADDR_SIZE;
+            if(at == done && len <= size - done)
+            {
+                if(sink(ctx, done, &pkt.payload[RDATA_ADDR_SIZE], len))
+                    return -1;
+                done += len;
+                resyncs = 0;
+                continue;
+            }
+            /* a copy of data already delivered, a late reply after a resync */
+            if(at < done)
+                continue;
+        }
+        else
+        {
+            if(sess->error == ISP_ERR_PORT)
+                return -1;
+            rtt_timed_out(&sess->rtt);
+            note_timeout(sess, REG_RDATA);
+        }
+
+        /**
+         * A request or reply was lost: let the pipe run dry, then restart
+         * from the first byte not delivered. Later replies are dropped
+         * rather than buffered, which keeps the sink strictly sequential.
+         */
+        if(++resyncs > ISP_WINDOW_RETRIES)
+            return -1;
+        note_retry(sess, REG_RDATA);
+        drain_until(sess, isp_now_ms() + timeout);
+        if(set_addr(sess, addr + done))
+            return -1;
+        sent = done;
+        inflight = 0;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  CRC-32 the device computes over a flash range
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t range_crc(isp_session_t *sess, uint32_t addr, uint32_t size, uint32_t *crc)
+{
+    uint8_t payload[RANGE_CRC_SIZE];
+    uint16_t len;
+
+    /* the device keeps the result, a lost reply only takes another read */
+    PUT_BE32(&payload[0], addr);
+    PUT_BE32(&payload[4], size);
+    if(arq_write(sess, REG_RANGE_CRC, payload, RANGE_CRC_SIZE, ISP_CRC_TIMEOUT) ||
+       arq_read(sess, TYPE_GET, REG_RANGE_CRC, 4, payload, 4, &len, ISP_ARQ_TRIES))
+        return -1;
+    if(len != 4)
+    {
+        sess->error = ISP_ERR_PROTOCOL;
+        return -1;
+    }
+    *crc = GET_BE32(payload);
+
+    return 0;
+}
+
+/**
+  * @brief  isp_read() sink counting the bytes that differ from isp_compare_t
+  */
+static int32_t compare_sink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    isp_compare_t *cmp = (isp_compare_t *)ctx;
+    uint32_t i;
+
+    for(i = 0; i < size; i++)
+    {
+        if(data[i] == cmp->data[offset + i])
+            continue;
+        if(cmp->verify->mismatches++ == 0)
+            cmp->verify->first_bad = cmp->addr + offset + i;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  read a range back and count the bytes that differ
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t read_compare(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size,
+                            uint8_t window, isp_verify_t *verify)
+{
+    isp_compare_t cmp;
+
+    cmp.data = data;
+    cmp.addr = addr;
+    cmp.verify = verify;
+    verify->read_back += size;
+
+    return isp_read(sess, addr, size, window, compare_sink, &cmp);
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t send_packet(com_handle_t hdl, uint8_t dev_addr, uint8_t type, uint8_t reg_addr, uint16_t length, const uint8_t *payload)
+{
+    frame_tx_t tx;
+
+    frame_tx_init(&tx);
+    if(frame_tx_add(&tx, dev_addr, type, reg_addr, length, NULL, 0, payload))
+        return -1;
+
+    return com_sendv(hdl, tx.iov, tx.iovs);
+}
+
+int32_t recv_packet(isp_session_t *sess, packet_t *pkt, uint32_t timeout)
+{
+    frame_rx_t *rx = &sess->rx;
+    stats_t *st = sess->stats;
+    uint64_t deadline = isp_now_ms() + timeout;
+    uint64_t now, start = 0;
+    uint32_t crc_errors = rx->crc_errors, resyncs = rx->resyncs;
+    uint8_t *space;
+    size_t size, want, rxlen;
+    int32_t ret = -1;
+
+    while(1)
+    {
+        if(frame_rx_parse(rx))
+        {
+            memcpy(pkt, &rx->pkt, offsetof(packet_t, payload) + rx->pkt.length);
+            ret = 0;
+            break;
+        }
+
+        now = isp_now_ms();
+        if(now >= deadline)
+        {
+            sess->error = ISP_ERR_TIMEOUT;
+            break;
+        }
+
+        /* never ask for more than the frame needs, so it completes on its last byte */
+        space = frame_rx_space(rx, &size);
+        want = frame_rx_needed(rx);
+        if(st)
+            start = isp_now_us();
+        if(com_recv(sess->hdl, space, want < size ? want : size, &rxlen, (uint32_t)(deadline - now)))
+        {
+            sess->error = ISP_ERR_PORT;
+            break;
+        }
+        if(st)
+        {
+            st->bytes_rx += rxlen;
+            st->wire_us += wire_us(sess, (uint32_t)rxlen);
+            st->wait_us += isp_now_us() - start;
+            note_span(sess, STATS_LANE_LINK, "wait", start, 0, (uint32_t)rxlen, rxlen ? 0 : -1);
+        }
+        if(rxlen == 0)
+        {
+            sess->error = ISP_ERR_TIMEOUT;
+            break;
+        }
+        frame_rx_commit(rx, rxlen);
+    }
+
+    if(st)
+    {
+        st->frames_rx += ret == 0;
+        st->crc_errors += rx->crc_errors - crc_errors;
+        st->resync_bytes += rx->resyncs - resyncs;
+    }
+
+    return ret;
+}
+
+int32_t read_reg(isp_session_t *sess, uint8_t reg_addr, uint8_t *pdata, uint16_t size, uint16_t *length, uint32_t budget)
+{
+    return read_xfer(sess, TYPE_GET, reg_addr, size, pdata, size, length, budget);
+}
+
+int32_t write_reg(isp_session_t *sess, uint8_t reg_addr, const uint8_t *pdata, uint16_t size, uint32_t budget)
+{
+    packet_t pkt;
+    uint64_t deadline, now, sent_us;
+    uint8_t clean = sess->rtt.backoff == 0;
+
+    sess->error = ISP_ERR_NONE;
+    sent_us = isp_now_us();
+    if(tx_send(sess, TYPE_SET, reg_addr, size, pdata))
+        return -1;
+    ISP_COUNT(sess, transactions);
+
+    deadline = isp_now_ms() + rtt_timeout(&sess->rtt, wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(size))) + budget;
+    while(1)
+    {
+        now = isp_now_ms();
+        if(now >= deadline || recv_packet(sess, &pkt, (uint32_t)(deadline - now)))
+        {
+            if(now >= deadline)
+                sess->error = ISP_ERR_TIMEOUT;
+            /* what is left of a damaged reply could hold up the next ones */
+            frame_rx_init(&sess->rx);
+            if(sess->error == ISP_ERR_TIMEOUT)
+            {
+                rtt_timed_out(&sess->rtt);
+                note_timeout(sess, reg_addr);
+            }
+            note_span(sess, STATS_LANE_XFER, "SET", sent_us, reg_addr, size, -1);
+            return -1;
+        }
+
+        if(pkt.header.dev_addr != sess->dev_addr || pkt.header.reg_addr != reg_addr)
+            continue;
+
+        if(clean && budget == ISP_BUDGET_NONE)
+            rtt_update(&sess->rtt, (int64_t)(isp_now_us() - sent_us) - wire_us(sess, ISP_PKT_OVERHEAD + pkt_bytes(size)));
+        sess->rtt.backoff = 0;
+
+        if(pkt.header.type != TYPE_SUCCESS)
+        {
+            reply_error(sess, reg_addr, pkt.header.type);
+            note_span(sess, STATS_LANE_XFER, "SET", sent_us, reg_addr, size, -1);
+            return -1;
+        }
+        note_span(sess, STATS_LANE_XFER, "SET", sent_us, reg_addr, size, 0);
+
+        return 0;
+    }
+}
+
+int32_t get_dev_attr(isp_session_t *sess, dev_attr_t *attr)
+{
+    uint8_t payload[PKT_PLD_SIZE];
+    uint32_t done = 0;
+    uint16_t len;
+    uint8_t off, reg;
+    /* a device that never answered is not retried, the caller polls for it */
+    uint32_t tries = 1;
+
+    memset(attr, 0x00, sizeof(dev_attr_t));
+
+    /* one round trip for the whole block if the bootloader can do it */
+    if(!sess->no_get_range)
+    {
+        if(arq_read(sess, TYPE_GET_RANGE, ISP_ATTR_FIRST, ISP_ATTR_LAST - ISP_ATTR_FIRST + 1,
+                    payload, sizeof(payload), &len, tries) == 0)
+        {
+            tries = ISP_ARQ_TRIES;
+            for(off = 0, reg = ISP_ATTR_FIRST; off < len && reg <= ISP_ATTR_LAST; reg++)
+            {
+                if(payload[off] > len - off - 1 ||
+                   decode_attr(attr, reg, &payload[off + 1], payload[off]))
+                    break;
+                done |= BIT(reg);
+                off += payload[off] + 1;
+            }
+        }
+        else if(sess->error == ISP_ERR_NAK)
+        {
+            sess->no_get_range = 1;
+        }
+        else if(sess->error == ISP_ERR_PORT)
+        {
+            return -1;
+        }
+        /* lost on the way or ignored by an old bootloader, read one by one */
+    }
+
+    /* whatever the block did not cover, one register at a time, retrying
+     * only the one that failed */
+    for(reg = ISP_ATTR_FIRST; reg <= ISP_ATTR_LAST; reg++)
+    {
+        if(done & BIT(reg))
+            continue;
+        if(arq_read(sess, TYPE_GET, reg, isp_attr_size[reg - ISP_ATTR_FIRST], payload,
+                    isp_attr_size[reg - ISP_ATTR_FIRST], &len, tries))
+        {
+            /* older bootloaders do not know REG_CAPS */
+            if(reg == REG_CAPS && sess->error == ISP_ERR_NAK)
+                continue;
+            return -1;
+        }
+        tries = ISP_ARQ_TRIES;
+        if(decode_attr(attr, reg, payload, (uint8_t)len))
+        {
+            if(reg == REG_CAPS)
+                continue;
+            sess->error = ISP_ERR_PROTOCOL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void isp_init(isp_session_t *sess, com_handle_t hdl, uint8_t dev_addr)
+{
+    memset(sess, 0x00, sizeof(isp_session_t));
+    sess->hdl = hdl;
+    sess->dev_addr = dev_addr;
+    frame_rx_init(&sess->rx);
+    frame_tx_init(&sess->tx);
+    sess->char_us = ISP_CHAR_US_DEFAULT;
+    sess->frame_limit = PKT_EXT_PLD_SIZE;
+    sess->frame_size = PKT_PLD_SIZE;
+}
+
+void isp_set_line(isp_session_t *sess, const com_param_t *param)
+{
+    uint32_t bits;
+
+    if(param->baudrate == 0)
+        return;
+
+    /* start bit + data bits + parity bit + stop bits, 1.5 rounded up */
+    bits = 1 + param->bytesize + (param->parity != COM_PARITY_NONE) + (param->stopbits == COM_STOPBITS_1 ? 1 : 2);
+    sess->char_us = (bits * 1000000 + param->baudrate - 1) / param->baudrate;
+}
+
+int32_t isp_connect(isp_session_t *sess)
+{
+    uint8_t payload[FRAME_SIZE_SIZE];
+    uint16_t len;
+
+    if(sess->attr_valid)
+        return 0;
+
+    ISP_COUNT(sess, connects);
+    sess->frame_size = PKT_PLD_SIZE;
+    if(get_dev_attr(sess, &sess->attr))
+        return -1;
+
+    if(sess->attr.caps & CAP_EXT_FRAME)
+    {
+        if(arq_read(sess, TYPE_GET, REG_FRAME_SIZE, sizeof(payload), payload, sizeof(payload), &len, ISP_ARQ_TRIES))
+            return -1;
+        if(len != sizeof(payload))
+        {
+            sess->error = ISP_ERR_PROTOCOL;
+            return -1;
+        }
+        sess->attr.max_frame = MIN(GET_BE16(payload), PKT_EXT_PLD_SIZE);
+        /* a device taking less than a basic frame is odd, ignore it */
+        if(sess->attr.max_frame > PKT_PLD_SIZE && sess->frame_limit > PKT_PLD_SIZE)
+            sess->frame_size = MIN(sess->attr.max_frame, sess->frame_limit);
+    }
+    sess->attr_valid = 1;
+
+    return 0;
+}
+
+int32_t isp_wait_connect(isp_session_t *sess, uint32_t wait_ms)
+{
+    uint64_t deadline = isp_now_ms() + wait_ms, now, until;
+    uint32_t pause = ISP_CONNECT_BACKOFF_MIN;
+    uint8_t error;
+
+    while(isp_connect(sess))
+    {
+        now = isp_now_ms();
+        if(ISP_FINAL(sess) || (wait_ms && now >= deadline))
+            return -1;
+
+        /* whatever a device sends while it boots is dropped meanwhile */
+        error = sess->error;
+        until = now + pause;
+        drain_until(sess, wait_ms ? MIN(until, deadline) : until);
+        if(sess->error == ISP_ERR_PORT)
+            return -1;
+        sess->error = error;
+        pause = MIN(pause * 2, ISP_CONNECT_BACKOFF_MAX);
+    }
+
+    return 0;
+}
+
+const char *isp_strerror(const isp_session_t *sess)
+{
+    switch(sess->error)
+    {
+        case ISP_ERR_NONE:      return "no error";
+        case ISP_ERR_TIMEOUT:   return "no reply";
+        case ISP_ERR_PORT:      return "port failure";
+        case ISP_ERR_PROTOCOL:  return "protocol error";
+        default:                break;
+    }
+
+    switch(sess->nak)
+    {
+        case TYPE_FAILURE_UNKNOWN_REG:      return "unknown register";
+        case TYPE_FAILURE_ERR_LENGTH:       return "wrong length";
+        case TYPE_FAILURE_NOT_SUPPORT:      return "not supported";
+        case TYPE_FAILURE_ERR_PASSWD:       return "wrong password";
+        case TYPE_FAILURE_ERR_SIGNATURE:    return "bad signature";
+        case TYPE_FAILURE_ERR_HAL:          return "flash driver error";
+        case TYPE_FAILURE_ERR_PARAM:        return "bad parameter";
+        default:                            return "refused";
+    }
+}
+
+int32_t isp_upshift(isp_session_t *sess, com_param_t *param, uint32_t max_baudrate)
+{
+    uint8_t payload[BAUDRATE_SIZE];
+    uint16_t len;
+    uint32_t limit, i;
+
+    /* a raw TCP device server keeps the rate it was set up for */
+    if(!(sess->attr.caps & CAP_BAUDRATE) || com_fixed_line(sess->hdl))
+        return 0;
+
+    if(read_reg(sess, REG_BAUDRATE, payload, sizeof(payload), &len, ISP_BUDGET_NONE) || len != BAUDRATE_SIZE)
+        return -1;
+    limit = GET_BE32(&payload[4]);
+    if(max_baudrate && max_baudrate < limit)
+        limit = max_baudrate;
+
+    /* fastest first, a rate the cable cannot carry fails its test burst */
+    for(i = 0; i < sizeof(isp_rates) / sizeof(isp_rates[0]); i++)
+    {
+        if(isp_rates[i] <= param->baudrate)
+            break;
+        if(isp_rates[i] <= limit && try_baudrate(sess, param, isp_rates[i]) == 0)
+            break;
+    }
+
+    return 0;
+}
+
+int32_t isp_area(const isp_session_t *sess, uint8_t area, uint32_t *addr, uint32_t *size)
+{
+    const dev_attr_flash_t *flash = &sess->attr.flash;
+
+    switch(area)
+    {
+        case ISP_AREA_APROM:
+            *addr = flash->aprom_addr;
+            *size = flash->aprom_size;
+            return 0;
+        case ISP_AREA_EEPROM:
+            *addr = flash->eeprom_addr;
+            *size = flash->eeprom_size;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+int32_t isp_erase(isp_session_t *sess, uint8_t area)
+{
+    return arq_write(sess, REG_ERASE, &area, 1, ISP_ERASE_TIMEOUT);
+}
+
+int32_t isp_write(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size, uint8_t window)
+{
+    isp_eraser_t eraser, *er = NULL;
+    isp_stream_t st;
+    uint32_t page = sess->attr.flash.page_size;
+    uint32_t chunk = ISP_WINDOW_CHUNK(sess->frame_size);
+    uint32_t len;
+    uint64_t start;
+    int32_t ret;
+
+    if(!(sess->attr.caps & CAP_WINDOW) || sess->attr.max_window < 2)
+        window = 1;
+    window = MIN(window, MIN(sess->attr.max_window, WDATA_SACK_BITS));
+
+    if(sess->erase_ahead && size)
+    {
+        if(page == 0)
+            return -1;
+        memset(&eraser, 0x00, sizeof(eraser));
+        eraser.page = page;
+        eraser.done = addr - addr % page;
+        eraser.end = (uint32_t)(((uint64_t)addr + size + page - 1) / page * page);
+        er = &eraser;
+    }
+
+    if(sess->compress && (sess->attr.caps & (CAP_WINDOW | CAP_ZDATA)) == (CAP_WINDOW | CAP_ZDATA))
+    {
+        ret = write_packed(sess, addr, data, size, window ? window : 1, er);
+        if(ret <= 0)
+            return ret;
+        /* the data does not pack, send it as it is */
+    }
+
+    if(window <= 1)
+    {
+        /* nothing to overlap the erases with */
+        if(er && erase_pages(sess, er))
+            return -1;
+        return write_stop_and_wait(sess, addr, data, size);
+    }
+
+    /* sequence numbers are 16-bit, split very long blocks into streams */
+    memset(&st, 0x00, sizeof(st));
+    st.er = er;
+    st.chunk = (uint16_t)chunk;
+    while(size)
+    {
+        len = MIN(size, 0xFFFFu * chunk);
+        st.data = data;
+        st.size = len;
+        st.count = (len + chunk - 1) / chunk;
+        start = isp_now_us();
+        ret = write_stream(sess, addr, &st, window);
+        note_span(sess, STATS_LANE_XFER, "stream", start, REG_WDATA, len, ret);
+        if(ret)
+        {
+            /* never send what a failed stream left queued later on */
+            frame_tx_init(&sess->tx);
+            return -1;
+        }
+        addr += len;
+        data += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+int32_t isp_write_diff(isp_session_t *sess, uint8_t area, const uint8_t *data, const uint8_t *prev,
+                       uint8_t window, isp_diff_t *diff)
+{
+    uint32_t page = sess->attr.flash.page_size;
+    uint32_t addr, size, pages, i, j, k, len;
+    uint8_t payload[4];
+    uint8_t *dirty, ahead = sess->erase_ahead;
+    int32_t ret = 0;
+
+    if(isp_area(sess, area, &addr, &size) || page == 0 || size % page || addr % page)
+        return -1;
+    pages = size / page;
+
+    memset(diff, 0x00, sizeof(isp_diff_t));
+    diff->pages = pages;
+
+    dirty = (uint8_t *)malloc(pages ? pages : 1);
+    if(dirty == NULL)
+        return -1;
+
+    if(prev)
+    {
+        /* trust what was flashed last time, no need to ask the device */
+        for(i = 0; i < pages; i++)
+            dirty[i] = memcmp(data + i * page, prev + i * page, page) != 0;
+    }
+    else if((sess->attr.caps & CAP_PAGE_CRC) && diff_by_crc(sess, addr, data, pages, dirty) == 0)
+    {
+        diff->queried = 1;
+    }
+    else
+    {
+        memset(dirty, 1, pages);
+    }
+
+    for(i = 0; i < pages; i++)
+        diff->changed += dirty[i];
+
+    if(diff->changed == pages)
+    {
+        /* everything changes, a mass erase is one transaction */
+        ret = isp_erase(sess, area == ISP_AREA_APROM ? ERASE_APROM : ERASE_EEPROM);
+        sess->erase_ahead = 0;
+    }
+    else if(!ahead)
+    {
+        for(i = 0; i < pages && ret == 0; i++)
+        {
+            if(!dirty[i])
+                continue;
+            PUT_BE32(payload, addr + i * page);
+            ret = arq_write(sess, REG_ERASE, payload, sizeof(payload), ISP_PAGE_ERASE_TIMEOUT);
+        }
+    }
+
+    /* program runs of changed pages, leaving out their erased tail */
+    for(i = 0; i < pages && ret == 0; i = j)
+    {
+        if(!dirty[i])
+        {
+            j = i + 1;
+            continue;
+        }
+        for(j = i; j < pages && dirty[j]; j++);
+        for(len = (j - i) * page; len && data[i * page + len - 1] == 0xFF; len--);
+        /* isp_write() erases what it programs, the blank tail is left to us */
+        for(k = i + (len + page - 1) / page; sess->erase_ahead && k < j && ret == 0; k++)
+        {
+            PUT_BE32(payload, addr + k * page);
+            ret = arq_write(sess, REG_ERASE, payload, sizeof(payload), ISP_PAGE_ERASE_TIMEOUT);
+        }
+        if(len && ret == 0)
+            ret = isp_write(sess, addr + i * page, data + i * page, len, window);
+    }
+
+    sess->erase_ahead = ahead;
+    free(dirty);
+
+    return ret;
+}
+
+int32_t isp_bus_erase(isp_session_t *const *sess, uint32_t count, uint8_t area)
+{
+    uint8_t ptr[4];
+    uint32_t i;
+    int32_t ret = 0;
+
+    if(count == 0)
+        return 0;
+
+    if(tx_broadcast(sess[0], REG_ERASE, 1, &area, 1, NULL) || tx_flush(sess[0]))
+        return -1;
+
+    /* each device answers once it is done, they all started at the same time */
+    for(i = 0; i < count; i++)
+    {
+        if(read_reg(sess[i], REG_ADDR, ptr, sizeof(ptr), NULL, ISP_ERASE_TIMEOUT) == 0)
+            continue;
+        if(sess[i]->error == ISP_ERR_PORT)
+            return -1;
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int32_t isp_bus_write(isp_session_t *pacer, uint32_t addr, const uint8_t *data, uint32_t size, uint16_t frame,
+                      uint32_t *frames)
+{
+    uint8_t ptr[4], reply[4];
+    uint32_t len, i, budget, tries;
+
+    *frames = 0;
+    for(; size; addr += len, data += len, size -= len)
+    {
+        len = MIN(size, frame);
+        /* the area was erased, a blank frame need not go out */
+        for(i = 0; i < len && data[i] == 0xFF; i++);
+        if(i == len)
+            continue;
+
+        /* each frame carries its address, a device missing one is left with a hole */
+        PUT_BE32(ptr, addr);
+        if(tx_broadcast(pacer, REG_ADDR, sizeof(ptr), ptr, sizeof(ptr), NULL) ||
+           tx_broadcast(pacer, REG_DATA, (uint16_t)len, NULL, 0, data))
+            return -1;
+        (*frames)++;
+
+        /* the request leaves behind both frames and is answered once they are programmed */
+        budget = (wire_us(pacer, pkt_bytes(sizeof(ptr)) + pkt_bytes(len)) + 999) / 1000 +
+                 (len - 1) / PKT_PLD_SIZE * ISP_PROGRAM_TIMEOUT;
+        for(tries = 0; read_reg(pacer, REG_ADDR, reply, sizeof(reply), NULL, budget); tries++)
+        {
+            /* the frame is not sent again, whoever missed it is repaired afterwards */
+            if(ISP_FINAL(pacer) || tries + 1 == ISP_RETRIES)
+                return -1;
+            note_retry(pacer, REG_ADDR);
+        }
+    }
+
+    return 0;
+}
+
+int32_t isp_bus_repair(isp_session_t *sess, uint8_t area, const uint8_t *data, uint8_t window, isp_diff_t *diff)
+{
+    uint32_t addr, size, crc;
+
+    memset(diff, 0x00, sizeof(isp_diff_t));
+    if(isp_area(sess, area, &addr, &size) || sess->attr.flash.page_size == 0)
+        return -1;
+
+    /* one round trip for a device that got every frame */
+    if(sess->attr.caps & CAP_RANGE_CRC)
+    {
+        if(range_crc(sess, addr, size, &crc))
+            return -1;
+        if(crc == crc32_ieee(data, size))
+        {
+            diff->pages = size / sess->attr.flash.page_size;
+            diff->queried = 1;
+            return 0;
+        }
+    }
+
+    return isp_write_diff(sess, area, data, NULL, window, diff);
+}
+
+int32_t isp_read(isp_session_t *sess, uint32_t addr, uint32_t size, uint8_t window, isp_sink_t sink, void *ctx)
+{
+    uint64_t start = isp_now_us();
+    uint8_t reg_addr = REG_RDATA;
+    int32_t ret;
+
+    if(!(sess->attr.caps & CAP_RDATA) || window <= 1)
+    {
+        reg_addr = REG_DATA;
+        ret = read_stop_and_wait(sess, addr, size, sink, ctx);
+    }
+    else
+    {
+        ret = read_window(sess, addr, size, window, sink, ctx);
+    }
+    note_span(sess, STATS_LANE_XFER, "read", start, reg_addr, size, ret);
+
+    return ret;
+}
+
+int32_t isp_verify(isp_session_t *sess, uint32_t addr, const uint8_t *data, uint32_t size, uint8_t window,
+                   isp_verify_t *verify)
+{
+    uint32_t page = sess->attr.flash.page_size;
+    uint32_t first, count, start, end, crc, i, j;
+    uint8_t *dirty;
+    int32_t ret = 0;
+
+    memset(verify, 0x00, sizeof(isp_verify_t));
+    if(size == 0)
+        return 0;
+
+    if(!(sess->attr.caps & CAP_RANGE_CRC) || page == 0)
+    {
+        if(read_compare(sess, addr, data, size, window, verify))
+            return -1;
+        return verify->mismatches ? 1 : 0;
+    }
+
+    if(range_crc(sess, addr, size, &crc))
+        return -1;
+    verify->queries++;
+    if(crc == crc32_ieee(data, size))
+        return 0;
+
+    /* narrow it down to the pages the range touches, maybe partly at its ends */
+    first = addr / page;
+    count = (addr + size - 1) / page - first + 1;
+    dirty = (uint8_t *)malloc(count);
+    if(dirty == NULL)
+        return -1;
+
+    if((sess->attr.caps & CAP_PAGE_CRC) && addr % page == 0 && size % page == 0)
+    {
+        ret = diff_by_crc(sess, addr, data, count, dirty);
+        verify->queries += (count + ISP_PAGE_CRC_BATCH(sess->frame_size) - 1) / ISP_PAGE_CRC_BATCH(sess->frame_size);
+    }
+    else
+    {
+        for(i = 0; i < count && ret == 0; i++)
+        {
+            start = i ? (first + i) * page - addr : 0;
+            end = MIN(size, (first + i + 1) * page - addr);
+            ret = range_crc(sess, addr + start, end - start, &crc);
+            verify->queries++;
+            dirty[i] = crc != crc32_ieee(data + start, end - start);
+        }
+    }
+
+    /* read back runs of pages that differ, nothing else */
+    for(i = 0; i < count && ret == 0; i = j)
+    {
+        if(!dirty[i])
+        {
+            j = i + 1;
+            continue;
+        }
+        for(j = i; j < count && dirty[j]; j++);
+        start = i ? (first + i) * page - addr : 0;
+        end = MIN(size, (first + j) * page - addr);
+        ret = read_compare(sess, addr + start, data + start, end - start, window, verify);
+    }
+
+    free(dirty);
+
+    if(ret)
+        return -1;
+
+    return verify->mismatches ? 1 : 0;
+}
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: libfsisp, non-blocking sessions for programs that drive
+ *                   many devices from their own event loop.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+#include "inc/serial.h"
+#include "inc/packet.h"
+#include "inc/isp.h"
+#include "inc/fsisp.h"
+/* Private define ------------------------------------------------------------*/
+/* Frames or reads in flight of a request that does not say */
+#define FSISP_WINDOW_DEFAULT                8
+/* Rate the bootloader starts at unless the configuration says otherwise */
+#define FSISP_BAUDRATE_DEFAULT              115200
+/* Clock of fsisp_complete() timeouts, one the wall clock being set does not move */
+#if defined(__APPLE__)
+#define FSISP_WAIT_CLOCK                    CLOCK_REALTIME
+#else
+#define FSISP_WAIT_CLOCK                    CLOCK_MONOTONIC
+#endif
+
+/* Request state of a session */
+#define FSISP_STATE_IDLE                    0
+#define FSISP_STATE_QUEUED                  1
+#define FSISP_STATE_RUNNING                 2
+#define FSISP_STATE_DONE                    3
+/* Private typedef -----------------------------------------------------------*/
+struct fsisp_session_s {
+    fsisp_config_t cfg;
+    char *port;
+    /* port, NULL until the first FSISP_OP_CONNECT opened it */
+    com_param_t param;
+    com_handle_t hdl;
+    isp_session_t sess;
+    uint8_t connected;
+    /* worker and the request handed over to it, under lock */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t state;
+    uint8_t quit;
+    fsisp_request_t req;
+    fsisp_result_t res;
+    /* one byte per completion, read back when it is collected */
+    int fds[2];
+};
+/* Private macro -------------------------------------------------------------*/
+#if defined(_WIN32)
+#define fsisp_pipe(fds)     _pipe(fds, 256, _O_BINARY)
+#define fsisp_close_fd(fd)  _close(fd)
+#define fsisp_read(fd, b)   _read(fd, b, 1)
+#define fsisp_write(fd, b)  _write(fd, b, 1)
+#else
+#define fsisp_pipe(fds)     pipe(fds)
+#define fsisp_close_fd(fd)  close(fd)
+#define fsisp_read(fd, b)   read(fd, b, 1)
+#define fsisp_write(fd, b)  write(fd, b, 1)
+#endif
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  isp_read() sink copying into the buffer of a FSISP_OP_READ request
+  */
+static int32_t fsisp_copy_sink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    memcpy((uint8_t *)ctx + offset, data, size);
+    return 0;
+}
+
+/**
+  * @brief  open the port if need be and handshake at the start rate
+  * @param  s [I] - session
+  * @retval 0 = success, -1 = failure
+  * @note   A device is back at the start rate after a reset, so every
+  *         connect starts over from there.
+  */
+static int32_t fsisp_connect(fsisp_session_t *s)
+{
+    uint8_t dev_addr = s->cfg.dev_addr ? s->cfg.dev_addr : DEVICE_ADDR;
+    uint32_t baudrate = s->cfg.baudrate ? s->cfg.baudrate : FSISP_BAUDRATE_DEFAULT;
+
+    if(s->hdl == NULL)
+    {
+        s->param.baudrate = baudrate;
+        s->param.bytesize = COM_BYTESZ_8;
+        s->param.parity = COM_PARITY_NONE;
+        s->param.stopbits = COM_STOPBITS_1;
+        if(com_open(s->port, &s->param, &s->hdl))
+        {
+            s->hdl = NULL;
+            s->sess.error = ISP_ERR_PORT;
+            return -1;
+        }
+    }
+    else if(s->param.baudrate != baudrate)
+    {
+        s->param.baudrate = baudrate;
+        if(com_set_param(s->hdl, &s->param))
+        {
+            s->sess.error = ISP_ERR_PORT;
+            return -1;
+        }
+    }
+
+    isp_init(&s->sess, s->hdl, dev_addr);
+    isp_set_line(&s->sess, &s->param);
+    if(s->cfg.frame_limit)
+        s->sess.frame_limit = s->cfg.frame_limit;
+    s->sess.stats = s->cfg.stats;
+    if(isp_wait_connect(&s->sess, s->cfg.connect_ms))
+        return -1;
+
+    if(s->cfg.max_baudrate > s->param.baudrate)
+        return isp_upshift(&s->sess, &s->param, s->cfg.max_baudrate);
+
+    return 0;
+}
+
+/**
+  * @brief  carry out one request with the blocking engine
+  * @param  s [I] - session
+  * @param  req [I] - request
+  * @param  res [O] - outcome
+  * @retval none
+  */
+static void fsisp_run(fsisp_session_t *s, const fsisp_request_t *req, fsisp_result_t *res)
+{
+    uint8_t window = req->window ? req->window : FSISP_WINDOW_DEFAULT;
+    uint64_t start = stats_now_us();
+    isp_verify_t verify;
+    int32_t ret;
+
+    memset(res, 0x00, sizeof(fsisp_result_t));
+    res->op = req->op;
+    res->user = req->user;
+    s->sess.error = ISP_ERR_NONE;
+
+    switch(req->op)
+    {
+        case FSISP_OP_CONNECT:
+            ret = fsisp_connect(s);
+            break;
+
+        case FSISP_OP_ERASE:
+            ret = isp_erase(&s->sess, req->area);
+            break;
+
+        case FSISP_OP_WRITE:
+            s->sess.erase_ahead = req->erase_ahead;
+            ret = isp_write(&s->sess, req->addr, req->data, req->size, window);
+            break;
+
+        case FSISP_OP_VERIFY:
+            ret = isp_verify(&s->sess, req->addr, req->data, req->size, window, &verify);
+            res->mismatches = verify.mismatches;
+            res->first_bad = verify.first_bad;
+            break;
+
+        case FSISP_OP_READ:
+            ret = isp_read(&s->sess, req->addr, req->size, window, fsisp_copy_sink, req->buf);
+            break;
+
+        default:
+            ret = -1;
+            break;
+    }
+
+    res->result = ret;
+    if(ret < 0)
+    {
+        res->error = s->sess.error;
+        res->nak = s->sess.nak;
+    }
+    res->us = stats_now_us() - start;
+}
+
+/**
+  * @brief  thread running the requests of one session
+  * @param  arg [I] - session
+  * @retval NULL
+  */
+static void *fsisp_worker(void *arg)
+{
+    fsisp_session_t *s = (fsisp_session_t *)arg;
+    fsisp_request_t req;
+    fsisp_result_t res;
+    char byte = 0;
+
+    pthread_mutex_lock(&s->lock);
+    while(1)
+    {
+        while(s->state != FSISP_STATE_QUEUED && !s->quit)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if(s->quit)
+            break;
+        s->state = FSISP_STATE_RUNNING;
+        req = s->req;
+        pthread_mutex_unlock(&s->lock);
+
+        fsisp_run(s, &req, &res);
+
+        pthread_mutex_lock(&s->lock);
+        if(req.op == FSISP_OP_CONNECT)
+            s->connected = res.result == 0;
+        s->res = res;
+        s->state = FSISP_STATE_DONE;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        /* outside the lock, a full pipe must not hold up the caller */
+        fsisp_write(s->fds[1], &byte);
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/**
+  * @brief  hand over the completed request, the lock is held
+  * @retval 1 = collected, 0 = nothing completed
+  */
+static int32_t fsisp_collect(fsisp_session_t *s, fsisp_result_t *res)
+{
+    char byte;
+
+    if(s->state != FSISP_STATE_DONE)
+        return 0;
+
+    *res = s->res;
+    s->state = FSISP_STATE_IDLE;
+    /* written right after the state changed, at worst a moment away */
+    fsisp_read(s->fds[0], &byte);
+
+    return 1;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+fsisp_session_t *fsisp_create(const fsisp_config_t *cfg)
+{
+    fsisp_session_t *s;
+    pthread_condattr_t attr;
+
+    if(cfg->port == NULL)
+        return NULL;
+
+    s = (fsisp_session_t *)calloc(1, sizeof(fsisp_session_t));
+    if(s == NULL)
+        return NULL;
+    s->cfg = *cfg;
+    s->port = (char *)malloc(strlen(cfg->port) + 1);
+    if(s->port == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+    strcpy(s->port, cfg->port);
+    s->cfg.port = s->port;
+
+    if(fsisp_pipe(s->fds))
+    {
+        free(s->port);
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_condattr_init(&attr);
+#if !defined(__APPLE__)
+    pthread_condattr_setclock(&attr, FSISP_WAIT_CLOCK);
+#endif
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if(pthread_create(&s->thread, NULL, fsisp_worker, s))
+    {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        fsisp_close_fd(s->fds[0]);
+        fsisp_close_fd(s->fds[1]);
+        free(s->port);
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+int fsisp_fd(const fsisp_session_t *s)
+{
+    return s->fds[0];
+}
+
+int32_t fsisp_submit(fsisp_session_t *s, const fsisp_request_t *req)
+{
+    int32_t ret = -1;
+
+    pthread_mutex_lock(&s->lock);
+    if(s->state == FSISP_STATE_IDLE && (req->op == FSISP_OP_CONNECT || s->connected) &&
+       !((req->op == FSISP_OP_WRITE || req->op == FSISP_OP_VERIFY) && req->data == NULL && req->size) &&
+       !(req->op == FSISP_OP_READ && req->buf == NULL && req->size))
+    {
+        if(req->op == FSISP_OP_CONNECT)
+            s->connected = 0;
+        s->req = *req;
+        s->state = FSISP_STATE_QUEUED;
+        pthread_cond_broadcast(&s->cond);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+int32_t fsisp_poll(fsisp_session_t *s, fsisp_result_t *res)
+{
+    int32_t ret;
+
+    pthread_mutex_lock(&s->lock);
+    ret = fsisp_collect(s, res);
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+int32_t fsisp_complete(fsisp_session_t *s, fsisp_result_t *res, uint32_t timeout)
+{
+    struct timespec until;
+    int32_t ret;
+
+    clock_gettime(FSISP_WAIT_CLOCK, &until);
+    until.tv_sec += timeout / 1000;
+    until.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if(until.tv_nsec >= 1000000000)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    while(s->state == FSISP_STATE_QUEUED || s->state == FSISP_STATE_RUNNING)
+    {
+        if(timeout == 0)
+            pthread_cond_wait(&s->cond, &s->lock);
+        else if(pthread_cond_timedwait(&s->cond, &s->lock, &until) == ETIMEDOUT)
+            break;
+    }
+    ret = fsisp_collect(s, res);
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+/* the worker thread only touches the session between QUEUED and DONE */
+int32_t fsisp_device(const fsisp_session_t *s, dev_attr_t *attr)
+{
+    fsisp_session_t *m = (fsisp_session_t *)s;
+    int32_t ret = -1;
+
+    pthread_mutex_lock(&m->lock);
+    if(s->connected && (s->state == FSISP_STATE_IDLE || s->state == FSISP_STATE_DONE))
+    {
+        memcpy(attr, &s->sess.attr, sizeof(dev_attr_t));
+        ret = 0;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return ret;
+}
+
+uint32_t fsisp_baudrate(const fsisp_session_t *s)
+{
+    fsisp_session_t *m = (fsisp_session_t *)s;
+    uint32_t baudrate = 0;
+
+    pthread_mutex_lock(&m->lock);
+    if(s->state == FSISP_STATE_IDLE || s->state == FSISP_STATE_DONE)
+        baudrate = s->param.baudrate;
+    pthread_mutex_unlock(&m->lock);
+
+    return baudrate;
+}
+
+void fsisp_close(fsisp_session_t *s)
+{
+    if(s == NULL)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    while(s->state == FSISP_STATE_QUEUED || s->state == FSISP_STATE_RUNNING)
+        pthread_cond_wait(&s->cond, &s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    if(s->hdl)
+        com_close(s->hdl);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    fsisp_close_fd(s->fds[0]);
+    fsisp_close_fd(s->fds[1]);
+    free(s->port);
+    free(s);
+}
+
+/******************************** END OF FILE *********************************/
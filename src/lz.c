@@ -0,0 +1,202 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: LZ block codec for REG_ZDATA frames.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <string.h>
+#include "inc/lz.h"
+/* Private define ------------------------------------------------------------*/
+/* Entries of the match finder hash table */
+#define LZ_HASH_BITS                        12
+/* Private typedef -----------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+#define LZ_HASH(p) ((((uint32_t)(p)[0] | (uint32_t)(p)[1] << 8 | (uint32_t)(p)[2] << 16 | \
+                      (uint32_t)(p)[3] << 24) * 2654435761u) >> (32 - LZ_HASH_BITS))
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  bytes a length nibble needs beyond the token
+  */
+static uint32_t lz_ext(uint32_t n)
+{
+    return n < 15 ? 0 : (n - 15) / 255 + 1;
+}
+
+/**
+  * @brief  size of a sequence
+  * @param  lits [I] - number of literals
+  * @param  match [I] - match length, 0 = literals only
+  */
+static uint32_t lz_cost(uint32_t lits, uint32_t match)
+{
+    return 1 + lz_ext(lits) + lits + (match ? 2 + lz_ext(match - LZ_MIN_MATCH) : 0);
+}
+
+static uint8_t *lz_put_ext(uint8_t *op, uint32_t n)
+{
+    if(n < 15)
+        return op;
+    for(n -= 15; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)n;
+
+    return op;
+}
+
+/**
+  * @brief  write one sequence
+  * @param  op [O] - output position
+  * @param  lit [I] - literals
+  * @param  lits [I] - number of literals
+  * @param  offset [I] - match offset
+  * @param  match [I] - match length, 0 = literals only
+  * @retval output position after the sequence
+  */
+static uint8_t *lz_put_seq(uint8_t *op, const uint8_t *lit, uint32_t lits, uint32_t offset, uint32_t match)
+{
+    uint32_t ml = match ? match - LZ_MIN_MATCH : 0;
+
+    *op++ = (uint8_t)((lits < 15 ? lits : 15) << 4 | (ml < 15 ? ml : 15));
+    op = lz_put_ext(op, lits);
+    memcpy(op, lit, lits);
+    op += lits;
+    if(match)
+    {
+        *op++ = (uint8_t)(offset >> 8);
+        *op++ = (uint8_t)offset;
+        op = lz_put_ext(op, ml);
+    }
+
+    return op;
+}
+
+/**
+  * @brief  read a length nibble and its continuation bytes
+  * @retval 0 = success, -1 = the block ends inside the length
+  */
+static int32_t lz_get_len(const uint8_t **ip, const uint8_t *end, uint32_t *n)
+{
+    uint8_t b;
+
+    if(*n < 15)
+        return 0;
+    do
+    {
+        if(*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while(b == 255);
+
+    return 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+uint32_t lz_pack(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dst_max, uint32_t *consumed)
+{
+    /* position + 1 of the latest occurrence of each hash, 0 = none */
+    uint16_t table[1 << LZ_HASH_BITS];
+    uint8_t *op = dst;
+    uint32_t i = 0, anchor = 0, out = 0, cand, match, cost, h;
+
+    if(size > 0xFFFF)
+        size = 0xFFFF;
+    memset(table, 0x00, sizeof(table));
+
+    while(i + LZ_MIN_MATCH <= size)
+    {
+        h = LZ_HASH(src + i);
+        cand = table[h];
+        table[h] = (uint16_t)(i + 1);
+
+        if(cand && memcmp(src + cand - 1, src + i, LZ_MIN_MATCH) == 0)
+        {
+            cand--;
+            for(match = LZ_MIN_MATCH; i + match < size && src[cand + match] == src[i + match]; match++);
+            cost = lz_cost(i - anchor, match);
+            if(out + cost > dst_max)
+                break;
+            op = lz_put_seq(op, src + anchor, i - anchor, i - cand, match);
+            out += cost;
+            /* index the bytes inside the match, runs find themselves again */
+            for(h = i + 1; h < i + match && h + LZ_MIN_MATCH <= size; h++)
+                table[LZ_HASH(src + h)] = (uint16_t)(h + 1);
+            i += match;
+            anchor = i;
+            continue;
+        }
+
+        if(out + lz_cost(i + 1 - anchor, 0) > dst_max)
+            break;
+        i++;
+    }
+
+    /* the rest goes out as literals, as far as they fit */
+    while(i < size && out + lz_cost(i + 1 - anchor, 0) <= dst_max)
+        i++;
+    if(i > anchor)
+    {
+        op = lz_put_seq(op, src + anchor, i - anchor, 0, 0);
+        out += lz_cost(i - anchor, 0);
+    }
+
+    *consumed = i;
+
+    return out;
+}
+
+int32_t lz_unpack(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t dst_max, uint32_t *length)
+{
+    const uint8_t *ip = src, *end = src + size;
+    uint32_t op = 0, lits, match, offset;
+    uint8_t token;
+
+    while(ip < end)
+    {
+        token = *ip++;
+
+        lits = token >> 4;
+        if(lz_get_len(&ip, end, &lits) || lits > (uint32_t)(end - ip) || lits > dst_max - op)
+            return -1;
+        memcpy(dst + op, ip, lits);
+        ip += lits;
+        op += lits;
+        if(ip == end)
+            break;
+
+        if(end - ip < 2)
+            return -1;
+        offset = (uint32_t)ip[0] << 8 | ip[1];
+        ip += 2;
+        match = token & 0x0F;
+        if(lz_get_len(&ip, end, &match))
+            return -1;
+        match += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op || match > dst_max - op)
+            return -1;
+
+        /* byte by byte, a match may overlap its own output */
+        for(; match; match--, op++)
+            dst[op] = dst[op - offset];
+    }
+
+    *length = op;
+
+    return 0;
+}
+
+/******************************** END OF FILE *********************************/
@@ -12,27 +12,60 @@
  * 2021-10-30   Wentao SUN   first version
  * 
  ******************************************************************************/
+#if defined(_WIN32)
 
 /* Includes ------------------------------------------------------------------*/
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include "inc/serial.h"
+#include "inc/serial_drv.h"
 /* Private define ------------------------------------------------------------*/
+/* Shortest idle gap that terminates a com_recv() once data has arrived, ms */
+#define COM_GAP_MIN_MS          2
+/* Idle gap expressed in character times */
+#define COM_GAP_CHARS           4
+/* Staging buffer a gathered write is copied into, WriteFile() takes one block */
+#define COM_TX_STAGE            16384
 /* Private typedef -----------------------------------------------------------*/
+typedef struct com_win_s {
+    /* transport, must come first */
+    com_port_t port;
+    /* serial port handle */
+    HANDLE hdl;
+    /* idle gap terminating a receive, derived from line settings */
+    DWORD gap;
+    /* timeouts last applied, SetCommTimeouts() is only called on a change */
+    COMMTIMEOUTS timeouts;
+    uint8_t timeouts_valid;
+    /* segments of a com_sendv() are gathered here */
+    uint8_t stage[COM_TX_STAGE];
+} com_win_t;
 /* Private macro -------------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
+static int32_t tty_set_param(com_handle_t handle, const com_param_t *param);
+static int32_t tty_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count);
+static int32_t tty_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
+static int32_t tty_close(com_handle_t handle);
 /* Private variables ---------------------------------------------------------*/
+static const com_drv_t com_tty_drv = {
+    tty_set_param,
+    tty_sendv,
+    tty_recv,
+    tty_close,
+    0
+};
 /* Private functions ---------------------------------------------------------*/
-/* Exported variables --------------------------------------------------------*/
-/* Exported functions --------------------------------------------------------*/
-
-int32_t com_open(const char *port, com_param_t *param, com_handle_t *handle)
+/**
+  * @brief  apply line settings to an open port
+  * @param  hdl [I] - port handle
+  * @param  param [I] - line settings
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t com_setup(HANDLE hdl, const com_param_t *param)
 {
-    uint8_t port_idx;
-    //DWORD event_mask;
-    HANDLE hdl;
     DCB dcbSerialParam = {0};
 
     static const BYTE stopbits[] = {
@@ -49,85 +82,89 @@ int32_t com_open(const char *port, com_param_t *param, com_handle_t *handle)
         SPACEPARITY
     };
 
-    hdl = CreateFile(port,                            // Serial Port name
-                     GENERIC_READ | GENERIC_WRITE,    // Read/Write
-                     0,                               // No Sharing
-                     NULL,                            // No Security
-                     OPEN_EXISTING,                   // Open existing port only
-                     0,                               // Non Overlapped I/O
-                     NULL);                           // Null for Comm Devices
-
-    if(hdl == INVALID_HANDLE_VALUE)
-        return -1;
-
-
     dcbSerialParam.DCBlength = sizeof(dcbSerialParam);
 
     if(GetCommState(hdl, &dcbSerialParam) == FALSE)
-    {
-        CloseHandle(hdl);
         return -1;
-    }
 
     dcbSerialParam.BaudRate = param->baudrate;
     dcbSerialParam.ByteSize = param->bytesize;
 
     if(param->stopbits < sizeof(stopbits)/sizeof(stopbits[0]))
-    {
         dcbSerialParam.StopBits = stopbits[param->stopbits];
-    }
     else
-    {
-        CloseHandle(hdl);
         return -1;
-    }
 
     if(param->parity < sizeof(parity)/sizeof(parity[0]))
-    {
         dcbSerialParam.Parity = parity[param->parity];
-    }
     else
-    {
-        CloseHandle(hdl);
         return -1;
-    }
 
     if(SetCommState(hdl, &dcbSerialParam) == FALSE)
-    {
-        CloseHandle(hdl);
         return -1;
-    }
 
-/*
-    if(SetCommMask(hdl, EV_RXCHAR) == FALSE)
-    {
-        CloseHandle(hdl);
-        return -1;
-    }
-*/
-
-    *handle = hdl;
     return 0;
 }
 
-int32_t com_send(com_handle_t handle, const uint8_t *buf, size_t size)
+/**
+  * @brief  compute the idle gap that ends a reception at given line settings
+  * @param  param [I] - line settings
+  * @retval gap in milliseconds
+  */
+static DWORD com_gap_ms(const com_param_t *param)
 {
-    DWORD dwtxcnt;
-    DCB dcbSerialParam = {0};
-    COMMTIMEOUTS timeouts = {0};
+    DWORD bits, gap;
+
+    if(param->baudrate == 0)
+        return COM_GAP_MIN_MS;
 
-    timeouts.ReadIntervalTimeout = 0;
-    timeouts.ReadTotalTimeoutConstant = 0;
-    timeouts.ReadTotalTimeoutMultiplier = 0;
-    timeouts.WriteTotalTimeoutConstant = 0;
-    timeouts.WriteTotalTimeoutMultiplier = 0;
+    /* start bit + data bits + parity bit + stop bits, 1.5 rounded up */
+    bits = 1 + param->bytesize + (param->parity != COM_PARITY_NONE) + (param->stopbits == COM_STOPBITS_1 ? 1 : 2);
+    gap = (bits * COM_GAP_CHARS * 1000 + param->baudrate - 1) / param->baudrate;
 
-    if(SetCommTimeouts(handle, &timeouts) == FALSE)
+    return gap < COM_GAP_MIN_MS ? COM_GAP_MIN_MS : gap;
+}
+
+/**
+  * @brief  apply read timeouts unless they are in effect already
+  * @param  com [I] - port instance
+  * @param  interval [I] - idle gap ending a read, ms
+  * @param  total [I] - time to wait for the first byte, ms
+  * @retval 0 = success, -1 = failure
+  * @note   Writes never time out, so every write setting stays 0.
+  */
+static int32_t com_timeouts(com_win_t *com, DWORD interval, DWORD total)
+{
+    if(com->timeouts_valid &&
+       com->timeouts.ReadIntervalTimeout == interval &&
+       com->timeouts.ReadTotalTimeoutConstant == total)
+        return 0;
+
+    memset(&com->timeouts, 0x00, sizeof(com->timeouts));
+    com->timeouts.ReadIntervalTimeout = interval;
+    com->timeouts.ReadTotalTimeoutConstant = total;
+    com->timeouts_valid = 0;
+    if(SetCommTimeouts(com->hdl, &com->timeouts) == FALSE)
         return -1;
+    com->timeouts_valid = 1;
+
+    return 0;
+}
+
+/**
+  * @brief  write a block, blocking until all of it is accepted
+  * @param  com [I] - port instance
+  * @param  buf [I] - data to send
+  * @param  size [I] - number of bytes to send
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t com_write(com_win_t *com, const uint8_t *buf, size_t size)
+{
+    DWORD dwtxcnt;
 
     while(size)
     {
-        if(WriteFile(handle, buf, size, &dwtxcnt, NULL) == FALSE)
+        if(WriteFile(com->hdl, buf, (DWORD)size, &dwtxcnt, NULL) == FALSE)
             return -1;
         buf += dwtxcnt;
         size -= dwtxcnt;
@@ -136,36 +173,70 @@ int32_t com_send(com_handle_t handle, const uint8_t *buf, size_t size)
     return 0;
 }
 
-int32_t com_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+/**
+  * @brief  see com_set_param()
+  */
+static int32_t tty_set_param(com_handle_t handle, const com_param_t *param)
 {
-    DWORD event_mask;
-    DWORD dwrxcnt;
-    COMMTIMEOUTS timeouts = {0};
-    DCB dcbSerialParam = {0};
-    //float tmp;
-
-    //if(GetCommState(handle, &dcbSerialParam) == FALSE)
-    //    return -1;
-
-    //tmp = ((1.0f/(float)dcbSerialParam.BaudRate)*1000.0f*1.0f+0.5f);
-    //if(tmp < 1.0f) tmp = 1.0f;
-    timeouts.ReadIntervalTimeout = 0;
-    timeouts.ReadTotalTimeoutConstant = (DWORD)timeout;
-    //tmp = ((1.0f/(float)dcbSerialParam.BaudRate)*1000.0f*11.0f+0.5f);
-    //if(tmp < 1.0f) tmp = 1.0f;
-    timeouts.ReadTotalTimeoutMultiplier = 0;
-    timeouts.WriteTotalTimeoutConstant = 0;
-    timeouts.WriteTotalTimeoutMultiplier = 0;
-
-    if(SetCommTimeouts(handle, &timeouts) == FALSE)
+    com_win_t *com = (com_win_t *)handle;
+
+    /* let pending output leave at the old rate */
+    if(FlushFileBuffers(com->hdl) == FALSE)
         return -1;
 
-/*
-    if(WaitCommEvent(handle, &event_mask, NULL) == FALSE)
+    if(com_setup(com->hdl, param))
+        return -1;
+    com->gap = com_gap_ms(param);
+
+    return 0;
+}
+
+/**
+  * @brief  see com_sendv()
+  */
+static int32_t tty_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count)
+{
+    com_win_t *com = (com_win_t *)handle;
+    size_t used = 0, off, len;
+
+    /**
+     * WriteFileGather() needs overlapped, page aligned I/O, so gather into
+     * the staging buffer and write it whenever it fills up.
+     */
+    for(; count; iov++, count--)
+    {
+        for(off = 0; off < iov->size; off += len)
+        {
+            if(used == COM_TX_STAGE)
+            {
+                if(com_write(com, com->stage, used))
+                    return -1;
+                used = 0;
+            }
+            len = iov->size - off;
+            if(len > COM_TX_STAGE - used)
+                len = COM_TX_STAGE - used;
+            memcpy(&com->stage[used], iov->base + off, len);
+            used += len;
+        }
+    }
+
+    return com_write(com, com->stage, used);
+}
+
+/**
+  * @brief  see com_recv()
+  */
+static int32_t tty_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    com_win_t *com = (com_win_t *)handle;
+    DWORD dwrxcnt;
+
+    /* the read ends once the line has been idle for a few character times */
+    if(com_timeouts(com, com->gap, (DWORD)timeout))
         return -1;
-*/
 
-    if(ReadFile(handle, buf, size, &dwrxcnt, NULL) == FALSE)
+    if(ReadFile(com->hdl, buf, (DWORD)size, &dwrxcnt, NULL) == FALSE)
         return -1;
 
     *rxcnt = (uint32_t)dwrxcnt;
@@ -173,12 +244,85 @@ int32_t com_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt,
     return 0;
 }
 
-int32_t com_close(com_handle_t handle)
+/**
+  * @brief  see com_close()
+  */
+static int32_t tty_close(com_handle_t handle)
+{
+    com_win_t *com = (com_win_t *)handle;
+    BOOL ok;
+
+    ok = CloseHandle(com->hdl);
+    free(com);
+
+    return ok == FALSE ? -1 : 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t com_tty_open(const char *port, com_param_t *param, com_handle_t *handle)
 {
-    if(CloseHandle(handle) == FALSE)
+    //DWORD event_mask;
+    com_win_t *com;
+    HANDLE hdl;
+
+    com = (com_win_t *)malloc(sizeof(com_win_t));
+    if(com == NULL)
         return -1;
 
+    hdl = CreateFile(port,                            // Serial Port name
+                     GENERIC_READ | GENERIC_WRITE,    // Read/Write
+                     0,                               // No Sharing
+                     NULL,                            // No Security
+                     OPEN_EXISTING,                   // Open existing port only
+                     0,                               // Non Overlapped I/O
+                     NULL);                           // Null for Comm Devices
+
+    if(hdl == INVALID_HANDLE_VALUE)
+    {
+        free(com);
+        return -1;
+    }
+
+    com->port.drv = &com_tty_drv;
+    com->hdl = hdl;
+    com->gap = com_gap_ms(param);
+    com->timeouts_valid = 0;
+    if(com_setup(hdl, param) || com_timeouts(com, com->gap, 0))
+    {
+        CloseHandle(hdl);
+        free(com);
+        return -1;
+    }
+
+/*
+    if(SetCommMask(hdl, EV_RXCHAR) == FALSE)
+    {
+        CloseHandle(hdl);
+        return -1;
+    }
+*/
+
+    *handle = com;
     return 0;
 }
 
+/* no pseudo terminals or socket pairs here, the simulator needs a real port */
+int32_t com_open_pty(char *slave, size_t size, com_handle_t *handle)
+{
+    (void)slave;
+    (void)size;
+    (void)handle;
+    return -1;
+}
+
+int32_t com_open_loopback(com_handle_t *handle_a, com_handle_t *handle_b)
+{
+    (void)handle_a;
+    (void)handle_b;
+    return -1;
+}
+
+#endif /* defined(_WIN32) */
+
 /******************************** END OF FILE *********************************/
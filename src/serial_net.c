@@ -0,0 +1,816 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Network transports for serial device servers, raw TCP
+ *                   and Telnet with RFC 2217 port control. Links with ws2_32
+ *                   on Windows.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include "inc/serial.h"
+#include "inc/serial_drv.h"
+#include "inc/packet.h"
+/* Private define ------------------------------------------------------------*/
+/* Outgoing bytes gathered into one send(), after Telnet escaping */
+#define NET_STAGE_SIZE          16384
+/* Data arriving while a port setting is being confirmed */
+#define NET_HOLD_SIZE           4096
+/* Longest subnegotiation kept, RFC 2217 ones carry at most a few bytes */
+#define NET_SB_MAX              32
+/* Time the server has to confirm a port setting, ms */
+#define NET_ACK_MS              2000
+
+/* Telnet commands, RFC 854 */
+#define TN_SE                   240
+#define TN_SB                   250
+#define TN_WILL                 251
+#define TN_WONT                 252
+#define TN_DO                   253
+#define TN_DONT                 254
+#define TN_IAC                  255
+
+/* Telnet options: binary transmission, suppress go ahead, COM port control */
+#define TN_OPT_BINARY           0
+#define TN_OPT_SGA              3
+#define TN_OPT_COM_PORT         44
+
+/* RFC 2217 client commands, the server answers with the code plus 100 */
+#define CPC_SET_BAUDRATE        1
+#define CPC_SET_DATASIZE        2
+#define CPC_SET_PARITY          3
+#define CPC_SET_STOPSIZE        4
+#define CPC_SERVER_BASE         100
+#define CPC_CLIENT_LAST         12
+
+/* Telnet decoder states */
+#define TN_ST_DATA              0
+#define TN_ST_IAC               1
+#define TN_ST_OPT               2
+#define TN_ST_SB                3
+#define TN_ST_SB_IAC            4
+
+#if defined(_WIN32)
+#define NET_SOCK_NONE           INVALID_SOCKET
+#define NET_SEND_FLAGS          0
+#define net_close_sock          closesocket
+#define net_poll                WSAPoll
+#define net_interrupted()       (WSAGetLastError() == WSAEINTR)
+#else
+#define NET_SOCK_NONE           (-1)
+#if defined(MSG_NOSIGNAL)
+#define NET_SEND_FLAGS          MSG_NOSIGNAL
+#else
+#define NET_SEND_FLAGS          0
+#endif
+#define net_close_sock          close
+#define net_poll                poll
+#define net_interrupted()       (errno == EINTR)
+#endif
+/* Private typedef -----------------------------------------------------------*/
+#if defined(_WIN32)
+typedef SOCKET net_sock_t;
+#else
+typedef int net_sock_t;
+#endif
+
+typedef struct com_net_s {
+    /* transport, must come first */
+    com_port_t port;
+    /* connection, NET_SOCK_NONE while a listener waits for a client */
+    net_sock_t fd;
+    /* listening socket, NET_SOCK_NONE on a client */
+    net_sock_t lfd;
+    /* Telnet with RFC 2217 rather than raw bytes */
+    uint8_t rfc2217;
+    /* Telnet decoder: state, command waiting for its option, subnegotiation */
+    uint8_t tn_state;
+    uint8_t tn_cmd;
+    uint8_t sb[NET_SB_MAX];
+    uint8_t sb_len;
+    /* baud rate last confirmed by the server, 0 = none since the request;
+     * set while net_request() waits for it */
+    uint32_t baud_ack;
+    uint8_t waiting;
+    /* line settings in effect */
+    com_param_t param;
+    /* data decoded while waiting for a confirmation, returned first */
+    uint8_t hold[NET_HOLD_SIZE];
+    size_t hold_len;
+    /* outgoing bytes, Telnet escaped */
+    uint8_t stage[NET_STAGE_SIZE];
+} com_net_t;
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static int32_t net_set_param(com_handle_t handle, const com_param_t *param);
+static int32_t net_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count);
+static int32_t net_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
+static int32_t net_close(com_handle_t handle);
+/* Private variables ---------------------------------------------------------*/
+/* raw TCP client, the server owns the line settings */
+static const com_drv_t com_tcp_drv = {
+    net_set_param,
+    net_sendv,
+    net_recv,
+    net_close,
+    1
+};
+
+/* RFC 2217 client and listeners of either kind */
+static const com_drv_t com_net_drv = {
+    net_set_param,
+    net_sendv,
+    net_recv,
+    net_close,
+    0
+};
+/* Private functions ---------------------------------------------------------*/
+static uint64_t net_now_ms(void)
+{
+#if defined(_WIN32)
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
+}
+
+/**
+  * @brief  wait until a socket has something to read
+  * @param  fd [I] - socket
+  * @param  timeout [I] - timeout in ms
+  * @retval 1 = ready, 0 = timeout, -1 = failure
+  */
+static int net_wait(net_sock_t fd, int timeout)
+{
+#if defined(_WIN32)
+    WSAPOLLFD pfd;
+#else
+    struct pollfd pfd;
+#endif
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do {
+        ret = net_poll(&pfd, 1, timeout);
+    } while(ret < 0 && net_interrupted());
+
+    if(ret > 0 && (pfd.revents & POLLNVAL))
+        return -1;
+
+    /* a hang-up or an error shows up as a failed or empty recv() */
+    return ret < 0 ? -1 : ret;
+}
+
+/**
+  * @brief  resolve "host:port" and open a connected or listening socket
+  * @param  host [I] - "host:port", an IPv6 host in brackets, may be empty
+  *                    when listening
+  * @param  listening [I] - 1 = bind and listen, 0 = connect
+  * @param  fd [O] - socket
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t net_socket(const char *host, uint8_t listening, net_sock_t *fd)
+{
+    struct addrinfo hints, *res, *ai;
+    const char *colon = strrchr(host, ':');
+    char name[256];
+    size_t len;
+    int on = 1;
+    net_sock_t s = NET_SOCK_NONE;
+
+    if(colon == NULL || colon[1] == '\0')
+        return -1;
+    len = (size_t)(colon - host);
+    if(len >= 2 && host[0] == '[' && host[len - 1] == ']')
+    {
+        host++;
+        len -= 2;
+    }
+    if(len >= sizeof(name) || (len == 0 && !listening))
+        return -1;
+    memcpy(name, host, len);
+    name[len] = '\0';
+
+    memset(&hints, 0x00, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if(getaddrinfo(len ? name : NULL, colon + 1, &hints, &res))
+        return -1;
+
+    for(ai = res; ai; ai = ai->ai_next)
+    {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(s == NET_SOCK_NONE)
+            continue;
+        if(listening)
+        {
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+            if(bind(s, ai->ai_addr, (int)ai->ai_addrlen) == 0 && listen(s, 1) == 0)
+                break;
+        }
+        else if(connect(s, ai->ai_addr, (int)ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        net_close_sock(s);
+        s = NET_SOCK_NONE;
+    }
+    freeaddrinfo(res);
+
+    if(s == NET_SOCK_NONE)
+        return -1;
+
+    *fd = s;
+    return 0;
+}
+
+/**
+  * @brief  set up a connected socket for small frames
+  * @param  fd [I] - socket
+  * @retval none
+  */
+static void net_tune(net_sock_t fd)
+{
+    int on = 1;
+
+    /* a frame leaves in one send(), waiting to fill a segment only adds latency */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&on, sizeof(on));
+#endif
+}
+
+/**
+  * @brief  write a block to the connection
+  * @param  net [I] - instance
+  * @param  buf [I] - data
+  * @param  size [I] - number of bytes
+  * @retval 0 = success, -1 = failure
+  * @note   A listener without a client drops the data.
+  */
+static int32_t net_write(com_net_t *net, const uint8_t *buf, size_t size)
+{
+    int n;
+
+    while(size)
+    {
+        if(net->fd == NET_SOCK_NONE)
+            return 0;
+        n = (int)send(net->fd, (const char *)buf, (int)size, NET_SEND_FLAGS);
+        if(n > 0)
+        {
+            buf += n;
+            size -= (size_t)n;
+        }
+        else if(n < 0 && net_interrupted())
+        {
+            continue;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  append a byte to a Telnet message, doubling IAC
+  * @retval none
+  */
+static void net_put(uint8_t *buf, size_t *len, uint8_t b)
+{
+    buf[(*len)++] = b;
+    if(b == TN_IAC)
+        buf[(*len)++] = TN_IAC;
+}
+
+/**
+  * @brief  send a Telnet option command
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t net_option_send(com_net_t *net, uint8_t cmd, uint8_t opt)
+{
+    uint8_t msg[3];
+
+    msg[0] = TN_IAC;
+    msg[1] = cmd;
+    msg[2] = opt;
+
+    return net_write(net, msg, sizeof(msg));
+}
+
+/**
+  * @brief  send an RFC 2217 command with a value of 1 or 4 bytes
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t net_com_port_send(com_net_t *net, uint8_t code, const uint8_t *val, size_t size)
+{
+    uint8_t msg[6 + 2 * NET_SB_MAX];
+    size_t len = 0, i;
+
+    msg[len++] = TN_IAC;
+    msg[len++] = TN_SB;
+    msg[len++] = TN_OPT_COM_PORT;
+    msg[len++] = code;
+    for(i = 0; i < size && i < NET_SB_MAX; i++)
+        net_put(msg, &len, val[i]);
+    msg[len++] = TN_IAC;
+    msg[len++] = TN_SE;
+
+    return net_write(net, msg, len);
+}
+
+/**
+  * @brief  offer the options the link needs, right after connecting
+  * @retval 0 = success, -1 = failure
+  * @note   Binary mode keeps CR and NUL bytes as they are. The client will
+  *         do COM port control and the server is asked to.
+  */
+static int32_t net_greet(com_net_t *net)
+{
+    uint8_t listener = net->lfd != NET_SOCK_NONE;
+
+    if(net_option_send(net, TN_WILL, TN_OPT_BINARY) || net_option_send(net, TN_DO, TN_OPT_BINARY) ||
+       net_option_send(net, TN_WILL, TN_OPT_SGA) || net_option_send(net, TN_DO, TN_OPT_SGA))
+        return -1;
+
+    return net_option_send(net, listener ? TN_DO : TN_WILL, TN_OPT_COM_PORT);
+}
+
+/**
+  * @brief  answer an option command of the peer
+  * @retval none
+  * @note   What net_greet() offered is agreed already, anything else is
+  *         refused. Refusals are never answered, so nothing loops.
+  */
+static void net_option(com_net_t *net, uint8_t cmd, uint8_t opt)
+{
+    uint8_t listener = net->lfd != NET_SOCK_NONE;
+    uint8_t ours = opt == TN_OPT_BINARY || opt == TN_OPT_SGA;
+
+    if(cmd == TN_DO && !(ours || (opt == TN_OPT_COM_PORT && !listener)))
+        net_option_send(net, TN_WONT, opt);
+    else if(cmd == TN_WILL && !(ours || (opt == TN_OPT_COM_PORT && listener)))
+        net_option_send(net, TN_DONT, opt);
+}
+
+/**
+  * @brief  act on a complete subnegotiation
+  * @retval none
+  */
+static void net_subneg(com_net_t *net)
+{
+    uint8_t *sb = net->sb;
+
+    if(net->sb_len < 2 || sb[0] != TN_OPT_COM_PORT)
+        return;
+
+    /* a client takes note of the rate the server settled on */
+    if(net->lfd == NET_SOCK_NONE)
+    {
+        if(sb[1] == CPC_SERVER_BASE + CPC_SET_BAUDRATE && net->sb_len >= 6)
+            net->baud_ack = GET_BE32(&sb[2]);
+        return;
+    }
+
+    /* a stand-in server confirms every setting, a zero value asks for it */
+    if(sb[1] < CPC_SET_BAUDRATE || sb[1] > CPC_CLIENT_LAST)
+        return;
+    if(sb[1] == CPC_SET_BAUDRATE && net->sb_len >= 6)
+    {
+        if(GET_BE32(&sb[2]))
+            net->param.baudrate = GET_BE32(&sb[2]);
+        PUT_BE32(&sb[2], net->param.baudrate);
+    }
+    net_com_port_send(net, (uint8_t)(sb[1] + CPC_SERVER_BASE), &sb[2], net->sb_len - 2);
+}
+
+/**
+  * @brief  strip Telnet commands from received bytes, in place
+  * @param  net [I] - instance
+  * @param  buf [I/O] - received bytes, data on return
+  * @param  size [I] - number of bytes received
+  * @retval number of data bytes left in buf
+  */
+static size_t net_decode(com_net_t *net, uint8_t *buf, size_t size)
+{
+    size_t i, out = 0;
+    uint8_t b;
+
+    for(i = 0; i < size; i++)
+    {
+        b = buf[i];
+        switch(net->tn_state)
+        {
+            case TN_ST_DATA:
+                if(b == TN_IAC)
+                    net->tn_state = TN_ST_IAC;
+                else
+                    buf[out++] = b;
+                break;
+
+            case TN_ST_IAC:
+                net->tn_state = TN_ST_DATA;
+                if(b == TN_IAC)
+                {
+                    buf[out++] = b;
+                }
+                else if(b >= TN_WILL && b <= TN_DONT)
+                {
+                    net->tn_cmd = b;
+                    net->tn_state = TN_ST_OPT;
+                }
+                else if(b == TN_SB)
+                {
+                    net->sb_len = 0;
+                    net->tn_state = TN_ST_SB;
+                }
+                /* NOP, GA and the like carry nothing */
+                break;
+
+            case TN_ST_OPT:
+                net_option(net, net->tn_cmd, b);
+                net->tn_state = TN_ST_DATA;
+                break;
+
+            case TN_ST_SB:
+                if(b == TN_IAC)
+                    net->tn_state = TN_ST_SB_IAC;
+                else if(net->sb_len < NET_SB_MAX)
+                    net->sb[net->sb_len++] = b;
+                break;
+
+            default:
+                if(b == TN_SE)
+                {
+                    net_subneg(net);
+                    net->tn_state = TN_ST_DATA;
+                    break;
+                }
+                if(b == TN_IAC && net->sb_len < NET_SB_MAX)
+                    net->sb[net->sb_len++] = b;
+                net->tn_state = TN_ST_SB;
+                break;
+        }
+    }
+
+    return out;
+}
+
+/**
+  * @brief  forget the client of a listener, making room for the next one
+  * @retval none
+  */
+static void net_hang_up(com_net_t *net)
+{
+    net_close_sock(net->fd);
+    net->fd = NET_SOCK_NONE;
+    net->tn_state = TN_ST_DATA;
+    net->hold_len = 0;
+}
+
+/**
+  * @brief  read what is available, waiting for the first byte
+  * @param  net [I] - instance
+  * @param  buf [O] - data
+  * @param  size [I] - size of buf
+  * @param  rxcnt [O] - number of data bytes, 0 on timeout
+  * @param  timeout [I] - time to wait for the first byte in ms
+  * @retval 0 = success, -1 = failure
+  * @note   Returns as soon as nothing more is pending, TCP has no idle gap
+  *         to wait for.
+  */
+static int32_t net_read(com_net_t *net, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    uint64_t deadline = net_now_ms() + timeout, now;
+    size_t cnt = 0;
+    int n, ret, wait;
+
+    while(cnt < size)
+    {
+        now = net_now_ms();
+        wait = cnt || now >= deadline ? 0 : (int)(deadline - now);
+
+        /* a listener waits for its next client */
+        if(net->fd == NET_SOCK_NONE)
+        {
+            ret = net_wait(net->lfd, wait);
+            if(ret < 0)
+                return -1;
+            if(ret == 0)
+                break;
+            net->fd = accept(net->lfd, NULL, NULL);
+            if(net->fd == NET_SOCK_NONE)
+                continue;
+            net_tune(net->fd);
+            if(net->rfc2217 && net_greet(net))
+                net_hang_up(net);
+            continue;
+        }
+
+        ret = net_wait(net->fd, wait);
+        if(ret < 0)
+            return -1;
+        if(ret == 0)
+        {
+            if(cnt || net_now_ms() >= deadline)
+                break;
+            continue;
+        }
+
+        n = (int)recv(net->fd, (char *)buf + cnt, (int)(size - cnt), 0);
+        if(n < 0 && net_interrupted())
+            continue;
+        if(n <= 0)
+        {
+            /* the peer hung up or the link broke */
+            if(net->lfd == NET_SOCK_NONE)
+                return -1;
+            net_hang_up(net);
+            continue;
+        }
+        cnt += net->rfc2217 ? net_decode(net, buf + cnt, (size_t)n) : (size_t)n;
+        /* the confirmation net_request() waits for carries no data */
+        if(net->waiting && net->baud_ack)
+            break;
+    }
+
+    *rxcnt = cnt;
+
+    return 0;
+}
+
+/**
+  * @brief  ask an RFC 2217 server for line settings and wait until it
+  *         confirms the baud rate
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t net_request(com_net_t *net, const com_param_t *param)
+{
+    /* COM_STOPBITS_* to RFC 2217 stop sizes: 1, 1.5, 2 */
+    static const uint8_t stopsize[] = { 1, 3, 2 };
+    uint8_t val[4];
+    uint8_t buf[256];
+    uint64_t deadline;
+    size_t n;
+
+    if(param->stopbits >= sizeof(stopsize) || param->parity > COM_PARITY_SPACE)
+        return -1;
+
+    net->baud_ack = 0;
+    PUT_BE32(val, param->baudrate);
+    if(net_com_port_send(net, CPC_SET_BAUDRATE, val, 4))
+        return -1;
+    val[0] = param->bytesize;
+    if(net_com_port_send(net, CPC_SET_DATASIZE, val, 1))
+        return -1;
+    /* RFC 2217 counts parities from 1 = none */
+    val[0] = (uint8_t)(param->parity + 1);
+    if(net_com_port_send(net, CPC_SET_PARITY, val, 1))
+        return -1;
+    val[0] = stopsize[param->stopbits];
+    if(net_com_port_send(net, CPC_SET_STOPSIZE, val, 1))
+        return -1;
+
+    /* data that comes in meanwhile is kept for the next com_recv() */
+    deadline = net_now_ms() + NET_ACK_MS;
+    net->waiting = 1;
+    while(net->baud_ack == 0 && net_now_ms() < deadline)
+    {
+        if(net_read(net, buf, sizeof(buf), &n, (uint32_t)(deadline - net_now_ms())))
+            break;
+        if(n > NET_HOLD_SIZE - net->hold_len)
+            n = NET_HOLD_SIZE - net->hold_len;
+        memcpy(&net->hold[net->hold_len], buf, n);
+        net->hold_len += n;
+    }
+    net->waiting = 0;
+
+    return net->baud_ack == param->baudrate ? 0 : -1;
+}
+
+/**
+  * @brief  create an instance
+  * @retval instance, NULL on failure
+  */
+static com_net_t *net_create(const com_drv_t *drv, uint8_t rfc2217)
+{
+    com_net_t *net;
+#if defined(_WIN32)
+    WSADATA wsa;
+
+    /* counted, net_close() pairs it with WSACleanup() */
+    if(WSAStartup(MAKEWORD(2, 2), &wsa))
+        return NULL;
+#endif
+
+    net = (com_net_t *)malloc(sizeof(com_net_t));
+    if(net == NULL)
+    {
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+        return NULL;
+    }
+
+    memset(net, 0x00, offsetof(com_net_t, hold));
+    net->port.drv = drv;
+    net->fd = NET_SOCK_NONE;
+    net->lfd = NET_SOCK_NONE;
+    net->rfc2217 = rfc2217;
+    net->tn_state = TN_ST_DATA;
+    net->hold_len = 0;
+
+    return net;
+}
+
+/**
+  * @brief  see com_set_param()
+  */
+static int32_t net_set_param(com_handle_t handle, const com_param_t *param)
+{
+    com_net_t *net = (com_net_t *)handle;
+
+    /* a stand-in server has no line of its own */
+    if(net->lfd != NET_SOCK_NONE)
+        return 0;
+
+    if(!net->rfc2217)
+    {
+        return param->baudrate == net->param.baudrate && param->bytesize == net->param.bytesize &&
+               param->parity == net->param.parity && param->stopbits == net->param.stopbits ? 0 : -1;
+    }
+
+    if(net_request(net, param))
+        return -1;
+    net->param = *param;
+
+    return 0;
+}
+
+/**
+  * @brief  see com_sendv()
+  * @note   The segments are gathered, and escaped for Telnet, so a batch of
+  *         frames leaves in one send() unless it outgrows the stage.
+  */
+static int32_t net_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count)
+{
+    com_net_t *net = (com_net_t *)handle;
+    size_t used = 0, off, len;
+    const uint8_t *p;
+
+    for(; count; iov++, count--)
+    {
+        for(off = 0; off < iov->size; off += len)
+        {
+            if(NET_STAGE_SIZE - used < 2)
+            {
+                if(net_write(net, net->stage, used))
+                    return -1;
+                used = 0;
+            }
+            p = iov->base + off;
+            len = iov->size - off;
+            if(!net->rfc2217)
+            {
+                len = len < NET_STAGE_SIZE - used ? len : NET_STAGE_SIZE - used;
+                memcpy(&net->stage[used], p, len);
+                used += len;
+                continue;
+            }
+            /* leave room for an IAC to be doubled */
+            for(len = 0; off + len < iov->size && NET_STAGE_SIZE - used >= 2; len++)
+                net_put(net->stage, &used, p[len]);
+        }
+    }
+
+    return net_write(net, net->stage, used);
+}
+
+/**
+  * @brief  see com_recv()
+  */
+static int32_t net_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    com_net_t *net = (com_net_t *)handle;
+    size_t n;
+
+    if(net->hold_len)
+    {
+        n = size < net->hold_len ? size : net->hold_len;
+        memcpy(buf, net->hold, n);
+        memmove(net->hold, &net->hold[n], net->hold_len - n);
+        net->hold_len -= n;
+        *rxcnt = n;
+        return 0;
+    }
+
+    return net_read(net, buf, size, rxcnt, timeout);
+}
+
+/**
+  * @brief  see com_close()
+  */
+static int32_t net_close(com_handle_t handle)
+{
+    com_net_t *net = (com_net_t *)handle;
+
+    if(net->fd != NET_SOCK_NONE)
+        net_close_sock(net->fd);
+    if(net->lfd != NET_SOCK_NONE)
+        net_close_sock(net->lfd);
+    free(net);
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+
+    return 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t com_net_open(const char *host, const com_param_t *param, uint8_t rfc2217, com_handle_t *handle)
+{
+    com_net_t *net;
+
+    net = net_create(rfc2217 ? &com_net_drv : &com_tcp_drv, rfc2217);
+    if(net == NULL)
+        return -1;
+
+    if(net_socket(host, 0, &net->fd))
+    {
+        net_close(net);
+        return -1;
+    }
+    net_tune(net->fd);
+    net->param = *param;
+
+    if(rfc2217 && (net_greet(net) || net_request(net, param)))
+    {
+        net_close(net);
+        return -1;
+    }
+
+    *handle = net;
+    return 0;
+}
+
+int32_t com_net_listen(const char *host, uint8_t rfc2217, com_handle_t *handle)
+{
+    com_param_t param = { 115200, COM_BYTESZ_8, COM_PARITY_NONE, COM_STOPBITS_1 };
+    com_net_t *net;
+
+    net = net_create(&com_net_drv, rfc2217);
+    if(net == NULL)
+        return -1;
+
+    if(net_socket(host, 1, &net->lfd))
+    {
+        net_close(net);
+        return -1;
+    }
+    net->param = param;
+
+    *handle = net;
+    return 0;
+}
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: com_* API, hands every call to the transport that opened
+ *                   the handle.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include <stdint.h>
+#include "inc/serial.h"
+#include "inc/serial_drv.h"
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+#define COM_DRV(handle)                     (((com_port_t *)(handle))->drv)
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  strip a prefix off a port name
+  * @retval the rest of the name, NULL if it does not start with the prefix
+  */
+static const char *com_prefixed(const char *port, const char *prefix)
+{
+    size_t len = strlen(prefix);
+
+    return strncmp(port, prefix, len) == 0 ? port + len : NULL;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t com_open(const char *port, com_param_t *param, com_handle_t *handle)
+{
+    const char *host;
+
+    if(port == NULL || param == NULL || handle == NULL)
+        return -1;
+
+    if((host = com_prefixed(port, COM_PREFIX_TCP)) != NULL)
+        return com_net_open(host, param, 0, handle);
+    if((host = com_prefixed(port, COM_PREFIX_RFC2217)) != NULL)
+        return com_net_open(host, param, 1, handle);
+
+    return com_tty_open(port, param, handle);
+}
+
+int32_t com_listen(const char *port, com_handle_t *handle)
+{
+    const char *host;
+
+    if(port == NULL || handle == NULL)
+        return -1;
+
+    if((host = com_prefixed(port, COM_PREFIX_TCP)) != NULL)
+        return com_net_listen(host, 0, handle);
+    if((host = com_prefixed(port, COM_PREFIX_RFC2217)) != NULL)
+        return com_net_listen(host, 1, handle);
+
+    return -1;
+}
+
+int32_t com_set_param(com_handle_t handle, const com_param_t *param)
+{
+    if(handle == NULL)
+        return -1;
+
+    return COM_DRV(handle)->set_param(handle, param);
+}
+
+int32_t com_send(com_handle_t handle, const uint8_t *buf, size_t size)
+{
+    com_iovec_t iov;
+
+    iov.base = buf;
+    iov.size = size;
+
+    return com_sendv(handle, &iov, 1);
+}
+
+int32_t com_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count)
+{
+    if(handle == NULL)
+        return -1;
+
+    return COM_DRV(handle)->sendv(handle, iov, count);
+}
+
+int32_t com_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    if(handle == NULL)
+        return -1;
+
+    return COM_DRV(handle)->recv(handle, buf, size, rxcnt, timeout);
+}
+
+uint8_t com_fixed_line(com_handle_t handle)
+{
+    return handle ? COM_DRV(handle)->fixed_line : 0;
+}
+
+int32_t com_close(com_handle_t handle)
+{
+    if(handle == NULL)
+        return -1;
+
+    return COM_DRV(handle)->close(handle);
+}
+
+/******************************** END OF FILE *********************************/
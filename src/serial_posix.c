@@ -0,0 +1,536 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: POSIX serial port backend (termios, non-blocking I/O).
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <asm/termbits.h>
+#else
+#include <termios.h>
+#endif
+#include "inc/serial.h"
+#include "inc/serial_drv.h"
+/* Private define ------------------------------------------------------------*/
+/* Shortest idle gap that terminates a com_recv() once data has arrived, ms */
+#define COM_GAP_MIN_MS          2
+/* Idle gap expressed in character times */
+#define COM_GAP_CHARS           4
+/* Segments handed to one writev(), well below any IOV_MAX */
+#define COM_IOV_MAX             128
+/* Private typedef -----------------------------------------------------------*/
+typedef struct com_posix_s {
+    /* transport, must come first */
+    com_port_t port;
+    /* serial port file descriptor, opened non-blocking */
+    int fd;
+    /* epoll instance watching fd for input, -1 if poll() is used instead */
+    int epfd;
+    /* idle gap terminating a receive, derived from line settings */
+    uint32_t gap_ms;
+    /* pty slave held open by the master side, -1 otherwise */
+    int hold_fd;
+} com_posix_t;
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static int32_t tty_set_param(com_handle_t handle, const com_param_t *param);
+static int32_t tty_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count);
+static int32_t tty_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
+static int32_t tty_close(com_handle_t handle);
+/* Private variables ---------------------------------------------------------*/
+static const com_drv_t com_tty_drv = {
+    tty_set_param,
+    tty_sendv,
+    tty_recv,
+    tty_close,
+    0
+};
+/* Private functions ---------------------------------------------------------*/
+static uint64_t com_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+  * @brief  compute the idle gap that ends a reception at given line settings
+  * @param  param [I] - line settings
+  * @retval gap in milliseconds
+  */
+static uint32_t com_gap_ms(const com_param_t *param)
+{
+    uint32_t bits, gap;
+
+    if(param->baudrate == 0)
+        return COM_GAP_MIN_MS;
+
+    /* start bit + data bits + parity bit + stop bits, 1.5 rounded up */
+    bits = 1 + param->bytesize + (param->parity != COM_PARITY_NONE) + (param->stopbits == COM_STOPBITS_1 ? 1 : 2);
+    gap = (bits * COM_GAP_CHARS * 1000 + param->baudrate - 1) / param->baudrate;
+
+    return gap < COM_GAP_MIN_MS ? COM_GAP_MIN_MS : gap;
+}
+
+/**
+  * @brief  put the terminal into raw mode with the requested line settings
+  * @param  fd [I] - terminal file descriptor
+  * @param  param [I] - line settings
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t com_setup(int fd, const com_param_t *param)
+{
+    static const unsigned int csize[] = { CS5, CS6, CS7, CS8 };
+#if defined(__linux__)
+    struct termios2 tio;
+
+    if(ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+#else
+    struct termios tio;
+
+    if(tcgetattr(fd, &tio) < 0)
+        return -1;
+#endif
+
+    if(param->bytesize < COM_BYTESZ_5 || param->bytesize > COM_BYTESZ_8)
+        return -1;
+
+    /* raw mode, same as cfmakeraw() */
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY | INPCK);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+#if defined(CMSPAR)
+    tio.c_cflag &= ~CMSPAR;
+#endif
+    tio.c_cflag |= csize[param->bytesize - COM_BYTESZ_5] | CREAD | CLOCAL;
+    /* reads never block in the driver, waiting is done with epoll/poll */
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    switch(param->stopbits)
+    {
+        case COM_STOPBITS_1:
+            break;
+        case COM_STOPBITS_1P5:
+            /* termios gives 1.5 stop bits only with CSTOPB on 5-bit characters */
+            if(param->bytesize != COM_BYTESZ_5)
+                return -1;
+            tio.c_cflag |= CSTOPB;
+            break;
+        case COM_STOPBITS_2:
+            tio.c_cflag |= CSTOPB;
+            break;
+        default:
+            return -1;
+    }
+
+    switch(param->parity)
+    {
+        case COM_PARITY_NONE:
+            break;
+        case COM_PARITY_ODD:
+            tio.c_cflag |= PARENB | PARODD;
+            break;
+        case COM_PARITY_EVEN:
+            tio.c_cflag |= PARENB;
+            break;
+#if defined(CMSPAR)
+        case COM_PARITY_MARK:
+            tio.c_cflag |= PARENB | PARODD | CMSPAR;
+            break;
+        case COM_PARITY_SPACE:
+            tio.c_cflag |= PARENB | CMSPAR;
+            break;
+#endif
+        default:
+            return -1;
+    }
+
+#if defined(__linux__)
+    /* BOTHER takes the baud rate verbatim, standard or not */
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = param->baudrate;
+    tio.c_ospeed = param->baudrate;
+
+    if(ioctl(fd, TCSETS2, &tio) < 0)
+        return -1;
+#else
+    /* BSD and macOS termios accept any integer speed */
+    if(cfsetspeed(&tio, (speed_t)param->baudrate) < 0)
+        return -1;
+
+    if(tcsetattr(fd, TCSANOW, &tio) < 0)
+        return -1;
+#endif
+
+    return 0;
+}
+
+/**
+  * @brief  wait until the port becomes readable or writable
+  * @param  com [I] - port instance
+  * @param  events [I] - POLLIN or POLLOUT
+  * @param  timeout [I] - timeout in ms, -1 waits forever
+  * @retval 1 = ready, 0 = timeout, -1 = failure
+  */
+static int com_wait(com_posix_t *com, short events, int timeout)
+{
+    int ret;
+#if defined(__linux__)
+    struct epoll_event ev;
+
+    if(events == POLLIN && com->epfd >= 0)
+    {
+        do {
+            ret = epoll_wait(com->epfd, &ev, 1, timeout);
+        } while(ret < 0 && errno == EINTR);
+        return ret < 0 ? -1 : ret;
+    }
+#endif
+    struct pollfd pfd;
+
+    pfd.fd = com->fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while(ret < 0 && errno == EINTR);
+
+    if(ret > 0 && (pfd.revents & (POLLERR | POLLNVAL)))
+        return -1;
+
+    return ret < 0 ? -1 : ret;
+}
+/**
+  * @brief  wrap an open non-blocking descriptor into a port instance
+  * @param  fd [I] - descriptor, owned by the instance on success
+  * @param  gap_ms [I] - idle gap terminating a receive
+  * @param  handle [O] - created handle
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t com_attach(int fd, uint32_t gap_ms, com_handle_t *handle)
+{
+    com_posix_t *com;
+
+    com = (com_posix_t *)malloc(sizeof(com_posix_t));
+    if(com == NULL)
+        return -1;
+    com->port.drv = &com_tty_drv;
+    com->fd = fd;
+    com->epfd = -1;
+    com->gap_ms = gap_ms;
+    com->hold_fd = -1;
+
+#if defined(__linux__)
+    com->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(com->epfd >= 0)
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if(epoll_ctl(com->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            close(com->epfd);
+            com->epfd = -1;
+        }
+    }
+#endif
+
+    *handle = com;
+    return 0;
+}
+
+/**
+  * @brief  see com_set_param()
+  */
+static int32_t tty_set_param(com_handle_t handle, const com_param_t *param)
+{
+    com_posix_t *com = (com_posix_t *)handle;
+
+    if(com == NULL)
+        return -1;
+
+    /* socket loopbacks have no line settings */
+    if(!isatty(com->fd))
+        return 0;
+
+    /* let pending output leave at the old rate */
+#if defined(__linux__)
+    /* tcdrain() lives in <termios.h>, which clashes with termbits */
+    if(ioctl(com->fd, TCSBRK, 1) < 0)
+        return -1;
+#else
+    if(tcdrain(com->fd) < 0)
+        return -1;
+#endif
+    if(com_setup(com->fd, param))
+        return -1;
+
+    /* pty and loopback handles keep reading without an idle gap */
+    if(com->gap_ms)
+        com->gap_ms = com_gap_ms(param);
+
+    return 0;
+}
+
+/**
+  * @brief  see com_sendv()
+  */
+static int32_t tty_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count)
+{
+    com_posix_t *com = (com_posix_t *)handle;
+    struct iovec vec[COM_IOV_MAX];
+    size_t n, skip = 0;
+    ssize_t ret;
+
+    while(count)
+    {
+        /* skip counts the bytes of the first segment already written */
+        for(n = 0; n < count && n < COM_IOV_MAX; n++)
+        {
+            vec[n].iov_base = (void *)(iov[n].base + (n ? 0 : skip));
+            vec[n].iov_len = iov[n].size - (n ? 0 : skip);
+        }
+
+        ret = writev(com->fd, vec, (int)n);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            /* driver buffer full, sleep until it drains */
+            if(com_wait(com, POLLOUT, -1) < 0)
+                return -1;
+            continue;
+        }
+        if(ret < 0)
+            return -1;
+
+        /* step over the segments that went out whole */
+        while(count && (size_t)ret >= iov->size - skip)
+        {
+            ret -= (ssize_t)(iov->size - skip);
+            skip = 0;
+            iov++;
+            count--;
+        }
+        skip += (size_t)ret;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  see com_recv()
+  */
+static int32_t tty_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    com_posix_t *com = (com_posix_t *)handle;
+    uint64_t deadline, now;
+    size_t cnt = 0;
+    ssize_t n;
+    int wait, ret = 0;
+
+    deadline = com_now_ms() + timeout;
+
+    while(cnt < size)
+    {
+        n = read(com->fd, buf + cnt, size - cnt);
+        if(n > 0)
+        {
+            cnt += (size_t)n;
+            ret = 0;
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        /**
+         * A tty reads 0 when idle too, but is not reported readable then:
+         * nothing to read from a readable port is the peer hanging up. What
+         * came before is returned, the next call fails.
+         */
+        if(n == 0 && ret > 0)
+        {
+            if(cnt == 0)
+                return -1;
+            break;
+        }
+
+        /**
+         * Nothing pending: wait for the first byte until the deadline, then
+         * keep collecting until the line stays idle for one gap.
+         */
+        now = com_now_ms();
+        if(cnt == 0)
+        {
+            if(now >= deadline)
+                break;
+            wait = (int)(deadline - now);
+        }
+        else
+        {
+            wait = (int)com->gap_ms;
+        }
+
+        ret = com_wait(com, POLLIN, wait);
+        if(ret < 0)
+            return -1;
+        if(ret == 0 && (cnt > 0 || com_now_ms() >= deadline))
+            break;
+    }
+
+    *rxcnt = cnt;
+
+    return 0;
+}
+
+/**
+  * @brief  see com_close()
+  */
+static int32_t tty_close(com_handle_t handle)
+{
+    com_posix_t *com = (com_posix_t *)handle;
+    int ret;
+
+    if(com->epfd >= 0)
+        close(com->epfd);
+    if(com->hold_fd >= 0)
+        close(com->hold_fd);
+    ret = close(com->fd);
+    free(com);
+
+    return ret < 0 ? -1 : 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int32_t com_tty_open(const char *port, com_param_t *param, com_handle_t *handle)
+{
+    int fd;
+
+    fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    /* no sharing, like the Windows backend */
+    if(ioctl(fd, TIOCEXCL) < 0 || com_setup(fd, param))
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* drop whatever was pending before we took the port */
+    ioctl(fd, TCFLSH, TCIOFLUSH);
+
+    if(com_attach(fd, com_gap_ms(param), handle))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int32_t com_open_pty(char *slave, size_t size, com_handle_t *handle)
+{
+    int fd, sfd;
+    const char *name;
+    com_param_t param = { 115200, COM_BYTESZ_8, COM_PARITY_NONE, COM_STOPBITS_1 };
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0)
+        return -1;
+
+    if(grantpt(fd) < 0 || unlockpt(fd) < 0 || (name = ptsname(fd)) == NULL || strlen(name) >= size)
+    {
+        close(fd);
+        return -1;
+    }
+    strcpy(slave, name);
+
+    /**
+     * The master sees whole writes of the peer, so it needs no idle gap.
+     * Without an open slave, reads on the master fail with EIO and epoll
+     * reports a hang-up continuously, so keep one reference ourselves.
+     */
+    sfd = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if(sfd < 0 || com_setup(sfd, &param))
+    {
+        if(sfd >= 0)
+            close(sfd);
+        close(fd);
+        return -1;
+    }
+
+    if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0 ||
+       fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+       com_attach(fd, 0, handle))
+    {
+        close(sfd);
+        close(fd);
+        return -1;
+    }
+    ((com_posix_t *)*handle)->hold_fd = sfd;
+
+    return 0;
+}
+
+int32_t com_open_loopback(com_handle_t *handle_a, com_handle_t *handle_b)
+{
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0)
+        return -1;
+
+    /* writes arrive whole, there is no gap to wait for */
+    if(com_attach(sv[0], 0, handle_a))
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if(com_attach(sv[1], 0, handle_b))
+    {
+        com_close(*handle_a);
+        close(sv[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif /* !defined(_WIN32) */
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,270 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Counters and timeline of a programming session, written
+ *                   out as a JSON summary and as a Chrome trace.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "inc/stats.h"
+/* Private define ------------------------------------------------------------*/
+/* Distinct phase names summed up by the summary */
+#define STATS_PHASES_MAX                    16
+/* Private typedef -----------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static const char *const stats_lane_names[STATS_LANES] = { "phase", "transaction", "link" };
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  write a string as a JSON string literal
+  */
+static void stats_put_str(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for(; s && *s; s++)
+    {
+        if(*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        if((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%.4x", (unsigned char)*s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static FILE *stats_open(const char *path)
+{
+    return strcmp(path, "-") ? fopen(path, "w") : stdout;
+}
+
+/**
+  * @brief  flush and close a report, stdout stays open
+  * @retval 0 = everything was written, -1 = otherwise
+  */
+static int32_t stats_close(FILE *fp)
+{
+    int32_t err = ferror(fp) ? -1 : 0;
+
+    if(fp == stdout)
+        return fflush(fp) || err ? -1 : 0;
+
+    return fclose(fp) || err ? -1 : 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+uint64_t stats_now_us(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+void stats_init(stats_t *st, uint8_t trace)
+{
+    memset(st, 0x00, sizeof(stats_t));
+    st->trace = trace;
+    st->start_us = stats_now_us();
+}
+
+void stats_free(stats_t *st)
+{
+    free(st->events);
+    st->events = NULL;
+    st->count = 0;
+    st->cap = 0;
+}
+
+void stats_event(stats_t *st, uint8_t lane, const char *name, uint64_t start_us, uint64_t end_us,
+                 uint8_t reg_addr, uint32_t bytes, int8_t result)
+{
+    stats_event_t *ev;
+    uint32_t cap;
+
+    if(!st->trace && lane != STATS_LANE_PHASE)
+        return;
+
+    if(st->count == st->cap)
+    {
+        cap = st->cap ? st->cap * 2 : 1024;
+        if(cap > STATS_EVENTS_MAX)
+            cap = STATS_EVENTS_MAX;
+        ev = cap > st->cap ? (stats_event_t *)realloc(st->events, cap * sizeof(stats_event_t)) : NULL;
+        if(ev == NULL)
+        {
+            st->dropped++;
+            return;
+        }
+        st->events = ev;
+        st->cap = cap;
+    }
+
+    ev = &st->events[st->count++];
+    ev->start_us = start_us;
+    ev->dur_us = end_us > start_us ? (uint32_t)(end_us - start_us) : 0;
+    ev->name = name;
+    ev->bytes = bytes;
+    ev->lane = lane;
+    ev->reg_addr = reg_addr;
+    ev->result = result;
+}
+
+void stats_phase(stats_t *st, const char *name)
+{
+    uint64_t now;
+
+    if(st == NULL)
+        return;
+
+    now = stats_now_us();
+    if(st->phase)
+        stats_event(st, STATS_LANE_PHASE, st->phase, st->phase_us, now, 0, 0, 0);
+    st->phase = name;
+    st->phase_us = now;
+}
+
+void stats_stop(stats_t *st)
+{
+    stats_phase(st, NULL);
+    st->end_us = stats_now_us();
+}
+
+int32_t stats_write_summary(const char *path, stats_t *const *st, uint32_t count)
+{
+    const char *names[STATS_PHASES_MAX];
+    uint64_t sums[STATS_PHASES_MAX];
+    uint64_t now = stats_now_us();
+    const stats_t *s;
+    const stats_event_t *ev;
+    uint32_t i, k, n, phases;
+    FILE *fp;
+
+    fp = stats_open(path);
+    if(fp == NULL)
+        return -1;
+
+    fprintf(fp, "{\"sessions\":[");
+    for(i = 0; i < count; i++)
+    {
+        s = st[i];
+        fprintf(fp, "%s\n{\"port\":", i ? "," : "");
+        stats_put_str(fp, s->port);
+        fprintf(fp, ",\"result\":\"%s\",\"stage\":", s->result ? "failed" : "ok");
+        stats_put_str(fp, s->stage);
+        fprintf(fp, ",\"seconds\":%.6f,\"connects\":%u,\"transactions\":%u,\"naks\":%u,"
+                    "\"timeouts\":%u,\"retries\":%u,\"crc_errors\":%u,\"resync_bytes\":%u,"
+                    "\"frames_tx\":%u,\"frames_rx\":%u,\"bytes_tx\":%llu,\"bytes_rx\":%llu,"
+                    "\"send_seconds\":%.6f,\"wait_seconds\":%.6f,\"wire_seconds\":%.6f,"
+                    "\"srtt_us\":%u,\"rttvar_us\":%u,\"frame_srtt_us\":%u,\"phases\":{",
+                ((s->end_us ? s->end_us : now) - s->start_us) / 1e6, s->connects, s->transactions, s->naks,
+                s->timeouts, s->retries, s->crc_errors, s->resync_bytes,
+                s->frames_tx, s->frames_rx, (unsigned long long)s->bytes_tx, (unsigned long long)s->bytes_rx,
+                s->send_us / 1e6, s->wait_us / 1e6, s->wire_us / 1e6,
+                s->srtt_us, s->rttvar_us, s->frame_srtt_us);
+
+        /* time per phase, a phase run several times is summed up */
+        for(n = 0, phases = 0; n < s->count; n++)
+        {
+            ev = &s->events[n];
+            if(ev->lane != STATS_LANE_PHASE)
+                continue;
+            for(k = 0; k < phases && strcmp(names[k], ev->name); k++);
+            if(k == phases)
+            {
+                if(phases == STATS_PHASES_MAX)
+                    continue;
+                names[phases] = ev->name;
+                sums[phases++] = 0;
+            }
+            sums[k] += ev->dur_us;
+        }
+        for(k = 0; k < phases; k++)
+        {
+            fprintf(fp, "%s", k ? "," : "");
+            stats_put_str(fp, names[k]);
+            fprintf(fp, ":%.6f", sums[k] / 1e6);
+        }
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n]}\n");
+
+    return stats_close(fp);
+}
+
+int32_t stats_write_trace(const char *path, stats_t *const *st, uint32_t count)
+{
+    const stats_event_t *ev;
+    uint64_t origin = UINT64_MAX;
+    uint32_t i, n, lane;
+    int first = 1;
+    FILE *fp;
+
+    fp = stats_open(path);
+    if(fp == NULL)
+        return -1;
+
+    /* sessions of a gang share the time axis */
+    for(i = 0; i < count; i++)
+        if(st[i]->start_us < origin)
+            origin = st[i]->start_us;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for(i = 0; i < count; i++)
+    {
+        fprintf(fp, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":", first ? "" : ",", i + 1);
+        stats_put_str(fp, st[i]->port);
+        fprintf(fp, "}}");
+        first = 0;
+        for(lane = 0; lane < STATS_LANES; lane++)
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    i + 1, lane, stats_lane_names[lane]);
+
+        for(n = 0; n < st[i]->count; n++)
+        {
+            ev = &st[i]->events[n];
+            fprintf(fp, ",\n{\"name\":");
+            stats_put_str(fp, ev->name);
+            fprintf(fp, ",\"cat\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%llu,",
+                    stats_lane_names[ev->lane], i + 1, ev->lane, (unsigned long long)(ev->start_us - origin));
+            if(ev->dur_us || ev->lane == STATS_LANE_PHASE)
+                fprintf(fp, "\"ph\":\"X\",\"dur\":%u,", ev->dur_us);
+            else
+                fprintf(fp, "\"ph\":\"i\",\"s\":\"t\",");
+            fprintf(fp, "\"args\":{\"reg\":\"0x%.2x\",\"bytes\":%u,\"ok\":%s}}",
+                    ev->reg_addr, ev->bytes, ev->result ? "false" : "true");
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    return stats_close(fp);
+}
+
+/******************************** END OF FILE *********************************/
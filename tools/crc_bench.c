@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Throughput of the CRC engines on frame and image sized
+ *                   blocks, compared with the time to send them on the line.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "inc/crc.h"
+/* Private define ------------------------------------------------------------*/
+/* Bytes hashed per measurement */
+#define BENCH_VOLUME                        (64UL << 20)
+/* Line rate the results are compared with, bits/s in 8N1 framing */
+#define BENCH_BAUDRATE                      3000000UL
+/* Private typedef -----------------------------------------------------------*/
+typedef uint32_t (*bench_fn_t)(const uint8_t *pdata, size_t size);
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+static uint32_t bench_crc8(const uint8_t *pdata, size_t size)
+{
+    return crc8_maxim(pdata, size);
+}
+
+static uint32_t bench_crc16(const uint8_t *pdata, size_t size)
+{
+    return crc16_modbus(pdata, size);
+}
+
+static uint32_t bench_crc32(const uint8_t *pdata, size_t size)
+{
+    return crc32_ieee(pdata, size);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+  * @brief  hash BENCH_VOLUME bytes in blocks of one size
+  * @param  fn [I] - CRC under test
+  * @param  buf [I] - data, at least size bytes
+  * @param  size [I] - block size
+  * @param  result [O] - CRC of the block, to check engines agree
+  * @retval throughput in MB/s
+  */
+static double bench_run(bench_fn_t fn, const uint8_t *buf, size_t size, uint32_t *result)
+{
+    size_t rounds = BENCH_VOLUME / size, i;
+    volatile uint32_t sink = 0;
+    double start;
+
+    start = bench_now();
+    for(i = 0; i < rounds; i++)
+        sink ^= fn(buf, size);
+    *result = fn(buf, size);
+
+    return (double)(rounds * size) / (bench_now() - start) / 1e6;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        bench_fn_t fn;
+    } crcs[] = {
+        {"crc8/maxim",      bench_crc8},
+        {"crc16/modbus",    bench_crc16},
+        {"crc32/ieee",      bench_crc32},
+    };
+    static const size_t sizes[] = { 133, 4096, 1UL << 20 };
+    static const char *engines[] = { "auto", "table", "clmul" };
+    uint32_t ref[sizeof(sizes) / sizeof(sizes[0])];
+    uint32_t result;
+    uint8_t *buf;
+    size_t c, s, i;
+    uint8_t e;
+    double mbps, line = (double)BENCH_BAUDRATE / 10 / 1e6;
+    int err = 0;
+
+    buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    if(buf == NULL)
+        return -1;
+    srand(1);
+    for(i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; i++)
+        buf[i] = (uint8_t)rand();
+
+    printf("line at %lu baud moves %.3f MB/s\r\n", BENCH_BAUDRATE, line);
+    printf("%-14s %-6s %10s %10s %10s\r\n", "crc", "engine", "133 B", "4 KiB", "1 MiB");
+    for(c = 0; c < sizeof(crcs) / sizeof(crcs[0]); c++)
+    {
+        for(e = CRC_ENGINE_TABLE; e <= CRC_ENGINE_CLMUL; e++)
+        {
+            if(crc_set_engine(e))
+                continue;
+            printf("%-14s %-6s", crcs[c].name, engines[e]);
+            for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            {
+                mbps = bench_run(crcs[c].fn, buf, sizes[s], &result);
+                printf(" %10.1f", mbps);
+                if(e == CRC_ENGINE_TABLE)
+                    ref[s] = result;
+                else if(result != ref[s])
+                    err = -1;
+            }
+            printf("  MB/s\r\n");
+        }
+    }
+    crc_set_engine(CRC_ENGINE_AUTO);
+    printf("auto engine: %s\r\n", engines[crc_engine()]);
+
+    if(err)
+        printf("engines disagree!\r\n");
+
+    free(buf);
+
+    return err;
+}
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,609 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Throughput and latency of the programming flow against
+ *                   the simulated bootloader, over an in-process loopback
+ *                   and a pseudo terminal, one JSON line per operation.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "inc/serial.h"
+#include "inc/serial_drv.h"
+#include "inc/packet.h"
+#include "inc/frame.h"
+#include "inc/isp.h"
+#include "inc/bldr_sim.h"
+/* Private define ------------------------------------------------------------*/
+/* Requests waiting for their reply, a window plus the odd register access */
+#define BENCH_PENDING                       256
+/* Round trip samples kept per operation */
+#define BENCH_SAMPLES                       (1UL << 18)
+
+/* Links to run over */
+#define BENCH_LINK_LOOPBACK                 BIT(0)
+#define BENCH_LINK_PTY                      BIT(1)
+/* Private typedef -----------------------------------------------------------*/
+typedef struct bench_req_s {
+    uint64_t sent_us;
+    uint8_t reg_addr;
+} bench_req_t;
+
+/**
+ * Transport wrapped around the host end of the link. It passes everything
+ * through and watches the frames: every one the host sends is a request
+ * the device answers, in order, so replies are paired with the oldest
+ * request to the same register. Requests passed over were lost.
+ */
+typedef struct bench_tap_s {
+    /* transport, must come first */
+    com_port_t port;
+    com_handle_t inner;
+    /* host frames: header bytes collected, bytes left to skip */
+    uint8_t tx_hdr[PKT_EXT_HDR_SIZE];
+    uint32_t tx_have;
+    uint32_t tx_skip;
+    /* device frames */
+    frame_rx_t rx;
+    /* requests in flight, a ring */
+    bench_req_t pending[BENCH_PENDING];
+    uint32_t head;
+    uint32_t tail;
+    /* counters of the running operation */
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t lost;
+    /* round trips of the running operation, us */
+    uint32_t *samples;
+    uint32_t nsamples;
+} bench_tap_t;
+
+typedef struct bench_opt_s {
+    uint32_t links;
+    uint32_t baudrate;
+    uint32_t latency_us;
+    uint32_t turnaround_us;
+    uint32_t erase_us;
+    uint32_t program_us;
+    uint32_t fault_ppm;
+    uint32_t size;
+    uint8_t window;
+    uint16_t frame_size;
+    uint8_t compress;
+    uint8_t text;
+} bench_opt_t;
+/* Private macro -------------------------------------------------------------*/
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+/* Private function prototypes -----------------------------------------------*/
+static int32_t tap_set_param(com_handle_t handle, const com_param_t *param);
+static int32_t tap_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count);
+static int32_t tap_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout);
+static int32_t tap_close(com_handle_t handle);
+/* Private variables ---------------------------------------------------------*/
+static const com_drv_t tap_drv = {
+    tap_set_param,
+    tap_sendv,
+    tap_recv,
+    tap_close,
+    0
+};
+
+static const char *usage =
+    "usage: fsisp_bench [options]\r\n"
+    "  --link <name>            loopback, pty or all (default)\r\n"
+    "  --baudrate[-b] <bps>     emulated line rate, 0 = unpaced, default 115200\r\n"
+    "  --latency-us <us>        one-way link delay\r\n"
+    "  --turnaround-us <us>     device reply turnaround\r\n"
+    "  --erase-us <us>          page erase time\r\n"
+    "  --program-us <us>        program time per 128 bytes\r\n"
+    "  --fault-ppm <ppm>        corrupted reply rate\r\n"
+    "  --size[-n] <bytes>       image size, default 65536\r\n"
+    "  --window[-w] <n>         frames in flight, 1 = stop-and-wait, default 8\r\n"
+    "  --frame-size[-F] <n>     largest frame payload, default 4096\r\n"
+    "  --compress[-z]           send LZ packed frames\r\n"
+    "  --text                   compressible image instead of random bytes\r\n";
+/* Private functions ---------------------------------------------------------*/
+static uint64_t bench_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+  * @brief  note the requests among bytes the host sends
+  * @param  tap [I] - tap
+  * @param  p [I] - bytes
+  * @param  n [I] - number of bytes
+  * @param  now [I] - time they were sent, us
+  * @retval none
+  */
+static void tap_tx(bench_tap_t *tap, const uint8_t *p, size_t n, uint64_t now)
+{
+    uint32_t need, len, k;
+    uint8_t ext;
+
+    while(n)
+    {
+        if(tap->tx_skip)
+        {
+            k = (uint32_t)MIN(n, tap->tx_skip);
+            tap->tx_skip -= k;
+            p += k;
+            n -= k;
+            continue;
+        }
+
+        tap->tx_hdr[tap->tx_have++] = *p++;
+        n--;
+        if(tap->tx_have < 2)
+            continue;
+        ext = (tap->tx_hdr[1] & TYPE_EXT) != 0;
+        need = ext ? PKT_EXT_HDR_SIZE : sizeof(packet_header_t);
+        if(tap->tx_have < need)
+            continue;
+
+        /* requests other than SET only announce the length they want */
+        len = ext ? GET_BE16(&tap->tx_hdr[3]) : tap->tx_hdr[3];
+        tap->tx_skip = ((tap->tx_hdr[1] & ~TYPE_EXT) == TYPE_SET ? len : 0) + (ext ? PKT_EXT_CRC_SIZE : 1);
+        tap->tx_have = 0;
+
+        /* the oldest request is dropped if the device fell that far behind */
+        if(tap->head - tap->tail == BENCH_PENDING)
+            tap->tail++;
+        tap->pending[tap->head % BENCH_PENDING].sent_us = now;
+        tap->pending[tap->head % BENCH_PENDING].reg_addr = tap->tx_hdr[2];
+        tap->head++;
+        tap->requests++;
+    }
+}
+
+/**
+  * @brief  pair the replies among bytes the device sent with their requests
+  * @param  tap [I] - tap
+  * @param  p [I] - bytes
+  * @param  n [I] - number of bytes
+  * @param  now [I] - time they arrived, us
+  * @retval none
+  */
+static void tap_rx(bench_tap_t *tap, const uint8_t *p, size_t n, uint64_t now)
+{
+    uint8_t *space;
+    size_t size;
+    bench_req_t *req;
+
+    while(n)
+    {
+        space = frame_rx_space(&tap->rx, &size);
+        size = MIN(size, n);
+        memcpy(space, p, size);
+        frame_rx_commit(&tap->rx, size);
+        p += size;
+        n -= size;
+
+        while(frame_rx_parse(&tap->rx))
+        {
+            tap->replies++;
+            while(tap->tail != tap->head)
+            {
+                req = &tap->pending[tap->tail++ % BENCH_PENDING];
+                if(req->reg_addr == tap->rx.pkt.header.reg_addr)
+                {
+                    if(tap->nsamples < BENCH_SAMPLES)
+                        tap->samples[tap->nsamples++] = (uint32_t)(now - req->sent_us);
+                    break;
+                }
+                tap->lost++;
+            }
+        }
+    }
+}
+
+/**
+  * @brief  see com_set_param()
+  */
+static int32_t tap_set_param(com_handle_t handle, const com_param_t *param)
+{
+    return com_set_param(((bench_tap_t *)handle)->inner, param);
+}
+
+/**
+  * @brief  see com_sendv()
+  */
+static int32_t tap_sendv(com_handle_t handle, const com_iovec_t *iov, size_t count)
+{
+    bench_tap_t *tap = (bench_tap_t *)handle;
+    uint64_t now = bench_now_us();
+    size_t i;
+
+    for(i = 0; i < count; i++)
+    {
+        tap_tx(tap, iov[i].base, iov[i].size, now);
+        tap->tx_bytes += iov[i].size;
+    }
+
+    return com_sendv(tap->inner, iov, count);
+}
+
+/**
+  * @brief  see com_recv()
+  */
+static int32_t tap_recv(com_handle_t handle, uint8_t *buf, size_t size, size_t *rxcnt, uint32_t timeout)
+{
+    bench_tap_t *tap = (bench_tap_t *)handle;
+
+    if(com_recv(tap->inner, buf, size, rxcnt, timeout))
+        return -1;
+    tap_rx(tap, buf, *rxcnt, bench_now_us());
+    tap->rx_bytes += *rxcnt;
+
+    return 0;
+}
+
+/**
+  * @brief  see com_close()
+  */
+static int32_t tap_close(com_handle_t handle)
+{
+    bench_tap_t *tap = (bench_tap_t *)handle;
+    int32_t ret;
+
+    ret = com_close(tap->inner);
+    free(tap->samples);
+    free(tap);
+
+    return ret;
+}
+
+/**
+  * @brief  wrap the host end of a link
+  * @param  inner [I] - handle, owned by the tap on success
+  * @retval tap, NULL on failure
+  */
+static bench_tap_t *tap_open(com_handle_t inner)
+{
+    bench_tap_t *tap;
+
+    tap = (bench_tap_t *)calloc(1, sizeof(bench_tap_t));
+    if(tap == NULL)
+        return NULL;
+    tap->samples = (uint32_t *)malloc(BENCH_SAMPLES * sizeof(uint32_t));
+    if(tap->samples == NULL)
+    {
+        free(tap);
+        return NULL;
+    }
+    tap->port.drv = &tap_drv;
+    tap->inner = inner;
+    frame_rx_init(&tap->rx);
+
+    return tap;
+}
+
+/**
+  * @brief  start counting a new operation
+  * @retval none
+  */
+static void tap_reset(bench_tap_t *tap)
+{
+    tap->tail = tap->head;
+    tap->tx_bytes = 0;
+    tap->rx_bytes = 0;
+    tap->requests = 0;
+    tap->replies = 0;
+    tap->lost = 0;
+    tap->nsamples = 0;
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+  * @brief  percentile of sorted samples, nearest rank
+  */
+static uint32_t bench_pct(const uint32_t *v, uint32_t n, uint32_t pct)
+{
+    uint32_t rank;
+
+    if(n == 0)
+        return 0;
+    rank = (n * pct + 99) / 100;
+
+    return v[rank ? rank - 1 : 0];
+}
+
+/**
+  * @brief  print the JSON line of a finished operation
+  * @param  tap [I] - tap, samples are sorted in place
+  * @param  opt [I] - settings
+  * @param  link [I] - link name
+  * @param  op [I] - operation name
+  * @param  bytes [I] - payload bytes the operation moved
+  * @param  start [I] - when it started, us
+  * @param  ok [I] - it succeeded
+  * @retval none
+  */
+static void bench_report(bench_tap_t *tap, const bench_opt_t *opt, const char *link, const char *op,
+                         uint32_t bytes, uint64_t start, int ok)
+{
+    double secs = (double)(bench_now_us() - start) / 1e6;
+    uint32_t n = tap->nsamples;
+
+    qsort(tap->samples, n, sizeof(uint32_t), bench_cmp_u32);
+
+    printf("{\"link\":\"%s\",\"op\":\"%s\",\"ok\":%s,"
+           "\"baudrate\":%u,\"latency_us\":%u,\"window\":%u,\"frame_size\":%u,\"compress\":%u,"
+           "\"bytes\":%u,\"seconds\":%.6f,\"bytes_per_s\":%.0f,"
+           "\"requests\":%u,\"replies\":%u,\"lost\":%u,\"round_trips_per_kib\":%.2f,"
+           "\"tx_bytes\":%llu,\"rx_bytes\":%llu,"
+           "\"rtt_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}}\r\n",
+           link, op, ok ? "true" : "false",
+           opt->baudrate, opt->latency_us, opt->window, opt->frame_size, opt->compress,
+           bytes, secs, secs > 0 && bytes ? bytes / secs : 0.0,
+           tap->requests, tap->replies, tap->lost, bytes ? tap->requests * 1024.0 / bytes : 0.0,
+           (unsigned long long)tap->tx_bytes, (unsigned long long)tap->rx_bytes,
+           bench_pct(tap->samples, n, 50), bench_pct(tap->samples, n, 90), bench_pct(tap->samples, n, 99),
+           n ? tap->samples[n - 1] : 0);
+    fflush(stdout);
+}
+
+/**
+  * @brief  isp_read() sink comparing what comes back with the image
+  */
+static int32_t bench_sink(void *ctx, uint32_t offset, const uint8_t *data, uint32_t size)
+{
+    return memcmp((const uint8_t *)ctx + offset, data, size) ? -1 : 0;
+}
+
+/**
+  * @brief  connect, erase, load, verify and read back over one link
+  * @param  opt [I] - settings
+  * @param  link [I] - BENCH_LINK_*
+  * @param  image [I] - opt->size bytes to program
+  * @retval 0 = every step succeeded, -1 = otherwise
+  */
+static int bench_link(const bench_opt_t *opt, uint32_t link, const uint8_t *image)
+{
+    const char *name = link == BENCH_LINK_PTY ? "pty" : "loopback";
+    com_param_t param = { 115200, COM_BYTESZ_8, COM_PARITY_NONE, COM_STOPBITS_1 };
+    bldr_sim_cfg_t cfg;
+    bldr_sim_t *sim;
+    com_handle_t dev = NULL, host = NULL;
+    bench_tap_t *tap;
+    isp_session_t *sess;
+    isp_verify_t verify;
+    char slave[128];
+    uint32_t addr, size;
+    uint64_t start;
+    int ok, err = 0;
+
+    bldr_sim_default_cfg(&cfg);
+    cfg.baudrate = opt->baudrate;
+    cfg.max_baudrate = 0;
+    cfg.latency_us = opt->latency_us;
+    cfg.turnaround_us = opt->turnaround_us;
+    cfg.erase_us = opt->erase_us;
+    cfg.program_us = opt->program_us;
+    cfg.fault_ppm = opt->fault_ppm;
+    if(opt->size > cfg.aprom_size)
+    {
+        printf("image larger than the simulated APROM\r\n");
+        return -1;
+    }
+    if(opt->baudrate)
+        param.baudrate = opt->baudrate;
+
+    if(link == BENCH_LINK_PTY)
+    {
+        if(com_open_pty(slave, sizeof(slave), &dev))
+            return -1;
+        if(com_open(slave, &param, &host))
+        {
+            com_close(dev);
+            return -1;
+        }
+    }
+    else if(com_open_loopback(&host, &dev))
+    {
+        return -1;
+    }
+
+    tap = tap_open(host);
+    sess = (isp_session_t *)malloc(sizeof(isp_session_t));
+    if(tap == NULL || sess == NULL || bldr_sim_create(&cfg, &sim))
+    {
+        free(sess);
+        if(tap)
+            com_close(tap);
+        else
+            com_close(host);
+        com_close(dev);
+        return -1;
+    }
+    if(bldr_sim_start(sim, dev))
+    {
+        bldr_sim_destroy(sim);
+        free(sess);
+        com_close(tap);
+        com_close(dev);
+        return -1;
+    }
+
+    isp_init(sess, tap, DEVICE_ADDR);
+    isp_set_line(sess, &param);
+    sess->frame_limit = opt->frame_size;
+    sess->compress = opt->compress;
+
+    tap_reset(tap);
+    start = bench_now_us();
+    ok = isp_connect(sess) == 0 && isp_area(sess, ISP_AREA_APROM, &addr, &size) == 0;
+    bench_report(tap, opt, name, "connect", 0, start, ok);
+    if(!ok)
+    {
+        err = -1;
+        goto done;
+    }
+
+    tap_reset(tap);
+    start = bench_now_us();
+    ok = isp_erase(sess, ERASE_APROM) == 0;
+    bench_report(tap, opt, name, "erase", size, start, ok);
+    err |= ok ? 0 : -1;
+
+    tap_reset(tap);
+    start = bench_now_us();
+    ok = isp_write(sess, addr, image, opt->size, opt->window) == 0;
+    ok = ok && memcmp(bldr_sim_memory(sim, addr, opt->size), image, opt->size) == 0;
+    bench_report(tap, opt, name, "load", opt->size, start, ok);
+    err |= ok ? 0 : -1;
+
+    memset(&verify, 0x00, sizeof(verify));
+    tap_reset(tap);
+    start = bench_now_us();
+    ok = isp_verify(sess, addr, image, opt->size, opt->window, &verify) == 0;
+    bench_report(tap, opt, name, "verify", opt->size, start, ok);
+    err |= ok ? 0 : -1;
+
+    tap_reset(tap);
+    start = bench_now_us();
+    ok = isp_read(sess, addr, opt->size, opt->window, bench_sink, (void *)image) == 0;
+    bench_report(tap, opt, name, "read", opt->size, start, ok);
+    err |= ok ? 0 : -1;
+
+done:
+    bldr_sim_destroy(sim);
+    free(sess);
+    com_close(tap);
+    com_close(dev);
+
+    return err;
+}
+
+static int parse_options(int argc, char **argv, bench_opt_t *opt)
+{
+    int c, option_index;
+    static const struct option opts[] = {
+        {"help",            no_argument,        NULL,   'h'},
+        {"link",            required_argument,  NULL,   'l'},
+        {"baudrate",        required_argument,  NULL,   'b'},
+        {"latency-us",      required_argument,  NULL,   'Y'},
+        {"turnaround-us",   required_argument,  NULL,   'T'},
+        {"erase-us",        required_argument,  NULL,   'R'},
+        {"program-us",      required_argument,  NULL,   'W'},
+        {"fault-ppm",       required_argument,  NULL,   'P'},
+        {"size",            required_argument,  NULL,   'n'},
+        {"window",          required_argument,  NULL,   'w'},
+        {"frame-size",      required_argument,  NULL,   'F'},
+        {"compress",        no_argument,        NULL,   'z'},
+        {"text",            no_argument,        NULL,   'x'},
+        {0,                 0,                  0,       0 },
+    };
+
+    while((c = getopt_long(argc, argv, "hb:n:w:F:z", opts, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'l':
+                if(strcmp(optarg, "loopback") == 0)
+                    opt->links = BENCH_LINK_LOOPBACK;
+                else if(strcmp(optarg, "pty") == 0)
+                    opt->links = BENCH_LINK_PTY;
+                else if(strcmp(optarg, "all") == 0)
+                    opt->links = BENCH_LINK_LOOPBACK | BENCH_LINK_PTY;
+                else
+                    goto bad;
+                break;
+            case 'b': opt->baudrate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'Y': opt->latency_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'T': opt->turnaround_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'R': opt->erase_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'W': opt->program_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'P': opt->fault_ppm = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'n': opt->size = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': opt->window = (uint8_t)strtoul(optarg, NULL, 0); break;
+            case 'F': opt->frame_size = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case 'z': opt->compress = 1; break;
+            case 'x': opt->text = 1; break;
+            case 'h':
+            default:
+                goto bad;
+        }
+    }
+
+    if(opt->size == 0 || opt->window == 0 || opt->frame_size < PKT_PLD_SIZE)
+        goto bad;
+
+    return 0;
+
+bad:
+    printf("%s", usage);
+    return -1;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    static const char *words[] = { "flash ", "page ", "erase ", "0x0000 ", "boot ", "\r\n" };
+    bench_opt_t opt;
+    uint8_t *image;
+    uint32_t i, w, c;
+    int err = 0;
+
+    memset(&opt, 0x00, sizeof(opt));
+    opt.links = BENCH_LINK_LOOPBACK | BENCH_LINK_PTY;
+    opt.baudrate = 115200;
+    opt.size = 65536;
+    opt.window = 8;
+    opt.frame_size = PKT_EXT_PLD_SIZE;
+    if(parse_options(argc, argv, &opt))
+        return -1;
+
+    image = (uint8_t *)malloc(opt.size);
+    if(image == NULL)
+        return -1;
+    srand(1);
+    for(i = 0; i < opt.size; )
+    {
+        if(!opt.text)
+        {
+            image[i++] = (uint8_t)rand();
+            continue;
+        }
+        /* words from a small vocabulary pack about as well as firmware strings */
+        w = (uint32_t)rand() % (sizeof(words) / sizeof(words[0]));
+        for(c = 0; words[w][c] != '\0' && i < opt.size; c++)
+            image[i++] = (uint8_t)words[w][c];
+    }
+
+    if(opt.links & BENCH_LINK_LOOPBACK)
+        err |= bench_link(&opt, BENCH_LINK_LOOPBACK, image);
+    if(opt.links & BENCH_LINK_PTY)
+        err |= bench_link(&opt, BENCH_LINK_PTY, image);
+
+    free(image);
+
+    return err;
+}
+
+/******************************** END OF FILE *********************************/
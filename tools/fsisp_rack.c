@@ -0,0 +1,255 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Program and verify one binary on many ports from a single
+ *                   thread through the libfsisp session API and poll().
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <getopt.h>
+#include "inc/isp.h"
+#include "inc/fsisp.h"
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+typedef struct rack_slot_s {
+    const char *port;
+    fsisp_session_t *s;
+    /* nothing in progress any more */
+    int done;
+    int32_t result;
+    const char *failed;
+    uint64_t us;
+} rack_slot_t;
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static const char *usage =
+    "usage: fsisp_rack [options] <file.bin> <port>...\r\n"
+    "  --baudrate[-b] <bps>         rate to connect at, default 115200\r\n"
+    "  --max-baudrate[-B] <bps>     fastest rate to negotiate, 0 = stay\r\n"
+    "  --connect-timeout[-C] <ms>   how long to wait for each device\r\n"
+    "  --window[-w] <n>             frames in flight\r\n";
+
+static const char *const rack_ops[] = { "connect", "erase", "write", "verify", "read" };
+/* Private functions ---------------------------------------------------------*/
+/**
+  * @brief  read a whole file
+  * @retval content, NULL = failure
+  */
+static uint8_t *rack_load(const char *path, uint32_t *size)
+{
+    uint8_t *buf;
+    long len;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if(fp == NULL)
+        return NULL;
+    if(fseek(fp, 0, SEEK_END) || (len = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET) ||
+       (buf = (uint8_t *)malloc((size_t)len)) == NULL)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    if(fread(buf, 1, (size_t)len, fp) != (size_t)len)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    *size = (uint32_t)len;
+
+    return buf;
+}
+
+/**
+  * @brief  submit the request after the one a slot just completed
+  * @retval 0 = submitted, -1 = the slot is finished
+  */
+static int rack_next(rack_slot_t *slot, const fsisp_result_t *res, const uint8_t *image, uint32_t size,
+                     uint8_t window)
+{
+    dev_attr_t attr;
+    fsisp_request_t req;
+
+    slot->us += res->us;
+    if(res->result)
+    {
+        slot->result = -1;
+        slot->failed = res->result > 0 ? "verify, flash differs" : rack_ops[res->op];
+        return -1;
+    }
+
+    if(fsisp_device(slot->s, &attr))
+    {
+        slot->result = -1;
+        slot->failed = rack_ops[res->op];
+        return -1;
+    }
+
+    memset(&req, 0x00, sizeof(req));
+    req.addr = attr.flash.aprom_addr;
+    req.size = size;
+    req.data = image;
+    req.window = window;
+    switch(res->op)
+    {
+        case FSISP_OP_CONNECT:
+            if(size > attr.flash.aprom_size)
+            {
+                slot->result = -1;
+                slot->failed = "image too large";
+                return -1;
+            }
+            req.op = FSISP_OP_WRITE;
+            req.erase_ahead = 1;
+            break;
+        case FSISP_OP_WRITE:
+            req.op = FSISP_OP_VERIFY;
+            break;
+        default:
+            slot->result = 0;
+            return -1;
+    }
+
+    if(fsisp_submit(slot->s, &req))
+    {
+        slot->result = -1;
+        slot->failed = rack_ops[req.op];
+        return -1;
+    }
+
+    return 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        {"baudrate",        required_argument,  NULL,   'b'},
+        {"max-baudrate",    required_argument,  NULL,   'B'},
+        {"connect-timeout", required_argument,  NULL,   'C'},
+        {"window",          required_argument,  NULL,   'w'},
+        {0,                 0,                  0,       0 },
+    };
+    fsisp_config_t cfg;
+    fsisp_request_t req;
+    fsisp_result_t res;
+    dev_attr_t attr;
+    rack_slot_t *slots;
+    struct pollfd *pfds;
+    uint8_t *image;
+    uint32_t size;
+    uint8_t window = 8;
+    int c, i, n, busy, failed = 0;
+
+    memset(&cfg, 0x00, sizeof(cfg));
+    cfg.baudrate = 115200;
+    cfg.max_baudrate = 3000000;
+    cfg.connect_ms = ISP_CONNECT_TIMEOUT;
+    while((c = getopt_long(argc, argv, "b:B:C:w:", opts, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 'b': cfg.baudrate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'B': cfg.max_baudrate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'C': cfg.connect_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': window = (uint8_t)atoi(optarg); break;
+            default: printf("%s", usage); return -1;
+        }
+    }
+    if(argc - optind < 2)
+    {
+        printf("%s", usage);
+        return -1;
+    }
+
+    image = rack_load(argv[optind], &size);
+    if(image == NULL)
+    {
+        printf("Reading \"%s\"...failed\r\n", argv[optind]);
+        return -1;
+    }
+    n = argc - optind - 1;
+    slots = (rack_slot_t *)calloc((size_t)n, sizeof(rack_slot_t));
+    pfds = (struct pollfd *)calloc((size_t)n, sizeof(struct pollfd));
+    if(slots == NULL || pfds == NULL)
+        return -1;
+
+    /* every session connects at once, then moves on at its own pace */
+    memset(&req, 0x00, sizeof(req));
+    req.op = FSISP_OP_CONNECT;
+    for(i = 0; i < n; i++)
+    {
+        slots[i].port = argv[optind + 1 + i];
+        cfg.port = slots[i].port;
+        slots[i].s = fsisp_create(&cfg);
+        if(slots[i].s == NULL || fsisp_submit(slots[i].s, &req))
+        {
+            slots[i].done = 1;
+            slots[i].result = -1;
+            slots[i].failed = "create";
+        }
+    }
+
+    do
+    {
+        for(i = 0, busy = 0; i < n; i++)
+        {
+            pfds[i].fd = slots[i].done ? -1 : fsisp_fd(slots[i].s);
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            busy += !slots[i].done;
+        }
+        if(busy == 0 || poll(pfds, (nfds_t)n, -1) < 0)
+            break;
+
+        for(i = 0; i < n; i++)
+        {
+            if(!(pfds[i].revents & POLLIN) || fsisp_poll(slots[i].s, &res) != 1)
+                continue;
+            if(rack_next(&slots[i], &res, image, size, window))
+                slots[i].done = 1;
+        }
+    } while(1);
+
+    for(i = 0; i < n; i++)
+    {
+        if(slots[i].result)
+        {
+            failed++;
+            printf("%-24s FAILED (%s) %6.2fs\r\n", slots[i].port, slots[i].failed, slots[i].us / 1e6);
+        }
+        else
+        {
+            if(fsisp_device(slots[i].s, &attr))
+                attr.mcu.uuid[0] = '\0';
+            printf("%-24s OK %6.2fs %7u %s\r\n", slots[i].port, slots[i].us / 1e6,
+                   fsisp_baudrate(slots[i].s), attr.mcu.uuid);
+        }
+        fsisp_close(slots[i].s);
+    }
+    printf("%d of %d ports OK\r\n", n - failed, n);
+    free(pfds);
+    free(slots);
+    free(image);
+
+    return failed ? -1 : 0;
+}
+
+/******************************** END OF FILE *********************************/
@@ -0,0 +1,409 @@
+/*******************************************************************************
+ * Copyright (c) 2021-2022, OKMCU Development Team
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Website: http://www.okmcu.com
+ *
+ * File Description: Bootloader simulator serving a pseudo terminal or a TCP
+ *                   port, so the host tool can be run without hardware; a
+ *                   whole multi-drop bus of them if asked to.
+ *
+ * Change Logs:
+ * Date         Author       Notes
+ * 2026-10-17   OKMCU Team   first version
+ *
+ ******************************************************************************/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "inc/serial.h"
+#include "inc/bldr_sim.h"
+/* Private define ------------------------------------------------------------*/
+/* Devices a simulated bus carries at most */
+#define SIM_BUS_MAX                         32
+/* How long the hub waits on a link before checking whether to stop, ms */
+#define SIM_HUB_POLL_MS                     100
+/* Private typedef -----------------------------------------------------------*/
+typedef struct sim_hub_s sim_hub_t;
+
+typedef struct sim_drop_s {
+    sim_hub_t *hub;
+    /* simulator, the hub side of its link and its own side */
+    bldr_sim_t *sim;
+    com_handle_t hdl;
+    com_handle_t far;
+    char uuid[64];
+    pthread_t thread;
+} sim_drop_t;
+
+struct sim_hub_s {
+    /* the line the host talks on */
+    com_handle_t host;
+    sim_drop_t drops[SIM_BUS_MAX];
+    uint32_t count;
+    /* probability of garbling a byte on its way to each device, ppm */
+    uint32_t noise_ppm;
+    uint32_t seed;
+    /* replies of two devices never mix on the host line */
+    pthread_mutex_t lock;
+    pthread_t thread;
+    volatile int stop;
+};
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static const char *usage =
+    "usage: fsisp_sim [options]\r\n"
+    "  --link[-l] <path>        symlink to the pty slave\r\n"
+    "  --listen[-t] <url>       serve tcp://host:port or rfc2217://host:port\r\n"
+    "                           instead of a pty, an empty host is any\r\n"
+    "  --baudrate[-b] <bps>     emulated line rate, 0 = unpaced\r\n"
+    "  --max-baudrate <bps>     highest rate the host may switch to, 0 = fixed\r\n"
+    "  --line-limit <bps>       garble the line above this rate, 0 = never\r\n"
+    "  --addr[-a] <addr>        device address, default 0xAA\r\n"
+    "  --part-number <str>      MCU part number\r\n"
+    "  --uuid <str>             MCU unique id\r\n"
+    "  --aprom-size <bytes>     APROM size\r\n"
+    "  --eeprom-size <bytes>    EEPROM size\r\n"
+    "  --page-size <bytes>      flash page size\r\n"
+    "  --turnaround-us <us>     reply turnaround latency\r\n"
+    "  --latency-us <us>        one-way link delay, overlapping between requests\r\n"
+    "  --erase-us <us>          page erase time\r\n"
+    "  --program-us <us>        program time per 128 bytes\r\n"
+    "  --fault-ppm <ppm>        corrupted reply rate\r\n"
+    "  --window <n>             largest write window, 0 = stop-and-wait only\r\n"
+    "  --frame-size <bytes>     largest extended frame payload, 0 = basic frames only\r\n"
+    "  --no-get-range           reject multi-register reads\r\n"
+    "  --no-zdata               no compressed writes\r\n"
+    "  --no-rdata               no addressed reads, REG_DATA only\r\n"
+    "  --no-range-crc           no range checksums, verify by readback\r\n"
+    "  --bus <n>                n devices on one line, at --addr and up\r\n"
+    "  --bus-noise-ppm <ppm>    garbled byte rate on the way to each device\r\n";
+/* Private functions ---------------------------------------------------------*/
+static uint32_t hub_rand(sim_hub_t *hub)
+{
+    /* xorshift32 */
+    hub->seed ^= hub->seed << 13;
+    hub->seed ^= hub->seed >> 17;
+    hub->seed ^= hub->seed << 5;
+    return hub->seed;
+}
+
+/**
+  * @brief  copy what the host sends to every device, each with its own noise
+  * @param  arg [I] - hub
+  * @retval NULL
+  */
+static void *hub_down_thread(void *arg)
+{
+    sim_hub_t *hub = (sim_hub_t *)arg;
+    uint8_t buf[256], copy[256];
+    size_t rxcnt, j;
+    uint32_t i;
+
+    while(!hub->stop)
+    {
+        if(com_recv(hub->host, buf, sizeof(buf), &rxcnt, SIM_HUB_POLL_MS))
+            break;
+        for(i = 0; i < hub->count && rxcnt; i++)
+        {
+            memcpy(copy, buf, rxcnt);
+            for(j = 0; hub->noise_ppm && j < rxcnt; j++)
+            {
+                if(hub_rand(hub) % 1000000 < hub->noise_ppm)
+                    copy[j] ^= 0x10;
+            }
+            com_send(hub->drops[i].hdl, copy, rxcnt);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+  * @brief  pass the replies of one device to the host
+  * @param  arg [I] - drop of the device
+  * @retval NULL
+  */
+static void *hub_up_thread(void *arg)
+{
+    sim_drop_t *drop = (sim_drop_t *)arg;
+    sim_hub_t *hub = drop->hub;
+    uint8_t buf[256];
+    size_t rxcnt;
+
+    while(!hub->stop)
+    {
+        if(com_recv(drop->hdl, buf, sizeof(buf), &rxcnt, SIM_HUB_POLL_MS))
+            break;
+        if(rxcnt == 0)
+            continue;
+        pthread_mutex_lock(&hub->lock);
+        com_send(hub->host, buf, rxcnt);
+        pthread_mutex_unlock(&hub->lock);
+    }
+
+    return NULL;
+}
+
+/**
+  * @brief  start a simulator per address, all of them on the host line
+  * @param  hub [O] - hub, count and noise_ppm set
+  * @param  cfg [I] - configuration of the first device, the others follow
+  *                   at the next addresses with their own UUIDs
+  * @param  host [I] - host line
+  * @retval 0 = success, -1 = failure
+  */
+static int32_t hub_start(sim_hub_t *hub, const bldr_sim_cfg_t *cfg, com_handle_t host)
+{
+    bldr_sim_cfg_t dev;
+    sim_drop_t *drop;
+    uint32_t i, n;
+
+    hub->host = host;
+    hub->seed = 0x6C078965;
+    hub->stop = 0;
+    pthread_mutex_init(&hub->lock, NULL);
+    for(n = 0; n < hub->count; n++)
+    {
+        drop = &hub->drops[n];
+        drop->hub = hub;
+        dev = *cfg;
+        dev.dev_addr = (uint8_t)(cfg->dev_addr + n);
+        snprintf(drop->uuid, sizeof(drop->uuid), "%s-%.2X", cfg->uuid, dev.dev_addr);
+        dev.uuid = drop->uuid;
+        if(com_open_loopback(&drop->hdl, &drop->far))
+            break;
+        if(bldr_sim_create(&dev, &drop->sim))
+        {
+            com_close(drop->far);
+            com_close(drop->hdl);
+            break;
+        }
+        if(bldr_sim_start(drop->sim, drop->far) || pthread_create(&drop->thread, NULL, hub_up_thread, drop))
+        {
+            bldr_sim_destroy(drop->sim);
+            com_close(drop->far);
+            com_close(drop->hdl);
+            break;
+        }
+    }
+    if(n == hub->count && pthread_create(&hub->thread, NULL, hub_down_thread, hub) == 0)
+        return 0;
+
+    hub->stop = 1;
+    for(i = 0; i < n; i++)
+    {
+        pthread_join(hub->drops[i].thread, NULL);
+        bldr_sim_destroy(hub->drops[i].sim);
+        com_close(hub->drops[i].far);
+        com_close(hub->drops[i].hdl);
+    }
+    pthread_mutex_destroy(&hub->lock);
+
+    return -1;
+}
+
+/**
+  * @brief  stop every simulator of the bus and the hub
+  * @param  hub [I] - hub started by hub_start()
+  * @retval none
+  */
+static void hub_stop(sim_hub_t *hub)
+{
+    uint32_t i;
+
+    hub->stop = 1;
+    pthread_join(hub->thread, NULL);
+    for(i = 0; i < hub->count; i++)
+    {
+        pthread_join(hub->drops[i].thread, NULL);
+        bldr_sim_destroy(hub->drops[i].sim);
+        com_close(hub->drops[i].far);
+        com_close(hub->drops[i].hdl);
+    }
+    pthread_mutex_destroy(&hub->lock);
+}
+
+static int parse_options(int argc, char **argv, bldr_sim_cfg_t *cfg, const char **link, const char **listen,
+                         sim_hub_t *hub)
+{
+    int c, option_index;
+    static const struct option opts[] = {
+        {"help",            no_argument,        NULL,   'h'},
+        {"link",            required_argument,  NULL,   'l'},
+        {"listen",          required_argument,  NULL,   't'},
+        {"baudrate",        required_argument,  NULL,   'b'},
+        {"max-baudrate",    required_argument,  NULL,   'M'},
+        {"line-limit",      required_argument,  NULL,   'L'},
+        {"addr",            required_argument,  NULL,   'a'},
+        {"part-number",     required_argument,  NULL,   'P'},
+        {"uuid",            required_argument,  NULL,   'U'},
+        {"aprom-size",      required_argument,  NULL,   'A'},
+        {"eeprom-size",     required_argument,  NULL,   'E'},
+        {"page-size",       required_argument,  NULL,   'S'},
+        {"turnaround-us",   required_argument,  NULL,   'T'},
+        {"latency-us",      required_argument,  NULL,   'Y'},
+        {"erase-us",        required_argument,  NULL,   'R'},
+        {"program-us",      required_argument,  NULL,   'W'},
+        {"fault-ppm",       required_argument,  NULL,   'F'},
+        {"window",          required_argument,  NULL,   'N'},
+        {"frame-size",      required_argument,  NULL,   'X'},
+        {"no-get-range",    no_argument,        NULL,   'G'},
+        {"no-zdata",        no_argument,        NULL,   'Z'},
+        {"no-rdata",        no_argument,        NULL,   'D'},
+        {"no-range-crc",    no_argument,        NULL,   'C'},
+        {"bus",             required_argument,  NULL,   'H'},
+        {"bus-noise-ppm",   required_argument,  NULL,   'O'},
+        {0,                 0,                  0,       0 },
+    };
+
+    optind = 1;
+    while((c = getopt_long(argc, argv, "hl:t:b:a:", opts, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'l': *link = optarg; break;
+            case 't': *listen = optarg; break;
+            case 'b': cfg->baudrate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'M': cfg->max_baudrate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'L': cfg->line_limit = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'a': cfg->dev_addr = (uint8_t)strtoul(optarg, NULL, 0); break;
+            case 'P': cfg->part_number = optarg; break;
+            case 'U': cfg->uuid = optarg; break;
+            case 'A': cfg->aprom_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'E': cfg->eeprom_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'S': cfg->page_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'T': cfg->turnaround_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'Y': cfg->latency_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'R': cfg->erase_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'W': cfg->program_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'F': cfg->fault_ppm = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'N': cfg->max_window = (uint8_t)strtoul(optarg, NULL, 0); break;
+            case 'X': cfg->frame_size = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case 'G': cfg->get_range = 0; break;
+            case 'Z': cfg->zdata = 0; break;
+            case 'D': cfg->rdata = 0; break;
+            case 'C': cfg->range_crc = 0; break;
+            case 'H': hub->count = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'O': hub->noise_ppm = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'h':
+            default:
+                printf("%s", usage);
+                return -1;
+        }
+    }
+
+    if(hub->count > SIM_BUS_MAX || (hub->count && cfg->dev_addr + hub->count - 1 > 0xFF))
+    {
+        printf("--bus: up to %u devices, addresses up to 0xFF\r\n", SIM_BUS_MAX);
+        return -1;
+    }
+
+    /* EEPROM follows APROM directly */
+    cfg->eeprom_addr = cfg->aprom_addr + cfg->aprom_size;
+
+    return 0;
+}
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    bldr_sim_cfg_t cfg;
+    bldr_sim_t *sim = NULL;
+    sim_hub_t hub;
+    com_handle_t hdl;
+    const char *link = NULL, *listen = NULL;
+    char slave[128];
+    sigset_t set;
+    int sig;
+
+    bldr_sim_default_cfg(&cfg);
+    memset(&hub, 0x00, sizeof(hub));
+    if(parse_options(argc, argv, &cfg, &link, &listen, &hub))
+        return -1;
+
+    if(listen)
+    {
+        if(com_listen(listen, &hdl))
+        {
+            printf("Listening on \"%s\"...failed\r\n", listen);
+            return -1;
+        }
+        /* there is no slave to link to */
+        link = NULL;
+    }
+    else if(com_open_pty(slave, sizeof(slave), &hdl))
+    {
+        printf("Creating pseudo terminal...failed\r\n");
+        return -1;
+    }
+
+    if(link)
+    {
+        unlink(link);
+        if(symlink(slave, link))
+        {
+            printf("Linking \"%s\" to \"%s\"...failed\r\n", link, slave);
+            com_close(hdl);
+            return -1;
+        }
+    }
+
+    /* handle termination synchronously in this thread */
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if(hub.count)
+    {
+        if(hub_start(&hub, &cfg, hdl))
+        {
+            com_close(hdl);
+            return -1;
+        }
+    }
+    else if(bldr_sim_create(&cfg, &sim))
+    {
+        com_close(hdl);
+        return -1;
+    }
+    else if(bldr_sim_start(sim, hdl))
+    {
+        bldr_sim_destroy(sim);
+        com_close(hdl);
+        return -1;
+    }
+
+    if(hub.count)
+        printf("Simulated bus of %u bootloaders 0x%.2X-0x%.2X on \"%s\", baudrate = %u\r\n", hub.count,
+               cfg.dev_addr, cfg.dev_addr + hub.count - 1, listen ? listen : link ? link : slave, cfg.baudrate);
+    else
+        printf("Simulated bootloader 0x%.2X on \"%s\", baudrate = %u\r\n", cfg.dev_addr,
+               listen ? listen : link ? link : slave, cfg.baudrate);
+    fflush(stdout);
+
+    sigwait(&set, &sig);
+
+    if(hub.count)
+        hub_stop(&hub);
+    else
+        bldr_sim_destroy(sim);
+    com_close(hdl);
+    if(link)
+        unlink(link);
+
+    return 0;
+}
+
+/******************************** END OF FILE *********************************/